@@ -0,0 +1,101 @@
+#include "blas_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+
+#include "parallel.h"
+#include "profiler.h"
+#include "vertex_weld.h"
+
+uint32_t DeduplicateBlasPool(std::vector<std::vector<glm::vec3>>* vertices, std::span<InstanceInfo> inst_infos)
+{
+    RRA_PROFILE_SCOPE("DeduplicateBlasPool");
+    const size_t          n = vertices->size();
+    std::vector<uint64_t> hashes(n);
+    ParallelForDynamic(n, 1, [&](uint32_t, size_t i) {
+        const std::vector<glm::vec3>& v = (*vertices)[i];
+        hashes[i] = HashBytesFNV1a(0xcbf29ce484222325ULL, reinterpret_cast<const uint8_t*>(v.data()), sizeof(glm::vec3) * v.size());
+    });
+
+    std::vector<uint32_t>                     canonical(n);
+    std::map<uint64_t, std::vector<uint32_t>> by_hash;
+    uint32_t                                  num_merged = 0;
+    uint64_t                                  num_freed  = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const std::vector<glm::vec3>& v = (*vertices)[i];
+        canonical[i]                    = i;
+        if (v.empty())
+            continue;
+        std::vector<uint32_t>& same_hash = by_hash[hashes[i]];
+        for (uint32_t j : same_hash)
+        {
+            const std::vector<glm::vec3>& u = (*vertices)[j];
+            if (u.size() == v.size() && memcmp(u.data(), v.data(), sizeof(glm::vec3) * v.size()) == 0)
+            {
+                canonical[i] = j;
+                break;
+            }
+        }
+        if (canonical[i] == i)
+        {
+            same_hash.push_back(i);
+            continue;
+        }
+        num_merged++;
+        num_freed += sizeof(glm::vec3) * v.size();
+        std::vector<glm::vec3>().swap((*vertices)[i]);
+    }
+
+    for (InstanceInfo& ii : inst_infos)
+    {
+        if (ii.blas_idx < n)
+            ii.blas_idx = canonical[ii.blas_idx];
+    }
+    if (num_merged > 0)
+        printf("%u BLAS(es) duplicate the triangles of another one, sharing them saves %.1f MB\n", num_merged, num_freed / (1024.0 * 1024.0));
+    return num_merged;
+}
+
+// Big BLASes are welded with all workers one at a time, the many small ones concurrently with one worker each
+std::vector<IndexedBlas> IndexBlasSoups(std::vector<std::vector<glm::vec3>>* soups, bool weld)
+{
+    RRA_PROFILE_SCOPE("IndexBlasSoups");
+    const size_t             PARALLEL_WELD_VERTS = 1 << 18;
+    const size_t             n                   = soups->size();
+    std::vector<IndexedBlas> blases(n);
+    uint64_t                 num_soup_verts = 0, num_verts = 0;
+    auto                     index_soup     = [&](size_t i, uint32_t num_workers) {
+        if (weld)
+            WeldVertices((*soups)[i], &blases[i], num_workers);
+        else
+            IndexTriangleSoup((*soups)[i], &blases[i]);
+        std::vector<glm::vec3>().swap((*soups)[i]);
+    };
+
+    std::vector<uint32_t> small_soups;
+    for (size_t i = 0; i < n; i++)
+    {
+        num_soup_verts += (*soups)[i].size();
+        if ((*soups)[i].size() >= PARALLEL_WELD_VERTS)
+            index_soup(i, GetNumWorkerThreads());
+        else
+            small_soups.push_back(uint32_t(i));
+    }
+    ParallelForDynamic(small_soups.size(), 1, [&](uint32_t, size_t i) { index_soup(small_soups[i], 1); });
+
+    for (const IndexedBlas& b : blases)
+    {
+        num_verts += b.vertices.size();
+    }
+    const double MB = 1024.0 * 1024.0;
+    printf("%s %llu vertices into %llu, geometry %.1f MB as soups, %.1f MB indexed\n",
+           weld ? "Welded" : "Indexed",
+           (unsigned long long)num_soup_verts,
+           (unsigned long long)num_verts,
+           num_soup_verts * sizeof(glm::vec3) / MB,
+           (num_verts * sizeof(glm::vec3) + num_soup_verts * sizeof(uint32_t)) / MB);
+    return blases;
+}
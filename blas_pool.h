@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "rt_common.h"
+
+// The BLASes of a capture as decoded, one triangle soup per BLAS, before they become the pool shared by all scene views
+
+// Points the instances of BLASes whose triangles equal those of a lower-indexed BLAS at that one and frees the copies,
+// so all scene views share one pool of geometry. Returns the number of BLASes merged away.
+uint32_t DeduplicateBlasPool(std::vector<std::vector<glm::vec3>>* vertices, std::span<InstanceInfo> inst_infos);
+
+// Turns the triangle soups into indexed BLASes, welded with WeldVertices or one vertex per corner, and frees every
+// soup once it is converted
+std::vector<IndexedBlas> IndexBlasSoups(std::vector<std::vector<glm::vec3>>* soups, bool weld);
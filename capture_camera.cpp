@@ -0,0 +1,54 @@
+#include "capture_camera.h"
+
+#include <map>
+#include <string>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+struct CamParams
+{
+    glm::vec3 eye, center, up;
+    bool      invert_y;
+};
+
+static const std::map<std::string, CamParams> CAM_PARAMS = {
+    {"SolarBay", {glm::vec3(5.964f, 1.691f, 5.374f), glm::vec3(2.921f, 1.691f, 2.120f), glm::vec3(0, 1, 0), false}},
+    {"PortRoyal", {glm::vec3(-7.2252469f, 0.8361527f, 25.2023430f), glm::vec3(-6.8860960f, 0.8613553f, 24.2284565f), glm::vec3(0, 1, 0), true}},
+    {"DXRFeatureTest", {glm::vec3(-6.1447086f, 2.7448003f, -11.9588842f), glm::vec3(-6.1102533f, 2.7394657f, -11.9192486f), glm::vec3(0, 1, 0), true}},
+    {"Cyberpunk2077", {glm::vec3(667.6618652f, -804.2122192f, 128.7313995f), glm::vec3(666.0505371f, -802.7095947f, 128.0240326f), glm::vec3(0, 0, 1), true}},
+    {"RealTimeDenoisedAmbientOcclusion", {glm::vec3(-43.5119209f, 24.3670177f, -29.0387344f), glm::vec3(-43.2385712f, 24.1981163f, -28.8011036f), glm::vec3(0, 1, 0), true}},
+    {"b1-Win64-Shipping", {glm::vec3(-32269.8417969f, 9393.68f, -1515.189f), glm::vec3(-32869.87f, 9697.102f, -1436.413f), glm::vec3(0, 0, 1), true}},
+    {"VictorStones", {glm::vec3(54.20388, -360.680725, 20.8701935), glm::vec3(93.000, -316.9831, 29.51616), glm::vec3(0, 0, 1), true}},
+    {"AncientGame", {glm::vec3(-290.0213013, 230.9532928, 341.0099792), glm::vec3(-344.7103882, 227.3368835, 347.0361633), glm::vec3(0,0,1), true}},
+    {"hairball", {glm::vec3(0, 0, -4), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0), true}}
+};
+
+CaptureCamera GetCaptureCamera(const char* rra_file_name, uint32_t width, uint32_t height)
+{
+    // up must not be parallel to the view direction, or lookAt divides by zero
+    glm::vec3 eye(0, 0, 0);
+    glm::vec3 center(0, 1, 0);
+    glm::vec3 up(0, 0, 1);
+
+    CaptureCamera cam;
+    std::string   fn(rra_file_name);
+    for (const auto& entry : CAM_PARAMS)
+    {
+        if (fn.find(entry.first) != std::string::npos)
+        {
+            eye             = entry.second.eye;
+            center          = entry.second.center;
+            up              = entry.second.up;
+            cam.invert_y    = entry.second.invert_y;
+            cam.params_name = entry.first.c_str();
+        }
+    }
+
+    glm::mat4 view = glm::lookAt(eye, center, up);
+    glm::mat4 proj = glm::perspectiveLH_ZO(glm::radians(60.0f), -1.0f * width / height, -0.1f, -499.0f) * (-1.0f);
+
+    cam.eye          = eye;
+    cam.inverse_view = glm::inverse(view);
+    cam.inverse_proj = glm::inverse(proj);
+    return cam;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+// The camera the viewer uses for a capture, matched on its file name. Captures without known camera parameters look
+// along +y from the origin, with +z up.
+struct CaptureCamera
+{
+    glm::mat4   inverse_view{1.0f};
+    glm::mat4   inverse_proj{1.0f};
+    glm::vec3   eye{};
+    bool        invert_y{false};
+    const char* params_name{nullptr};  // Key of the camera parameters that matched, null if none did
+};
+
+CaptureCamera GetCaptureCamera(const char* rra_file_name, uint32_t width, uint32_t height);
@@ -0,0 +1,300 @@
+#include "cpu_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+#include "profiler.h"
+
+constexpr uint32_t MAX_LEAF_TRIANGLES       = 8;        // Up to two CpuTriangleBlock4s, one 8-wide AVX2 test
+constexpr uint32_t TRIANGLE_BLOCK_SIZE      = 4;
+constexpr uint32_t MAX_LEAF_INSTANCES       = 1;        // Every instance leaf costs a ray transform, so keep them small
+constexpr size_t   PARALLEL_BLAS_BUILD_TRIS = 1 << 16;  // BLASes at least this big are built with all workers, one at a time
+
+// Collapses a binary BVH into 8-wide nodes. Each wide node takes the two children of a binary node, then keeps opening
+// the inner child with the largest surface area until it has eight children or only leaves are left.
+// make_leaf(first, count) turns a binary leaf into the value stored in CpuBvh8Node::child.
+template<class F>
+static void CollapseToBvh8(const std::vector<CpuBvhNode>& bin, std::vector<CpuBvh8Node>* wide, F&& make_leaf)
+{
+    wide->clear();
+    if (bin.empty())
+        return;
+
+    auto half_area = [&](uint32_t i) {
+        const glm::vec3 e = bin[i].aabb_max - bin[i].aabb_min;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    };
+    auto set_child = [&](uint32_t node_idx, uint32_t slot, const CpuBvhNode& b, uint32_t child) {
+        CpuBvh8Node& node                = (*wide)[node_idx];
+        node.bounds[CPU_BVH8_LO_X][slot] = b.aabb_min.x;
+        node.bounds[CPU_BVH8_HI_X][slot] = b.aabb_max.x;
+        node.bounds[CPU_BVH8_LO_Y][slot] = b.aabb_min.y;
+        node.bounds[CPU_BVH8_HI_Y][slot] = b.aabb_max.y;
+        node.bounds[CPU_BVH8_LO_Z][slot] = b.aabb_min.z;
+        node.bounds[CPU_BVH8_HI_Z][slot] = b.aabb_max.z;
+        node.child[slot]                 = child;
+    };
+    auto new_node = [&]() {
+        CpuBvh8Node node;
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            for (uint32_t p = 0; p < 6; p += 2)
+            {
+                node.bounds[p][i]     = 1e30f;
+                node.bounds[p + 1][i] = -1e30f;
+            }
+            node.child[i] = CPU_BVH8_EMPTY;
+        }
+        wide->push_back(node);
+        return uint32_t(wide->size() - 1);
+    };
+
+    wide->reserve(bin.size() / 4 + 1);
+    new_node();
+    if (bin[0].count > 0)
+    {
+        set_child(0, 0, bin[0], make_leaf(bin[0].first, bin[0].count));
+        return;
+    }
+
+    // (binary inner node, wide node it becomes)
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+    while (!stack.empty())
+    {
+        auto [bin_idx, wide_idx] = stack.back();
+        stack.pop_back();
+
+        uint32_t children[8] = {bin[bin_idx].first, bin[bin_idx].first + 1};
+        uint32_t n           = 2;
+        while (n < 8)
+        {
+            int   best      = -1;
+            float best_area = -1;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (bin[children[i]].count == 0 && half_area(children[i]) > best_area)
+                {
+                    best      = int(i);
+                    best_area = half_area(children[i]);
+                }
+            }
+            if (best < 0)
+                break;
+            const uint32_t opened = children[best];
+            children[best]        = bin[opened].first;
+            children[n++]         = bin[opened].first + 1;
+        }
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            const CpuBvhNode& b = bin[children[i]];
+            if (b.count > 0)
+            {
+                set_child(wide_idx, i, b, make_leaf(b.first, b.count));
+                continue;
+            }
+            const uint32_t child_idx = new_node();
+            set_child(wide_idx, i, b, child_idx);
+            stack.push_back({children[i], child_idx});
+        }
+    }
+}
+
+static uint32_t EncodeBvh8Leaf(uint32_t first, uint32_t count)
+{
+    return CPU_BVH8_LEAF | ((count - 1) << CPU_BVH8_COUNT_SHIFT) | first;
+}
+
+// Inverse of a row-major 3x4 affine transform. Returns false for singular transforms.
+static bool InvertAffine(const float* m, float* inv)
+{
+    const float c00 = m[5] * m[10] - m[6] * m[9];
+    const float c01 = m[6] * m[8] - m[4] * m[10];
+    const float c02 = m[4] * m[9] - m[5] * m[8];
+    const float det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+    if (det == 0 || !std::isfinite(det))
+        return false;
+    const float id = 1.0f / det;
+
+    inv[0]  = c00 * id;
+    inv[1]  = (m[2] * m[9] - m[1] * m[10]) * id;
+    inv[2]  = (m[1] * m[6] - m[2] * m[5]) * id;
+    inv[4]  = c01 * id;
+    inv[5]  = (m[0] * m[10] - m[2] * m[8]) * id;
+    inv[6]  = (m[2] * m[4] - m[0] * m[6]) * id;
+    inv[8]  = c02 * id;
+    inv[9]  = (m[1] * m[8] - m[0] * m[9]) * id;
+    inv[10] = (m[0] * m[5] - m[1] * m[4]) * id;
+    inv[3]  = -(inv[0] * m[3] + inv[1] * m[7] + inv[2] * m[11]);
+    inv[7]  = -(inv[4] * m[3] + inv[5] * m[7] + inv[6] * m[11]);
+    inv[11] = -(inv[8] * m[3] + inv[9] * m[7] + inv[10] * m[11]);
+    return true;
+}
+
+CpuAabb TransformAabb(const float* t, const CpuAabb& b)
+{
+    CpuAabb ret;
+    if (b.Empty())
+        return ret;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 p((corner & 1) ? b.max.x : b.min.x, (corner & 2) ? b.max.y : b.min.y, (corner & 4) ? b.max.z : b.min.z);
+        ret.Grow(TransformInstancePosition(t, p));
+    }
+    return ret;
+}
+
+void CpuBlas::Build(const BlasGeometry& geom, uint32_t num_workers)
+{
+    RRA_PROFILE_SCOPE_ARG("CpuBlas::Build", geom.NumTriangles());
+    const size_t num_tris = geom.NumTriangles();
+    num_triangles_        = num_tris;
+    bounds_               = {};
+
+    std::vector<CpuAabb> bounds(num_tris);
+    ParallelForChunks(
+        num_tris,
+        [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                bounds[i].Grow(geom.Vertex(i, 0));
+                bounds[i].Grow(geom.Vertex(i, 1));
+                bounds[i].Grow(geom.Vertex(i, 2));
+            }
+        },
+        num_workers);
+
+    std::vector<CpuBvhNode> bin_nodes;
+    std::vector<uint32_t>   order;
+    BuildCpuBvh(bounds, MAX_LEAF_TRIANGLES, TRIANGLE_BLOCK_SIZE, &bin_nodes, &order, num_workers);
+    if (!bin_nodes.empty())
+        bounds_ = {bin_nodes[0].aabb_min, bin_nodes[0].aabb_max};
+
+    // Every binary leaf gets its own run of blocks, so a leaf of 5 triangles takes two blocks with three empty lanes
+    struct LeafBlocks
+    {
+        uint32_t first_block, first, count;
+    };
+    std::vector<LeafBlocks> leaves;
+    uint32_t                num_blocks = 0;
+    CollapseToBvh8(bin_nodes, &nodes_, [&](uint32_t first, uint32_t count) {
+        const uint32_t leaf_blocks = (count + TRIANGLE_BLOCK_SIZE - 1) / TRIANGLE_BLOCK_SIZE;
+        leaves.push_back({num_blocks, first, count});
+        num_blocks += leaf_blocks;
+        return EncodeBvh8Leaf(num_blocks - leaf_blocks, leaf_blocks);
+    });
+
+    blocks_.resize(num_blocks);
+    ParallelForChunks(
+        leaves.size(),
+        [&](uint32_t, size_t begin, size_t end) {
+            for (size_t l = begin; l < end; l++)
+            {
+                const LeafBlocks& leaf  = leaves[l];
+                const uint32_t    lanes = (leaf.count + TRIANGLE_BLOCK_SIZE - 1) / TRIANGLE_BLOCK_SIZE * TRIANGLE_BLOCK_SIZE;
+                for (uint32_t i = 0; i < lanes; i++)
+                {
+                    CpuTriangleBlock4& block = blocks_[leaf.first_block + i / TRIANGLE_BLOCK_SIZE];
+                    const uint32_t     lane  = i % TRIANGLE_BLOCK_SIZE;
+                    glm::vec3          v0{}, e1{}, e2{};
+                    uint32_t           prim = UINT32_MAX;
+                    if (i < leaf.count)
+                    {
+                        prim = order[leaf.first + i];
+                        v0   = geom.Vertex(prim, 0);
+                        e1   = geom.Vertex(prim, 1) - v0;
+                        e2   = geom.Vertex(prim, 2) - v0;
+                    }
+                    for (int c = 0; c < 3; c++)
+                    {
+                        block.v0[c][lane] = v0[c];
+                        block.e1[c][lane] = e1[c];
+                        block.e2[c][lane] = e2[c];
+                    }
+                    block.primitive_idx[lane] = prim;
+                }
+            }
+        },
+        num_workers);
+}
+
+void CpuTlas::Build(const BlasGeometrySpans& blas_geometry, std::span<const InstanceInfo> instances, uint32_t num_workers)
+{
+    RRA_PROFILE_SCOPE_ARG("CpuTlas::Build", instances.size());
+    // Bottom level. Big BLASes get all workers each; the many small ones are built concurrently, one per worker.
+    blases_.clear();
+    blases_.resize(blas_geometry.size());
+    std::vector<uint32_t> small_blases;
+    for (size_t i = 0; i < blas_geometry.size(); i++)
+    {
+        if (blas_geometry[i].NumTriangles() >= PARALLEL_BLAS_BUILD_TRIS)
+            blases_[i].Build(blas_geometry[i], num_workers);
+        else
+            small_blases.push_back(uint32_t(i));
+    }
+    ParallelForDynamic(
+        small_blases.size(), 1, [&](uint32_t, size_t i) { blases_[small_blases[i]].Build(blas_geometry[small_blases[i]], 1); }, num_workers);
+
+    // Top level over the world-space bounds of every instance that references a non-empty BLAS
+    std::vector<CpuTlasInstance> insts;
+    std::vector<CpuAabb>         inst_bounds;
+    insts.reserve(instances.size());
+    inst_bounds.reserve(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        const InstanceInfo& ii = instances[i];
+        if (ii.blas_idx >= blases_.size() || blases_[ii.blas_idx].NumTriangles() == 0)
+            continue;
+
+        CpuTlasInstance inst{};
+        if (!InvertAffine(ii.transform, inst.world_to_object))
+            continue;
+        inst.blas_idx     = uint32_t(ii.blas_idx);
+        inst.instance_idx = uint32_t(i);
+        insts.push_back(inst);
+        inst_bounds.push_back(TransformAabb(ii.transform, blases_[ii.blas_idx].Bounds()));
+    }
+
+    std::vector<CpuBvhNode> bin_nodes;
+    std::vector<uint32_t>   order;
+    BuildCpuBvh(inst_bounds, MAX_LEAF_INSTANCES, 1, &bin_nodes, &order, num_workers);
+    bounds_ = bin_nodes.empty() ? CpuAabb{} : CpuAabb{bin_nodes[0].aabb_min, bin_nodes[0].aabb_max};
+    CollapseToBvh8(bin_nodes, &nodes_, EncodeBvh8Leaf);
+
+    instances_.resize(insts.size());
+    for (size_t i = 0; i < insts.size(); i++)
+    {
+        instances_[i] = insts[order[i]];
+    }
+}
+
+size_t CpuTlas::NumBlasTriangles() const
+{
+    size_t n = 0;
+    for (const CpuBlas& b : blases_)
+    {
+        n += b.NumTriangles();
+    }
+    return n;
+}
+
+size_t CpuTlas::NumNodes() const
+{
+    size_t n = nodes_.size();
+    for (const CpuBlas& b : blases_)
+    {
+        n += b.NumNodes();
+    }
+    return n;
+}
+
+size_t CpuTlas::MemoryBytes() const
+{
+    size_t n = nodes_.size() * sizeof(CpuBvh8Node) + instances_.size() * sizeof(CpuTlasInstance);
+    for (const CpuBlas& b : blases_)
+    {
+        n += b.MemoryBytes();
+    }
+    return n;
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "parallel.h"
+#include "rt_common.h"
+
+struct CpuRay
+{
+    glm::vec3 origin;
+    float     tmin;
+    glm::vec3 direction;
+    float     tmax;
+};
+
+struct CpuHit
+{
+    float     t{-1};
+    uint32_t  instance_idx{};
+    uint32_t  primitive_idx{};  // Triangle index within the instance's BLAS, same as PrimitiveIndex() in HLSL
+    glm::vec2 bary{};
+};
+
+// Work done by one traversal, e.g. to compare the cost of captured ray workloads (cpu_replay.h)
+struct CpuTraversalStats
+{
+    uint32_t steps{};                 // Inner nodes and leaves taken off the traversal stacks of both levels
+    uint32_t node_visits{};           // Inner nodes whose eight child boxes were tested
+    uint32_t triangle_tests{};        // Ray-triangle tests, not counting the empty lanes of a block
+    uint32_t instance_transitions{};  // Rays moved into the object space of an instance
+    uint32_t max_stack_depth{};       // Most stack entries held at once, TLAS and BLAS stacks added up
+};
+
+// Sees every node and triangle block a counted traversal reads, e.g. to model how rays share cache lines
+class CpuTraversalObserver
+{
+public:
+    virtual void Touch(const void* data, size_t bytes) = 0;
+
+protected:
+    ~CpuTraversalObserver() = default;
+};
+
+// Up to CPU_MAX_PACKET_SIZE rays from one origin, e.g. the camera rays of a 4x2 or 4x4 pixel block
+constexpr uint32_t CPU_MAX_PACKET_SIZE = 16;
+struct CpuRayPacket
+{
+    glm::vec3 origin;
+    float     tmin;
+    float     tmax;
+    uint32_t  size;
+    glm::vec3 direction[CPU_MAX_PACKET_SIZE];
+};
+
+struct CpuAabb
+{
+    glm::vec3 min{1e30f};
+    glm::vec3 max{-1e30f};
+
+    void Grow(const glm::vec3& p)
+    {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+    void Grow(const CpuAabb& b)
+    {
+        min = glm::min(min, b.min);
+        max = glm::max(max, b.max);
+    }
+    bool Empty() const
+    {
+        return min.x > max.x;
+    }
+};
+
+// Bounds of a box after an InstanceInfo::transform (conservative: the transformed corners' bounds)
+CpuAabb TransformAabb(const float* transform, const CpuAabb& b);
+
+// 32 bytes. Inner nodes have count == 0 and their children at [first, first + 1].
+// Leaves reference [first, first + count) of the owner's primitive array.
+struct CpuBvhNode
+{
+    glm::vec3 aabb_min;
+    uint32_t  first;
+    glm::vec3 aabb_max;
+    uint32_t  count;
+};
+
+// Builds a binary BVH over primitive bounds with the binned SAH (cpu_bvh_builder.cpp).
+// Leaves are costed per leaf_block_size primitives, the width they are intersected at.
+// *order receives the primitive indices in leaf order.
+void BuildCpuBvh(std::span<const CpuAabb> prim_bounds,
+                 uint32_t                 max_leaf_size,
+                 uint32_t                 leaf_block_size,
+                 std::vector<CpuBvhNode>* nodes,
+                 std::vector<uint32_t>*   order,
+                 uint32_t                 num_workers = GetNumWorkerThreads());
+
+// 8-wide node collapsed from the binary BVH. The bounds of all eight children are stored in SoA order
+// (bounds[CPU_BVH8_LO_X][child] ...) so one AVX2 slab test, or two SSE ones, checks every child at once. 224 bytes.
+struct alignas(32) CpuBvh8Node
+{
+    float    bounds[6][8];
+    uint32_t child[8];
+};
+
+enum CpuBvh8Plane
+{
+    CPU_BVH8_LO_X,
+    CPU_BVH8_HI_X,
+    CPU_BVH8_LO_Y,
+    CPU_BVH8_HI_Y,
+    CPU_BVH8_LO_Z,
+    CPU_BVH8_HI_Z,
+};
+
+// CpuBvh8Node::child is an inner node index, CPU_BVH8_EMPTY, or a leaf: CPU_BVH8_LEAF | (count - 1) << CPU_BVH8_COUNT_SHIFT | first.
+// Empty slots have inverted bounds, but a slab test with NaN in it passes anyway, so the traversal loops also mask
+// them out with OccupiedChildren.
+constexpr uint32_t CPU_BVH8_EMPTY       = 0xffffffff;
+constexpr uint32_t CPU_BVH8_LEAF        = 0x80000000;
+constexpr uint32_t CPU_BVH8_COUNT_SHIFT = 27;
+constexpr uint32_t CPU_BVH8_FIRST_MASK  = (1U << CPU_BVH8_COUNT_SHIFT) - 1;
+
+// Four object-space triangles as (v0, v1 - v0, v2 - v0) in SoA order for a 4-wide Moller-Trumbore test;
+// two consecutive blocks make one 8-wide AVX2 test. Unused lanes have zero edges and are rejected as degenerate.
+struct alignas(16) CpuTriangleBlock4
+{
+    float    v0[3][4];
+    float    e1[3][4];
+    float    e2[3][4];
+    uint32_t primitive_idx[4];
+};
+
+// Instruction sets the traversal kernels are compiled for (cpu_bvh_traverse.cpp). The best one the CPU supports
+// is picked at runtime; g_cpu_simd_limit caps it, e.g. to compare the paths.
+enum CpuSimdLevel
+{
+    CPU_SIMD_SCALAR,
+    CPU_SIMD_SSE,
+    CPU_SIMD_AVX2,
+};
+inline CpuSimdLevel g_cpu_simd_limit{CPU_SIMD_AVX2};
+
+CpuSimdLevel GetCpuSimdLevel();
+const char*  GetCpuSimdLevelName(CpuSimdLevel level);
+
+// Bottom level: one per BLAS
+class CpuBlas
+{
+public:
+    void Build(const BlasGeometry& geom, uint32_t num_workers = GetNumWorkerThreads());
+
+    CpuAabb Bounds() const
+    {
+        return bounds_;
+    }
+    size_t NumNodes() const
+    {
+        return nodes_.size();
+    }
+    size_t NumTriangles() const
+    {
+        return num_triangles_;
+    }
+    size_t MemoryBytes() const
+    {
+        return nodes_.size() * sizeof(CpuBvh8Node) + blocks_.size() * sizeof(CpuTriangleBlock4);
+    }
+
+    // Root at index 0. Leaf children reference [first, first + count) of Blocks().
+    std::span<const CpuBvh8Node> Nodes() const
+    {
+        return nodes_;
+    }
+    std::span<const CpuTriangleBlock4> Blocks() const
+    {
+        return blocks_;
+    }
+
+private:
+    std::vector<CpuBvh8Node>       nodes_;
+    std::vector<CpuTriangleBlock4> blocks_;
+    CpuAabb                        bounds_;
+    size_t                         num_triangles_{};
+};
+
+struct CpuTlasInstance
+{
+    float    world_to_object[12];  // Row major, like InstanceInfo::transform
+    uint32_t blas_idx;
+    uint32_t instance_idx;  // Index into the InstanceInfo array, reported as CpuHit::instance_idx
+};
+
+// Top level over instances. Every BLAS is built once no matter how many instances reference it;
+// rays are moved into object space when they reach an instance.
+class CpuTlas
+{
+public:
+    void Build(const BlasGeometrySpans& blas_geometry, std::span<const InstanceInfo> instances, uint32_t num_workers = GetNumWorkerThreads());
+
+    // Closest hit in (ray.tmin, ray.tmax). Returns false on a miss.
+    bool Intersect(const CpuRay& ray, CpuHit* hit) const;
+
+    // Same as above, and adds the traversal work to *stats. observer, if given, sees the memory the traversal reads.
+    bool Intersect(const CpuRay& ray, CpuHit* hit, CpuTraversalStats* stats, CpuTraversalObserver* observer = nullptr) const;
+
+    // Any hit in (ray.tmin, ray.tmax), i.e. RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH
+    bool Occluded(const CpuRay& ray) const;
+
+    // Closest hits of a packet (cpu_bvh_packet.cpp). Nodes are first tested against the frustum of the whole packet,
+    // then against the rays still active in it. Rays that miss get hits[i].t < 0.
+    void IntersectPacket(const CpuRayPacket& packet, CpuHit* hits) const;
+
+    // Closest hits of any number of rays. At every node the active rays are split into one list per child, so each
+    // node is fetched once per stream rather than once per ray. Rays that miss get hits[i].t < 0.
+    void IntersectStream(std::span<const CpuRay> rays, CpuHit* hits) const;
+
+    CpuAabb Bounds() const
+    {
+        return bounds_;
+    }
+    size_t NumInstances() const
+    {
+        return instances_.size();
+    }
+    size_t NumBlasTriangles() const;  // Unique triangles, not multiplied by instance count
+    size_t NumNodes() const;          // Top and bottom levels
+    size_t MemoryBytes() const;
+
+    // Leaf children of Nodes() reference [first, first + count) of Instances()
+    std::span<const CpuBvh8Node> Nodes() const
+    {
+        return nodes_;
+    }
+    std::span<const CpuTlasInstance> Instances() const
+    {
+        return instances_;
+    }
+    std::span<const CpuBlas> Blases() const
+    {
+        return blases_;
+    }
+
+private:
+    std::vector<CpuBlas>         blases_;
+    std::vector<CpuBvh8Node>     nodes_;
+    std::vector<CpuTlasInstance> instances_;  // In leaf order
+    CpuAabb                      bounds_;
+};
@@ -0,0 +1,475 @@
+// Binned SAH builder for the CPU BVHs in cpu_bvh.h
+//
+// Ranges of at least PARALLEL_BUILD_THRESHOLD primitives are split one at a time, with every worker binning a slice
+// of the range. The subtrees below that size are independent and are built concurrently, each by a single worker,
+// then stitched into the node array. Binning uses SSE to place a primitive into its bins on all three axes at once.
+#include "cpu_bvh.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+#include "profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define CPU_BVH_USE_SSE 1
+#endif
+
+constexpr uint32_t NUM_SAH_BINS             = 16;
+constexpr uint32_t MAX_SAH_DEPTH            = 64;       // Deeper ranges are median-split, which bounds the traversal stack
+constexpr uint32_t PARALLEL_BUILD_THRESHOLD = 1 << 14;  // Smaller ranges are not worth splitting with all workers
+constexpr float    SAH_TRAVERSAL_COST       = 1.0f;
+constexpr float    SAH_INTERSECT_COST       = 1.0f;
+
+// One primitive's bounds; lo[3] carries the primitive index so the array can be partitioned in place
+struct alignas(16) BuildPrim
+{
+    float lo[4];
+    float hi[4];
+};
+
+struct alignas(16) SahBins
+{
+    float    lo[3][NUM_SAH_BINS][4];
+    float    hi[3][NUM_SAH_BINS][4];
+    uint32_t count[3][NUM_SAH_BINS];
+
+    void Reset()
+    {
+        for (uint32_t a = 0; a < 3; a++)
+        {
+            for (uint32_t b = 0; b < NUM_SAH_BINS; b++)
+            {
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    lo[a][b][c] = 1e30f;
+                    hi[a][b][c] = -1e30f;
+                }
+                count[a][b] = 0;
+            }
+        }
+    }
+
+    void Merge(const SahBins& o)
+    {
+        for (uint32_t a = 0; a < 3; a++)
+        {
+            for (uint32_t b = 0; b < NUM_SAH_BINS; b++)
+            {
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                    lo[a][b][c] = std::min(lo[a][b][c], o.lo[a][b][c]);
+                    hi[a][b][c] = std::max(hi[a][b][c], o.hi[a][b][c]);
+                }
+                count[a][b] += o.count[a][b];
+            }
+        }
+    }
+};
+
+// Primitives are binned by their doubled centroid (lo + hi), which saves a multiply per primitive
+struct BinMapping
+{
+    alignas(16) float cmin[4];
+    alignas(16) float scale[4];
+
+    uint32_t Bin(const BuildPrim& p, int axis) const
+    {
+        int b = int((p.lo[axis] + p.hi[axis] - cmin[axis]) * scale[axis]);
+        return uint32_t(std::clamp(b, 0, int(NUM_SAH_BINS) - 1));
+    }
+};
+
+static uint32_t PrimIndex(const BuildPrim& p)
+{
+    uint32_t idx;
+    memcpy(&idx, &p.lo[3], sizeof(idx));
+    return idx;
+}
+
+static float HalfArea(const float* lo, const float* hi)
+{
+    const float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static void BinPrims(const BuildPrim* prims, size_t begin, size_t end, const BinMapping& m, SahBins* bins)
+{
+#ifdef CPU_BVH_USE_SSE
+    const __m128 vcmin  = _mm_load_ps(m.cmin);
+    const __m128 vscale = _mm_load_ps(m.scale);
+    alignas(16) int32_t bi[4];
+    for (size_t i = begin; i < end; i++)
+    {
+        const __m128 lo = _mm_load_ps(prims[i].lo);
+        const __m128 hi = _mm_load_ps(prims[i].hi);
+        _mm_store_si128(reinterpret_cast<__m128i*>(bi), _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_add_ps(lo, hi), vcmin), vscale)));
+        for (int a = 0; a < 3; a++)
+        {
+            const int b = std::clamp(bi[a], 0, int(NUM_SAH_BINS) - 1);
+            _mm_store_ps(bins->lo[a][b], _mm_min_ps(_mm_load_ps(bins->lo[a][b]), lo));
+            _mm_store_ps(bins->hi[a][b], _mm_max_ps(_mm_load_ps(bins->hi[a][b]), hi));
+            bins->count[a][b]++;
+        }
+    }
+#else
+    for (size_t i = begin; i < end; i++)
+    {
+        const BuildPrim& p = prims[i];
+        for (int a = 0; a < 3; a++)
+        {
+            const uint32_t b = m.Bin(p, a);
+            for (int c = 0; c < 3; c++)
+            {
+                bins->lo[a][b][c] = std::min(bins->lo[a][b][c], p.lo[c]);
+                bins->hi[a][b][c] = std::max(bins->hi[a][b][c], p.hi[c]);
+            }
+            bins->count[a][b]++;
+        }
+    }
+#endif
+}
+
+struct RangeBounds
+{
+    CpuAabb bounds;
+    CpuAabb centroids2;  // Bounds of the doubled centroids
+
+    void Grow(const RangeBounds& o)
+    {
+        bounds.Grow(o.bounds);
+        centroids2.Grow(o.centroids2);
+    }
+};
+
+static void ComputeRangeBounds(const BuildPrim* prims, size_t begin, size_t end, RangeBounds* rb)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        const BuildPrim& p = prims[i];
+        rb->bounds.Grow(glm::vec3(p.lo[0], p.lo[1], p.lo[2]));
+        rb->bounds.Grow(glm::vec3(p.hi[0], p.hi[1], p.hi[2]));
+        rb->centroids2.Grow(glm::vec3(p.lo[0] + p.hi[0], p.lo[1] + p.hi[1], p.lo[2] + p.hi[2]));
+    }
+}
+
+class SahBuilder
+{
+public:
+    SahBuilder(std::vector<BuildPrim>* prims, uint32_t max_leaf_size, uint32_t leaf_block_size)
+        : prims_(*prims), max_leaf_size_(std::max(1U, max_leaf_size)), leaf_block_size_(std::max(1U, leaf_block_size))
+    {
+    }
+
+    // Decides how to split prims[begin, end). Returns false if the range should become a leaf.
+    // Uses num_workers threads for the bounds and the binning.
+    bool Split(uint32_t begin, uint32_t end, uint32_t depth, uint32_t num_workers, CpuAabb* bounds, uint32_t* mid)
+    {
+        const uint32_t n = end - begin;
+        num_workers      = n >= PARALLEL_BUILD_THRESHOLD ? num_workers : 1;
+
+        RangeBounds rb;
+        if (num_workers > 1)
+        {
+            std::vector<RangeBounds> partial(num_workers);
+            ParallelForChunks(
+                n, [&](uint32_t w, size_t b, size_t e) { ComputeRangeBounds(prims_.data(), begin + b, begin + e, &partial[w]); }, num_workers);
+            for (const RangeBounds& p : partial)
+            {
+                rb.Grow(p);
+            }
+        }
+        else
+        {
+            ComputeRangeBounds(prims_.data(), begin, end, &rb);
+        }
+        *bounds = rb.bounds;
+
+        if (n <= 1)
+            return false;
+
+        const glm::vec3 extent  = rb.centroids2.max - rb.centroids2.min;
+        const int       longest = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        if (extent[longest] <= 0)
+        {
+            // All centroids coincide: no split can separate them, so only cut for the leaf size
+            if (n <= max_leaf_size_)
+                return false;
+            *mid = begin + n / 2;
+            return true;
+        }
+        if (depth >= MAX_SAH_DEPTH)
+        {
+            if (n <= max_leaf_size_)
+                return false;
+            return MedianSplit(begin, end, longest, mid);
+        }
+
+        BinMapping m{};
+        for (int a = 0; a < 3; a++)
+        {
+            m.cmin[a]  = rb.centroids2.min[a];
+            m.scale[a] = extent[a] > 0 ? NUM_SAH_BINS * (1 - 1e-6f) / extent[a] : 0;
+        }
+
+        SahBins bins;
+        bins.Reset();
+        if (num_workers > 1)
+        {
+            std::vector<SahBins> partial(num_workers);
+            ParallelForChunks(
+                n,
+                [&](uint32_t w, size_t b, size_t e) {
+                    partial[w].Reset();
+                    BinPrims(prims_.data(), begin + b, begin + e, m, &partial[w]);
+                },
+                num_workers);
+            for (const SahBins& p : partial)
+            {
+                bins.Merge(p);
+            }
+        }
+        else
+        {
+            BinPrims(prims_.data(), begin, end, m, &bins);
+        }
+
+        // Sweep every axis: right-to-left for the right side's area and count, then left-to-right to evaluate
+        float    best_cost = INFINITY;
+        int      best_axis = -1;
+        uint32_t best_bin  = 0;
+        for (int a = 0; a < 3; a++)
+        {
+            if (extent[a] <= 0)
+                continue;
+            float    right_area[NUM_SAH_BINS];
+            uint32_t right_count[NUM_SAH_BINS];
+            float    lo[3] = {1e30f, 1e30f, 1e30f}, hi[3] = {-1e30f, -1e30f, -1e30f};
+            uint32_t cnt   = 0;
+            for (int b = NUM_SAH_BINS - 1; b > 0; b--)
+            {
+                GrowBox(lo, hi, bins.lo[a][b], bins.hi[a][b]);
+                cnt += bins.count[a][b];
+                right_area[b]  = cnt > 0 ? HalfArea(lo, hi) : 0;
+                right_count[b] = cnt;
+            }
+            float lo_l[3] = {1e30f, 1e30f, 1e30f}, hi_l[3] = {-1e30f, -1e30f, -1e30f};
+            cnt           = 0;
+            for (uint32_t b = 0; b + 1 < NUM_SAH_BINS; b++)
+            {
+                GrowBox(lo_l, hi_l, bins.lo[a][b], bins.hi[a][b]);
+                cnt += bins.count[a][b];
+                if (cnt == 0 || right_count[b + 1] == 0)
+                    continue;
+                const float cost = HalfArea(lo_l, hi_l) * LeafBlocks(cnt) + right_area[b + 1] * LeafBlocks(right_count[b + 1]);
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_bin  = b;
+                }
+            }
+        }
+
+        if (best_axis < 0)
+        {
+            if (n <= max_leaf_size_)
+                return false;
+            return MedianSplit(begin, end, longest, mid);
+        }
+
+        const float parent_area = HalfArea(&bounds->min.x, &bounds->max.x);
+        const float split_cost  = SAH_TRAVERSAL_COST + SAH_INTERSECT_COST * best_cost / std::max(parent_area, 1e-30f);
+        if (n <= max_leaf_size_ && SAH_INTERSECT_COST * LeafBlocks(n) <= split_cost)
+            return false;
+
+        BuildPrim* it = std::partition(prims_.data() + begin, prims_.data() + end, [&](const BuildPrim& p) { return m.Bin(p, best_axis) <= best_bin; });
+        *mid          = uint32_t(it - prims_.data());
+        if (*mid == begin || *mid == end)
+            return MedianSplit(begin, end, longest, mid);
+        return true;
+    }
+
+    // Builds prims[begin, end) on the calling thread. The subtree root is (*nodes)[0], the rest follows it.
+    void BuildSerial(uint32_t begin, uint32_t end, uint32_t depth, std::vector<CpuBvhNode>* nodes)
+    {
+        struct Task
+        {
+            uint32_t node_idx, begin, end, depth;
+        };
+
+        nodes->clear();
+        nodes->push_back({});
+        std::vector<Task> tasks = {{0, begin, end, depth}};
+        while (!tasks.empty())
+        {
+            Task t = tasks.back();
+            tasks.pop_back();
+
+            CpuAabb  bounds;
+            uint32_t mid{};
+            bool     split = Split(t.begin, t.end, t.depth, 1, &bounds, &mid);
+
+            CpuBvhNode& node = (*nodes)[t.node_idx];
+            node.aabb_min    = bounds.min;
+            node.aabb_max    = bounds.max;
+            if (!split)
+            {
+                node.first = t.begin;
+                node.count = t.end - t.begin;
+                continue;
+            }
+            const uint32_t left = uint32_t(nodes->size());
+            node.first          = left;
+            node.count          = 0;
+            nodes->push_back({});
+            nodes->push_back({});
+            tasks.push_back({left + 1, mid, t.end, t.depth + 1});
+            tasks.push_back({left, t.begin, mid, t.depth + 1});
+        }
+    }
+
+private:
+    static void GrowBox(float* lo, float* hi, const float* blo, const float* bhi)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            lo[c] = std::min(lo[c], blo[c]);
+            hi[c] = std::max(hi[c], bhi[c]);
+        }
+    }
+
+    bool MedianSplit(uint32_t begin, uint32_t end, int axis, uint32_t* mid)
+    {
+        *mid = begin + (end - begin) / 2;
+        std::nth_element(prims_.begin() + begin, prims_.begin() + *mid, prims_.begin() + end, [axis](const BuildPrim& a, const BuildPrim& b) {
+            return a.lo[axis] + a.hi[axis] < b.lo[axis] + b.hi[axis];
+        });
+        return true;
+    }
+
+    // Leaves are intersected leaf_block_size primitives at a time, so a partial block costs as much as a full one
+    uint32_t LeafBlocks(uint32_t n) const
+    {
+        return (n + leaf_block_size_ - 1) / leaf_block_size_;
+    }
+
+    std::vector<BuildPrim>& prims_;
+    uint32_t                max_leaf_size_;
+    uint32_t                leaf_block_size_;
+};
+
+void BuildCpuBvh(std::span<const CpuAabb> prim_bounds,
+                 uint32_t                 max_leaf_size,
+                 uint32_t                 leaf_block_size,
+                 std::vector<CpuBvhNode>* nodes,
+                 std::vector<uint32_t>*   order,
+                 uint32_t                 num_workers)
+{
+    RRA_PROFILE_SCOPE_ARG("BuildCpuBvh", prim_bounds.size());
+    nodes->clear();
+    order->clear();
+    const size_t n = prim_bounds.size();
+    if (n == 0 || n > UINT32_MAX)
+        return;
+    num_workers = std::max(1U, num_workers);
+
+    std::vector<BuildPrim> prims(n);
+    ParallelForChunks(
+        n,
+        [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                BuildPrim&     p   = prims[i];
+                const CpuAabb& b   = prim_bounds[i];
+                const uint32_t idx = uint32_t(i);
+                p.lo[0]            = b.min.x;
+                p.lo[1]            = b.min.y;
+                p.lo[2]            = b.min.z;
+                memcpy(&p.lo[3], &idx, sizeof(idx));
+                p.hi[0] = b.max.x;
+                p.hi[1] = b.max.y;
+                p.hi[2] = b.max.z;
+                p.hi[3] = 0;
+            }
+        },
+        num_workers);
+
+    SahBuilder builder(&prims, max_leaf_size, leaf_block_size);
+
+    // Upper levels: one range at a time, every worker helping with the binning
+    struct Task
+    {
+        uint32_t node_idx, begin, end, depth;
+    };
+    std::vector<Task> pending = {{0, 0, uint32_t(n), 0}}, subtrees;
+    nodes->reserve(2 * (n / max_leaf_size) + 1);
+    nodes->push_back({});
+    while (!pending.empty())
+    {
+        Task t = pending.back();
+        pending.pop_back();
+        if (num_workers == 1 || t.end - t.begin < PARALLEL_BUILD_THRESHOLD)
+        {
+            subtrees.push_back(t);
+            continue;
+        }
+
+        CpuAabb  bounds;
+        uint32_t mid{};
+        bool     split = builder.Split(t.begin, t.end, t.depth, num_workers, &bounds, &mid);
+
+        CpuBvhNode& node = (*nodes)[t.node_idx];
+        node.aabb_min    = bounds.min;
+        node.aabb_max    = bounds.max;
+        if (!split)
+        {
+            node.first = t.begin;
+            node.count = t.end - t.begin;
+            continue;
+        }
+        const uint32_t left = uint32_t(nodes->size());
+        node.first          = left;
+        node.count          = 0;
+        nodes->push_back({});
+        nodes->push_back({});
+        pending.push_back({left + 1, mid, t.end, t.depth + 1});
+        pending.push_back({left, t.begin, mid, t.depth + 1});
+    }
+
+    // Lower levels: independent subtrees, one worker each, biggest first
+    std::sort(subtrees.begin(), subtrees.end(), [](const Task& a, const Task& b) { return a.end - a.begin > b.end - b.begin; });
+    std::vector<std::vector<CpuBvhNode>> local(subtrees.size());
+    ParallelForDynamic(
+        subtrees.size(), 1, [&](uint32_t, size_t i) { builder.BuildSerial(subtrees[i].begin, subtrees[i].end, subtrees[i].depth, &local[i]); }, num_workers);
+
+    // Stitch: local root i goes to its placeholder, local node j >= 1 goes to base + j - 1
+    for (size_t i = 0; i < subtrees.size(); i++)
+    {
+        const uint32_t base = uint32_t(nodes->size());
+        auto           fix  = [base](CpuBvhNode nd) {
+            if (nd.count == 0)
+                nd.first = base + nd.first - 1;
+            return nd;
+        };
+        (*nodes)[subtrees[i].node_idx] = fix(local[i][0]);
+        for (size_t j = 1; j < local[i].size(); j++)
+        {
+            nodes->push_back(fix(local[i][j]));
+        }
+    }
+
+    order->resize(n);
+    ParallelForChunks(
+        n,
+        [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                (*order)[i] = PrimIndex(prims[i]);
+            }
+        },
+        num_workers);
+}
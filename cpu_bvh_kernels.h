@@ -0,0 +1,502 @@
+#pragma once
+
+// Building blocks shared by the CPU BVH traversal kernels (cpu_bvh_traverse.cpp, cpu_bvh_packet.cpp).
+// The box and triangle tests come in a scalar, an SSE and an AVX2 flavor with the same interface, and the traversal
+// loops are templates over them. AVX2 code is compiled through target attributes, so only functions marked
+// CPU_BVH_AVX2_ENTRY may call into Avx2Isa; flatten pulls everything below them in.
+#include "cpu_bvh.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)
+#include <immintrin.h>
+#define CPU_BVH_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CPU_BVH_AVX2_HELPER static __forceinline
+#define CPU_BVH_AVX2_ENTRY  static
+#else
+#define CPU_BVH_AVX2_HELPER static inline __attribute__((target("avx2")))
+#define CPU_BVH_AVX2_ENTRY  static __attribute__((target("avx2"), flatten))
+#endif
+#endif
+
+constexpr uint32_t MAX_BVH_DEPTH   = 96;  // The builder median-splits below depth 64, so trees stay under 64 + 32 levels
+constexpr uint32_t TRAVERSAL_STACK = MAX_BVH_DEPTH * 7 + 1;  // A node replaces itself with at most eight children
+
+struct TraversalRay
+{
+    float org[3];
+    float dir[3];
+    float inv_dir[3];
+    float tmin;
+    int   near_plane[3];  // CpuBvh8Plane the ray enters a box through on each axis
+    int   far_plane[3];
+};
+
+inline TraversalRay MakeTraversalRay(const glm::vec3& origin, const glm::vec3& direction, float tmin)
+{
+    TraversalRay r;
+    for (int a = 0; a < 3; a++)
+    {
+        r.org[a]     = origin[a];
+        r.dir[a]     = direction[a];
+        r.inv_dir[a] = 1.0f / direction[a];
+        // Sign of the reciprocal rather than the direction, so -0 picks the planes that match its -inf
+        const bool negative = r.inv_dir[a] < 0;
+        r.near_plane[a]     = a * 2 + (negative ? 1 : 0);
+        r.far_plane[a]      = a * 2 + (negative ? 0 : 1);
+    }
+    r.tmin = tmin;
+    return r;
+}
+
+// Rays with a NaN or infinite origin, direction or tmin miss everything; the slab tests cannot bound them
+inline bool IsTraceableRay(const glm::vec3& origin, const glm::vec3& direction, float tmin)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        if (!std::isfinite(origin[a]) || !std::isfinite(direction[a]))
+            return false;
+    }
+    return std::isfinite(tmin);
+}
+
+// Slots of node that hold a child, to be and-ed with the slab test results
+inline uint32_t OccupiedChildren(const CpuBvh8Node& node)
+{
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        mask |= uint32_t(node.child[i] != CPU_BVH8_EMPTY) << i;
+    }
+    return mask;
+}
+
+// Nearest of the lanes in mask that is closer than *best_t, lowest lane first on ties. Returns false if there is none.
+inline bool PickNearestLane(uint32_t mask, const float* t, uint32_t lane_offset, bool have_best, float* best_t, uint32_t* best_lane)
+{
+    bool picked = false;
+    while (mask)
+    {
+        const uint32_t i = std::countr_zero(mask);
+        mask &= mask - 1;
+        if (!have_best || t[i] < *best_t)
+        {
+            *best_t    = t[i];
+            *best_lane = lane_offset + i;
+            have_best  = true;
+            picked     = true;
+        }
+    }
+    return picked;
+}
+
+// Same operations in the same order as the SIMD versions, so every path reports the same hits
+struct ScalarIsa
+{
+    // Like _mm_max_ps/_mm_min_ps: a NaN in a returns b
+    static float Max(float a, float b)
+    {
+        return a > b ? a : b;
+    }
+    static float Min(float a, float b)
+    {
+        return a < b ? a : b;
+    }
+
+    // Slab test of all eight children. Returns the mask of children hit in [tmin, tmax] and their entry distances.
+    static uint32_t IntersectChildren(const CpuBvh8Node& node, const TraversalRay& r, float tmax, float* tnear)
+    {
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            const float tn_x = (node.bounds[r.near_plane[0]][i] - r.org[0]) * r.inv_dir[0];
+            const float tn_y = (node.bounds[r.near_plane[1]][i] - r.org[1]) * r.inv_dir[1];
+            const float tn_z = (node.bounds[r.near_plane[2]][i] - r.org[2]) * r.inv_dir[2];
+            const float tf_x = (node.bounds[r.far_plane[0]][i] - r.org[0]) * r.inv_dir[0];
+            const float tf_y = (node.bounds[r.far_plane[1]][i] - r.org[1]) * r.inv_dir[1];
+            const float tf_z = (node.bounds[r.far_plane[2]][i] - r.org[2]) * r.inv_dir[2];
+            const float tn   = Max(Max(tn_x, tn_y), Max(tn_z, r.tmin));
+            const float tf   = Min(Min(tf_x, tf_y), Min(tf_z, tmax));
+            tnear[i]         = tn;
+            mask |= uint32_t(tn <= tf) << i;
+        }
+        return mask;
+    }
+
+    // Moller-Trumbore without back-face culling, matching RAY_FLAG_NONE. Returns the mask of lanes hit in [tmin, tmax].
+    static uint32_t IntersectBlock(const CpuTriangleBlock4& b, const TraversalRay& r, float tmax, float* t, float* u, float* v)
+    {
+        const float dx = r.dir[0], dy = r.dir[1], dz = r.dir[2];
+        uint32_t    mask = 0;
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            const float e1x = b.e1[0][i], e1y = b.e1[1][i], e1z = b.e1[2][i];
+            const float e2x = b.e2[0][i], e2y = b.e2[1][i], e2z = b.e2[2][i];
+            const float px  = dy * e2z - dz * e2y;
+            const float py  = dz * e2x - dx * e2z;
+            const float pz  = dx * e2y - dy * e2x;
+            const float det = e1x * px + e1y * py + e1z * pz;
+            const float inv = 1.0f / det;
+            const float sx  = r.org[0] - b.v0[0][i];
+            const float sy  = r.org[1] - b.v0[1][i];
+            const float sz  = r.org[2] - b.v0[2][i];
+            const float qx  = sy * e1z - sz * e1y;
+            const float qy  = sz * e1x - sx * e1z;
+            const float qz  = sx * e1y - sy * e1x;
+            u[i]            = (sx * px + sy * py + sz * pz) * inv;
+            v[i]            = (dx * qx + dy * qy + dz * qz) * inv;
+            t[i]            = (e2x * qx + e2y * qy + e2z * qz) * inv;
+            const bool hit  = det != 0 && u[i] >= 0 && u[i] <= 1 && v[i] >= 0 && u[i] + v[i] <= 1 && t[i] >= r.tmin && t[i] <= tmax;
+            mask |= uint32_t(hit) << i;
+        }
+        return mask;
+    }
+
+    // Closest hit among num_blocks blocks. Shrinks *tmax and returns block * 4 + lane, or -1 on a miss.
+    static int IntersectTriangles(const CpuTriangleBlock4* blocks, uint32_t num_blocks, const TraversalRay& r, float* tmax, glm::vec2* bary)
+    {
+        bool     found  = false;
+        uint32_t best   = 0;
+        float    best_t = 0;
+        for (uint32_t b = 0; b < num_blocks; b++)
+        {
+            float t[4], u[4], v[4];
+            if (PickNearestLane(IntersectBlock(blocks[b], r, *tmax, t, u, v), t, b * 4, found, &best_t, &best))
+            {
+                found = true;
+                *tmax = best_t;
+                *bary = glm::vec2(u[best % 4], v[best % 4]);
+            }
+        }
+        return found ? int(best) : -1;
+    }
+
+    static bool AnyTriangle(const CpuTriangleBlock4* blocks, uint32_t num_blocks, const TraversalRay& r, float tmax)
+    {
+        for (uint32_t b = 0; b < num_blocks; b++)
+        {
+            float t[4], u[4], v[4];
+            if (IntersectBlock(blocks[b], r, tmax, t, u, v))
+                return true;
+        }
+        return false;
+    }
+};
+
+#if CPU_BVH_X86
+// Two 4-wide passes per node, one block per triangle test
+struct SseIsa
+{
+    static uint32_t IntersectChildren(const CpuBvh8Node& node, const TraversalRay& r, float tmax, float* tnear)
+    {
+        const __m128 org_x = _mm_set1_ps(r.org[0]), org_y = _mm_set1_ps(r.org[1]), org_z = _mm_set1_ps(r.org[2]);
+        const __m128 inv_x = _mm_set1_ps(r.inv_dir[0]), inv_y = _mm_set1_ps(r.inv_dir[1]), inv_z = _mm_set1_ps(r.inv_dir[2]);
+        const __m128 t0 = _mm_set1_ps(r.tmin), t1 = _mm_set1_ps(tmax);
+        uint32_t     mask = 0;
+        for (uint32_t h = 0; h < 8; h += 4)
+        {
+            const __m128 tn_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[r.near_plane[0]][h]), org_x), inv_x);
+            const __m128 tn_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[r.near_plane[1]][h]), org_y), inv_y);
+            const __m128 tn_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[r.near_plane[2]][h]), org_z), inv_z);
+            const __m128 tf_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[r.far_plane[0]][h]), org_x), inv_x);
+            const __m128 tf_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[r.far_plane[1]][h]), org_y), inv_y);
+            const __m128 tf_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[r.far_plane[2]][h]), org_z), inv_z);
+            const __m128 tn   = _mm_max_ps(_mm_max_ps(tn_x, tn_y), _mm_max_ps(tn_z, t0));
+            const __m128 tf   = _mm_min_ps(_mm_min_ps(tf_x, tf_y), _mm_min_ps(tf_z, t1));
+            _mm_storeu_ps(tnear + h, tn);
+            mask |= uint32_t(_mm_movemask_ps(_mm_cmple_ps(tn, tf))) << h;
+        }
+        return mask;
+    }
+
+    static uint32_t IntersectBlock(const CpuTriangleBlock4& b, const TraversalRay& r, float tmax, float* t, float* u, float* v)
+    {
+        const __m128 dx = _mm_set1_ps(r.dir[0]), dy = _mm_set1_ps(r.dir[1]), dz = _mm_set1_ps(r.dir[2]);
+        const __m128 e1x = _mm_load_ps(b.e1[0]), e1y = _mm_load_ps(b.e1[1]), e1z = _mm_load_ps(b.e1[2]);
+        const __m128 e2x = _mm_load_ps(b.e2[0]), e2y = _mm_load_ps(b.e2[1]), e2z = _mm_load_ps(b.e2[2]);
+
+        const __m128 px  = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        const __m128 py  = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        const __m128 pz  = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        const __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+        const __m128 sx  = _mm_sub_ps(_mm_set1_ps(r.org[0]), _mm_load_ps(b.v0[0]));
+        const __m128 sy  = _mm_sub_ps(_mm_set1_ps(r.org[1]), _mm_load_ps(b.v0[1]));
+        const __m128 sz  = _mm_sub_ps(_mm_set1_ps(r.org[2]), _mm_load_ps(b.v0[2]));
+        const __m128 qx  = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        const __m128 qy  = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        const __m128 qz  = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        const __m128 uu  = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+        const __m128 vv  = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+        const __m128 tt  = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        __m128       hit  = _mm_cmpneq_ps(det, zero);
+        hit               = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmple_ps(uu, one)));
+        hit               = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(vv, zero), _mm_cmple_ps(_mm_add_ps(uu, vv), one)));
+        hit               = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(tt, _mm_set1_ps(r.tmin)), _mm_cmple_ps(tt, _mm_set1_ps(tmax))));
+        _mm_storeu_ps(t, tt);
+        _mm_storeu_ps(u, uu);
+        _mm_storeu_ps(v, vv);
+        return uint32_t(_mm_movemask_ps(hit));
+    }
+
+    static int IntersectTriangles(const CpuTriangleBlock4* blocks, uint32_t num_blocks, const TraversalRay& r, float* tmax, glm::vec2* bary)
+    {
+        bool     found  = false;
+        uint32_t best   = 0;
+        float    best_t = 0;
+        for (uint32_t b = 0; b < num_blocks; b++)
+        {
+            float t[4], u[4], v[4];
+            if (PickNearestLane(IntersectBlock(blocks[b], r, *tmax, t, u, v), t, b * 4, found, &best_t, &best))
+            {
+                found = true;
+                *tmax = best_t;
+                *bary = glm::vec2(u[best % 4], v[best % 4]);
+            }
+        }
+        return found ? int(best) : -1;
+    }
+
+    static bool AnyTriangle(const CpuTriangleBlock4* blocks, uint32_t num_blocks, const TraversalRay& r, float tmax)
+    {
+        for (uint32_t b = 0; b < num_blocks; b++)
+        {
+            float t[4], u[4], v[4];
+            if (IntersectBlock(blocks[b], r, tmax, t, u, v))
+                return true;
+        }
+        return false;
+    }
+};
+
+// One 8-wide pass per node; triangle blocks are tested in pairs
+struct Avx2Isa
+{
+    CPU_BVH_AVX2_HELPER uint32_t IntersectChildren(const CpuBvh8Node& node, const TraversalRay& r, float tmax, float* tnear)
+    {
+        const __m256 org_x = _mm256_set1_ps(r.org[0]), org_y = _mm256_set1_ps(r.org[1]), org_z = _mm256_set1_ps(r.org[2]);
+        const __m256 inv_x = _mm256_set1_ps(r.inv_dir[0]), inv_y = _mm256_set1_ps(r.inv_dir[1]), inv_z = _mm256_set1_ps(r.inv_dir[2]);
+        const __m256 tn_x  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.near_plane[0]]), org_x), inv_x);
+        const __m256 tn_y  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.near_plane[1]]), org_y), inv_y);
+        const __m256 tn_z  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.near_plane[2]]), org_z), inv_z);
+        const __m256 tf_x  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.far_plane[0]]), org_x), inv_x);
+        const __m256 tf_y  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.far_plane[1]]), org_y), inv_y);
+        const __m256 tf_z  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.far_plane[2]]), org_z), inv_z);
+        const __m256 tn    = _mm256_max_ps(_mm256_max_ps(tn_x, tn_y), _mm256_max_ps(tn_z, _mm256_set1_ps(r.tmin)));
+        const __m256 tf    = _mm256_min_ps(_mm256_min_ps(tf_x, tf_y), _mm256_min_ps(tf_z, _mm256_set1_ps(tmax)));
+        _mm256_storeu_ps(tnear, tn);
+        return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ)));
+    }
+
+    CPU_BVH_AVX2_HELPER __m256 Load2x4(const float* lo, const float* hi)
+    {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(lo)), _mm_load_ps(hi), 1);
+    }
+
+    // Lanes 0-3 test block a, lanes 4-7 block b
+    CPU_BVH_AVX2_HELPER uint32_t IntersectBlockPair(
+        const CpuTriangleBlock4& a, const CpuTriangleBlock4& b, const TraversalRay& r, float tmax, float* t, float* u, float* v)
+    {
+        const __m256 dx = _mm256_set1_ps(r.dir[0]), dy = _mm256_set1_ps(r.dir[1]), dz = _mm256_set1_ps(r.dir[2]);
+        const __m256 e1x = Load2x4(a.e1[0], b.e1[0]), e1y = Load2x4(a.e1[1], b.e1[1]), e1z = Load2x4(a.e1[2], b.e1[2]);
+        const __m256 e2x = Load2x4(a.e2[0], b.e2[0]), e2y = Load2x4(a.e2[1], b.e2[1]), e2z = Load2x4(a.e2[2], b.e2[2]);
+
+        const __m256 px  = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        const __m256 py  = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        const __m256 pz  = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        const __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+        const __m256 sx  = _mm256_sub_ps(_mm256_set1_ps(r.org[0]), Load2x4(a.v0[0], b.v0[0]));
+        const __m256 sy  = _mm256_sub_ps(_mm256_set1_ps(r.org[1]), Load2x4(a.v0[1], b.v0[1]));
+        const __m256 sz  = _mm256_sub_ps(_mm256_set1_ps(r.org[2]), Load2x4(a.v0[2], b.v0[2]));
+        const __m256 qx  = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        const __m256 qy  = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        const __m256 qz  = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+        const __m256 uu  = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inv);
+        const __m256 vv  = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv);
+        const __m256 tt  = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv);
+
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+        const __m256 t0 = _mm256_set1_ps(r.tmin), t1 = _mm256_set1_ps(tmax);
+        __m256       hit  = _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ);
+        hit               = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(uu, zero, _CMP_GE_OQ), _mm256_cmp_ps(uu, one, _CMP_LE_OQ)));
+        hit               = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(vv, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(uu, vv), one, _CMP_LE_OQ)));
+        hit               = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(tt, t0, _CMP_GE_OQ), _mm256_cmp_ps(tt, t1, _CMP_LE_OQ)));
+        _mm256_storeu_ps(t, tt);
+        _mm256_storeu_ps(u, uu);
+        _mm256_storeu_ps(v, vv);
+        return uint32_t(_mm256_movemask_ps(hit));
+    }
+
+    // An odd block at the end is paired with itself and its upper lanes are ignored
+    CPU_BVH_AVX2_HELPER int IntersectTriangles(const CpuTriangleBlock4* blocks, uint32_t num_blocks, const TraversalRay& r, float* tmax, glm::vec2* bary)
+    {
+        bool     found  = false;
+        uint32_t best   = 0;
+        float    best_t = 0;
+        for (uint32_t b = 0; b < num_blocks; b += 2)
+        {
+            const bool pair = b + 1 < num_blocks;
+            float      t[8], u[8], v[8];
+            uint32_t   mask = IntersectBlockPair(blocks[b], blocks[pair ? b + 1 : b], r, *tmax, t, u, v) & (pair ? 0xff : 0x0f);
+            if (PickNearestLane(mask, t, b * 4, found, &best_t, &best))
+            {
+                found = true;
+                *tmax = best_t;
+                *bary = glm::vec2(u[best - b * 4], v[best - b * 4]);
+            }
+        }
+        return found ? int(best) : -1;
+    }
+
+    CPU_BVH_AVX2_HELPER bool AnyTriangle(const CpuTriangleBlock4* blocks, uint32_t num_blocks, const TraversalRay& r, float tmax)
+    {
+        for (uint32_t b = 0; b < num_blocks; b += 2)
+        {
+            const bool pair = b + 1 < num_blocks;
+            float      t[8], u[8], v[8];
+            if (IntersectBlockPair(blocks[b], blocks[pair ? b + 1 : b], r, tmax, t, u, v) & (pair ? 0xff : 0x0f))
+                return true;
+        }
+        return false;
+    }
+};
+#endif
+
+struct StackEntry
+{
+    uint32_t child;
+    float    t;  // Where the ray enters the child's box
+};
+
+// Hooks through which the traversal loops report their work. The plain kernels use NoTraversalCounter, which
+// compiles away; TraversalCounter adds to a CpuTraversalStats.
+struct NoTraversalCounter
+{
+    void Step()
+    {
+    }
+    void Node(const CpuBvh8Node&)
+    {
+    }
+    void Depth(uint32_t)
+    {
+    }
+    void Triangles(const CpuTriangleBlock4*, uint32_t)
+    {
+    }
+    NoTraversalCounter Instance()
+    {
+        return {};
+    }
+};
+
+struct TraversalCounter
+{
+    CpuTraversalStats*    stats;
+    CpuTraversalObserver* observer{};
+    uint32_t              base_depth{};  // Stack entries held by the levels above this one
+    uint32_t              depth{};       // Stack entries of this level
+
+    void Step()
+    {
+        stats->steps++;
+    }
+    void Node(const CpuBvh8Node& node)
+    {
+        stats->node_visits++;
+        if (observer)
+            observer->Touch(&node, sizeof(node));
+    }
+    void Depth(uint32_t sp)
+    {
+        depth                  = sp;
+        stats->max_stack_depth = std::max(stats->max_stack_depth, base_depth + sp);
+    }
+    // Padding lanes are not counted
+    void Triangles(const CpuTriangleBlock4* blocks, uint32_t num_blocks)
+    {
+        if (observer)
+            observer->Touch(blocks, num_blocks * sizeof(CpuTriangleBlock4));
+        for (uint32_t b = 0; b < num_blocks; b++)
+        {
+            for (uint32_t lane = 0; lane < 4; lane++)
+            {
+                stats->triangle_tests += blocks[b].primitive_idx[lane] != UINT32_MAX;
+            }
+        }
+    }
+    // Counter for the traversal of an instance's BLAS, stacked on top of this level
+    TraversalCounter Instance()
+    {
+        stats->instance_transitions++;
+        return {stats, observer, base_depth + depth};
+    }
+};
+
+// Front-to-back traversal of an 8-wide BVH. leaf(first, count) tests a leaf's primitives and returns true on a hit;
+// closest-hit queries shrink *tmax in there. Any-hit queries stop at the first hit and skip the child sort.
+// counter is taken by reference when it is an lvalue, so leaf() can start nested counters from its current depth.
+template<class Isa, bool ANY_HIT, class LeafFn, class Counter = NoTraversalCounter>
+static bool TraverseBvh8(const CpuBvh8Node* nodes, const TraversalRay& r, float* tmax, LeafFn&& leaf, Counter&& counter = Counter())
+{
+    StackEntry stack[TRAVERSAL_STACK];
+    uint32_t   sp    = 0;
+    bool       found = false;
+    stack[sp++]      = {0, r.tmin};
+    counter.Depth(sp);
+    while (sp > 0)
+    {
+        const StackEntry e = stack[--sp];
+        if (e.t > *tmax)
+            continue;
+        counter.Step();
+        if (e.child & CPU_BVH8_LEAF)
+        {
+            counter.Depth(sp);
+            if (leaf(e.child & CPU_BVH8_FIRST_MASK, ((e.child & ~CPU_BVH8_LEAF) >> CPU_BVH8_COUNT_SHIFT) + 1))
+            {
+                if (ANY_HIT)
+                    return true;
+                found = true;
+            }
+            continue;
+        }
+
+        const CpuBvh8Node& node = nodes[e.child];
+        float              tnear[8];
+        uint32_t           mask = Isa::IntersectChildren(node, r, *tmax, tnear) & OccupiedChildren(node);
+        counter.Node(node);
+
+        // Push far to near so the nearest child is popped next
+        const uint32_t base = sp;
+        while (mask)
+        {
+            const uint32_t i = std::countr_zero(mask);
+            mask &= mask - 1;
+            uint32_t j = sp++;
+            for (; !ANY_HIT && j > base && stack[j - 1].t < tnear[i]; j--)
+            {
+                stack[j] = stack[j - 1];
+            }
+            stack[j] = {node.child[i], tnear[i]};
+        }
+        counter.Depth(sp);
+    }
+    return found;
+}
+
+// The direction is not re-normalized, so t means the same thing in world and object space
+inline TraversalRay MakeObjectRay(const CpuTlasInstance& inst, const CpuRay& ray)
+{
+    return MakeTraversalRay(
+        TransformInstancePosition(inst.world_to_object, ray.origin), TransformInstanceDirection(inst.world_to_object, ray.direction), ray.tmin);
+}
@@ -0,0 +1,394 @@
+// Packet and stream traversal of the CPU BVHs, for coherent rays such as the camera rays of RayGen_primary
+//
+// A packet shares one origin, so the whole packet can be tested against a node as a frustum first, which skips the
+// per-ray box tests wherever the packet as a whole misses. A stream makes no assumption about its rays. It only
+// batches them: the rays reaching a node are tested against its children one after the other while the node is in
+// cache, then split into one id list per child.
+#include "cpu_bvh_kernels.h"
+
+#include <cmath>
+#include <vector>
+
+// A packet moved into the space of the BVH being traversed
+struct PacketRays
+{
+    TraversalRay rays[CPU_MAX_PACKET_SIZE];
+    float        org[3];
+    float        tmin;
+    // Range of the reciprocal directions over the packet. Only usable if all rays enter boxes through the same planes.
+    bool  has_frustum;
+    float inv_lo[3];
+    float inv_hi[3];
+    int   near_plane[3];
+    int   far_plane[3];
+};
+
+static void MakePacketRays(const glm::vec3& origin, const glm::vec3* directions, uint32_t mask, float tmin, PacketRays* p)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        p->org[a]    = origin[a];
+        p->inv_lo[a] = INFINITY;
+        p->inv_hi[a] = -INFINITY;
+    }
+    p->tmin        = tmin;
+    p->has_frustum = mask != 0;
+
+    const uint32_t first = mask ? std::countr_zero(mask) : 0;
+    for (uint32_t m = mask; m; m &= m - 1)
+    {
+        const uint32_t i = std::countr_zero(m);
+        TraversalRay&  r = p->rays[i];
+        r                = MakeTraversalRay(origin, directions[i], tmin);
+        for (int a = 0; a < 3; a++)
+        {
+            p->inv_lo[a] = std::min(p->inv_lo[a], r.inv_dir[a]);
+            p->inv_hi[a] = std::max(p->inv_hi[a], r.inv_dir[a]);
+            p->has_frustum &= std::isfinite(r.inv_dir[a]) && r.near_plane[a] == p->rays[first].near_plane[a];
+        }
+    }
+    for (int a = 0; a < 3; a++)
+    {
+        p->near_plane[a] = p->rays[first].near_plane[a];
+        p->far_plane[a]  = p->rays[first].far_plane[a];
+    }
+}
+
+// Interval version of the slab test: a child is culled only if no reciprocal direction within the packet's range
+// can hit it before tmax. With a shared origin this is a test against the packet's frustum.
+static uint32_t FrustumTestChildren(const CpuBvh8Node& node, const PacketRays& p, float tmax)
+{
+    if (!p.has_frustum)
+        return 0xff;
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        float tn = p.tmin;
+        float tf = tmax;
+        for (int a = 0; a < 3; a++)
+        {
+            const float dn = node.bounds[p.near_plane[a]][i] - p.org[a];
+            const float df = node.bounds[p.far_plane[a]][i] - p.org[a];
+            tn             = std::max(tn, std::min(dn * p.inv_lo[a], dn * p.inv_hi[a]));
+            tf             = std::min(tf, std::max(df * p.inv_lo[a], df * p.inv_hi[a]));
+        }
+        mask |= uint32_t(tn <= tf) << i;
+    }
+    return mask;
+}
+
+struct PacketStackEntry
+{
+    uint32_t child;
+    uint32_t mask;  // Rays that hit the child's box
+    float    t;     // Nearest entry distance among them
+};
+
+// leaf(first, count, mask) tests a leaf's primitives for the rays in mask and shrinks their tmax
+template<class Isa, class LeafFn>
+static void TraversePacket(const CpuBvh8Node* nodes, const PacketRays& p, uint32_t active, float* tmax, LeafFn&& leaf)
+{
+    PacketStackEntry stack[TRAVERSAL_STACK];
+    uint32_t         sp = 0;
+    stack[sp++]         = {0, active, p.tmin};
+    while (sp > 0)
+    {
+        const PacketStackEntry e        = stack[--sp];
+        float                  tmax_far = -INFINITY;
+        for (uint32_t m = e.mask; m; m &= m - 1)
+        {
+            tmax_far = std::max(tmax_far, tmax[std::countr_zero(m)]);
+        }
+        if (e.t > tmax_far)
+            continue;
+        if (e.child & CPU_BVH8_LEAF)
+        {
+            leaf(e.child & CPU_BVH8_FIRST_MASK, ((e.child & ~CPU_BVH8_LEAF) >> CPU_BVH8_COUNT_SHIFT) + 1, e.mask);
+            continue;
+        }
+
+        const CpuBvh8Node& node       = nodes[e.child];
+        const uint32_t     candidates = FrustumTestChildren(node, p, tmax_far) & OccupiedChildren(node);
+        if (candidates == 0)
+            continue;
+
+        uint32_t child_mask[8] = {};
+        float    child_t[8]    = {INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY};
+        for (uint32_t m = e.mask; m; m &= m - 1)
+        {
+            const uint32_t i = std::countr_zero(m);
+            float          tnear[8];
+            for (uint32_t hit = Isa::IntersectChildren(node, p.rays[i], tmax[i], tnear) & candidates; hit; hit &= hit - 1)
+            {
+                const uint32_t c = std::countr_zero(hit);
+                child_mask[c] |= 1U << i;
+                child_t[c] = std::min(child_t[c], tnear[c]);
+            }
+        }
+
+        // Push far to near so the nearest child is popped next
+        const uint32_t base = sp;
+        for (uint32_t c = 0; c < 8; c++)
+        {
+            if (!child_mask[c])
+                continue;
+            uint32_t j = sp++;
+            for (; j > base && stack[j - 1].t < child_t[c]; j--)
+            {
+                stack[j] = stack[j - 1];
+            }
+            stack[j] = {node.child[c], child_mask[c], child_t[c]};
+        }
+    }
+}
+
+template<class Isa>
+static void IntersectPacketTlas(const CpuTlas& tlas, const CpuRayPacket& packet, CpuHit* hits)
+{
+    const uint32_t size = std::min(packet.size, CPU_MAX_PACKET_SIZE);
+    float          tmax[CPU_MAX_PACKET_SIZE];
+    for (uint32_t i = 0; i < size; i++)
+    {
+        hits[i] = {};
+        tmax[i] = packet.tmax;
+    }
+    if (tlas.Nodes().empty() || size == 0)
+        return;
+
+    uint32_t all = 0;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        all |= uint32_t(IsTraceableRay(packet.origin, packet.direction[i], packet.tmin)) << i;
+    }
+    if (all == 0)
+        return;
+    PacketRays     world;
+    MakePacketRays(packet.origin, packet.direction, all, packet.tmin, &world);
+
+    const CpuTlasInstance* instances = tlas.Instances().data();
+    const CpuBlas*         blases    = tlas.Blases().data();
+    TraversePacket<Isa>(tlas.Nodes().data(), world, all, tmax, [&](uint32_t first, uint32_t count, uint32_t mask) {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            // The directions are not re-normalized, so t means the same thing in both spaces
+            const CpuTlasInstance&   inst   = instances[i];
+            const CpuTriangleBlock4* blocks = blases[inst.blas_idx].Blocks().data();
+            glm::vec3                dirs[CPU_MAX_PACKET_SIZE];
+            for (uint32_t m = mask; m; m &= m - 1)
+            {
+                const uint32_t j = std::countr_zero(m);
+                dirs[j]          = TransformInstanceDirection(inst.world_to_object, packet.direction[j]);
+            }
+            PacketRays obj;
+            MakePacketRays(TransformInstancePosition(inst.world_to_object, packet.origin), dirs, mask, packet.tmin, &obj);
+
+            TraversePacket<Isa>(blases[inst.blas_idx].Nodes().data(), obj, mask, tmax, [&](uint32_t first_block, uint32_t num_blocks, uint32_t leaf_mask) {
+                for (uint32_t m = leaf_mask; m; m &= m - 1)
+                {
+                    const uint32_t j = std::countr_zero(m);
+                    glm::vec2      bary;
+                    const int      lane = Isa::IntersectTriangles(blocks + first_block, num_blocks, obj.rays[j], &tmax[j], &bary);
+                    if (lane >= 0)
+                        hits[j] = {tmax[j], inst.instance_idx, blocks[first_block + lane / 4].primitive_idx[lane % 4], bary};
+                }
+            });
+        }
+    });
+}
+
+struct StreamStackEntry
+{
+    uint32_t child;
+    uint32_t begin, end;  // Ids of the rays that hit the child's box, in the traversal's id arena
+    uint32_t top;         // End of the lists of the child and its siblings
+    float    t;           // Nearest entry distance among them
+};
+
+// Per-thread buffers, so tracing a stream does not allocate once they have grown
+struct StreamScratch
+{
+    std::vector<uint32_t> ids;
+    std::vector<uint8_t>  child_masks;
+};
+
+// leaf(first, count, ids, num_ids) tests a leaf's primitives for the listed rays and shrinks their tmax.
+// The lists of a node's children are appended to the arena together; popping one of them frees everything above them.
+template<class Isa, class LeafFn>
+static void TraverseStream(const CpuBvh8Node* nodes, const TraversalRay* rays, const float* tmax, float tmin, StreamScratch* s, LeafFn&& leaf)
+{
+    StreamStackEntry stack[TRAVERSAL_STACK];
+    uint32_t         sp = 0;
+    stack[sp++]         = {0, 0, uint32_t(s->ids.size()), uint32_t(s->ids.size()), tmin};
+    while (sp > 0)
+    {
+        const StreamStackEntry e = stack[--sp];
+        const uint32_t         n = e.end - e.begin;
+        s->ids.resize(e.top);
+        if (e.child & CPU_BVH8_LEAF)
+        {
+            leaf(e.child & CPU_BVH8_FIRST_MASK, ((e.child & ~CPU_BVH8_LEAF) >> CPU_BVH8_COUNT_SHIFT) + 1, s->ids.data() + e.begin, n);
+            continue;
+        }
+
+        const CpuBvh8Node& node        = nodes[e.child];
+        const uint32_t     occupied    = OccupiedChildren(node);
+        uint32_t           counts[8]   = {};
+        float              child_t[8]  = {INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY};
+        uint8_t*           child_masks = s->child_masks.data();
+        for (uint32_t k = 0; k < n; k++)
+        {
+            const uint32_t id = s->ids[e.begin + k];
+            float          tnear[8];
+            const uint32_t hit = Isa::IntersectChildren(node, rays[id], tmax[id], tnear) & occupied;
+            child_masks[k]     = uint8_t(hit);
+            for (uint32_t m = hit; m; m &= m - 1)
+            {
+                const uint32_t c = std::countr_zero(m);
+                counts[c]++;
+                child_t[c] = std::min(child_t[c], tnear[c]);
+            }
+        }
+
+        uint32_t offsets[8];
+        uint32_t total = 0;
+        for (uint32_t c = 0; c < 8; c++)
+        {
+            offsets[c] = e.top + total;
+            total += counts[c];
+        }
+        if (total == 0)
+            continue;
+        const uint32_t top = e.top + total;
+        s->ids.resize(top);
+        uint32_t* ids = s->ids.data();
+        for (uint32_t k = 0; k < n; k++)
+        {
+            for (uint32_t m = child_masks[k]; m; m &= m - 1)
+            {
+                ids[offsets[std::countr_zero(m)]++] = ids[e.begin + k];
+            }
+        }
+
+        // Push far to near so the nearest child is popped next
+        const uint32_t base = sp;
+        for (uint32_t c = 0; c < 8; c++)
+        {
+            if (!counts[c])
+                continue;
+            uint32_t j = sp++;
+            for (; j > base && stack[j - 1].t < child_t[c]; j--)
+            {
+                stack[j] = stack[j - 1];
+            }
+            stack[j] = {node.child[c], offsets[c] - counts[c], offsets[c], top, child_t[c]};
+        }
+    }
+}
+
+template<class Isa>
+static void IntersectStreamTlas(const CpuTlas& tlas, std::span<const CpuRay> rays, CpuHit* hits)
+{
+    thread_local StreamScratch             top, bottom;
+    thread_local std::vector<TraversalRay> world, obj;
+    thread_local std::vector<float>        tmax;
+
+    const uint32_t n = uint32_t(rays.size());
+    for (uint32_t i = 0; i < n; i++)
+    {
+        hits[i] = {};
+    }
+    if (tlas.Nodes().empty() || n == 0)
+        return;
+
+    world.resize(n);
+    obj.resize(n);
+    tmax.resize(n);
+    top.ids.clear();
+    top.child_masks.resize(n);
+    bottom.child_masks.resize(n);
+    float tmin = INFINITY;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        world[i] = MakeTraversalRay(rays[i].origin, rays[i].direction, rays[i].tmin);
+        tmax[i]  = rays[i].tmax;
+        if (!IsTraceableRay(rays[i].origin, rays[i].direction, rays[i].tmin))
+            continue;
+        top.ids.push_back(i);
+        tmin = std::min(tmin, rays[i].tmin);
+    }
+    if (top.ids.empty())
+        return;
+
+    const CpuTlasInstance* instances = tlas.Instances().data();
+    const CpuBlas*         blases    = tlas.Blases().data();
+    TraverseStream<Isa>(tlas.Nodes().data(), world.data(), tmax.data(), tmin, &top, [&](uint32_t first, uint32_t count, const uint32_t* ids, uint32_t num_ids) {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            const CpuTlasInstance&   inst   = instances[i];
+            const CpuTriangleBlock4* blocks = blases[inst.blas_idx].Blocks().data();
+            for (uint32_t k = 0; k < num_ids; k++)
+            {
+                obj[ids[k]] = MakeObjectRay(inst, rays[ids[k]]);
+            }
+            bottom.ids.assign(ids, ids + num_ids);
+
+            TraverseStream<Isa>(blases[inst.blas_idx].Nodes().data(),
+                                obj.data(),
+                                tmax.data(),
+                                tmin,
+                                &bottom,
+                                [&](uint32_t first_block, uint32_t num_blocks, const uint32_t* leaf_ids, uint32_t num_leaf_ids) {
+                                    for (uint32_t k = 0; k < num_leaf_ids; k++)
+                                    {
+                                        const uint32_t id = leaf_ids[k];
+                                        glm::vec2      bary;
+                                        const int      lane = Isa::IntersectTriangles(blocks + first_block, num_blocks, obj[id], &tmax[id], &bary);
+                                        if (lane >= 0)
+                                            hits[id] = {tmax[id], inst.instance_idx, blocks[first_block + lane / 4].primitive_idx[lane % 4], bary};
+                                    }
+                                });
+        }
+    });
+}
+
+#if CPU_BVH_X86
+CPU_BVH_AVX2_ENTRY void IntersectPacketAvx2(const CpuTlas& tlas, const CpuRayPacket& packet, CpuHit* hits)
+{
+    IntersectPacketTlas<Avx2Isa>(tlas, packet, hits);
+}
+
+CPU_BVH_AVX2_ENTRY void IntersectStreamAvx2(const CpuTlas& tlas, std::span<const CpuRay> rays, CpuHit* hits)
+{
+    IntersectStreamTlas<Avx2Isa>(tlas, rays, hits);
+}
+#endif
+
+void CpuTlas::IntersectPacket(const CpuRayPacket& packet, CpuHit* hits) const
+{
+    switch (GetCpuSimdLevel())
+    {
+#if CPU_BVH_X86
+    case CPU_SIMD_AVX2:
+        return IntersectPacketAvx2(*this, packet, hits);
+    case CPU_SIMD_SSE:
+        return IntersectPacketTlas<SseIsa>(*this, packet, hits);
+#endif
+    default:
+        return IntersectPacketTlas<ScalarIsa>(*this, packet, hits);
+    }
+}
+
+void CpuTlas::IntersectStream(std::span<const CpuRay> rays, CpuHit* hits) const
+{
+    switch (GetCpuSimdLevel())
+    {
+#if CPU_BVH_X86
+    case CPU_SIMD_AVX2:
+        return IntersectStreamAvx2(*this, rays, hits);
+    case CPU_SIMD_SSE:
+        return IntersectStreamTlas<SseIsa>(*this, rays, hits);
+#endif
+    default:
+        return IntersectStreamTlas<ScalarIsa>(*this, rays, hits);
+    }
+}
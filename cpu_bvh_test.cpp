@@ -0,0 +1,104 @@
+// Checks of the CPU BVH traversal that need no capture: rays with NaN or infinite components must miss in every
+// SIMD level and trace mode instead of walking into the empty child slots of the 8-wide nodes.
+
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cpu_bvh.h"
+#include "rt_common.h"
+
+static int g_failures = 0;
+
+static void Check(bool ok, const char* what, int line)
+{
+    if (ok)
+        return;
+    printf("%s:%d: %s failed with %s traversal\n", __FILE__, line, what, GetCpuSimdLevelName(GetCpuSimdLevel()));
+    g_failures++;
+}
+#define CHECK(cond) Check(cond, #cond, __LINE__)
+
+// A row of unit quads in the z = 0 plane, one instance each, so the nodes of both levels have empty slots
+static void BuildQuadRow(CpuTlas* tlas, uint32_t num_instances)
+{
+    static const std::vector<glm::vec3> vertices = {{-1, -1, 0}, {1, -1, 0}, {1, 1, 0}, {-1, 1, 0}};
+    static const std::vector<uint32_t>  indices  = {0, 1, 2, 0, 2, 3};
+
+    BlasGeometrySpans blases = {{vertices, indices}};
+    std::vector<InstanceInfo> instances(num_instances);
+    for (uint32_t i = 0; i < num_instances; i++)
+    {
+        instances[i].transform[0]  = 1;
+        instances[i].transform[3]  = 3.0f * i;
+        instances[i].transform[5]  = 1;
+        instances[i].transform[10] = 1;
+    }
+    tlas->Build(blases, instances, 1);
+}
+
+static void CheckNonFiniteRaysMiss(const CpuTlas& tlas)
+{
+    const float     nan = NAN;
+    const glm::vec3 origin(0, 0, 5), down(0, 0, -1);
+    const CpuRay    rays[] = {
+        {origin, 0, glm::vec3(nan, nan, nan), INFINITY},
+        {origin, 0, glm::vec3(0, nan, -1), INFINITY},
+        {glm::vec3(nan, 0, 5), 0, down, INFINITY},
+        {glm::vec3(INFINITY, 0, 5), 0, down, INFINITY},
+        {origin, nan, down, INFINITY},
+    };
+    const CpuRay hit_ray = {origin, 0, down, INFINITY};
+
+    CpuHit hit;
+    CHECK(tlas.Intersect(hit_ray, &hit) && hit.t == 5.0f);
+    for (const CpuRay& ray : rays)
+    {
+        CpuTraversalStats stats{};
+        CHECK(!tlas.Intersect(ray, &hit));
+        CHECK(!tlas.Intersect(ray, &hit, &stats));
+        CHECK(!tlas.Occluded(ray));
+    }
+
+    // A NaN ray in a packet or stream must not disturb the finite rays next to it
+    CpuRayPacket packet{};
+    packet.origin       = origin;
+    packet.tmax         = INFINITY;
+    packet.size         = 2;
+    packet.direction[0] = glm::vec3(nan, nan, nan);
+    packet.direction[1] = down;
+    CpuHit packet_hits[CPU_MAX_PACKET_SIZE];
+    tlas.IntersectPacket(packet, packet_hits);
+    CHECK(packet_hits[0].t < 0);
+    CHECK(packet_hits[1].t == 5.0f);
+
+    std::vector<CpuRay> stream(std::begin(rays), std::end(rays));
+    stream.push_back(hit_ray);
+    std::vector<CpuHit> stream_hits(stream.size());
+    tlas.IntersectStream(stream, stream_hits.data());
+    for (size_t i = 0; i + 1 < stream.size(); i++)
+    {
+        CHECK(stream_hits[i].t < 0);
+    }
+    CHECK(stream_hits.back().t == 5.0f);
+}
+
+int main()
+{
+    CpuTlas tlas;
+    BuildQuadRow(&tlas, 24);
+
+    for (CpuSimdLevel level : {CPU_SIMD_SCALAR, CPU_SIMD_SSE, CPU_SIMD_AVX2})
+    {
+        g_cpu_simd_limit = level;
+        CheckNonFiniteRaysMiss(tlas);
+    }
+
+    if (g_failures > 0)
+        return 1;
+    printf("All CPU BVH checks passed\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+// Single-ray traversal of the 8-wide CPU BVHs in cpu_bvh.h, and the runtime choice between the scalar, SSE and AVX2
+// kernels of cpu_bvh_kernels.h. AVX2 comes from target attributes rather than per-file compiler flags, so nothing else
+// in the program needs AVX2 and the SSE path keeps working on older CPUs.
+#include "cpu_bvh_kernels.h"
+
+#include <algorithm>
+
+template<class Isa, class Counter = NoTraversalCounter>
+static bool IntersectTlas(const CpuTlas& tlas, const CpuRay& ray, CpuHit* hit, Counter counter = {})
+{
+    if (tlas.Nodes().empty() || !IsTraceableRay(ray.origin, ray.direction, ray.tmin))
+        return false;
+
+    const CpuTlasInstance* instances = tlas.Instances().data();
+    const CpuBlas*         blases    = tlas.Blases().data();
+    float                  tmax      = ray.tmax;
+    auto                   leaf      = [&](uint32_t first, uint32_t count) {
+        bool found = false;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            const CpuTlasInstance&   inst         = instances[i];
+            const CpuTriangleBlock4* blocks       = blases[inst.blas_idx].Blocks().data();
+            const TraversalRay       obj          = MakeObjectRay(inst, ray);
+            auto                     blas_counter = counter.Instance();
+            if (TraverseBvh8<Isa, false>(blases[inst.blas_idx].Nodes().data(), obj, &tmax, [&](uint32_t first_block, uint32_t num_blocks) {
+                    blas_counter.Triangles(blocks + first_block, num_blocks);
+                    glm::vec2 bary;
+                    const int lane = Isa::IntersectTriangles(blocks + first_block, num_blocks, obj, &tmax, &bary);
+                    if (lane < 0)
+                        return false;
+                    hit->t             = tmax;
+                    hit->primitive_idx = blocks[first_block + lane / 4].primitive_idx[lane % 4];
+                    hit->bary          = bary;
+                    return true;
+                },
+                blas_counter))
+            {
+                hit->instance_idx = inst.instance_idx;
+                found             = true;
+            }
+        }
+        return found;
+    };
+    return TraverseBvh8<Isa, false>(tlas.Nodes().data(), MakeTraversalRay(ray.origin, ray.direction, ray.tmin), &tmax, leaf, counter);
+}
+
+template<class Isa>
+static bool OccludedTlas(const CpuTlas& tlas, const CpuRay& ray)
+{
+    if (tlas.Nodes().empty() || !IsTraceableRay(ray.origin, ray.direction, ray.tmin))
+        return false;
+
+    const CpuTlasInstance* instances = tlas.Instances().data();
+    const CpuBlas*         blases    = tlas.Blases().data();
+    float                  tmax      = ray.tmax;
+    return TraverseBvh8<Isa, true>(tlas.Nodes().data(), MakeTraversalRay(ray.origin, ray.direction, ray.tmin), &tmax, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            const CpuTlasInstance&   inst   = instances[i];
+            const CpuTriangleBlock4* blocks = blases[inst.blas_idx].Blocks().data();
+            const TraversalRay       obj    = MakeObjectRay(inst, ray);
+            if (TraverseBvh8<Isa, true>(blases[inst.blas_idx].Nodes().data(), obj, &tmax, [&](uint32_t first_block, uint32_t num_blocks) {
+                    return Isa::AnyTriangle(blocks + first_block, num_blocks, obj, tmax);
+                }))
+                return true;
+        }
+        return false;
+    });
+}
+
+#if CPU_BVH_X86
+CPU_BVH_AVX2_ENTRY bool IntersectTlasAvx2(const CpuTlas& tlas, const CpuRay& ray, CpuHit* hit)
+{
+    return IntersectTlas<Avx2Isa>(tlas, ray, hit);
+}
+
+CPU_BVH_AVX2_ENTRY bool IntersectTlasCountedAvx2(const CpuTlas& tlas, const CpuRay& ray, CpuHit* hit, TraversalCounter counter)
+{
+    return IntersectTlas<Avx2Isa>(tlas, ray, hit, counter);
+}
+
+CPU_BVH_AVX2_ENTRY bool OccludedTlasAvx2(const CpuTlas& tlas, const CpuRay& ray)
+{
+    return OccludedTlas<Avx2Isa>(tlas, ray);
+}
+#endif
+
+static CpuSimdLevel DetectCpuSimdLevel()
+{
+#if !CPU_BVH_X86
+    return CPU_SIMD_SCALAR;
+#elif defined(_MSC_VER)
+    // AVX2 needs both the instructions and the OS saving the YMM registers
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return CPU_SIMD_SSE;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx     = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return CPU_SIMD_SSE;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) ? CPU_SIMD_AVX2 : CPU_SIMD_SSE;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? CPU_SIMD_AVX2 : CPU_SIMD_SSE;
+#endif
+}
+
+CpuSimdLevel GetCpuSimdLevel()
+{
+    static const CpuSimdLevel detected = DetectCpuSimdLevel();
+    return std::min(detected, g_cpu_simd_limit);
+}
+
+const char* GetCpuSimdLevelName(CpuSimdLevel level)
+{
+    switch (level)
+    {
+    case CPU_SIMD_SCALAR:
+        return "scalar";
+    case CPU_SIMD_SSE:
+        return "SSE";
+    case CPU_SIMD_AVX2:
+        return "AVX2";
+    }
+    return "unknown";
+}
+
+bool CpuTlas::Intersect(const CpuRay& ray, CpuHit* hit) const
+{
+    switch (GetCpuSimdLevel())
+    {
+#if CPU_BVH_X86
+    case CPU_SIMD_AVX2:
+        return IntersectTlasAvx2(*this, ray, hit);
+    case CPU_SIMD_SSE:
+        return IntersectTlas<SseIsa>(*this, ray, hit);
+#endif
+    default:
+        return IntersectTlas<ScalarIsa>(*this, ray, hit);
+    }
+}
+
+bool CpuTlas::Intersect(const CpuRay& ray, CpuHit* hit, CpuTraversalStats* stats, CpuTraversalObserver* observer) const
+{
+    const TraversalCounter counter{stats, observer};
+    switch (GetCpuSimdLevel())
+    {
+#if CPU_BVH_X86
+    case CPU_SIMD_AVX2:
+        return IntersectTlasCountedAvx2(*this, ray, hit, counter);
+    case CPU_SIMD_SSE:
+        return IntersectTlas<SseIsa>(*this, ray, hit, counter);
+#endif
+    default:
+        return IntersectTlas<ScalarIsa>(*this, ray, hit, counter);
+    }
+}
+
+bool CpuTlas::Occluded(const CpuRay& ray) const
+{
+    switch (GetCpuSimdLevel())
+    {
+#if CPU_BVH_X86
+    case CPU_SIMD_AVX2:
+        return OccludedTlasAvx2(*this, ray);
+    case CPU_SIMD_SSE:
+        return OccludedTlas<SseIsa>(*this, ray);
+#endif
+    default:
+        return OccludedTlas<ScalarIsa>(*this, ray);
+    }
+}
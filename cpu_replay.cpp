@@ -0,0 +1,318 @@
+#include "cpu_replay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "cpu_tracer.h"
+#include "profiler.h"
+
+CpuReplayRecord CpuReplayRay(const CpuTlas& tlas, const CpuRay& ray)
+{
+    CpuReplayRecord rec{-1, UINT32_MAX, UINT32_MAX, {}};
+    if (ray.direction == glm::vec3(0))
+        return rec;
+
+    CpuHit            hit;
+    CpuTraversalStats stats;
+    if (tlas.Intersect(ray, &hit, &stats))
+    {
+        rec.t             = hit.t;
+        rec.instance_idx  = hit.instance_idx;
+        rec.primitive_idx = hit.primitive_idx;
+    }
+    rec.stats = stats;
+    return rec;
+}
+
+bool WriteCpuReplayFile(const char*                      file_name,
+                        const glm::uvec3&                dispatch_dims,
+                        std::span<const uint32_t>        ray_idxes,
+                        std::span<const CpuReplayRecord> records)
+{
+    FILE* f = fopen(file_name, "wb");
+    if (!f)
+    {
+        printf("Could not open %s for writing\n", file_name);
+        return false;
+    }
+
+    CpuReplayFileHeader hdr{};
+    memcpy(hdr.magic, CPU_REPLAY_MAGIC, sizeof(CPU_REPLAY_MAGIC));
+    hdr.version          = CPU_REPLAY_VERSION;
+    hdr.record_size      = sizeof(CpuReplayRecord);
+    hdr.dispatch_dims[0] = dispatch_dims.x;
+    hdr.dispatch_dims[1] = dispatch_dims.y;
+    hdr.dispatch_dims[2] = dispatch_dims.z;
+    hdr.num_threads      = uint32_t(ray_idxes.size());
+    hdr.num_rays         = records.size();
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fwrite(ray_idxes.data(), sizeof(uint32_t), ray_idxes.size(), f);
+    fwrite(records.data(), sizeof(CpuReplayRecord), records.size(), f);
+
+    bool ok = ferror(f) == 0;
+    fclose(f);
+    return ok;
+}
+
+const char* GetCpuReplayCounterName(CpuReplayCounter counter)
+{
+    switch (counter)
+    {
+    case CPU_REPLAY_STEPS:
+        return "steps";
+    case CPU_REPLAY_NODE_VISITS:
+        return "nodes";
+    case CPU_REPLAY_TRIANGLE_TESTS:
+        return "triangles";
+    case CPU_REPLAY_INSTANCE_TRANSITIONS:
+        return "instances";
+    case CPU_REPLAY_MAX_STACK_DEPTH:
+        return "depth";
+    default:
+        return "unknown";
+    }
+}
+
+uint32_t GetCpuReplayCounter(const CpuReplayRecord& rec, CpuReplayCounter counter)
+{
+    switch (counter)
+    {
+    case CPU_REPLAY_STEPS:
+        return rec.stats.steps;
+    case CPU_REPLAY_NODE_VISITS:
+        return rec.stats.node_visits;
+    case CPU_REPLAY_TRIANGLE_TESTS:
+        return rec.stats.triangle_tests;
+    case CPU_REPLAY_INSTANCE_TRANSITIONS:
+        return rec.stats.instance_transitions;
+    case CPU_REPLAY_MAX_STACK_DEPTH:
+        return rec.stats.max_stack_depth;
+    default:
+        return 0;
+    }
+}
+
+CpuReplayHistogram ComputeCpuReplayHistogram(std::span<const CpuReplayRecord> records, CpuReplayCounter counter, uint32_t num_bins)
+{
+    RRA_PROFILE_SCOPE("ComputeCpuReplayHistogram");
+    CpuReplayHistogram h;
+    h.bins.assign(std::max(1U, num_bins), 0);
+    const size_t n = records.size();
+    if (n == 0)
+        return h;
+
+    // Pass 1: the counter of every ray, with per-worker sums and maxima
+    const uint32_t        num_workers = GetNumWorkerThreads();
+    std::vector<uint32_t> values(n);
+    std::vector<uint64_t> worker_sum(num_workers, 0);
+    std::vector<uint32_t> worker_max(num_workers, 0);
+    ParallelForChunks(
+        n,
+        [&](uint32_t w, size_t begin, size_t end) {
+            uint64_t sum = 0;
+            uint32_t mx  = 0;
+            for (size_t i = begin; i < end; i++)
+            {
+                values[i] = GetCpuReplayCounter(records[i], counter);
+                sum += values[i];
+                mx = std::max(mx, values[i]);
+            }
+            worker_sum[w] = sum;
+            worker_max[w] = mx;
+        },
+        num_workers);
+    uint64_t sum = 0;
+    for (uint32_t w = 0; w < num_workers; w++)
+    {
+        sum += worker_sum[w];
+        h.max = std::max(h.max, worker_max[w]);
+    }
+    h.mean = double(sum) / n;
+
+    // Pass 2: per-worker bins
+    const uint32_t nb = uint32_t(h.bins.size());
+    h.bin_width       = h.max / nb + 1;
+
+    std::vector<uint64_t> worker_bins(size_t(num_workers) * nb, 0);
+    ParallelForChunks(
+        n,
+        [&](uint32_t w, size_t begin, size_t end) {
+            uint64_t* bins = &worker_bins[size_t(w) * nb];
+            for (size_t i = begin; i < end; i++)
+            {
+                bins[values[i] / h.bin_width]++;
+            }
+        },
+        num_workers);
+    for (size_t i = 0; i < worker_bins.size(); i++)
+    {
+        h.bins[i % nb] += worker_bins[i];
+    }
+
+    // Nearest-rank percentiles. Each selection only reorders the part above the previous one.
+    auto percentile = [&](size_t lo, double p) {
+        const size_t k = std::max<size_t>(size_t(std::ceil(p * n)), 1) - 1;
+        std::nth_element(values.begin() + lo, values.begin() + k, values.end());
+        return k;
+    };
+    size_t k = percentile(0, 0.50);
+    h.p50    = values[k];
+    k        = percentile(k, 0.95);
+    h.p95    = values[k];
+    k        = percentile(k, 0.99);
+    h.p99    = values[k];
+    return h;
+}
+
+bool WriteCpuReplayHeatmap(const char*                      file_name,
+                           const glm::uvec3&                dispatch_dims,
+                           std::span<const uint32_t>        ray_idxes,
+                           std::span<const CpuReplayRecord> records,
+                           CpuReplayCounter                 counter)
+{
+    const uint32_t w = dispatch_dims.x, h = dispatch_dims.y;
+    if (uint64_t(w) * h * dispatch_dims.z != ray_idxes.size() || w == 0 || h == 0)
+    {
+        printf("The dispatch (%u,%u,%u) does not match its %zu thread offsets\n", w, h, dispatch_dims.z, ray_idxes.size());
+        return false;
+    }
+
+    std::vector<uint64_t> pixels(size_t(w) * h, 0);
+    ParallelForDynamic(h, 1, [&](uint32_t, size_t y) {
+        for (uint32_t z = 0; z < dispatch_dims.z; z++)
+        {
+            for (uint32_t x = 0; x < w; x++)
+            {
+                const size_t   t  = x + size_t(w) * (y + size_t(h) * z);
+                const uint32_t lb = (t == 0) ? 0 : ray_idxes[t - 1];
+                for (uint32_t i = lb; i < ray_idxes[t] && i < records.size(); i++)
+                {
+                    pixels[y * w + x] += GetCpuReplayCounter(records[i], counter);
+                }
+            }
+        }
+    });
+
+    // Scale to the 99th percentile pixel so a few pathological pixels do not wash out the rest
+    std::vector<uint64_t> sorted = pixels;
+    const size_t          k      = sorted.size() * 99 / 100;
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    const double scale = double(std::max<uint64_t>(1, sorted[k]));
+
+    const glm::vec3 ramp[] = {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}};
+    const int       last   = int(std::size(ramp)) - 1;
+
+    std::vector<glm::vec4> colors(pixels.size());
+    ParallelForChunks(pixels.size(), [&](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            const float x = float(std::min(1.0, pixels[i] / scale)) * last;
+            const int   j = std::min(int(x), last - 1);
+            colors[i]     = glm::vec4(glm::mix(ramp[j], ramp[j + 1], x - j), 1);
+        }
+    });
+    return WriteBMP(file_name, w, h, colors);
+}
+
+// Collects the cache lines a traversal reads
+class CacheLineObserver final : public CpuTraversalObserver
+{
+public:
+    std::vector<uintptr_t> lines;
+    uint64_t               num_reads{};
+
+    void Touch(const void* data, size_t bytes) override
+    {
+        const uintptr_t first = uintptr_t(data) / CPU_REPLAY_CACHE_LINE;
+        const uintptr_t last  = (uintptr_t(data) + bytes - 1) / CPU_REPLAY_CACHE_LINE;
+        for (uintptr_t line = first; line <= last; line++)
+        {
+            lines.push_back(line);
+        }
+        num_reads += last - first + 1;
+    }
+};
+
+CpuReplayOrderScore ScoreCpuReplayOrder(const CpuTlas& tlas, std::span<const CpuRay> rays, std::span<const uint32_t> order)
+{
+    RRA_PROFILE_SCOPE("ScoreCpuReplayOrder");
+    CpuReplayOrderScore score;
+    const size_t        n = std::min(rays.size(), order.size());
+    if (n == 0)
+        return score;
+
+    // Counted pass, one warp at a time
+    struct WorkerSums
+    {
+        uint64_t cost{}, warp_cost{}, num_rays{}, lines{}, reads{};
+    };
+    const uint32_t                 num_workers = GetNumWorkerThreads();
+    const size_t                   num_warps   = (n + CPU_REPLAY_WARP_SIZE - 1) / CPU_REPLAY_WARP_SIZE;
+    std::vector<WorkerSums>        sums(num_workers);
+    std::vector<CacheLineObserver> observers(num_workers);
+    ParallelForDynamic(
+        num_warps,
+        16,
+        [&](uint32_t w, size_t warp) {
+            CacheLineObserver& observer = observers[w];
+            observer.lines.clear();
+            observer.num_reads = 0;
+
+            const size_t first = warp * CPU_REPLAY_WARP_SIZE;
+            const size_t last  = std::min(first + CPU_REPLAY_WARP_SIZE, n);
+            uint64_t     cost = 0, max_cost = 0, num_rays = 0;
+            for (size_t i = first; i < last; i++)
+            {
+                const CpuRay& ray = rays[order[i]];
+                if (ray.direction == glm::vec3(0))
+                    continue;
+                CpuHit            hit;
+                CpuTraversalStats stats;
+                tlas.Intersect(ray, &hit, &stats, &observer);
+                const uint64_t c = stats.node_visits + stats.triangle_tests;
+                cost += c;
+                max_cost = std::max(max_cost, c);
+                num_rays++;
+            }
+            std::sort(observer.lines.begin(), observer.lines.end());
+            sums[w].lines += std::unique(observer.lines.begin(), observer.lines.end()) - observer.lines.begin();
+            sums[w].reads += observer.num_reads;
+            sums[w].cost += cost;
+            sums[w].warp_cost += max_cost * (last - first);
+            sums[w].num_rays += num_rays;
+        },
+        num_workers);
+
+    WorkerSums total;
+    for (const WorkerSums& s : sums)
+    {
+        total.cost += s.cost;
+        total.warp_cost += s.warp_cost;
+        total.num_rays += s.num_rays;
+        total.lines += s.lines;
+        total.reads += s.reads;
+    }
+    score.mean_cost        = total.num_rays ? double(total.cost) / total.num_rays : 0;
+    score.simd_efficiency  = total.warp_cost ? double(total.cost) / total.warp_cost : 0;
+    score.cache_line_reuse = total.reads ? 1.0 - double(total.lines) / total.reads : 0;
+
+    // Timed pass without counters
+    using Clock          = std::chrono::steady_clock;
+    Clock::time_point t0 = Clock::now();
+    ParallelForChunks(n, [&](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            const CpuRay& ray = rays[order[i]];
+            CpuHit        hit;
+            if (ray.direction != glm::vec3(0))
+                tlas.Intersect(ray, &hit);
+        }
+    });
+    const double seconds   = std::chrono::duration<double>(Clock::now() - t0).count();
+    score.mrays_per_second = seconds > 0 ? total.num_rays / seconds * 1e-6 : 0;
+    return score;
+}
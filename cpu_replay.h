@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cpu_bvh.h"
+#include "parallel.h"
+#include "profiler.h"
+
+// Headless replay of captured rays (a DispatchRaysInfo from an RRA trace or a PIX dump) against the CPU BVH of the
+// capture, so the traversal cost of real game workloads can be studied offline.
+
+// One record per replayed ray, 32 bytes, in the same order as the replayed rays
+struct CpuReplayRecord
+{
+    float             t;              // -1 on a miss
+    uint32_t          instance_idx;   // UINT32_MAX on a miss
+    uint32_t          primitive_idx;  // UINT32_MAX on a miss
+    CpuTraversalStats stats;
+};
+static_assert(sizeof(CpuReplayRecord) == 32);
+
+// A replay file is a CpuReplayFileHeader, then num_threads uint32_t end offsets into the records of every dispatch
+// thread (thread z, y, x order, like DispatchRaysInfo::ray_idxes), then num_rays CpuReplayRecords. Little endian.
+constexpr char     CPU_REPLAY_MAGIC[8] = {'R', 'R', 'A', 'R', 'P', 'L', 'Y', '\0'};
+constexpr uint32_t CPU_REPLAY_VERSION  = 2;
+
+struct CpuReplayFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;  // sizeof(CpuReplayRecord)
+    uint32_t dispatch_dims[3];
+    uint32_t num_threads;
+    uint64_t num_rays;
+};
+static_assert(sizeof(CpuReplayFileHeader) == 40);
+
+// Closest hit of one ray, with its traversal counters. Rays without a direction count as misses without any work.
+CpuReplayRecord CpuReplayRay(const CpuTlas& tlas, const CpuRay& ray);
+
+// Replays get_ray(i) -> CpuRay for i in [0, records.size()) on the worker threads
+template<class GetRay>
+void CpuReplayRays(const CpuTlas& tlas, std::span<CpuReplayRecord> records, GetRay&& get_ray)
+{
+    RRA_PROFILE_SCOPE_ARG("CpuReplayRays", records.size());
+    constexpr size_t REPLAY_GRAIN = 256;  // Neighboring rays of a capture tend to be coherent, keep them together
+    ParallelForDynamic(records.size(), REPLAY_GRAIN, [&](uint32_t, size_t i) { records[i] = CpuReplayRay(tlas, get_ray(i)); });
+}
+
+bool WriteCpuReplayFile(const char*                      file_name,
+                        const glm::uvec3&                dispatch_dims,
+                        std::span<const uint32_t>        ray_idxes,
+                        std::span<const CpuReplayRecord> records);
+
+// The per-ray counters of CpuTraversalStats, for the aggregates below
+enum CpuReplayCounter
+{
+    CPU_REPLAY_STEPS,
+    CPU_REPLAY_NODE_VISITS,
+    CPU_REPLAY_TRIANGLE_TESTS,
+    CPU_REPLAY_INSTANCE_TRANSITIONS,
+    CPU_REPLAY_MAX_STACK_DEPTH,
+    CPU_REPLAY_NUM_COUNTERS,
+};
+const char* GetCpuReplayCounterName(CpuReplayCounter counter);
+uint32_t    GetCpuReplayCounter(const CpuReplayRecord& rec, CpuReplayCounter counter);
+
+// Distribution of one counter over the rays of a dispatch. The percentiles are exact; the histogram has
+// bins.size() bins of bin_width values each, starting at 0.
+struct CpuReplayHistogram
+{
+    double                mean{};
+    uint32_t              p50{}, p95{}, p99{}, max{};
+    uint32_t              bin_width{1};
+    std::vector<uint64_t> bins;
+};
+CpuReplayHistogram ComputeCpuReplayHistogram(std::span<const CpuReplayRecord> records, CpuReplayCounter counter, uint32_t num_bins = 32);
+
+// Writes a BMP of dispatch_dims.x x dispatch_dims.y pixels showing the counter summed over the rays of every
+// dispatch thread (and over z). The color ramp goes from black at 0 to red at the 99th percentile pixel and beyond.
+bool WriteCpuReplayHeatmap(const char*                      file_name,
+                           const glm::uvec3&                dispatch_dims,
+                           std::span<const uint32_t>        ray_idxes,
+                           std::span<const CpuReplayRecord> records,
+                           CpuReplayCounter                 counter);
+
+// How well rays traced in a given order would share work on a GPU. Consecutive groups of CPU_REPLAY_WARP_SIZE rays
+// of the order stand in for warps; rays without a direction are skipped but keep their lane.
+constexpr uint32_t CPU_REPLAY_WARP_SIZE  = 32;
+constexpr uint32_t CPU_REPLAY_CACHE_LINE = 64;
+
+struct CpuReplayOrderScore
+{
+    double mean_cost{};         // Node visits plus triangle tests per traced ray
+    double simd_efficiency{};   // Sum of the cost of all rays over the sum of (warp size * costliest ray) of all warps
+    double cache_line_reuse{};  // 1 - distinct cache lines read per warp / cache lines read by its rays one by one
+    double mrays_per_second{};  // Closest-hit tracing in this order, each worker taking a contiguous part of it
+};
+
+// rays[p] is the ray of pixel p and order[i] the pixel traced i-th
+CpuReplayOrderScore ScoreCpuReplayOrder(const CpuTlas& tlas, std::span<const CpuRay> rays, std::span<const uint32_t> order);
@@ -0,0 +1,252 @@
+#include "cpu_tracer.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "parallel.h"
+#include "profiler.h"
+
+// Splits the image into tile_size x tile_size tiles and hands them out to the worker threads.
+// Tiles near the horizon cost far more than sky tiles, hence the dynamic schedule.
+template<class F>
+static void ForEachTile(const CpuRenderSettings& settings, F&& fn)
+{
+    const uint32_t ts      = std::max(1U, settings.tile_size);
+    const uint32_t tiles_x = (settings.width + ts - 1) / ts;
+    const uint32_t tiles_y = (settings.height + ts - 1) / ts;
+    ParallelForDynamic(size_t(tiles_x) * tiles_y, 1, [&](uint32_t, size_t tile) {
+        const uint32_t x0 = uint32_t(tile % tiles_x) * ts;
+        const uint32_t y0 = uint32_t(tile / tiles_x) * ts;
+        fn(x0, y0, std::min(x0 + ts, settings.width), std::min(y0 + ts, settings.height));
+    });
+}
+
+static glm::vec3 GetCameraRayDirection(const CpuRenderSettings& settings, uint32_t x, uint32_t y)
+{
+    glm::vec2 d = ((glm::vec2(float(x), float(y)) + 0.5f) / glm::vec2(float(settings.width), float(settings.height))) * 2.f - 1.f;
+    if (settings.invert_y)
+        d.y *= -1;
+    glm::vec3 target = TransformPosition(settings.inverse_proj, glm::vec3(d.x, -d.y, 1));
+    return TransformDirection(settings.inverse_view, glm::normalize(target));
+}
+
+void CpuScene::Build(const BlasGeometrySpans& blas_geom, std::span<const InstanceInfo> insts)
+{
+    RRA_PROFILE_SCOPE("CpuScene::Build");
+    blas_geometry = blas_geom;
+    instances     = insts;
+    tlas.Build(blas_geometry, instances);
+}
+
+glm::vec3 GetCpuHitNormal(const CpuScene& scene, const CpuHit& hit)
+{
+    const InstanceInfo& inst = scene.instances[hit.instance_idx];
+    const BlasGeometry& geom = scene.blas_geometry[inst.blas_idx];
+    const glm::vec3&    v0   = geom.Vertex(hit.primitive_idx, 0);
+    const glm::vec3&    v1   = geom.Vertex(hit.primitive_idx, 1);
+    const glm::vec3&    v2   = geom.Vertex(hit.primitive_idx, 2);
+    glm::vec3           n    = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+    return TransformInstanceDirection(inst.transform, n);  // Not re-normalized, same as the shader
+}
+
+const char* GetCpuTraceModeName(CpuTraceMode mode)
+{
+    switch (mode)
+    {
+    case CPU_TRACE_SINGLE:
+        return "single";
+    case CPU_TRACE_PACKET8:
+        return "packet8";
+    case CPU_TRACE_PACKET16:
+        return "packet16";
+    case CPU_TRACE_STREAM:
+        return "stream";
+    }
+    return "unknown";
+}
+
+void CpuTracePrimary(const CpuScene& scene, const CpuRenderSettings& settings, std::vector<glm::vec4>* hit_normal_and_t, std::vector<glm::vec4>* normal_colors)
+{
+    RRA_PROFILE_SCOPE("CpuTracePrimary");
+    const size_t num_pixels = size_t(settings.width) * settings.height;
+    hit_normal_and_t->assign(num_pixels, glm::vec4(0, 0, 0, -1));
+    if (normal_colors)
+        normal_colors->assign(num_pixels, glm::vec4(0, 0, 0, 1));
+
+    const glm::vec3 origin = TransformPosition(settings.inverse_view, glm::vec3(0, 0, 0));
+    auto            shade  = [&](uint32_t x, uint32_t y, const glm::vec3& dir, const CpuHit& hit) {
+        const size_t idx = x + size_t(y) * settings.width;
+        if (hit.t >= 0)
+        {
+            glm::vec3 n = GetCpuHitNormal(scene, hit);
+            if (normal_colors)
+                (*normal_colors)[idx] = glm::vec4((n + 1.0f) / 2.0f, 1);
+            if (glm::dot(n, dir) > 0)
+                n *= -1;
+            (*hit_normal_and_t)[idx] = glm::vec4(n, hit.t - 0.001f);
+        }
+        else if (normal_colors)
+        {
+            // Miss shader of primaryray.hlsl: vertical gradient
+            const float v         = float(y) / settings.height;
+            const float c         = 0.9f + (0.3f - 0.9f) * v;
+            (*normal_colors)[idx] = glm::vec4(c, c, 0.9f, 1);
+        }
+    };
+
+    ForEachTile(settings, [&](uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+        switch (settings.trace_mode)
+        {
+        case CPU_TRACE_SINGLE:
+            for (uint32_t y = y0; y < y1; y++)
+            {
+                for (uint32_t x = x0; x < x1; x++)
+                {
+                    CpuRay ray{origin, 0.001f, GetCameraRayDirection(settings, x, y), 10000.0f};
+                    CpuHit hit;
+                    scene.tlas.Intersect(ray, &hit);
+                    shade(x, y, ray.direction, hit);
+                }
+            }
+            break;
+        case CPU_TRACE_PACKET8:
+        case CPU_TRACE_PACKET16:
+        {
+            const uint32_t pw = 4;
+            const uint32_t ph = settings.trace_mode == CPU_TRACE_PACKET8 ? 2 : 4;
+            for (uint32_t by = y0; by < y1; by += ph)
+            {
+                for (uint32_t bx = x0; bx < x1; bx += pw)
+                {
+                    CpuRayPacket packet;
+                    uint32_t     px[CPU_MAX_PACKET_SIZE], py[CPU_MAX_PACKET_SIZE];
+                    packet.origin = origin;
+                    packet.tmin   = 0.001f;
+                    packet.tmax   = 10000.0f;
+                    packet.size   = 0;
+                    for (uint32_t y = by; y < std::min(by + ph, y1); y++)
+                    {
+                        for (uint32_t x = bx; x < std::min(bx + pw, x1); x++)
+                        {
+                            px[packet.size]                 = x;
+                            py[packet.size]                 = y;
+                            packet.direction[packet.size++] = GetCameraRayDirection(settings, x, y);
+                        }
+                    }
+                    CpuHit hits[CPU_MAX_PACKET_SIZE];
+                    scene.tlas.IntersectPacket(packet, hits);
+                    for (uint32_t i = 0; i < packet.size; i++)
+                    {
+                        shade(px[i], py[i], packet.direction[i], hits[i]);
+                    }
+                }
+            }
+            break;
+        }
+        case CPU_TRACE_STREAM:
+        {
+            thread_local std::vector<CpuRay> rays;
+            thread_local std::vector<CpuHit> hits;
+            rays.clear();
+            for (uint32_t y = y0; y < y1; y++)
+            {
+                for (uint32_t x = x0; x < x1; x++)
+                {
+                    rays.push_back({origin, 0.001f, GetCameraRayDirection(settings, x, y), 10000.0f});
+                }
+            }
+            hits.resize(rays.size());
+            scene.tlas.IntersectStream(rays, hits.data());
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                shade(x0 + uint32_t(i % (x1 - x0)), y0 + uint32_t(i / (x1 - x0)), rays[i].direction, hits[i]);
+            }
+            break;
+        }
+        }
+    });
+}
+
+void CpuTraceAO(const CpuScene& scene, const CpuRenderSettings& settings, const std::vector<glm::vec4>& hit_normal_and_t, std::vector<glm::vec4>* colors)
+{
+    RRA_PROFILE_SCOPE("CpuTraceAO");
+    colors->assign(size_t(settings.width) * settings.height, glm::vec4(1, 1, 1, 1));
+
+    const glm::vec3 origin = TransformPosition(settings.inverse_view, glm::vec3(0, 0, 0));
+    ForEachTile(settings, [&](uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+        for (uint32_t y = y0; y < y1; y++)
+        {
+            for (uint32_t x = x0; x < x1; x++)
+            {
+                const size_t     idx = x + size_t(y) * settings.width;
+                const glm::vec4& nt  = hit_normal_and_t[idx];
+                if (nt.w < 0)
+                    continue;
+
+                const glm::vec3 n   = glm::vec3(nt);
+                const glm::vec3 dir = GetCameraRayDirection(settings, x, y);
+                CpuRay          ray{origin + dir * nt.w, 0.001f, {}, settings.ao_radius};
+
+                int ao = 0;
+                for (int i = 0; i < settings.ao_samples; i++)
+                {
+                    int seed      = int(TEA(uint32_t(idx), i, 16).x);
+                    ray.direction = SampleHemisphereCosine(n, seed);
+                    if (scene.tlas.Occluded(ray))
+                        ao++;
+                }
+
+                const float ao_occ = (1.0f - (ao * 1.0f / std::max(1, settings.ao_samples))) * 0.8f + 0.2f;
+                (*colors)[idx]     = glm::vec4(ao_occ, ao_occ, ao_occ, 1);
+            }
+        }
+    });
+}
+
+bool WriteBMP(const char* file_name, uint32_t width, uint32_t height, const std::vector<glm::vec4>& colors)
+{
+    FILE* f = fopen(file_name, "wb");
+    if (!f)
+    {
+        printf("Could not open %s for writing\n", file_name);
+        return false;
+    }
+
+    const uint32_t row_bytes  = (width * 3 + 3) & ~3U;
+    const uint32_t image_size = row_bytes * height;
+    uint8_t        header[54]{};
+    auto           put32 = [&](int ofst, uint32_t v) {
+        for (int i = 0; i < 4; i++)
+            header[ofst + i] = uint8_t(v >> (8 * i));
+    };
+    header[0] = 'B';
+    header[1] = 'M';
+    put32(2, 54 + image_size);
+    put32(10, 54);
+    put32(14, 40);
+    put32(18, width);
+    put32(22, height);
+    header[26] = 1;
+    header[28] = 24;
+    put32(34, image_size);
+    fwrite(header, 1, sizeof(header), f);
+
+    // BMP rows are stored bottom-up in BGR order
+    std::vector<uint8_t> row(row_bytes, 0);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const glm::vec4* src = &colors[size_t(height - 1 - y) * width];
+        for (uint32_t x = 0; x < width; x++)
+        {
+            glm::vec3 c        = glm::clamp(glm::vec3(src[x]), 0.0f, 1.0f) * 255.0f + 0.5f;
+            row[x * 3 + 0]     = uint8_t(c.z);
+            row[x * 3 + 1]     = uint8_t(c.y);
+            row[x * 3 + 2]     = uint8_t(c.x);
+        }
+        fwrite(row.data(), 1, row_bytes, f);
+    }
+    bool ok = ferror(f) == 0;
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cpu_bvh.h"
+#include "rt_common.h"
+
+// CPU replay of the AO pipeline in shaders/aoray.hlsl, for machines without a DXR-capable GPU.
+// The scene references geometry owned by the caller (std::vectors or a mapped .rrageo file).
+struct CpuScene
+{
+    BlasGeometrySpans             blas_geometry;
+    std::span<const InstanceInfo> instances;
+    CpuTlas                       tlas;
+
+    void Build(const BlasGeometrySpans& blas_geom, std::span<const InstanceInfo> insts);
+};
+
+// How CpuTracePrimary traces the camera rays. AO rays are always traced one at a time.
+enum CpuTraceMode
+{
+    CPU_TRACE_SINGLE,
+    CPU_TRACE_PACKET8,   // 4x2 pixel packets
+    CPU_TRACE_PACKET16,  // 4x4 pixel packets
+    CPU_TRACE_STREAM,    // One stream per tile
+};
+const char* GetCpuTraceModeName(CpuTraceMode mode);
+
+// Same inputs as RayGenCB
+struct CpuRenderSettings
+{
+    uint32_t     width{1280};
+    uint32_t     height{720};
+    glm::mat4    inverse_view{1.0f};
+    glm::mat4    inverse_proj{1.0f};
+    bool         invert_y{false};
+    int          ao_samples{1};
+    float        ao_radius{10000};
+    uint32_t     tile_size{16};  // Pixels per side of one unit of work
+    CpuTraceMode trace_mode{CPU_TRACE_SINGLE};
+};
+
+// World-space geometric normal at a hit, computed like ClosestHit_primary (object normal times ObjectToWorld3x4)
+glm::vec3 GetCpuHitNormal(const CpuScene& scene, const CpuHit& hit);
+
+// RayGen_primary + ClosestHit_primary: one float4(normal facing the ray, t - 0.001) per pixel.
+// Pixels that miss get t = -1.
+// If normal_colors is not null, it also receives the normal visualization from shaders/primaryray.hlsl.
+void CpuTracePrimary(const CpuScene& scene, const CpuRenderSettings& settings, std::vector<glm::vec4>* hit_normal_and_t, std::vector<glm::vec4>* normal_colors = nullptr);
+
+// RayGen_ao without ray binning. Pixels whose primary ray missed come out unoccluded.
+void CpuTraceAO(const CpuScene& scene, const CpuRenderSettings& settings, const std::vector<glm::vec4>& hit_normal_and_t, std::vector<glm::vec4>* colors);
+
+// Writes an uncompressed 24-bit BMP; colors are clamped to [0, 1]
+bool WriteBMP(const char* file_name, uint32_t width, uint32_t height, const std::vector<glm::vec4>& colors);
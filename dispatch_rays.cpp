@@ -0,0 +1,207 @@
+#include "dispatch_rays.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <bit>
+
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "radix_sort.h"
+
+// The dump is memory-mapped and the rays are gathered in dispatch order straight from the mapped records,
+// so the only large allocations are the output arrays themselves and one 8-byte sort key per ray.
+// Every pass runs on the worker threads; the sort is a linear-time radix sort on the thread index.
+bool ReadPixBufferDump(const char* filename, const RayStorageFormat& format, DispatchRaysInfo* out)
+{
+    RRA_PROFILE_SCOPE("ReadPixBufferDump");
+    DispatchRaysInfo dri{};
+
+    printf("Will read a pix buffer dump, named %s\n", filename);
+    MappedFile f;
+    if (!f.Open(filename))
+    {
+        printf("Oh! file %s is not good.\n", filename);
+        return false;
+    }
+    printf("File size: %llu\n", (unsigned long long)f.Size());
+
+    struct RayInPixBufferDump
+    {
+        uint32_t   type;
+        glm::uvec3 dispatch_rays_idx;
+        glm::vec3 origin;
+        glm::vec3 direction;
+        float     tmin;
+        float     tcurrent;
+        uint32_t   ray_flags;
+    };
+    static_assert(sizeof(RayInPixBufferDump) == 52);
+
+    const uint64_t num_records = f.Size() / sizeof(RayInPixBufferDump);
+    if (f.Size() % sizeof(RayInPixBufferDump) != 0)
+    {
+        printf("Warning: %s is not a whole number of %zu-byte records, ignoring the last %llu bytes\n",
+               filename,
+               sizeof(RayInPixBufferDump),
+               (unsigned long long)(f.Size() % sizeof(RayInPixBufferDump)));
+    }
+    if (num_records == 0 || num_records > UINT32_MAX)
+    {
+        printf("Oh! %s holds %llu rays, expected between 1 and %u.\n", filename, (unsigned long long)num_records, UINT32_MAX);
+        return false;
+    }
+    const uint32_t            num_rays = uint32_t(num_records);
+    const RayInPixBufferDump* records  = reinterpret_cast<const RayInPixBufferDump*>(f.Data());
+
+    // Pass 1: dispatch dimensions. An index of UINT32_MAX would wrap the dimension to 0, so such records are rejected.
+    const uint32_t          num_workers = GetNumWorkerThreads();
+    std::vector<glm::uvec3> worker_dims(num_workers, glm::uvec3(0));
+    std::vector<uint32_t>   worker_bad_record(num_workers, UINT32_MAX);
+    ParallelForChunks(
+        num_rays,
+        [&](uint32_t w, size_t begin, size_t end) {
+            glm::uvec3 dims(0);
+            for (size_t i = begin; i < end; i++)
+            {
+                const glm::uvec3& idx = records[i].dispatch_rays_idx;
+                if (idx.x == UINT32_MAX || idx.y == UINT32_MAX || idx.z == UINT32_MAX)
+                {
+                    worker_bad_record[w] = std::min(worker_bad_record[w], uint32_t(i));
+                    continue;
+                }
+                dims = glm::max(dims, idx + 1U);
+            }
+            worker_dims[w] = dims;
+        },
+        num_workers);
+    const uint32_t bad_record = *std::min_element(worker_bad_record.begin(), worker_bad_record.end());
+    if (bad_record != UINT32_MAX)
+    {
+        const glm::uvec3& idx = records[bad_record].dispatch_rays_idx;
+        printf("Oh! Ray %u of %s has the invalid dispatch index (%u,%u,%u).\n", bad_record, filename, idx.x, idx.y, idx.z);
+        return false;
+    }
+    for (const glm::uvec3& dims : worker_dims)
+    {
+        dri.dispatch_dims = glm::max(dri.dispatch_dims, dims);
+    }
+    const uint64_t num_threads = uint64_t(dri.dispatch_dims.x) * dri.dispatch_dims.y * dri.dispatch_dims.z;
+    if (num_threads == 0 || num_threads > UINT32_MAX)
+    {
+        printf("Oh! Dispatch dimension (%u,%u,%u) of %s is too large.\n", dri.dispatch_dims.x, dri.dispatch_dims.y, dri.dispatch_dims.z, filename);
+        return false;
+    }
+
+    // Pass 2: sort by linearized thread index (z, then y, then x). The record index sits in the low bits and the
+    // radix sort is stable, so rays of the same thread keep the order they were traced in.
+    const glm::uvec3      dims = dri.dispatch_dims;
+    std::vector<uint64_t> keys(num_rays);
+    std::vector<uint8_t>  worker_out_of_range(num_workers, 0);
+    ParallelForChunks(
+        num_rays,
+        [&](uint32_t w, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                const glm::uvec3& idx    = records[i].dispatch_rays_idx;
+                uint64_t          linear = idx.x + uint64_t(dims.x) * (idx.y + uint64_t(dims.y) * idx.z);
+                worker_out_of_range[w] |= linear >= num_threads;
+                keys[i] = (linear << 32) | i;
+            }
+        },
+        num_workers);
+    // Cannot happen with the dimensions of pass 1, but ray_idxes below is indexed with it
+    if (std::find(worker_out_of_range.begin(), worker_out_of_range.end(), 1) != worker_out_of_range.end())
+    {
+        printf("Oh! %s has rays outside of its dispatch (%u,%u,%u).\n", filename, dims.x, dims.y, dims.z);
+        return false;
+    }
+    ParallelRadixSort(keys, 32, 32 + std::bit_width(num_threads - 1), num_workers);
+
+    // Pass 3: gather the sorted rays, and record the end offset of every thread that traced rays
+    dri.rays.Reset(num_rays, format);
+    dri.ray_idxes.assign(num_threads, 0);
+    std::vector<RayStorageError> errors(num_workers);
+    ParallelForChunks(
+        num_rays,
+        [&](uint32_t w, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                const RayInPixBufferDump& r = records[uint32_t(keys[i])];
+                RayInPixDumpFileMinimal   r1;
+                r1.origin    = r.origin;
+                r1.direction = r.direction;
+                r1.tcurrent  = r.tcurrent;
+                r1.tmin      = r.tmin;
+                dri.rays.Set(i, r1, &errors[w]);
+
+                const uint64_t thread_idx = keys[i] >> 32;
+                if (i + 1 == num_rays || (keys[i + 1] >> 32) != thread_idx)
+                {
+                    dri.ray_idxes[thread_idx] = uint32_t(i + 1);
+                }
+            }
+        },
+        num_workers);
+    // Threads without rays end where the previous thread ended
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+        dri.ray_idxes[t] = std::max(dri.ray_idxes[t], dri.ray_idxes[t - 1]);
+    }
+    dri.num_invocations = num_rays;
+
+    char buf[100];
+    snprintf(buf, sizeof(buf), "PixDump (%u,%u,%u)", dri.dispatch_dims.x, dri.dispatch_dims.y, dri.dispatch_dims.z);
+    dri.name = std::string(buf);
+
+    printf("Read %zu rays\n", dri.rays.Size());
+    PrintRayStorageReport(&dri, errors);
+    ComputeDispatchRaysCoherence(&dri);
+    *out = std::move(dri);
+    return true;
+}
+
+void PrintRayStorageReport(const DispatchRaysInfo* dri, std::span<const RayStorageError> errors)
+{
+    const RayStorageFormat& format = dri->rays.Format();
+    const size_t            n      = dri->rays.Size();
+    printf("  %s: %zu rays in %.1f MB (%.1f MB as floats)\n",
+           dri->name.c_str(),
+           n,
+           dri->rays.MemoryBytes() / (1024.0 * 1024.0),
+           n * sizeof(RayInPixDumpFileMinimal) / (1024.0 * 1024.0));
+    if (!format.oct_directions && !format.quantize_origins)
+        return;
+
+    RayStorageError e;
+    for (const RayStorageError& w : errors)
+    {
+        e.Add(w);
+    }
+    const double inv_n = e.num_rays ? 1.0 / double(e.num_rays) : 0.0;
+    printf("    direction error mean/max %.4f/%.4f deg, origin error mean/max %g/%g\n",
+           e.sum_angle * inv_n,
+           e.max_angle,
+           e.sum_origin * inv_n,
+           e.max_origin);
+    if (e.num_rescaled > 0)
+        printf("    %llu non-unit directions normalized, their t ranges rescaled\n", (unsigned long long)e.num_rescaled);
+    if (e.num_clamped > 0)
+        printf("    %llu origins outside the scene bounds clamped to them\n", (unsigned long long)e.num_clamped);
+}
+
+void ComputeDispatchRaysCoherence(DispatchRaysInfo* dri)
+{
+    RRA_PROFILE_SCOPE("ComputeDispatchRaysCoherence");
+    dri->coherence        = ComputeRayCoherence(dri->dispatch_dims, dri->ray_idxes, dri->rays);
+    const RayCoherence& c = dri->coherence;
+    printf("  %s: %.1f/%.1f deg within 8x8/32x32 tiles, origin spread %g/%g, %.2f bits of direction entropy, %.0f%% of a warp shares a bin\n",
+           dri->name.c_str(),
+           c.tile_angular_deviation[0],
+           c.tile_angular_deviation[1],
+           c.tile_origin_spread[0],
+           c.tile_origin_spread[1],
+           c.direction_entropy,
+           c.warp_shared_bin_fraction * 100);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_coherence.h"
+#include "ray_storage.h"
+
+// The rays of one DispatchRays call, from a PIX dump or an RRA trace. The rays of thread t (z, y, x order) are
+// rays[ray_idxes[t - 1], ray_idxes[t]).
+struct DispatchRaysInfo
+{
+    RayStorage            rays;
+    std::vector<uint32_t> ray_idxes;
+    glm::uvec3            dispatch_dims;
+    std::string           name;
+    uint32_t              num_invocations{};
+    RayCoherence          coherence;  // Computed the first time the rays are resident
+
+    // Dispatches from an RRA trace are loaded as metadata only (dims, name, ray count) and their rays are decoded
+    // when first selected. Those can be evicted again; rays from a PIX dump stay resident.
+    int32_t  rra_dispatch_idx{-1};
+    bool     resident{true};
+    uint64_t last_used{0};
+};
+
+// Reads a buffer dumped from PIX's "DXR Invocation" tab into *dri, storing the rays in the given format.
+// Returns false, after printing why, if the file cannot be read or does not hold a usable dispatch.
+bool ReadPixBufferDump(const char* filename, const RayStorageFormat& format, DispatchRaysInfo* dri);
+
+// Memory of the rays of dri and, for the lossy formats, what was lost. errors holds one entry per worker thread.
+void PrintRayStorageReport(const DispatchRaysInfo* dri, std::span<const RayStorageError> errors);
+
+// Fills dri->coherence from the resident rays of dri and prints it
+void ComputeDispatchRaysCoherence(DispatchRaysInfo* dri);
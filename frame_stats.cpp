@@ -0,0 +1,112 @@
+#include "frame_stats.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+constexpr uint32_t SUB_BUCKET_COUNT = 1U << DurationHistogram::SUB_BUCKET_BITS;
+constexpr uint32_t SUB_BUCKET_HALF  = SUB_BUCKET_COUNT / 2;
+constexpr uint32_t NUM_BUCKETS      = SUB_BUCKET_COUNT + (DurationHistogram::MAX_VALUE_BITS - DurationHistogram::SUB_BUCKET_BITS) * SUB_BUCKET_HALF;
+
+DurationHistogram::DurationHistogram() : counts_(NUM_BUCKETS, 0)
+{
+}
+
+// Values below SUB_BUCKET_COUNT map to themselves. Above, a value with its top bit at e keeps its top
+// SUB_BUCKET_BITS bits: shift = e - (SUB_BUCKET_BITS - 1), and the bits m = v >> shift lie in [HALF, COUNT).
+uint32_t DurationHistogram::BucketIndex(uint64_t ns)
+{
+    ns = std::min(ns, (uint64_t(1) << MAX_VALUE_BITS) - 1);
+    if (ns < SUB_BUCKET_COUNT)
+        return uint32_t(ns);
+    const uint32_t e     = uint32_t(std::bit_width(ns)) - 1;
+    const uint32_t shift = e - (SUB_BUCKET_BITS - 1);
+    const uint32_t m     = uint32_t(ns >> shift);
+    return SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF + (m - SUB_BUCKET_HALF);
+}
+
+uint64_t DurationHistogram::BucketHighestValue(uint32_t idx)
+{
+    if (idx < SUB_BUCKET_COUNT)
+        return idx;
+    const uint32_t k     = idx - SUB_BUCKET_COUNT;
+    const uint32_t shift = k / SUB_BUCKET_HALF + 1;
+    const uint64_t m     = SUB_BUCKET_HALF + k % SUB_BUCKET_HALF;
+    return ((m + 1) << shift) - 1;
+}
+
+void DurationHistogram::Record(uint64_t ns)
+{
+    counts_[BucketIndex(ns)]++;
+    count_++;
+    sum_ += ns;
+    min_ = std::min(min_, ns);
+    max_ = std::max(max_, ns);
+}
+
+void DurationHistogram::Reset()
+{
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = 0;
+    sum_   = 0;
+    min_   = UINT64_MAX;
+    max_   = 0;
+}
+
+uint64_t DurationHistogram::Percentile(double p) const
+{
+    if (count_ == 0)
+        return 0;
+    const uint64_t rank = std::clamp<uint64_t>(uint64_t(std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * count_)), 1, count_);
+    uint64_t       seen = 0;
+    for (uint32_t i = 0; i < NUM_BUCKETS; i++)
+    {
+        seen += counts_[i];
+        if (seen >= rank)
+            return i == NUM_BUCKETS - 1 ? max_ : std::clamp(BucketHighestValue(i), min_, max_);  // The last one holds the clamped values
+    }
+    return max_;
+}
+
+FrameTimeSummary SummarizeFrameTimes(const DurationHistogram& h)
+{
+    FrameTimeSummary s;
+    s.frames  = h.Count();
+    s.min_ms  = h.Min() / 1e6;
+    s.p50_ms  = h.Percentile(50) / 1e6;
+    s.p90_ms  = h.Percentile(90) / 1e6;
+    s.p99_ms  = h.Percentile(99) / 1e6;
+    s.max_ms  = h.Max() / 1e6;
+    s.mean_ms = h.Mean() / 1e6;
+    return s;
+}
+
+bool AppendFrameTimeCsv(const char* file_name, const char* capture, uint32_t width, uint32_t height, const char* config, const char* series, const FrameTimeSummary& s)
+{
+    FILE* f = fopen(file_name, "a");
+    if (!f)
+    {
+        printf("Could not open %s for writing.\n", file_name);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) == 0)
+        fprintf(f, "capture,width,height,config,series,frames,min_ms,p50_ms,p90_ms,p99_ms,max_ms,mean_ms\n");
+    fprintf(f,
+            "%s,%u,%u,%s,%s,%llu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+            capture,
+            width,
+            height,
+            config,
+            series,
+            (unsigned long long)s.frames,
+            s.min_ms,
+            s.p50_ms,
+            s.p90_ms,
+            s.p99_ms,
+            s.max_ms,
+            s.mean_ms);
+    return fclose(f) == 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+// Log-linear histogram of durations in nanoseconds, after HdrHistogram. Values below 2^SUB_BUCKET_BITS ns are counted
+// exactly; larger ones fall into buckets 1/2^(SUB_BUCKET_BITS - 1) of their magnitude wide, so percentiles are within
+// 0.8% of a recorded value. The counters are allocated by the constructor and recording never allocates.
+class DurationHistogram
+{
+public:
+    static constexpr uint32_t SUB_BUCKET_BITS = 8;
+    static constexpr uint32_t MAX_VALUE_BITS  = 40;  // About 18 minutes; longer durations are clamped
+
+    DurationHistogram();
+
+    void Record(uint64_t ns);
+    void Reset();
+
+    uint64_t Count() const
+    {
+        return count_;
+    }
+    uint64_t Min() const
+    {
+        return count_ ? min_ : 0;
+    }
+    uint64_t Max() const
+    {
+        return max_;
+    }
+    double Mean() const
+    {
+        return count_ ? double(sum_) / count_ : 0;
+    }
+
+    // Smallest value that at least p percent of the recorded values do not exceed, to the precision of its bucket
+    uint64_t Percentile(double p) const;
+
+private:
+    static uint32_t BucketIndex(uint64_t ns);
+    static uint64_t BucketHighestValue(uint32_t idx);
+
+    std::vector<uint64_t> counts_;
+    uint64_t              count_{};
+    uint64_t              sum_{};
+    uint64_t              min_{UINT64_MAX};
+    uint64_t              max_{};
+};
+
+// What the frame time UI and CSV show of one series
+struct FrameTimeSummary
+{
+    uint64_t frames{};
+    double   min_ms{};
+    double   p50_ms{};
+    double   p90_ms{};
+    double   p99_ms{};
+    double   max_ms{};
+    double   mean_ms{};
+};
+
+FrameTimeSummary SummarizeFrameTimes(const DurationHistogram& h);
+
+// Appends one row to a CSV file, writing the header first if the file is new or empty
+bool AppendFrameTimeCsv(const char* file_name, const char* capture, uint32_t width, uint32_t height, const char* config, const char* series, const FrameTimeSummary& s);
@@ -0,0 +1,280 @@
+#include "geometry_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+
+#include "parallel.h"
+#include "profiler.h"
+
+// Small files are hashed entirely; for large ones the hash covers the first and last MiB plus 64 evenly spaced 64 KiB
+// blocks, which keeps the check well under the cost of decoding while still catching re-captures that kept the same
+// size and timestamp.
+bool ComputeRRAFileKey(const char* rra_file_name, RRAFileKey* key)
+{
+    RRA_PROFILE_SCOPE("ComputeRRAFileKey");
+    std::error_code ec;
+    auto            mtime = std::filesystem::last_write_time(rra_file_name, ec);
+    if (ec)
+        return false;
+
+    MappedFile f;
+    if (!f.Open(rra_file_name))
+        return false;
+
+    key->size  = f.Size();
+    key->mtime = int64_t(mtime.time_since_epoch().count());
+
+    const uint64_t FULL_HASH_LIMIT = 16ULL << 20;
+    const uint64_t HEAD_TAIL_SIZE  = 1ULL << 20;
+    const uint64_t BLOCK_SIZE      = 64ULL << 10;
+    const uint64_t NUM_BLOCKS      = 64;
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h          = HashBytesFNV1a(h, reinterpret_cast<const uint8_t*>(&key->size), sizeof(key->size));
+    if (f.Size() <= FULL_HASH_LIMIT)
+    {
+        h = HashBytesFNV1a(h, f.Data(), f.Size());
+    }
+    else
+    {
+        h = HashBytesFNV1a(h, f.Data(), HEAD_TAIL_SIZE);
+        h = HashBytesFNV1a(h, f.Data() + f.Size() - HEAD_TAIL_SIZE, HEAD_TAIL_SIZE);
+        const uint64_t stride = (f.Size() - BLOCK_SIZE) / NUM_BLOCKS;
+        for (uint64_t b = 0; b < NUM_BLOCKS; b++)
+        {
+            h = HashBytesFNV1a(h, f.Data() + b * stride, BLOCK_SIZE);
+        }
+    }
+    key->content_hash = h;
+    return true;
+}
+
+std::string GetGeometryCachePath(const char* rra_file_name)
+{
+    return std::string(rra_file_name) + ".rrageo";
+}
+
+static uint64_t AlignCacheOffset(uint64_t x)
+{
+    return (x + 63) & ~uint64_t(63);
+}
+
+bool MapGeometryCache(const char* rra_file_name, bool weld_vertices, GeometryCache* cache)
+{
+    RRA_PROFILE_SCOPE("MapGeometryCache");
+    const std::string cache_path = GetGeometryCachePath(rra_file_name);
+    if (!std::filesystem::exists(cache_path))
+        return false;
+
+    RRAFileKey key{};
+    if (!ComputeRRAFileKey(rra_file_name, &key))
+        return false;
+
+    if (!cache->file.Open(cache_path.c_str()) || cache->file.Size() < sizeof(GeometryCacheHeader))
+    {
+        printf("Geometry cache %s cannot be read, ignoring it.\n", cache_path.c_str());
+        return false;
+    }
+
+    const uint8_t*             base = cache->file.Data();
+    const GeometryCacheHeader* hdr  = reinterpret_cast<const GeometryCacheHeader*>(base);
+    if (memcmp(hdr->magic, GEOMETRY_CACHE_MAGIC, sizeof(GEOMETRY_CACHE_MAGIC)) != 0 || hdr->version != GEOMETRY_CACHE_VERSION ||
+        hdr->header_size != sizeof(GeometryCacheHeader) || hdr->file_size != cache->file.Size())
+    {
+        printf("Geometry cache %s has an unexpected format, ignoring it.\n", cache_path.c_str());
+        cache->file.Close();
+        return false;
+    }
+    if (hdr->rra_key.size != key.size || hdr->rra_key.mtime != key.mtime || hdr->rra_key.content_hash != key.content_hash)
+    {
+        printf("Geometry cache %s is stale, ignoring it.\n", cache_path.c_str());
+        cache->file.Close();
+        return false;
+    }
+    if (hdr->welded_vertices != uint32_t(weld_vertices))
+    {
+        printf("Geometry cache %s was written %s vertex welding, ignoring it.\n", cache_path.c_str(), hdr->welded_vertices ? "with" : "without");
+        cache->file.Close();
+        return false;
+    }
+
+    // Bounds-check the sections before handing out pointers into them
+    auto section_fits = [&](uint64_t offset, uint64_t count, uint64_t elem_size) {
+        return offset % 64 == 0 && offset <= hdr->file_size && count <= (hdr->file_size - offset) / elem_size;
+    };
+    if (!section_fits(hdr->blas_offsets_offset, hdr->num_blas + 1, sizeof(uint64_t)) ||
+        !section_fits(hdr->blas_index_offsets_offset, hdr->num_blas + 1, sizeof(uint64_t)) ||
+        !section_fits(hdr->view_offsets_offset, hdr->num_views + 1, sizeof(uint64_t)) ||
+        !section_fits(hdr->indices_offset, hdr->num_indices, sizeof(uint32_t)) ||
+        !section_fits(hdr->instances_offset, hdr->num_instances, sizeof(InstanceInfo)) ||
+        !section_fits(hdr->vertices_offset, hdr->num_vertices, sizeof(glm::vec3)))
+    {
+        printf("Geometry cache %s is truncated, ignoring it.\n", cache_path.c_str());
+        cache->file.Close();
+        return false;
+    }
+
+    const uint64_t*  blas_offsets       = reinterpret_cast<const uint64_t*>(base + hdr->blas_offsets_offset);
+    const uint64_t*  blas_index_offsets = reinterpret_cast<const uint64_t*>(base + hdr->blas_index_offsets_offset);
+    const glm::vec3* verts              = reinterpret_cast<const glm::vec3*>(base + hdr->vertices_offset);
+    const uint32_t*  indices            = reinterpret_cast<const uint32_t*>(base + hdr->indices_offset);
+    cache->blas_geometry.clear();
+    cache->blas_geometry.reserve(hdr->num_blas);
+    for (uint64_t i = 0; i < hdr->num_blas; i++)
+    {
+        uint64_t lb = blas_offsets[i], ub = blas_offsets[i + 1];
+        uint64_t ilb = blas_index_offsets[i], iub = blas_index_offsets[i + 1];
+        if (lb > ub || ub > hdr->num_vertices || ilb > iub || iub > hdr->num_indices || (iub - ilb) % 3 != 0)
+        {
+            printf("Geometry cache %s has bad BLAS offsets, ignoring it.\n", cache_path.c_str());
+            cache->file.Close();
+            return false;
+        }
+        cache->blas_geometry.push_back({std::span<const glm::vec3>(verts + lb, ub - lb), std::span<const uint32_t>(indices + ilb, iub - ilb)});
+    }
+
+    // The CPU paths index the vertices without further checks
+    std::atomic<bool> bad_index{false};
+    ParallelForDynamic(cache->blas_geometry.size(), 1, [&](uint32_t, size_t i) {
+        const BlasGeometry& geom = cache->blas_geometry[i];
+        for (uint32_t idx : geom.indices)
+        {
+            if (idx >= geom.vertices.size())
+            {
+                bad_index = true;
+                return;
+            }
+        }
+    });
+    if (bad_index)
+    {
+        printf("Geometry cache %s has bad vertex indices, ignoring it.\n", cache_path.c_str());
+        cache->file.Close();
+        return false;
+    }
+    const uint64_t* view_offsets = reinterpret_cast<const uint64_t*>(base + hdr->view_offsets_offset);
+    for (uint64_t v = 0; v < hdr->num_views; v++)
+    {
+        if (view_offsets[v] > view_offsets[v + 1] || view_offsets[v + 1] > hdr->num_instances)
+        {
+            printf("Geometry cache %s has bad TLAS offsets, ignoring it.\n", cache_path.c_str());
+            cache->file.Close();
+            return false;
+        }
+    }
+    cache->instances    = std::span<const InstanceInfo>(reinterpret_cast<const InstanceInfo*>(base + hdr->instances_offset), hdr->num_instances);
+    cache->view_offsets = std::span<const uint64_t>(view_offsets, hdr->num_views + 1);
+    cache->header       = hdr;
+    cache->aabb_min     = glm::vec3(hdr->aabb_min[0], hdr->aabb_min[1], hdr->aabb_min[2]);
+    cache->aabb_max     = glm::vec3(hdr->aabb_max[0], hdr->aabb_max[1], hdr->aabb_max[2]);
+
+    printf("Mapped geometry cache %s: %llu BLASes, %llu TLASes, %llu instances, %llu vertices, %llu indices\n",
+           cache_path.c_str(),
+           (unsigned long long)hdr->num_blas,
+           (unsigned long long)hdr->num_views,
+           (unsigned long long)hdr->num_instances,
+           (unsigned long long)hdr->num_vertices,
+           (unsigned long long)hdr->num_indices);
+    return true;
+}
+
+void WriteGeometryCache(const char*                      rra_file_name,
+                        uint32_t                         num_dispatches,
+                        bool                             welded_vertices,
+                        const std::vector<InstanceInfo>& inst_infos,
+                        const std::vector<uint64_t>&     view_offsets,
+                        const std::vector<IndexedBlas>&  blases,
+                        const glm::vec3&                 aabb_min,
+                        const glm::vec3&                 aabb_max)
+{
+    RRA_PROFILE_SCOPE("WriteGeometryCache");
+    GeometryCacheHeader hdr{};
+    memcpy(hdr.magic, GEOMETRY_CACHE_MAGIC, sizeof(GEOMETRY_CACHE_MAGIC));
+    hdr.version     = GEOMETRY_CACHE_VERSION;
+    hdr.header_size = sizeof(GeometryCacheHeader);
+    if (!ComputeRRAFileKey(rra_file_name, &hdr.rra_key))
+        return;
+
+    std::vector<uint64_t> blas_offsets = {0}, blas_index_offsets = {0};
+    for (const IndexedBlas& b : blases)
+    {
+        blas_offsets.push_back(blas_offsets.back() + b.vertices.size());
+        blas_index_offsets.push_back(blas_index_offsets.back() + b.indices.size());
+    }
+
+    hdr.num_blas                  = blases.size();
+    hdr.num_instances             = inst_infos.size();
+    hdr.num_vertices              = blas_offsets.back();
+    hdr.num_indices               = blas_index_offsets.back();
+    hdr.num_views                 = GetNumSceneViews(view_offsets);
+    hdr.num_dispatches            = num_dispatches;
+    hdr.welded_vertices           = welded_vertices;
+    hdr.blas_offsets_offset       = AlignCacheOffset(sizeof(GeometryCacheHeader));
+    hdr.blas_index_offsets_offset = AlignCacheOffset(hdr.blas_offsets_offset + sizeof(uint64_t) * blas_offsets.size());
+    hdr.view_offsets_offset       = AlignCacheOffset(hdr.blas_index_offsets_offset + sizeof(uint64_t) * blas_index_offsets.size());
+    hdr.instances_offset          = AlignCacheOffset(hdr.view_offsets_offset + sizeof(uint64_t) * (hdr.num_views + 1));
+    hdr.vertices_offset           = AlignCacheOffset(hdr.instances_offset + sizeof(InstanceInfo) * inst_infos.size());
+    hdr.indices_offset            = AlignCacheOffset(hdr.vertices_offset + sizeof(glm::vec3) * hdr.num_vertices);
+    hdr.file_size                 = hdr.indices_offset + sizeof(uint32_t) * hdr.num_indices;
+    for (int c = 0; c < 3; c++)
+    {
+        hdr.aabb_min[c] = aabb_min[c];
+        hdr.aabb_max[c] = aabb_max[c];
+    }
+
+    const std::string cache_path = GetGeometryCachePath(rra_file_name);
+    const std::string tmp_path   = cache_path + ".tmp";
+    {
+        std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!ofs.good())
+        {
+            printf("Could not create geometry cache %s\n", tmp_path.c_str());
+            return;
+        }
+        auto pad_to = [&](uint64_t offset) {
+            static const char zeros[64]{};
+            uint64_t          pos = uint64_t(ofs.tellp());
+            ofs.write(zeros, std::streamsize(offset - pos));
+        };
+        ofs.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        pad_to(hdr.blas_offsets_offset);
+        ofs.write(reinterpret_cast<const char*>(blas_offsets.data()), std::streamsize(sizeof(uint64_t) * blas_offsets.size()));
+        pad_to(hdr.blas_index_offsets_offset);
+        ofs.write(reinterpret_cast<const char*>(blas_index_offsets.data()), std::streamsize(sizeof(uint64_t) * blas_index_offsets.size()));
+        pad_to(hdr.view_offsets_offset);
+        ofs.write(reinterpret_cast<const char*>(view_offsets.data()), std::streamsize(sizeof(uint64_t) * (hdr.num_views + 1)));
+        pad_to(hdr.instances_offset);
+        ofs.write(reinterpret_cast<const char*>(inst_infos.data()), std::streamsize(sizeof(InstanceInfo) * inst_infos.size()));
+        pad_to(hdr.vertices_offset);
+        for (const IndexedBlas& b : blases)
+        {
+            ofs.write(reinterpret_cast<const char*>(b.vertices.data()), std::streamsize(sizeof(glm::vec3) * b.vertices.size()));
+        }
+        pad_to(hdr.indices_offset);
+        for (const IndexedBlas& b : blases)
+        {
+            ofs.write(reinterpret_cast<const char*>(b.indices.data()), std::streamsize(sizeof(uint32_t) * b.indices.size()));
+        }
+        if (!ofs.good())
+        {
+            printf("Failed writing geometry cache %s\n", tmp_path.c_str());
+            ofs.close();
+            std::filesystem::remove(tmp_path);
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, cache_path, ec);
+    if (ec)
+    {
+        printf("Could not move geometry cache into place: %s\n", ec.message().c_str());
+        std::filesystem::remove(tmp_path, ec);
+        return;
+    }
+    printf("Wrote geometry cache %s (%llu bytes)\n", cache_path.c_str(), (unsigned long long)hdr.file_size);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mapped_file.h"
+#include "rt_common.h"
+
+// On-disk cache of the decoded geometry, stored next to the capture as <capture>.rrageo
+//
+// Layout: GeometryCacheHeader, uint64_t blas_offsets[num_blas + 1] (in vertices),
+//         uint64_t blas_index_offsets[num_blas + 1] (in indices), uint64_t view_offsets[num_views + 1] (in instances),
+//         InstanceInfo instances[num_instances], glm::vec3 vertices[num_vertices], uint32_t indices[num_indices].
+// Indices are relative to the first vertex of their BLAS.
+// Every section starts at a 64-byte aligned offset so the file can be used in place after mapping it.
+constexpr uint32_t GEOMETRY_CACHE_VERSION  = 4;
+constexpr char     GEOMETRY_CACHE_MAGIC[8] = {'R', 'R', 'A', 'G', 'E', 'O', '\0', '\0'};
+
+struct RRAFileKey
+{
+    uint64_t size{};
+    int64_t  mtime{};
+    uint64_t content_hash{};
+};
+
+struct GeometryCacheHeader
+{
+    char       magic[8];
+    uint32_t   version;
+    uint32_t   header_size;
+    RRAFileKey rra_key;
+    uint64_t   file_size;
+    uint64_t   num_blas;
+    uint64_t   num_instances;
+    uint64_t   num_vertices;
+    uint64_t   num_indices;
+    uint64_t   num_views;
+    uint64_t   blas_offsets_offset;
+    uint64_t   blas_index_offsets_offset;
+    uint64_t   view_offsets_offset;
+    uint64_t   instances_offset;
+    uint64_t   vertices_offset;
+    uint64_t   indices_offset;
+    uint32_t   num_dispatches;  // The trace still has to be opened for these
+    float      aabb_min[3];
+    float      aabb_max[3];
+    uint32_t   welded_vertices;  // 1 if the BLASes were welded into distinct vertices, 0 if every triangle has its own
+};
+
+struct GeometryCache
+{
+    MappedFile                    file;
+    const GeometryCacheHeader*    header{};
+    BlasGeometrySpans             blas_geometry;
+    std::span<const InstanceInfo> instances;  // Of all scene views
+    std::span<const uint64_t>     view_offsets;
+    glm::vec3                     aabb_min{}, aabb_max{};  // Of all scene views
+};
+
+// Size, mtime and a hash of the content of the capture, which a cache has to match
+bool        ComputeRRAFileKey(const char* rra_file_name, RRAFileKey* key);
+std::string GetGeometryCachePath(const char* rra_file_name);
+
+// Maps <rra_file_name>.rrageo and points cache->blas_geometry/instances into it.
+// Returns false if the cache is missing, from another version, was written for a different capture, or with a different
+// weld_vertices than the caller decodes with.
+bool MapGeometryCache(const char* rra_file_name, bool weld_vertices, GeometryCache* cache);
+
+// Writes the decoded geometry and the scene AABB to <rra_file_name>.rrageo.
+// The file is written under a temporary name first so a crash never leaves a half-written cache behind.
+void WriteGeometryCache(const char*                      rra_file_name,
+                        uint32_t                         num_dispatches,
+                        bool                             welded_vertices,
+                        const std::vector<InstanceInfo>& inst_infos,
+                        const std::vector<uint64_t>&     view_offsets,
+                        const std::vector<IndexedBlas>&  blases,
+                        const glm::vec3&                 aabb_min,
+                        const glm::vec3&                 aabb_max);
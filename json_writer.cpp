@@ -0,0 +1,103 @@
+#include "json_writer.h"
+
+#include <cinttypes>
+#include <cmath>
+
+void JsonWriter::BeginValue(const char* key)
+{
+    if (!has_values_.empty())
+    {
+        fputs(has_values_.back() ? ",\n" : "\n", f_);
+        has_values_.back() = true;
+        fprintf(f_, "%*s", int(has_values_.size() * 2), "");
+    }
+    if (key)
+    {
+        WriteEscaped(key);
+        fputs(": ", f_);
+    }
+}
+
+void JsonWriter::WriteEscaped(const std::string& s)
+{
+    fputc('"', f_);
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            fprintf(f_, "\\%c", c);
+        else if (uint8_t(c) < 0x20)
+            fprintf(f_, "\\u%04x", unsigned(uint8_t(c)));
+        else
+            fputc(c, f_);
+    }
+    fputc('"', f_);
+}
+
+void JsonWriter::BeginObject(const char* key)
+{
+    BeginValue(key);
+    fputc('{', f_);
+    has_values_.push_back(false);
+}
+
+void JsonWriter::EndObject()
+{
+    const bool had_values = has_values_.back();
+    has_values_.pop_back();
+    if (had_values)
+        fprintf(f_, "\n%*s", int(has_values_.size() * 2), "");
+    fputc('}', f_);
+    if (has_values_.empty())
+        fputc('\n', f_);
+}
+
+void JsonWriter::BeginArray(const char* key)
+{
+    BeginValue(key);
+    fputc('[', f_);
+    has_values_.push_back(false);
+}
+
+void JsonWriter::EndArray()
+{
+    const bool had_values = has_values_.back();
+    has_values_.pop_back();
+    if (had_values)
+        fprintf(f_, "\n%*s", int(has_values_.size() * 2), "");
+    fputc(']', f_);
+    if (has_values_.empty())
+        fputc('\n', f_);
+}
+
+void JsonWriter::String(const char* key, const std::string& value)
+{
+    BeginValue(key);
+    WriteEscaped(value);
+}
+
+void JsonWriter::Number(const char* key, double value)
+{
+    BeginValue(key);
+    if (std::isfinite(value))
+        fprintf(f_, "%.10g", value);
+    else
+        fputs("null", f_);
+}
+
+void JsonWriter::Integer(const char* key, int64_t value)
+{
+    BeginValue(key);
+    fprintf(f_, "%" PRId64, value);
+}
+
+void JsonWriter::Bool(const char* key, bool value)
+{
+    BeginValue(key);
+    fputs(value ? "true" : "false", f_);
+}
+
+void JsonWriter::Null(const char* key)
+{
+    BeginValue(key);
+    fputs("null", f_);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// Streams a JSON document to a FILE, for results that scripts read back. Keys are given to the calls inside an
+// object and left null inside an array. Non-finite numbers are written as null.
+class JsonWriter
+{
+public:
+    explicit JsonWriter(FILE* f) : f_(f)
+    {
+    }
+
+    void BeginObject(const char* key = nullptr);
+    void EndObject();
+    void BeginArray(const char* key = nullptr);
+    void EndArray();
+
+    void String(const char* key, const std::string& value);
+    void Number(const char* key, double value);
+    void Integer(const char* key, int64_t value);
+    void Bool(const char* key, bool value);
+    void Null(const char* key);
+
+private:
+    // Separator, indentation and key of the next value
+    void BeginValue(const char* key);
+    void WriteEscaped(const std::string& s);
+
+    FILE*             f_;
+    std::vector<bool> has_values_;  // Per open object or array
+};
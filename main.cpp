@@ -4,10 +4,12 @@
 
 #include <algorithm>
 #include <atomic>
-#include <deque>
+#include <bit>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <map>
+#include <span>
 #include <thread>
 
 #include <GLFW/glfw3.h>
@@ -29,11 +31,6 @@
 #include <dxcapi.h>
 #include <DirectXMath.h>
 
-#include "public/rra_bvh.h"
-#include "public/rra_blas.h"
-#include "public/rra_tlas.h"
-#include "public/rra_trace_loader.h"
-#include "public/rra_ray_history.h"
 #include "../frontend/version.h"
 
 #include "imgui/imgui.h"
@@ -48,58 +45,105 @@
 #undef min
 #undef max
 
-struct RayInPixDumpFileMinimal
-{
-    //uint32_t   type;
-    //glm::uvec3 dispatch_rays_idx;
-    glm::vec3  origin;
-    float      tmin;
-    glm::vec3  direction;
-    float      tcurrent;
-    //uint32_t   ray_flags;
-};
+#include "capture_camera.h"
+#include "dispatch_rays.h"
+#include "frame_stats.h"
+#include "geometry_cache.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "ray_binning.h"
+#include "ray_coherence.h"
+#include "ray_reorder.h"
+#include "ray_storage.h"
+#include "rra_trace.h"
+#include "vertex_weld.h"
+#include "rt_common.h"
+
 //std::vector<RayInPixDumpFileMinimal> g_rays_in_pix_dumpfile_minimal;
 //glm::uvec3                         g_ray_in_pix_dispatch_dims;
 bool                               g_use_ray_in_pix{false};
 
-struct DispatchRaysInfo
-{
-    std::vector<RayInPixDumpFileMinimal> rays;
-    std::vector<uint32_t>                ray_idxes;
-    glm::uvec3                           dispatch_dims;
-    std::string                          name;
-    uint32_t                             num_invocations{};
-};
 std::vector<DispatchRaysInfo> g_dispatch_rays_info;
 bool                          g_dispatch_rays_info_reflow{false};
+uint32_t                      g_max_resident_dispatches{4};  // LRU cap on decoded RRA dispatches
+bool                          g_oct_ray_directions{false};   // RayStorageFormat of dispatches loaded from now on
+bool                          g_quantize_ray_origins{false};
+bool                          g_weld_vertices{true};         // Merge the identical vertices of every BLAS; --no-vertex-weld keeps the soups as they are
+
+void EnsureDispatchRaysResident(DispatchRaysInfo* dri);
+void DecodeDispatchRays(DispatchRaysInfo* dri);
+
+// Decodes the rays of one RRA dispatch on a background thread, so selecting a dispatch in the UI does not stall it.
+// Only the decode thread touches the dispatch until Poll() has joined it and marked the dispatch resident.
+struct DispatchRaysDecoder
+{
+    std::thread       thread;
+    std::atomic<bool> busy{false};
+    DispatchRaysInfo* dri{nullptr};
+
+    ~DispatchRaysDecoder()
+    {
+        Wait();
+    }
+
+    void Start(DispatchRaysInfo* d)
+    {
+        dri    = d;
+        busy   = true;
+        thread = std::thread([this]() {
+            DecodeDispatchRays(dri);
+            busy = false;
+        });
+    }
+
+    // Finishes a completed decode. Returns true while one is still running.
+    bool Poll()
+    {
+        if (busy)
+            return true;
+        Wait();
+        return false;
+    }
+
+    void Wait()
+    {
+        if (!dri)
+            return;
+        thread.join();
+        dri->resident = true;
+        dri           = nullptr;
+    }
+};
+DispatchRaysDecoder g_dispatch_rays_decoder;
+int32_t             g_dispatch_to_show{-1};  // Selected dispatch whose rays are still being decoded
 
+// Mean frame time over windows of update_interval seconds, for the window title and the 'B' benchmark
 struct FrameTime
 {
-    std::vector<float> samples;  // elapsed, frame_time
-    float                                last_secs{0};
-    float                                curr_frametime{0};
-    float                                update_interval = 0.75f; // seconds
+    float sum{0};
+    int   num_samples{0};
+    float last_secs{0};
+    float curr_frametime{0};
+    float update_interval = 0.75f;  // seconds
 
     float GetFrameTime()
     {
         float curr_secs = glfwGetTime();
         if (curr_secs - last_secs > update_interval)
         {
-            float sum = 0;
-            for (float s : samples)
-            {
-                sum += s;
-            }
-            curr_frametime = sum * 1.0f / int(samples.size());
-            samples.clear();
-            last_secs = curr_secs;
+            if (num_samples > 0)
+                curr_frametime = sum / num_samples;
+            sum         = 0;
+            num_samples = 0;
+            last_secs   = curr_secs;
         }
         return curr_frametime;
     }
 
     void AddSample(float x)
     {
-        samples.push_back(x);
+        sum += x;
+        num_samples++;
     }
 
     bool ShouldUpdate()
@@ -146,33 +190,24 @@ struct MySlidingWindow
 };
 MySlidingWindow<float> g_frame_time_sliding_window(60);
 
-struct CamParams
-{
-    glm::vec3 eye, center, up;
-    bool      invert_y;
-};
+// Frame time distributions since the last change of what is rendered: the CPU time between Render() calls and the
+// GPU time between the timestamps around the frame's dispatches
+DurationHistogram g_cpu_frame_times;
+DurationHistogram g_gpu_frame_times;
+const char*       g_frame_stats_csv{"frame_stats.csv"};
+bool              g_append_frame_stats_on_exit{false};  // --frame-stats-csv
 
-std::map<std::string, CamParams> CAM_PARAMS = {
-    {"SolarBay", {glm::vec3(5.964f, 1.691f, 5.374f), glm::vec3(2.921f, 1.691f, 2.120f), glm::vec3(0, 1, 0), false}},
-    {"PortRoyal", {glm::vec3(-7.2252469f, 0.8361527f, 25.2023430f), glm::vec3(-6.8860960f, 0.8613553f, 24.2284565f), glm::vec3(0, 1, 0), true}},
-    {"DXRFeatureTest", {glm::vec3(-6.1447086f, 2.7448003f, -11.9588842f), glm::vec3(-6.1102533f, 2.7394657f, -11.9192486f), glm::vec3(0, 1, 0), true}},
-    {"Cyberpunk2077", {glm::vec3(667.6618652f, -804.2122192f, 128.7313995f), glm::vec3(666.0505371f, -802.7095947f, 128.0240326f), glm::vec3(0, 0, 1), true}},
-    {"RealTimeDenoisedAmbientOcclusion", {glm::vec3(-43.5119209f, 24.3670177f, -29.0387344f), glm::vec3(-43.2385712f, 24.1981163f, -28.8011036f), glm::vec3(0, 1, 0), true}},
-    {"b1-Win64-Shipping", {glm::vec3(-32269.8417969f, 9393.68f, -1515.189f), glm::vec3(-32869.87f, 9697.102f, -1436.413f), glm::vec3(0, 0, 1), true}},
-    {"VictorStones", {glm::vec3(54.20388, -360.680725, 20.8701935), glm::vec3(93.000, -316.9831, 29.51616), glm::vec3(0, 0, 1), true}},
-    {"AncientGame", {glm::vec3(-290.0213013, 230.9532928, 341.0099792), glm::vec3(-344.7103882, 227.3368835, 347.0361633), glm::vec3(0,0,1), true}},
-    {"hairball", {glm::vec3(0, 0, -4), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0), true}}
-};
+void ResetFrameStats()
+{
+    g_frame_time_sliding_window.Reset();
+    g_cpu_frame_times.Reset();
+    g_gpu_frame_times.Reset();
+}
 
 struct Vertex
 {
     DirectX::XMFLOAT3 position;
 };
-struct InstanceInfo
-{
-    uint64_t blas_idx{};
-    float    transform[12]{};  // Row Major
-};
 struct RayGenCB
 {
     DirectX::XMMATRIX inverse_view;
@@ -261,6 +296,8 @@ ID3D12Resource* g_raydump_ray_idxes_upload;
 bool g_use_ao{false};
 int g_use_ray_binning{0};
 bool g_ray_mapping_dirty{true};
+int       g_ray_binning_uploaded{0};  // Mode whose RayDirs/RayMapping are on the GPU, 0 while none are
+RayBinner g_ray_binner;
 
 ID3D12Fence* g_fence;
 int          g_fence_value;
@@ -294,7 +331,10 @@ float GetCurrentDispatchRaysAvgInvocationPerRay()
 {
     DispatchRaysInfo* dri = GetCurrentDispatchRaysInfo();
     if (dri)
-        return 1.0f * dri->num_invocations / dri->ray_idxes.size();
+    {
+        const glm::uvec3 d = dri->dispatch_dims;
+        return 1.0f * dri->num_invocations / std::max(1.0, double(d.x) * d.y * d.z);
+    }
     else
         return 0;
 }
@@ -311,11 +351,24 @@ enum AppState
 AppState g_app_state{};
 float    g_app_current_progress{};
 std::string g_app_current_progress_string;
+
+RraDecodeProgress g_decode_progress;  // Of the trace decoders, including the per-worker progress of the BLAS walk
 bool        g_hide_ui{false};
 std::string g_adapter_name{};
 
 std::atomic<bool> g_as_built{false};
 
+// GPU acceleration structures of one scene view, i.e. one TLAS of the capture. All views share the BLASes.
+struct SceneViewAS
+{
+    ID3D12Resource* tlas{};
+    ID3D12Resource* inst_offsets{};  // First index and first vertex of every instance's BLAS, indexed by InstanceID
+    uint32_t        num_instances{};
+};
+std::vector<SceneViewAS> g_scene_view_as;
+uint32_t                 g_scene_view{0};  // TLAS that is rendered and traced on the CPU; --tlas N picks the initial one
+void                     BindSceneView(uint32_t v);
+
 glm::vec3 g_scene_aabb_min{1e20, 1e20, 1e20}, g_scene_aabb_max{-1e20, -1e20, -1e20};
 float     g_ao_radius{10000};
 glm::vec3 g_cam_pos{};
@@ -332,99 +385,6 @@ const int          BMK_AO_SAMPLE_COUNT_LIMIT = 32;
 
 bool g_show_demo_window{true};
 
-static glm::vec3 Constrain(glm::vec3 x)
-{
-    x.x = std::max(0.0f, std::min(1.0f, x.x));
-    x.y = std::max(0.0f, std::min(1.0f, x.y));
-    x.z = std::max(0.0f, std::min(1.0f, x.z));
-    return x;
-}
-
-static glm::vec3 TransformPosition(const glm::mat4& m, const glm::vec3& x)
-{
-    glm::vec4 x4(x, 0.0f);
-    x4 = m * x4;
-    x4.x += m[3][0];
-    x4.y += m[3][1];
-    x4.z += m[3][2];
-    return glm::vec3(x4);
-}
-
-static glm::vec3 TransformDirection(const glm::mat4& m, const glm::vec3& x)
-{
-    glm::vec4 x4(x, 0.0f);
-    x4 = m * x4;
-    return glm::vec3(x4);
-}
-
-static glm::vec2 OctWrap(const glm::vec2& v)
-{
-    glm::vec2 ret(1.0f, 1.0f);
-    ret -= glm::vec2(abs(v.y), abs(v.x));
-    ret.x *= (v.x >= 0 ? 1 : -1);
-    ret.y *= (v.y >= 0 ? 1 : -1);
-    return ret;
-}
-
-static glm::vec2 OctEncode(glm::vec3 n)
-{
-    n = glm::normalize(n);
-    n /= (abs(n.x) + abs(n.y) + abs(n.z));
-    if (n.z < 0)
-    {
-        glm::vec2 xy = OctWrap(glm::vec2(n.x, n.y));
-        n.x        = xy.x;
-        n.y        = xy.y;
-    }
-    n.x = n.x * 0.5 + 0.5;
-    n.y = n.y * 0.5 + 0.5;
-    return glm::vec2(n.x, n.y);
-}
-
-glm::uvec2 TEA(unsigned int val0, unsigned int val1, unsigned int N)
-{
-    unsigned int v0 = val0;
-    unsigned int v1 = val1;
-    unsigned int s0 = 0;
-
-    for (unsigned int n = 0; n < N; n++)
-    {
-        s0 += 0x9e3779b9;
-        v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
-        v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
-    }
-
-    return glm::uvec2(v0, v1);
-}
-
-unsigned LCG(int& seed)
-{
-    const unsigned int LCG_A = 1103515245u;
-    const unsigned int LCG_C = 12345u;
-    const unsigned int LCG_M = 0x00FFFFFFu;
-    seed                     = (LCG_A * seed + LCG_C);
-    return seed & LCG_M;
-}
-
-float RandF(int& seed)
-{
-    return float(LCG(seed)) / float(0x01000000);
-}
-
-glm::vec3 SampleHemisphereCosine(glm::vec3 n, int& seed)
-{
-    float phi         = 2.0f * 3.14159 * RandF(seed);
-    float sinThetaSqr = RandF(seed);
-    float sinTheta    = sqrt(sinThetaSqr);
-
-    glm::vec3 axis = abs(n.x) > 0.001f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
-    glm::vec3 t    = glm::cross(axis, n);
-    t              = normalize(t);
-    glm::vec3 s    = glm::cross(n, t);
-
-    return glm::normalize(s * cos(phi) * sinTheta + t * sin(phi) * sinTheta + n * sqrt(1.0f - sinThetaSqr));
-}
-
 void CE(HRESULT x)
 {
     if (FAILED(x))
@@ -469,7 +429,7 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
             {
                 g_device12->SetStablePowerState(false);
             }
-            exit(0);
+            glfwSetWindowShouldClose(window, GLFW_TRUE);  // Leave the main loop so what runs after it, like --frame-stats-csv, still does
             break;
         }
         case GLFW_KEY_1:
@@ -479,7 +439,7 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
             g_use_ray_in_pix  = false;
             g_ray_type_idx    = 1;
             g_rayflag_accept_first_hit_and_end_search = true;
-            g_frame_time_sliding_window.Reset();
+            ResetFrameStats();
             break;
         }
         case GLFW_KEY_0: {
@@ -487,11 +447,15 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
             g_use_ray_in_pix = false;
             g_ray_type_idx = 0;
             g_rayflag_accept_first_hit_and_end_search = false;
-            g_frame_time_sliding_window.Reset();
+            ResetFrameStats();
             break;
         }
+        case GLFW_KEY_7:
+        case GLFW_KEY_6:
+        case GLFW_KEY_5:
+        case GLFW_KEY_4:
         case GLFW_KEY_3:
-        case GLFW_KEY_2:
+        case GLFW_KEY_2:  // RayReorderMode
         {
             g_ao_sample_count = 1;
             g_use_ao          = true;
@@ -522,6 +486,7 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
                 g_use_ao          = true;
                 g_bmk_ft_count    = 0;
                 g_bmk_frametimes.clear();
+                ResetFrameStats();
             }
             break;
         }
@@ -739,7 +704,7 @@ void CopyDispatchRaysInfoToGPU(const struct DispatchRaysInfo& info)
     if (g_raydump_ray_idxes_upload)
         g_raydump_ray_idxes_upload->Release();
 
-    if (info.rays.size() > 0)
+    if (info.rays.Size() > 0)
     {
         D3D12_HEAP_PROPERTIES props{};
         props.Type                 = D3D12_HEAP_TYPE_DEFAULT;
@@ -751,7 +716,7 @@ void CopyDispatchRaysInfoToGPU(const struct DispatchRaysInfo& info)
         D3D12_HEAP_PROPERTIES props1 = props;
         props1.Type                  = D3D12_HEAP_TYPE_UPLOAD;
 
-        size_t sz_rays = sizeof(RayInPixDumpFileMinimal) * info.rays.size();
+        size_t sz_rays = sizeof(RayInPixDumpFileMinimal) * info.rays.Size();
         size_t sz_ray_idxes = sizeof(uint32_t) * info.ray_idxes.size();
 
         D3D12_RESOURCE_DESC res_desc{};
@@ -780,7 +745,7 @@ void CopyDispatchRaysInfoToGPU(const struct DispatchRaysInfo& info)
 
         char* mapped;
         g_rays_in_pix_buffer_upload->Map(0, nullptr, (void**)(&mapped));
-        memcpy(mapped, info.rays.data(), sz_rays);
+        info.rays.Decode(0, info.rays.Size(), reinterpret_cast<RayInPixDumpFileMinimal*>(mapped));
         g_rays_in_pix_buffer_upload->Unmap(0, nullptr);
 
         g_raydump_ray_idxes_upload->Map(0, nullptr, (void**)(&mapped));
@@ -808,7 +773,7 @@ void CopyDispatchRaysInfoToGPU(const struct DispatchRaysInfo& info)
         D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc{};
         srv_desc.Buffer.FirstElement        = 0;
         srv_desc.Buffer.Flags               = D3D12_BUFFER_SRV_FLAG_NONE;
-        srv_desc.Buffer.NumElements         = info.rays.size();
+        srv_desc.Buffer.NumElements         = info.rays.Size();
         srv_desc.Buffer.StructureByteStride = sizeof(RayInPixDumpFileMinimal);
         srv_desc.Format                     = DXGI_FORMAT_UNKNOWN;
         srv_desc.Shader4ComponentMapping    = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
@@ -896,7 +861,7 @@ void InitDX12Stuff()
 
     // CBV SRV UAV Heap
     D3D12_DESCRIPTOR_HEAP_DESC heap_desc{};
-    heap_desc.NumDescriptors = 10;  // [0]=output, [1]=BVH, [2]=CBV, [3]=Verts, [4]=Offsets, [5]=HitNormal, [6]=Mapping, [7]=Dirs, [8]=RaysInPix, [9]=RayIdxes
+    heap_desc.NumDescriptors = 11;  // [0]=output, [1]=BVH, [2]=CBV, [3]=Verts, [4]=Offsets, [5]=HitNormal, [6]=Mapping, [7]=Dirs, [8]=RaysInPix, [9]=RayIdxes, [10]=Indices
     heap_desc.Type           = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
     heap_desc.Flags          = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
     CE(g_device12->CreateDescriptorHeap(&heap_desc, IID_PPV_ARGS(&g_srv_uav_cbv_heap)));
@@ -1142,15 +1107,21 @@ void CreateRTPipeline()
         root_params[0].ShaderVisibility                    = D3D12_SHADER_VISIBILITY_ALL;
 
         // For PIX rays specifically
-        D3D12_DESCRIPTOR_RANGE desc_ranges1[1]{};
+        D3D12_DESCRIPTOR_RANGE desc_ranges1[2]{};
         desc_ranges1[0].RangeType                         = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;  // Rays, offsets
         desc_ranges1[0].NumDescriptors                    = 2;
         desc_ranges1[0].BaseShaderRegister                = 3;
         desc_ranges1[0].RegisterSpace                     = 0;
         desc_ranges1[0].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 
+        desc_ranges1[1].RangeType                         = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;  // Indices
+        desc_ranges1[1].NumDescriptors                    = 1;
+        desc_ranges1[1].BaseShaderRegister                = 5;
+        desc_ranges1[1].RegisterSpace                     = 0;
+        desc_ranges1[1].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
         root_params[1].DescriptorTable.pDescriptorRanges   = desc_ranges1;
-        root_params[1].DescriptorTable.NumDescriptorRanges = 1;
+        root_params[1].DescriptorTable.NumDescriptorRanges = 2;
         root_params[1].ShaderVisibility                    = D3D12_SHADER_VISIBILITY_ALL;
 
         D3D12_ROOT_SIGNATURE_DESC rootsig_desc{};
@@ -1468,6 +1439,24 @@ void CreateShaderBindingTable()
     g_miss_sbt_storage_ao->Unmap(0, nullptr);
 }
 
+// Appends the CPU and GPU frame time summaries of what is being rendered to g_frame_stats_csv
+void AppendFrameStatsCsv()
+{
+    char config[64];
+    if (g_ray_type_idx >= 2)
+        snprintf(config, sizeof(config), "dispatch %d", g_ray_type_idx - 2);
+    else if (g_use_ao)
+        snprintf(config, sizeof(config), "ao %d spp binning %d", g_ao_sample_count, g_use_ray_binning);
+    else
+        snprintf(config, sizeof(config), "primary");
+
+    const std::string capture = std::filesystem::path(g_rra_file_name).filename().string();
+    const bool        ok      = AppendFrameTimeCsv(g_frame_stats_csv, capture.c_str(), RT_W, RT_H, config, "cpu", SummarizeFrameTimes(g_cpu_frame_times)) &&
+                     AppendFrameTimeCsv(g_frame_stats_csv, capture.c_str(), RT_W, RT_H, config, "gpu", SummarizeFrameTimes(g_gpu_frame_times));
+    if (ok)
+        printf("Appended the frame times of %s to %s\n", config, g_frame_stats_csv);
+}
+
 void RenderImGUI(ID3D12GraphicsCommandList4* command_list)
 {
     ImGui_ImplDX12_NewFrame();
@@ -1507,13 +1496,17 @@ void RenderImGUI(ID3D12GraphicsCommandList4* command_list)
         case AppState::APP_READ_DISPATCHES:
         {
             ImGui::Text("[2/4] Reading ray dispatches");
-            ImGui::ProgressBar(g_app_current_progress);
+            ImGui::ProgressBar(g_decode_progress.fraction);
             break;
         }
         case AppState::APP_READ_BLAS_TLAS:
         {
             ImGui::Text("[3/4] Reading geometries from RRA");
-            ImGui::ProgressBar(g_app_current_progress);
+            ImGui::ProgressBar(g_decode_progress.fraction);
+            for (uint32_t w = 0; w < g_decode_progress.num_workers; w++)
+            {
+                ImGui::Text("  Worker %u: %u done, at BLAS[%u]", w, uint32_t(g_decode_progress.worker_num_done[w]), uint32_t(g_decode_progress.worker_current_blas[w]));
+            }
             break;
         }
         case AppState::APP_BUILD_BLAS_TLAS:
@@ -1532,11 +1525,44 @@ void RenderImGUI(ID3D12GraphicsCommandList4* command_list)
             char     buf[32];
             snprintf(buf, sizeof(buf), "%.3f ms", g_frame_time_sliding_window.GetAverage() * 1000.0f);
             ImGui::PlotLines(buf, dat, sz, o);
+
+            const FrameTimeSummary cpu = SummarizeFrameTimes(g_cpu_frame_times);
+            const FrameTimeSummary gpu = SummarizeFrameTimes(g_gpu_frame_times);
+            ImGui::Text("%llu frames     min     p50     p90     p99     max", (unsigned long long)gpu.frames);
+            ImGui::Text("CPU ms    %7.2f %7.2f %7.2f %7.2f %7.2f", cpu.min_ms, cpu.p50_ms, cpu.p90_ms, cpu.p99_ms, cpu.max_ms);
+            ImGui::Text("GPU ms    %7.2f %7.2f %7.2f %7.2f %7.2f", gpu.min_ms, gpu.p50_ms, gpu.p90_ms, gpu.p99_ms, gpu.max_ms);
+            if (ImGui::Button("Reset stats"))
+                ResetFrameStats();
+            ImGui::SameLine();
+            if (ImGui::Button("Append to CSV"))
+                AppendFrameStatsCsv();
             ImGui::Separator();
             break;
         }
     }
 
+    if (g_app_state == AppState::APP_RENDERING && g_scene_view_as.size() > 1)
+    {
+        // Every TLAS of the capture was built up front over the same BLASes, so switching only rebinds two SRVs
+        std::vector<std::string> view_names;
+        std::vector<const char*> view_labels;
+        for (size_t v = 0; v < g_scene_view_as.size(); v++)
+        {
+            view_names.push_back("TLAS " + std::to_string(v) + " (" + std::to_string(g_scene_view_as[v].num_instances) + " instances)");
+        }
+        for (const std::string& n : view_names)
+        {
+            view_labels.push_back(n.c_str());
+        }
+        int view = int(g_scene_view);
+        if (ImGui::Combo("Scene view", &view, view_labels.data(), int(view_labels.size())) && uint32_t(view) != g_scene_view)
+        {
+            BindSceneView(uint32_t(view));
+            g_ray_mapping_dirty = true;  // The AO rays start from the hits of the other TLAS now
+            ResetFrameStats();
+        }
+    }
+
     if (g_app_state == AppState::APP_RENDERING) {
         std::vector<const char*> labels;
         for (const std::string& s : g_ray_types)
@@ -1560,7 +1586,7 @@ void RenderImGUI(ID3D12GraphicsCommandList4* command_list)
                 g_use_ao = false;
                 g_use_ray_in_pix = false;
                 g_rayflag_accept_first_hit_and_end_search = false;
-                g_frame_time_sliding_window.Reset();
+                ResetFrameStats();
             }
             else if (g_ray_type_idx == 1)  // ao
             {
@@ -1568,25 +1594,50 @@ void RenderImGUI(ID3D12GraphicsCommandList4* command_list)
                 g_use_ray_binning = false;
                 g_use_ray_in_pix  = false;
                 g_rayflag_accept_first_hit_and_end_search = true;
-                g_frame_time_sliding_window.Reset();
+                ResetFrameStats();
             }
             else
             {
                 uint32_t ray_dump_idx = g_ray_type_idx - 2;
                 if (ray_dump_idx < g_dispatch_rays_info.size())
                 {
-                    is_using_dumped_rays = true;
-                    CopyDispatchRaysInfoToGPU(g_dispatch_rays_info.at(ray_dump_idx));
-                    g_use_ray_in_pix = true;
-                    g_use_ao         = false;
+                    // Primary rays are drawn until the rays of the dispatch are decoded and uploaded below
+                    is_using_dumped_rays = false;
+                    g_use_ray_in_pix     = false;
+                    g_use_ao             = false;
                     g_rayflag_accept_first_hit_and_end_search = false;
-                    g_frame_time_sliding_window.Reset();
+                    g_dispatch_to_show   = int32_t(ray_dump_idx);
                 }
             }
+            if (g_ray_type_idx < 2)
+                g_dispatch_to_show = -1;
         }
 
         last_ray_type_idx = g_ray_type_idx;
 
+        // A decode keeps running when another ray type gets selected; the dispatch is resident afterwards
+        const bool decoding = g_dispatch_rays_decoder.Poll();
+        if (g_dispatch_to_show >= 0)
+        {
+            DispatchRaysInfo* dri = &g_dispatch_rays_info.at(g_dispatch_to_show);
+            if (dri->resident)
+            {
+                is_using_dumped_rays = true;
+                EnsureDispatchRaysResident(dri);
+                CopyDispatchRaysInfoToGPU(*dri);
+                g_use_ray_in_pix   = true;
+                g_dispatch_to_show = -1;
+                ResetFrameStats();
+            }
+            else
+            {
+                if (!decoding)
+                    g_dispatch_rays_decoder.Start(dri);
+                ImGui::Text("Decoding the rays of %s", dri->name.c_str());
+                ImGui::ProgressBar(g_decode_progress.fraction);
+            }
+        }
+
         ImGui::Text("Ray flag");
         ImGui::Checkbox("ACCEPT_FIRST_SEARCH_AND_END_FLAG", &g_rayflag_accept_first_hit_and_end_search);
 
@@ -1597,6 +1648,23 @@ void RenderImGUI(ID3D12GraphicsCommandList4* command_list)
             glm::uvec3 d = GetCurrentDispatchRaysDimension();
             snprintf(buf, sizeof(buf), "Dim (%u,%u,%u), %.2f invoc/ray", d.x, d.y, d.z, GetCurrentDispatchRaysAvgInvocationPerRay());
             ImGui::Text(buf);
+            const RayCoherence& c = GetCurrentDispatchRaysInfo()->coherence;
+            if (c.valid)
+            {
+                ImGui::Text("Coherence");
+                ImGui::Text("  Angular dev. 8x8 / 32x32: %.2f / %.2f deg", c.tile_angular_deviation[0], c.tile_angular_deviation[1]);
+                ImGui::Text("  Origin spread 8x8 / 32x32: %g / %g", c.tile_origin_spread[0], c.tile_origin_spread[1]);
+                ImGui::Text("  Direction entropy: %.2f of %.0f bits", c.direction_entropy, std::log2(float(RAY_COHERENCE_OCT_BINS * RAY_COHERENCE_OCT_BINS)));
+                ImGui::Text("  Warp rays sharing a bin: %.1f%%", c.warp_shared_bin_fraction * 100);
+            }
+            const RayStorage& rays = GetCurrentDispatchRaysInfo()->rays;
+            if (rays.Size() > 0)
+            {
+                ImGui::Text("Rays: %.1f MB%s%s",
+                            rays.MemoryBytes() / (1024.0 * 1024.0),
+                            rays.Format().oct_directions ? ", oct dirs" : "",
+                            rays.Format().quantize_origins ? ", 16-bit origins" : "");
+            }
             static int dr_layout{1};  // Do not reflow by default
             static int last_dr_layout;
             snprintf(buf, sizeof(buf), "Reflow to %ux%u", WIN_W, WIN_H);
@@ -1621,6 +1689,7 @@ void RenderImGUI(ID3D12GraphicsCommandList4* command_list)
 
 void Render()
 {
+    RRA_PROFILE_SCOPE("Render");
     static double   last_secs{0};
     double          secs        = glfwGetTime();
     if (!g_as_built)
@@ -1632,6 +1701,13 @@ void Render()
     }
     last_secs = secs;
 
+    // CPU frame time: from the start of the previous Render() to the start of this one
+    static std::chrono::steady_clock::time_point last_frame_start{};
+    const std::chrono::steady_clock::time_point  frame_start = std::chrono::steady_clock::now();
+    if (g_as_built && last_frame_start != std::chrono::steady_clock::time_point{})
+        g_cpu_frame_times.Record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(frame_start - last_frame_start).count()));
+    last_frame_start = frame_start;
+
     // Update
     char* mapped;
     g_raygen_cb->Map(0, nullptr, (void**)(&mapped));
@@ -1640,7 +1716,7 @@ void Render()
     GlmMat4ToDirectXMatrix(&cb.inverse_proj, g_inv_proj);
     cb.invert_y   = g_invert_y;
     cb.ao_samples = g_ao_sample_count;
-    cb.use_ray_binning = g_use_ray_binning;
+    cb.use_ray_binning = (g_ray_binning_uploaded == g_use_ray_binning) ? g_use_ray_binning : 0;
     cb.ao_radius       = g_ao_radius;
     cb.load_ray_from_buffer = g_use_ray_in_pix;
     if (g_dispatch_rays_info_reflow && g_use_ray_in_pix)
@@ -1863,167 +1939,49 @@ void Render()
     WaitForPreviousFrame();
     CE(g_command_allocator->Reset());
 
-    // Read back ray dirs
+    // Ray binning runs on a background thread from the hit data read back this frame. Until its result is uploaded,
+    // the AO pass traces the rays unbinned.
     if (g_use_ray_binning > 0)
     {
-        if (g_ray_mapping_dirty)
+        if (g_ray_mapping_dirty && !g_ray_binner.Busy())
         {
-            CE(g_command_list->Reset(g_command_allocator, nullptr));
-
+            RRA_PROFILE_SCOPE("RayBinningStart");
             glm::vec4*  mapped{};  // Normal and T
             D3D12_RANGE read_range{};
             read_range.Begin = 0;
-            read_range.End   = sizeof(float) * 3 * RT_W * RT_H;
+            read_range.End   = sizeof(glm::vec4) * RT_W * RT_H;
             g_hitpos_ao_readback->Map(0, &read_range, (void**)(&mapped));
-            std::vector<std::pair<glm::vec4, int>> tmp;
-
-            for (int i = 0; i < RT_W * RT_H; i++)
-            {
-                glm::vec4 nt   = mapped[i];
-                int       seed = TEA(i, 0, 16).x;
-                glm::vec3 dir  = SampleHemisphereCosine(glm::vec3(nt), seed);
-                tmp.push_back(std::make_pair(glm::vec4(dir, nt.w), i));
-            }
-            g_hitpos_ao_readback->Unmap(0, nullptr);
-            
-            // Global two-point ... ?
-            if (g_use_ray_binning == 2)
-            {
-                std::vector<std::pair<unsigned, int>> tmp1;
-                for (int i = 0; i < RT_W * RT_H; i++)
-                {
-                    float dx = (float(i % RT_W) + 0.5f) / RT_W * 2 - 1;
-                    float dy = (float(i / RT_W) + 0.5f) / RT_H * 2 - 1;
-                    dy *= -1;
-                    if (g_invert_y)
-                        dy *= -1;
-                    glm::vec3 d(dx, dy, 1);
-                    glm::vec3 tgt = TransformPosition(g_inv_proj, d);
-                    glm::vec3 dir = TransformDirection(g_inv_view, glm::normalize(tgt));
-                    
-                    std::pair<glm::vec4, int>& entry = tmp[i];
-
-                    glm::vec3 o = g_cam_pos + (dir * entry.first.w);
-                    glm::vec3 ao_d = glm::vec3(entry.first);
-                    glm::vec3 t = o + ao_d * 10.0f;
-
-                    glm::vec3 t01    = Constrain((t - g_scene_aabb_min) / (g_scene_aabb_max - g_scene_aabb_min));
-                    int       code_t = (int(32 * t01.x) << 10) | (int(32 * t01.y) << 5) | (int(32 * t01.z));
-                    glm::vec3 o01    = Constrain((o - g_scene_aabb_min) / (g_scene_aabb_max - g_scene_aabb_min));
-                    int       code_o = (int(64 * o01.x) << 11) | (int(64 * o01.y) << 5) | (int(32 * o01.z));
-                    unsigned sort_key = (((code_o >> 14) & 7) << 29) |
-                                   (((code_t >> 12) & 7) << 26) |
-                                   (((code_o >> 11) & 7) << 23) |
-                                   (((code_t >>  9) & 7) << 20) |
-                                   (((code_o >>  8) & 7) << 17) |
-                                   (((code_t >>  6) & 7) << 14) |
-                                   (((code_o >>  5) & 7) << 11) |
-                                   (((code_t >>  3) & 7) <<  8) |
-                                   (((code_o >>  2) & 7) <<  5) |
-                                   (((code_t      ) & 7) <<  3) |
-                                   (((code_o      ) & 3));
-                    tmp1.push_back(std::make_pair(sort_key, i));
-
-                    if (i % 100 == 0)
-                        printf("(%g,%g), code_o=0x%08x, code_t=0x%08x, sortkey=0x%08x\n", dx, dy, code_o, code_t, sort_key);
-                }
-                sort(tmp1.begin(), tmp1.end());
-                std::vector<std::pair<glm::vec4, int>> tmp2;
-                for (const auto& x : tmp1)
-                {
-                    tmp2.push_back(tmp.at(x.second));
-                }
-                tmp = tmp2;
-            }
-
-            // Sorting happens here
-            const int BLK_W = 32, BLK_H = 32;
-            for (int y0 = 0; y0 < RT_H; y0 += BLK_H)
-            {
-                for (int x0 = 0; x0 < RT_W; x0 += BLK_W)
-                {
-                    // Record original data
-                    std::vector<std::pair<glm::vec4, int>> block;
-                    for (int y1 = 0; y1 < BLK_H; y1++)
-                    {
-                        for (int x1 = 0; x1 < BLK_W; x1++)
-                        {
-                            if (x1 + x0 >= RT_W || y1 + y0 >= RT_H)
-                                continue;
-                            block.push_back(tmp[(x1 + x0) + (y1 + y0) * RT_W]);
-                        }
-                    }
-
-                    // Sort block
-                    if (g_use_ray_binning == 3)
-                    {
-                        const int NUM_BINS_W = 4, NUM_BINS_H = 4;
-                        std::vector<int> occs(NUM_BINS_W * NUM_BINS_H);
-                        std::vector<int> bin_idxes;
-                        for (const auto& x : block)
-                        {
-                            glm::vec2 enc = OctEncode(glm::vec3(x.first));
-                            int       bidx = NUM_BINS_H * NUM_BINS_W - 1;
-                            if (!isnan(enc.x))
-                            {
-                                int gridx = int(enc.x * NUM_BINS_W);
-                                int gridy = int(enc.y * NUM_BINS_H);
-                                assert(gridx >= 0 && gridx < NUM_BINS_W);
-                                assert(gridy >= 0 && gridy < NUM_BINS_H);
-                                bidx = gridy * NUM_BINS_W + gridx;
-                            }
-                            bin_idxes.push_back(bidx);
-                            occs[bidx]++;
-                        }
-
-                        std::vector<int> offsets(NUM_BINS_W * NUM_BINS_H);
-
-                        int s = 0;
-                        for (int i = 0; i < NUM_BINS_W * NUM_BINS_H; i++)
-                        {
-                            offsets[i] = s;
-                            s += occs[i];
-                        }
 
-                        std::vector<std::pair<glm::vec4, int>> block_binned(BLK_W * BLK_H);
-                        for (int i = 0; i < block.size(); i++)
-                        {
-                            int bidx = bin_idxes[i];
-                            block_binned[offsets[bidx]++] = block[i];
-                        }
-                        block = block_binned;
-                    }
+            RayBinningSettings settings;
+            settings.mode         = g_use_ray_binning;
+            settings.width        = RT_W;
+            settings.height       = RT_H;
+            settings.inverse_view = g_inv_view;
+            settings.inverse_proj = g_inv_proj;
+            settings.invert_y     = g_invert_y;
+            settings.cam_pos      = g_cam_pos;
+            settings.scene_min    = g_scene_aabb_min;
+            settings.scene_max    = g_scene_aabb_max;
+            g_ray_binner.Start(settings, mapped);
 
-                    // Put back
-                    int bidx = 0;
-                    for (int y1 = 0; y1 < BLK_H; y1++)
-                    {
-                        for (int x1 = 0; x1 < BLK_W; x1++)
-                        {
-                            if (x1 + x0 >= RT_W || y1 + y0 >= RT_H)
-                                continue;
-                            tmp[(x1 + x0) + (y1 + y0) * RT_W] = block[bidx];
-                            bidx++;
-                        }
-                    }
-                }
-            }
+            g_hitpos_ao_readback->Unmap(0, nullptr);
+            g_ray_binning_uploaded = 0;
+            g_ray_mapping_dirty    = false;
+        }
 
-            std::vector<glm::vec3> raydirs;
-            std::vector<int>       raymappings;
-            for (int i = 0; i < RT_W * RT_H; i++)
-            {
-                raydirs.push_back(glm::vec3(tmp[i].first));
-                raymappings.push_back(tmp[i].second);
-            }
+        // A result that was overtaken by another change is dropped; the binning restarts above
+        if (g_ray_binner.TakeResult() && !g_ray_mapping_dirty)
+        {
+            RRA_PROFILE_SCOPE("RayBinningUpload");
+            CE(g_command_list->Reset(g_command_allocator, nullptr));
 
             void* mapped1;
             g_aoray_dirs_upload->Map(0, nullptr, &mapped1);
-            memcpy(mapped1, raydirs.data(), sizeof(glm::vec3) * RT_W * RT_H);
+            memcpy(mapped1, g_ray_binner.Directions().data(), sizeof(glm::vec3) * RT_W * RT_H);
             g_aoray_dirs_upload->Unmap(0, nullptr);
 
             g_ray_mapping_upload->Map(0, nullptr, &mapped1);
-            memcpy(mapped1, raymappings.data(), sizeof(int) * RT_W * RT_H);
+            memcpy(mapped1, g_ray_binner.Mapping().data(), sizeof(int) * RT_W * RT_H);
             g_ray_mapping_upload->Unmap(0, nullptr);
 
             D3D12_RESOURCE_BARRIER bar{};
@@ -2048,12 +2006,13 @@ void Render()
             bar.Transition.StateAfter  = D3D12_RESOURCE_STATE_GENERIC_READ;
             g_command_list->ResourceBarrier(1, &bar);
 
-            g_ray_mapping_dirty = false;
-
             CE(g_command_list->Close());
             g_command_queue->ExecuteCommandLists(1, (ID3D12CommandList* const*)&g_command_list);
             WaitForPreviousFrame();
             CE(g_command_allocator->Reset());
+
+            g_ray_binning_uploaded = g_ray_binner.Settings().mode;
+            printf("Ray binning mode %d: %dx%d rays in %.1f ms on %u thread(s)\n", g_ray_binning_uploaded, RT_W, RT_H, g_ray_binner.LastMillis(), GetNumWorkerThreads());
         }
     }
 
@@ -2066,6 +2025,8 @@ void Render()
     memcpy(timestamps, mapped, 2 * sizeof(uint64_t));
     g_query_readback_buffer->Unmap(0, nullptr);
     float sec = (timestamps[1] - timestamps[0]) * 1.0f / freq;
+    if (g_as_built)  // Frames during loading are throttled and show the loading screen
+        g_gpu_frame_times.Record(uint64_t((timestamps[1] - timestamps[0]) * 1e9 / freq));
 
     g_frame_time.AddSample(sec);
     g_frame_time_sliding_window.AddSample(sec);
@@ -2088,7 +2049,16 @@ void Render()
                         
                         g_bmk_ft_count = 0;
                         g_bmk_frametimes.push_back(g_frame_time.GetFrameTime() * 1000);
-                        printf("Benchmarked sample count %d/%d = %g ms\n", g_ao_sample_count, BMK_AO_SAMPLE_COUNT_LIMIT, g_bmk_frametimes.back());
+                        const FrameTimeSummary gpu = SummarizeFrameTimes(g_gpu_frame_times);
+                        printf("Benchmarked sample count %d/%d = %g ms (GPU p50 %.3f, p99 %.3f, max %.3f ms)\n",
+                               g_ao_sample_count,
+                               BMK_AO_SAMPLE_COUNT_LIMIT,
+                               g_bmk_frametimes.back(),
+                               gpu.p50_ms,
+                               gpu.p99_ms,
+                               gpu.max_ms);
+                        g_cpu_frame_times.Reset();
+                        g_gpu_frame_times.Reset();
                         g_ao_sample_count++;
                         if (g_ao_sample_count > BMK_AO_SAMPLE_COUNT_LIMIT)
                         {
@@ -2132,54 +2102,23 @@ void Render()
     }
 }
 
-void CreateAS(const std::vector<std::vector<glm::vec3>>& vertices, const std::vector<InstanceInfo>& inst_infos)
+// Builds the TLAS of one scene view over the shared BLASes, plus the index and vertex offsets of each of its instances
+SceneViewAS CreateSceneViewAS(std::span<ID3D12Resource* const> blases, std::span<const glm::uvec2> blas_offsets, std::span<const InstanceInfo> inst_infos)
 {
-    g_app_state            = AppState::APP_BUILD_BLAS_TLAS;
-    g_app_current_progress = 0;
-
-    std::vector<ID3D12Resource*> blases;
-    std::vector<ID3D12Resource*> transform_buffers;
-
+    std::vector<ID3D12Resource*>                transform_buffers;
     std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instance_descs;
-    ID3D12Resource*                             tlas_insts;
+    std::vector<glm::uvec2>                     inst_offsets;
 
-    // Overall vertices and offsets
-    std::vector<glm::vec3> all_verts;
-    std::vector<int>       blas_offsets, inst_offsets;
-
-    for (uint32_t i_blas = 0; i_blas < vertices.size(); i_blas++)
+    for (uint32_t i_inst = 0; i_inst < inst_infos.size(); i_inst++)
     {
-        g_app_current_progress = i_blas * 1.0f / vertices.size();
-        g_app_current_progress_string = std::to_string(i_blas + 1) + "/" + std::to_string(vertices.size());
-
-        ID3D12Resource*               verts_buf;
-        size_t                        num_verts = vertices[i_blas].size();
-        const std::vector<glm::vec3>* verts     = &(vertices[i_blas]);
-
-        std::vector<glm::vec3> dummy = {{0, 0, 0}, {0, 1, 0}, {1, 0, 0}};
-
-        if (num_verts < 1)  // FIXME: Why does BLAS[0] have 0 vertices
-        {
-            num_verts = 3;
-            verts     = &dummy;
-        }
-
-        size_t verts_size = sizeof(glm::vec3) * num_verts;
-
-        blas_offsets.push_back(all_verts.size());
-        all_verts.insert(all_verts.end(), verts->begin(), verts->end());
+        const InstanceInfo& info = inst_infos[i_inst];
+        ID3D12Resource*     transform_buf;
 
-        D3D12_HEAP_PROPERTIES heap_props{};
-        heap_props.Type                 = D3D12_HEAP_TYPE_UPLOAD;
-        heap_props.CPUPageProperty      = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-        heap_props.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-        heap_props.CreationNodeMask     = 1;
-        heap_props.VisibleNodeMask      = 1;
+        inst_offsets.push_back(blas_offsets[info.blas_idx]);
 
         D3D12_RESOURCE_DESC res_desc{};
         res_desc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
         res_desc.Alignment          = 0;
-        res_desc.Width              = verts_size;
         res_desc.Height             = 1;
         res_desc.DepthOrArraySize   = 1;
         res_desc.MipLevels          = 1;
@@ -2188,158 +2127,35 @@ void CreateAS(const std::vector<std::vector<glm::vec3>>& vertices, const std::ve
         res_desc.SampleDesc.Quality = 0;
         res_desc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
         res_desc.Flags              = D3D12_RESOURCE_FLAG_NONE;
+        res_desc.Width              = sizeof(float) * 12;
 
-        CE(g_device12->CreateCommittedResource(
-            &heap_props, D3D12_HEAP_FLAG_NONE, &res_desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&verts_buf)));
-        char*       mapped{nullptr};
-        verts_buf->Map(0, nullptr, (void**)(&mapped));
-        memcpy(mapped, verts->data(), verts_size);
-        verts_buf->Unmap(0, nullptr);
-        verts_buf->SetName(L"Verts Buf BLAS");
-
-        D3D12_RAYTRACING_GEOMETRY_DESC geom_desc{};
-        geom_desc.Type                                 = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-        geom_desc.Triangles.VertexBuffer.StartAddress  = verts_buf->GetGPUVirtualAddress();
-        geom_desc.Triangles.VertexBuffer.StrideInBytes = sizeof(glm::vec3);
-        geom_desc.Triangles.VertexCount                = num_verts;
-        geom_desc.Triangles.VertexFormat               = DXGI_FORMAT_R32G32B32_FLOAT;
-        geom_desc.Triangles.IndexBuffer                = 0;
-        geom_desc.Triangles.IndexFormat                = DXGI_FORMAT_UNKNOWN;
-        geom_desc.Triangles.IndexCount                 = 0;
-        geom_desc.Triangles.Transform3x4               = 0;
-        //transform_buf->GetGPUVirtualAddress();
-        geom_desc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NONE;
-
-        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs{};
-        inputs.Type           = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-        inputs.DescsLayout    = D3D12_ELEMENTS_LAYOUT_ARRAY;
-        inputs.NumDescs       = 1;
-        inputs.pGeometryDescs = &geom_desc;
-        inputs.Flags          = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
-
-        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO pb_info{};
-        g_device12->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &pb_info);
-        printf("BLAS[%u] prebuild info:", i_blas);
-        printf(" Scratch: %d", int(pb_info.ScratchDataSizeInBytes));
-        printf(", Result : %d\n", int(pb_info.ResultDataMaxSizeInBytes));
-        glfwSetWindowTitle(g_window, (std::string("Building BLAS ") + std::to_string(i_blas+1) + "/" + std::to_string(vertices.size())).c_str());
-
-        D3D12_RESOURCE_DESC scratch_desc{};
-        scratch_desc.Alignment          = 0;
-        scratch_desc.DepthOrArraySize   = 1;
-        scratch_desc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
-        scratch_desc.Flags              = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
-        scratch_desc.Format             = DXGI_FORMAT_UNKNOWN;
-        scratch_desc.Height             = 1;
-        scratch_desc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-        scratch_desc.MipLevels          = 1;
-        scratch_desc.SampleDesc.Count   = 1;
-        scratch_desc.SampleDesc.Quality = 0;
-        scratch_desc.Width              = pb_info.ScratchDataSizeInBytes;
-
-        heap_props.Type                 = D3D12_HEAP_TYPE_DEFAULT;
+        D3D12_HEAP_PROPERTIES heap_props{};
+        heap_props.Type                 = D3D12_HEAP_TYPE_UPLOAD;
         heap_props.CPUPageProperty      = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
         heap_props.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
         heap_props.CreationNodeMask     = 1;
         heap_props.VisibleNodeMask      = 1;
 
-        ID3D12Resource* blas_scratch;
-        ID3D12Resource* blas_result;
-
+        char* mapped{};
         CE(g_device12->CreateCommittedResource(
-            &heap_props, D3D12_HEAP_FLAG_NONE, &scratch_desc, D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&blas_scratch)));
-        blas_scratch->SetName(L"BLAS Scratch");
-
-        D3D12_RESOURCE_DESC result_desc = scratch_desc;
-        result_desc.Width               = pb_info.ResultDataMaxSizeInBytes;
+            &heap_props, D3D12_HEAP_FLAG_NONE, &res_desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&transform_buf)));
+        D3D12_RANGE read_range{};
+        read_range.Begin = read_range.End = 0;
+        transform_buf->Map(0, &read_range, (void**)(&mapped));
+        memcpy(mapped, info.transform, sizeof(float) * 12);
+        transform_buf->Unmap(0, nullptr);
 
-        CE(g_device12->CreateCommittedResource(
-            &heap_props, D3D12_HEAP_FLAG_NONE, &result_desc, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&blas_result)));
-        blas_result->SetName(L"BLAS Result");
+        transform_buffers.push_back(transform_buf);
 
-        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC build_desc{};
-        build_desc.Inputs.Type                      = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-        build_desc.Inputs.DescsLayout               = D3D12_ELEMENTS_LAYOUT_ARRAY;
-        build_desc.Inputs.NumDescs                  = 1;
-        build_desc.Inputs.pGeometryDescs            = &geom_desc;
-        build_desc.DestAccelerationStructureData    = blas_result->GetGPUVirtualAddress();
-        build_desc.ScratchAccelerationStructureData = blas_scratch->GetGPUVirtualAddress();
-        build_desc.SourceAccelerationStructureData  = 0;
-        build_desc.Inputs.Flags                     = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
-
-        // Build BLAS
-        g_command_list1->Reset(g_command_allocator1, nullptr);
-        
-        D3D12_RESOURCE_BARRIER barrier{};
-        barrier.Type                   = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-        barrier.Transition.pResource   = blas_scratch;
-        barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_COMMON;
-        barrier.Transition.StateAfter  = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-        g_command_list1->ResourceBarrier(1, &barrier);
-
-        g_command_list1->BuildRaytracingAccelerationStructure(&build_desc, 0, nullptr);
-
-        D3D12_RESOURCE_BARRIER barrier1{};
-        barrier1.Type          = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-        barrier1.UAV.pResource = blas_result;
-        g_command_list1->ResourceBarrier(1, &barrier1);
-
-        g_command_list1->Close();
-
-        g_command_queue->ExecuteCommandLists(1, (ID3D12CommandList* const*)(&g_command_list1));
-        WaitForPreviousFrame();
-
-        blas_scratch->Release();
-        blases.push_back(blas_result);
-    }
-
-    for (uint32_t i_inst = 0; i_inst < inst_infos.size(); i_inst++)
-    {
-        const InstanceInfo& info = inst_infos[i_inst];
-        ID3D12Resource*     transform_buf;
-
-        inst_offsets.push_back(blas_offsets.at(info.blas_idx));
-
-        D3D12_RESOURCE_DESC res_desc{};
-        res_desc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
-        res_desc.Alignment          = 0;
-        res_desc.Height             = 1;
-        res_desc.DepthOrArraySize   = 1;
-        res_desc.MipLevels          = 1;
-        res_desc.Format             = DXGI_FORMAT_UNKNOWN;
-        res_desc.SampleDesc.Count   = 1;
-        res_desc.SampleDesc.Quality = 0;
-        res_desc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-        res_desc.Flags              = D3D12_RESOURCE_FLAG_NONE;
-        res_desc.Width              = sizeof(float) * 12;
-
-        D3D12_HEAP_PROPERTIES heap_props{};
-        heap_props.Type                 = D3D12_HEAP_TYPE_UPLOAD;
-        heap_props.CPUPageProperty      = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-        heap_props.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-        heap_props.CreationNodeMask     = 1;
-        heap_props.VisibleNodeMask      = 1;
-
-        char* mapped{};
-        CE(g_device12->CreateCommittedResource(
-            &heap_props, D3D12_HEAP_FLAG_NONE, &res_desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&transform_buf)));
-        D3D12_RANGE read_range{};
-        read_range.Begin = read_range.End = 0;
-        transform_buf->Map(0, &read_range, (void**)(&mapped));
-        memcpy(mapped, info.transform, sizeof(float) * 12);
-        transform_buf->Unmap(0, nullptr);
-
-        transform_buffers.push_back(transform_buf);
-
-        D3D12_RAYTRACING_INSTANCE_DESC inst_desc{};
-        inst_desc.InstanceID                          = i_inst;
-        inst_desc.InstanceContributionToHitGroupIndex = 0;
-        inst_desc.Flags                               = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
-        memcpy(inst_desc.Transform, info.transform, sizeof(float) * 12);
-        inst_desc.AccelerationStructure = blases[info.blas_idx]->GetGPUVirtualAddress();
-        inst_desc.InstanceMask          = 0xFF;
-        instance_descs.push_back(inst_desc);
-    }
+        D3D12_RAYTRACING_INSTANCE_DESC inst_desc{};
+        inst_desc.InstanceID                          = i_inst;
+        inst_desc.InstanceContributionToHitGroupIndex = 0;
+        inst_desc.Flags                               = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
+        memcpy(inst_desc.Transform, info.transform, sizeof(float) * 12);
+        inst_desc.AccelerationStructure = blases[info.blas_idx]->GetGPUVirtualAddress();
+        inst_desc.InstanceMask          = 0xFF;
+        instance_descs.push_back(inst_desc);
+    }
 
     D3D12_RESOURCE_DESC tlas_insts_desc_desc{};
     tlas_insts_desc_desc.Alignment          = 0;
@@ -2352,7 +2168,7 @@ void CreateAS(const std::vector<std::vector<glm::vec3>>& vertices, const std::ve
     tlas_insts_desc_desc.MipLevels          = 1;
     tlas_insts_desc_desc.SampleDesc.Count   = 1;
     tlas_insts_desc_desc.SampleDesc.Quality = 0;
-    tlas_insts_desc_desc.Width              = sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instance_descs.size();
+    tlas_insts_desc_desc.Width              = sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * std::max<size_t>(instance_descs.size(), 1);
 
     D3D12_HEAP_PROPERTIES heap_props{};
     heap_props.Type                 = D3D12_HEAP_TYPE_UPLOAD;
@@ -2444,16 +2260,100 @@ void CreateAS(const std::vector<std::vector<glm::vec3>>& vertices, const std::ve
     // Cannot release until command is done
     tlas_scratch->Release();
 
-    // SRV of TLAS
+    // Index and vertex offsets of every instance, indexed by InstanceID
+    D3D12_RESOURCE_DESC res_desc{};
+    res_desc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
+    res_desc.Alignment          = 0;
+    res_desc.Height             = 1;
+    res_desc.DepthOrArraySize   = 1;
+    res_desc.MipLevels          = 1;
+    res_desc.Format             = DXGI_FORMAT_UNKNOWN;
+    res_desc.SampleDesc.Count   = 1;
+    res_desc.SampleDesc.Quality = 0;
+    res_desc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+    res_desc.Flags              = D3D12_RESOURCE_FLAG_NONE;
+    res_desc.Width              = std::max<size_t>(inst_offsets.size(), 1) * sizeof(glm::uvec2);
+
+    heap_props.Type = D3D12_HEAP_TYPE_UPLOAD;
+    ID3D12Resource* d_inst_offsets;
+    CE(g_device12->CreateCommittedResource(
+        &heap_props, D3D12_HEAP_FLAG_NONE, &res_desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&d_inst_offsets)));
+    d_inst_offsets->Map(0, nullptr, (void**)(&mapped));
+    memcpy(mapped, inst_offsets.data(), inst_offsets.size() * sizeof(glm::uvec2));
+    d_inst_offsets->Unmap(0, nullptr);
+
+    SceneViewAS view;
+    view.tlas          = tlas_result;
+    view.inst_offsets  = d_inst_offsets;
+    view.num_instances = uint32_t(inst_offsets.size());
+    return view;
+}
+
+// Points the TLAS and instance offset SRVs at scene view v. Only called while the GPU is idle.
+void BindSceneView(uint32_t v)
+{
+    const SceneViewAS& view = g_scene_view_as.at(v);
+
     D3D12_CPU_DESCRIPTOR_HANDLE srv_handle(g_srv_uav_cbv_heap->GetCPUDescriptorHandleForHeapStart());
     srv_handle.ptr += g_srv_uav_cbv_descriptor_size;
     D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc{};
     srv_desc.Format                                   = DXGI_FORMAT_UNKNOWN;
     srv_desc.ViewDimension                            = D3D12_SRV_DIMENSION_RAYTRACING_ACCELERATION_STRUCTURE;
     srv_desc.Shader4ComponentMapping                  = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-    srv_desc.RaytracingAccelerationStructure.Location = tlas_result->GetGPUVirtualAddress();
+    srv_desc.RaytracingAccelerationStructure.Location = view.tlas->GetGPUVirtualAddress();
     g_device12->CreateShaderResourceView(nullptr, &srv_desc, srv_handle);
 
+    srv_handle = D3D12_CPU_DESCRIPTOR_HANDLE(g_srv_uav_cbv_heap->GetCPUDescriptorHandleForHeapStart());
+    srv_handle.ptr += 4 * g_srv_uav_cbv_descriptor_size;
+
+    srv_desc                            = {};
+    srv_desc.Buffer.FirstElement        = 0;
+    srv_desc.Buffer.Flags               = D3D12_BUFFER_SRV_FLAG_NONE;
+    srv_desc.Buffer.NumElements         = std::max(view.num_instances, 1U);
+    srv_desc.Buffer.StructureByteStride = sizeof(glm::uvec2);
+    srv_desc.Format                     = DXGI_FORMAT_UNKNOWN;
+    srv_desc.Shader4ComponentMapping    = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    srv_desc.ViewDimension              = D3D12_SRV_DIMENSION_BUFFER;
+    g_device12->CreateShaderResourceView(view.inst_offsets, &srv_desc, srv_handle);
+
+    g_scene_view = v;
+}
+
+// Builds every BLAS once, then one TLAS per scene view over them. inst_infos holds the instances of all views, view v
+// owning [view_offsets[v], view_offsets[v + 1]).
+void CreateAS(const BlasGeometrySpans& geometry, std::span<const InstanceInfo> inst_infos, std::span<const uint64_t> view_offsets)
+{
+    RRA_PROFILE_SCOPE("CreateAS");
+    g_app_state            = AppState::APP_BUILD_BLAS_TLAS;
+    g_app_current_progress = 0;
+
+    static const glm::vec3 dummy_verts[3]   = {{0, 0, 0}, {0, 1, 0}, {1, 0, 0}};
+    static const uint32_t  dummy_indices[3] = {0, 1, 2};
+
+    // The vertices and indices of all BLASes go into one buffer each. The BLAS builds read their part of them, and the
+    // hit shaders find it through the offsets of the instance; indices stay relative to the first vertex of their BLAS.
+    std::vector<BlasGeometry> blas_geom(geometry.begin(), geometry.end());
+    std::vector<glm::uvec2>   blas_offsets;  // First index, first vertex
+    size_t                    num_verts = 0, num_indices = 0;
+    for (BlasGeometry& geom : blas_geom)
+    {
+        if (geom.NumTriangles() < 1)  // FIXME: Why does BLAS[0] have 0 vertices
+        {
+            geom.vertices = dummy_verts;
+            geom.indices  = dummy_indices;
+        }
+        blas_offsets.push_back(glm::uvec2(num_indices, num_verts));
+        num_verts += geom.vertices.size();
+        num_indices += geom.indices.size();
+    }
+
+    D3D12_HEAP_PROPERTIES heap_props{};
+    heap_props.Type                 = D3D12_HEAP_TYPE_UPLOAD;
+    heap_props.CPUPageProperty      = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+    heap_props.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+    heap_props.CreationNodeMask     = 1;
+    heap_props.VisibleNodeMask      = 1;
+
     D3D12_RESOURCE_DESC res_desc{};
     res_desc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
     res_desc.Alignment          = 0;
@@ -2465,36 +2365,151 @@ void CreateAS(const std::vector<std::vector<glm::vec3>>& vertices, const std::ve
     res_desc.SampleDesc.Quality = 0;
     res_desc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
     res_desc.Flags              = D3D12_RESOURCE_FLAG_NONE;
-    res_desc.Width              = all_verts.size() * sizeof(Vertex);
-
-    heap_props.Type                 = D3D12_HEAP_TYPE_UPLOAD;
-    heap_props.CPUPageProperty      = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-    heap_props.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-    heap_props.CreationNodeMask     = 1;
-    heap_props.VisibleNodeMask      = 1;
 
     ID3D12Resource* d_all_verts;
+    ID3D12Resource* d_all_indices;
+    res_desc.Width = std::max<size_t>(num_verts, 1) * sizeof(glm::vec3);
     CE(g_device12->CreateCommittedResource(
         &heap_props, D3D12_HEAP_FLAG_NONE, &res_desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&d_all_verts)));
-    d_all_verts->Map(0, nullptr, (void**)(&mapped));
-    memcpy(mapped, all_verts.data(), res_desc.Width);
+    d_all_verts->SetName(L"All Verts");
+    res_desc.Width = std::max<size_t>(num_indices, 1) * sizeof(uint32_t);
+    CE(g_device12->CreateCommittedResource(
+        &heap_props, D3D12_HEAP_FLAG_NONE, &res_desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&d_all_indices)));
+    d_all_indices->SetName(L"All Indices");
+
+    glm::vec3* mapped_verts{};
+    uint32_t*  mapped_indices{};
+    d_all_verts->Map(0, nullptr, (void**)(&mapped_verts));
+    d_all_indices->Map(0, nullptr, (void**)(&mapped_indices));
+    for (uint32_t i_blas = 0; i_blas < blas_geom.size(); i_blas++)
+    {
+        const BlasGeometry& geom = blas_geom[i_blas];
+        memcpy(mapped_verts + blas_offsets[i_blas].y, geom.vertices.data(), sizeof(glm::vec3) * geom.vertices.size());
+        memcpy(mapped_indices + blas_offsets[i_blas].x, geom.indices.data(), sizeof(uint32_t) * geom.indices.size());
+    }
     d_all_verts->Unmap(0, nullptr);
+    d_all_indices->Unmap(0, nullptr);
 
-    res_desc.Width = inst_offsets.size() * sizeof(int);
-    ID3D12Resource* d_inst_offsets;
-    CE(g_device12->CreateCommittedResource(
-        &heap_props, D3D12_HEAP_FLAG_NONE, &res_desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&d_inst_offsets)));
-    d_inst_offsets->Map(0, nullptr, (void**)(&mapped));
-    memcpy(mapped, inst_offsets.data(), res_desc.Width);
-    d_inst_offsets->Unmap(0, nullptr);
+    std::vector<ID3D12Resource*> blases;
 
-    srv_handle = D3D12_CPU_DESCRIPTOR_HANDLE(g_srv_uav_cbv_heap->GetCPUDescriptorHandleForHeapStart());
+    for (uint32_t i_blas = 0; i_blas < blas_geom.size(); i_blas++)
+    {
+        g_app_current_progress = i_blas * 1.0f / blas_geom.size();
+        g_app_current_progress_string = std::to_string(i_blas + 1) + "/" + std::to_string(blas_geom.size());
+
+        const BlasGeometry& geom = blas_geom[i_blas];
+
+        D3D12_RAYTRACING_GEOMETRY_DESC geom_desc{};
+        geom_desc.Type                                 = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+        geom_desc.Triangles.VertexBuffer.StartAddress  = d_all_verts->GetGPUVirtualAddress() + sizeof(glm::vec3) * blas_offsets[i_blas].y;
+        geom_desc.Triangles.VertexBuffer.StrideInBytes = sizeof(glm::vec3);
+        geom_desc.Triangles.VertexCount                = geom.vertices.size();
+        geom_desc.Triangles.VertexFormat               = DXGI_FORMAT_R32G32B32_FLOAT;
+        geom_desc.Triangles.IndexBuffer                = d_all_indices->GetGPUVirtualAddress() + sizeof(uint32_t) * blas_offsets[i_blas].x;
+        geom_desc.Triangles.IndexFormat                = DXGI_FORMAT_R32_UINT;
+        geom_desc.Triangles.IndexCount                 = geom.indices.size();
+        geom_desc.Triangles.Transform3x4               = 0;
+        //transform_buf->GetGPUVirtualAddress();
+        geom_desc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NONE;
+
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs{};
+        inputs.Type           = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+        inputs.DescsLayout    = D3D12_ELEMENTS_LAYOUT_ARRAY;
+        inputs.NumDescs       = 1;
+        inputs.pGeometryDescs = &geom_desc;
+        inputs.Flags          = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO pb_info{};
+        g_device12->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &pb_info);
+        printf("BLAS[%u] prebuild info:", i_blas);
+        printf(" Scratch: %d", int(pb_info.ScratchDataSizeInBytes));
+        printf(", Result : %d\n", int(pb_info.ResultDataMaxSizeInBytes));
+        glfwSetWindowTitle(g_window, (std::string("Building BLAS ") + std::to_string(i_blas+1) + "/" + std::to_string(blas_geom.size())).c_str());
+
+        D3D12_RESOURCE_DESC scratch_desc{};
+        scratch_desc.Alignment          = 0;
+        scratch_desc.DepthOrArraySize   = 1;
+        scratch_desc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
+        scratch_desc.Flags              = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+        scratch_desc.Format             = DXGI_FORMAT_UNKNOWN;
+        scratch_desc.Height             = 1;
+        scratch_desc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        scratch_desc.MipLevels          = 1;
+        scratch_desc.SampleDesc.Count   = 1;
+        scratch_desc.SampleDesc.Quality = 0;
+        scratch_desc.Width              = pb_info.ScratchDataSizeInBytes;
+
+        heap_props.Type                 = D3D12_HEAP_TYPE_DEFAULT;
+        heap_props.CPUPageProperty      = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+        heap_props.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+        heap_props.CreationNodeMask     = 1;
+        heap_props.VisibleNodeMask      = 1;
+
+        ID3D12Resource* blas_scratch;
+        ID3D12Resource* blas_result;
+
+        CE(g_device12->CreateCommittedResource(
+            &heap_props, D3D12_HEAP_FLAG_NONE, &scratch_desc, D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&blas_scratch)));
+        blas_scratch->SetName(L"BLAS Scratch");
+
+        D3D12_RESOURCE_DESC result_desc = scratch_desc;
+        result_desc.Width               = pb_info.ResultDataMaxSizeInBytes;
+
+        CE(g_device12->CreateCommittedResource(
+            &heap_props, D3D12_HEAP_FLAG_NONE, &result_desc, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&blas_result)));
+        blas_result->SetName(L"BLAS Result");
+
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC build_desc{};
+        build_desc.Inputs.Type                      = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+        build_desc.Inputs.DescsLayout               = D3D12_ELEMENTS_LAYOUT_ARRAY;
+        build_desc.Inputs.NumDescs                  = 1;
+        build_desc.Inputs.pGeometryDescs            = &geom_desc;
+        build_desc.DestAccelerationStructureData    = blas_result->GetGPUVirtualAddress();
+        build_desc.ScratchAccelerationStructureData = blas_scratch->GetGPUVirtualAddress();
+        build_desc.SourceAccelerationStructureData  = 0;
+        build_desc.Inputs.Flags                     = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+
+        // Build BLAS
+        g_command_list1->Reset(g_command_allocator1, nullptr);
+        
+        D3D12_RESOURCE_BARRIER barrier{};
+        barrier.Type                   = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+        barrier.Transition.pResource   = blas_scratch;
+        barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_COMMON;
+        barrier.Transition.StateAfter  = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+        g_command_list1->ResourceBarrier(1, &barrier);
+
+        g_command_list1->BuildRaytracingAccelerationStructure(&build_desc, 0, nullptr);
+
+        D3D12_RESOURCE_BARRIER barrier1{};
+        barrier1.Type          = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+        barrier1.UAV.pResource = blas_result;
+        g_command_list1->ResourceBarrier(1, &barrier1);
+
+        g_command_list1->Close();
+
+        g_command_queue->ExecuteCommandLists(1, (ID3D12CommandList* const*)(&g_command_list1));
+        WaitForPreviousFrame();
+
+        blas_scratch->Release();
+        blases.push_back(blas_result);
+    }
+
+    const uint32_t num_views = std::max(GetNumSceneViews(view_offsets), 1U);  // A capture without TLASes gets an empty one
+    g_scene_view_as.clear();
+    for (uint32_t v = 0; v < num_views; v++)
+    {
+        g_app_current_progress_string = "TLAS " + std::to_string(v + 1) + "/" + std::to_string(num_views);
+        g_scene_view_as.push_back(CreateSceneViewAS(blases, blas_offsets, GetSceneViewInstances(inst_infos, view_offsets, v)));
+    }
+
+    D3D12_CPU_DESCRIPTOR_HANDLE srv_handle(g_srv_uav_cbv_heap->GetCPUDescriptorHandleForHeapStart());
     srv_handle.ptr += 3 * g_srv_uav_cbv_descriptor_size;
 
-    srv_desc                            = {};
+    D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc{};
     srv_desc.Buffer.FirstElement        = 0;
     srv_desc.Buffer.Flags               = D3D12_BUFFER_SRV_FLAG_NONE;
-    srv_desc.Buffer.NumElements         = all_verts.size();
+    srv_desc.Buffer.NumElements         = std::max<size_t>(num_verts, 1);
     static_assert(sizeof(glm::vec3) == sizeof(Vertex));
     srv_desc.Buffer.StructureByteStride = sizeof(glm::vec3);
     srv_desc.Format                     = DXGI_FORMAT_UNKNOWN;
@@ -2502,10 +2517,19 @@ void CreateAS(const std::vector<std::vector<glm::vec3>>& vertices, const std::ve
     srv_desc.ViewDimension              = D3D12_SRV_DIMENSION_BUFFER;
     g_device12->CreateShaderResourceView(d_all_verts, &srv_desc, srv_handle);
 
-    srv_handle.ptr += g_srv_uav_cbv_descriptor_size;
-    srv_desc.Buffer.NumElements         = inst_offsets.size();
-    srv_desc.Buffer.StructureByteStride = sizeof(int);
-    g_device12->CreateShaderResourceView(d_inst_offsets, &srv_desc, srv_handle);
+    srv_handle = D3D12_CPU_DESCRIPTOR_HANDLE(g_srv_uav_cbv_heap->GetCPUDescriptorHandleForHeapStart());
+    srv_handle.ptr += 10 * g_srv_uav_cbv_descriptor_size;
+
+    srv_desc.Buffer.NumElements         = std::max<size_t>(num_indices, 1);
+    srv_desc.Buffer.StructureByteStride = sizeof(uint32_t);
+    g_device12->CreateShaderResourceView(d_all_indices, &srv_desc, srv_handle);
+
+    if (g_scene_view >= num_views)
+    {
+        printf("The capture has %u TLAS(es), showing TLAS 0 instead of %u\n", num_views, g_scene_view);
+        g_scene_view = 0;
+    }
+    BindSceneView(g_scene_view);
 }
 
 void LoadCubeAndCreateAS()
@@ -2599,9 +2623,18 @@ void LoadCubeAndCreateAS()
     g_scene_aabb_min = {-1, -1, -1};
     g_scene_aabb_max = {1, 1, 1};
 
-    std::vector<InstanceInfo> infos = {info};
+    std::vector<InstanceInfo> infos           = {info};
+    const uint64_t            view_offsets[] = {0, 1};
 
-    CreateAS(verts, infos);
+    std::vector<IndexedBlas> blases(verts.size());
+    for (size_t i = 0; i < verts.size(); i++)
+    {
+        if (g_weld_vertices)
+            WeldVertices(verts[i], &blases[i]);
+        else
+            IndexTriangleSoup(verts[i], &blases[i]);
+    }
+    CreateAS(ToBlasGeometrySpans(blases), infos, view_offsets);
 
     // Set Camera
     glm::vec3 eye(0, 0, 5);
@@ -2625,358 +2658,127 @@ void LoadCubeAndCreateAS()
     g_raygen_cb->Unmap(0, nullptr);
 }
 
-void OpenRRAFile(const char* rra_file_name)
+// Loads the trace of the viewer, or quits since there is nothing else to show
+void OpenViewerRRAFile(const char* rra_file_name)
 {
     g_app_state = AppState::APP_OPENING_RRA_FILE;
-    if (!std::filesystem::exists(rra_file_name))
-    {
-        printf("%s does not exist.\n", rra_file_name);
-        exit(1);
-    }
-
-    RraErrorCode ec = RraTraceLoaderLoad(rra_file_name);
-    printf("Error: %d\n", static_cast<int>(ec));
-    if (ec)
+    if (!OpenRRAFile(rra_file_name))
     {
         printf("Error encountered, quitting.\n");
         exit(1);
     }
 }
 
+// Decodes the geometry of the trace into the scene views. Returns the instances of all views back to back, the view
+// offsets into them and the indexed BLASes.
 std::tuple<std::vector<InstanceInfo>,
-           std::vector<std::vector<glm::vec3>>>
+           std::vector<uint64_t>,
+           std::vector<IndexedBlas>>
 LoadGeometryFromRRAFileAndCreateAS()
 {
     g_app_state = AppState::APP_READ_BLAS_TLAS;
-    g_app_current_progress = 0;
-    std::tuple<std::vector<InstanceInfo>,
-               std::vector<std::vector<glm::vec3>>> ret;
 
-    {
-        time_t  ct = RraTraceLoaderGetCreateTime();
-        std::tm tm;
-        localtime_s(&tm, &ct);
-        char buffer[100];
-        std::strftime(buffer, 32, "%a, %Y-%m-%d %H:%M:%S", &tm);
-        printf("Trace create time: %s\n", buffer);
+    RraGeometry geom = LoadGeometryFromRRAFile(g_weld_vertices, &g_decode_progress);
+    g_scene_aabb_min = glm::min(g_scene_aabb_min, geom.aabb_min);
+    g_scene_aabb_max = glm::max(g_scene_aabb_max, geom.aabb_max);
+    return std::make_tuple(std::move(geom.inst_infos), std::move(geom.view_offsets), std::move(geom.blases));
+}
 
-        uint64_t tlas_count{}, blas_count{};
-        RraBvhGetTlasCount(&tlas_count);
-        RraBvhGetBlasCount(&blas_count);
-        printf("Trace has %llu TLASs and %llu BLASs\n", tlas_count, blas_count);
+bool g_use_geometry_cache{true};
 
-        for (unsigned i = 1; i <= blas_count; i++)
-        {
-            uint32_t cnt{}, cnt1{}, cnt2{}, cnt3{};
-            uint64_t addr{};
-            RraBlasGetGeometryCount(i, &cnt);
-            RraBlasGetProceduralNodeCount(i, &cnt1);
-            RraBlasGetTriangleNodeCount(i, &cnt2);
-            RraBlasGetUniqueTriangleCount(i, &cnt3);
-            RraBlasGetBaseAddress(i, &addr);
-            printf("  BLAS[%u] (%llx) has %u geometries, %u proc nodes, %u tri nodes, %u uniq tris\n", i, addr, cnt, cnt1, cnt2, cnt3);
-        }
+// The format dispatches are loaded in. Origins are quantized within the scene bounds, so they stay floats until the
+// scene is known, e.g. for PIX dumps, which are read while parsing the command line.
+RayStorageFormat GetRayStorageFormat()
+{
+    RayStorageFormat format;
+    format.oct_directions   = g_oct_ray_directions;
+    format.quantize_origins = g_quantize_ray_origins;
+    if (format.quantize_origins && !glm::all(glm::lessThanEqual(g_scene_aabb_min, g_scene_aabb_max)))
+    {
+        printf("  No scene bounds yet, keeping the ray origins as floats\n");
+        format.quantize_origins = false;
     }
+    format.origin_min = g_scene_aabb_min;
+    format.origin_max = g_scene_aabb_max;
+    return format;
+}
 
-    // TLAS[0]'s instances
-    uint32_t tlas0_inst_count{0};
-    uint64_t tlas_count{0}, blas_count{0};
-
-    std::vector<InstanceInfo> tlas0_inst_infos;
-
-    // BLAS's vertices
-    std::vector<std::vector<glm::vec3>> vertices;
-    uint32_t                         tot_tri_count{0};
+// Decodes the rays of an RRA dispatch from the trace and measures their coherence. Leaves dri->resident to the caller.
+void DecodeDispatchRays(DispatchRaysInfo* dri)
+{
+    printf("Decoding the rays of %s\n", dri->name.c_str());
+    ExtractDispatchRays(dri, GetRayStorageFormat(), &g_decode_progress);
+    if (!dri->coherence.valid)
+        ComputeDispatchRaysCoherence(dri);
+}
 
-    // Triangles
+// Makes sure the rays of dri are in memory, decoding them from the trace if needed, and marks dri as most recently
+// used. Least recently used RRA dispatches beyond g_max_resident_dispatches are evicted afterwards.
+void EnsureDispatchRaysResident(DispatchRaysInfo* dri)
+{
+    RRA_PROFILE_SCOPE("EnsureDispatchRaysResident");
+    static uint64_t use_counter{0};
+    dri->last_used = ++use_counter;
+    if (!dri->resident)
     {
-        RraBvhGetTlasCount(&tlas_count);
-        RraBvhGetBlasCount(&blas_count);
-        printf("Trace has %llu TLASs and %llu BLASs\n", tlas_count, blas_count);
-
-        uint32_t ptr{};
-        RraBvhGetRootNodePtr(&ptr) == kRraOk;
-
-        for (unsigned i = 0; i <= blas_count; i++)
-        {
-            g_app_current_progress = 1.0f * i / blas_count;
-            std::vector<glm::vec3> geom_verts;
-
-            uint32_t cnt{}, cnt1{}, cnt2{}, cnt3{};
-            uint64_t addr;
-            RraBlasGetGeometryCount(i, &cnt);
-            RraBlasGetProceduralNodeCount(i, &cnt1);
-            RraBlasGetTriangleNodeCount(i, &cnt2);
-            RraBlasGetUniqueTriangleCount(i, &cnt3);
-            RraBlasGetBaseAddress(i, &addr);
-
-            uint32_t root_node{};
-            RraBvhGetRootNodePtr(&root_node);
-            std::deque<uint32_t> n2v = {root_node};
-
-            if (i > 0)
-            {
-                float sa{};
-                RraBlasGetSurfaceArea(i, root_node, &sa);
-                if (sa <= 0)
-                {
-                    throw std::exception();
-                }
-            }
-
-            uint32_t num_tris{0};
-            while (!n2v.empty())
-            {
-                uint32_t node = n2v.front();
-                n2v.pop_front();
-
-                uint32_t nc{};
-                RraBlasGetChildNodeCount(i, node, &nc);
-                std::vector<uint32_t> children(nc);
-                RraBlasGetChildNodes(i, node, children.data());
-
-                for (uint32_t j = 0; j < children.size(); j++)
-                {
-                    uint32_t ch = children[j];
-                    if (RraBvhIsBoxNode(ch))
-                    {
-                        n2v.push_back(ch);
-                    }
-                    else if (RraBlasIsTriangleNode(i, ch))
-                    {
-                        float sa{};
-                        RraBlasGetSurfaceArea(i, ch, &sa);
-                        if (sa <= 0)
-                        {
-                            printf("BLAS[%u]'s node %08X's surface area is zero\n", i, ch);
-                        }
-
-                        uint32_t tc{};
-                        if (RraBlasGetNodeTriangleCount(i, ch, &tc) != kRraOk)
-                        {
-                            continue;
-                        }
-                        assert(tc < 3);
-
-                        std::vector<TriangleVertices> triangles(8);
-                        if (RraBlasGetNodeTriangles(i, ch, triangles.data()) != kRraOk)
-                        {
-                            continue;
-                        }
-
-                        if (sa > 0)
-                        {
-                            num_tris += tc;
-                            for (uint32_t tri_idx = 0; tri_idx < tc; tri_idx++)
-                            {
-                                const TriangleVertices& triangle = triangles.at(tri_idx);
-                                geom_verts.push_back({triangle.a.x, triangle.a.y, triangle.a.z});
-                                geom_verts.push_back({triangle.b.x, triangle.b.y, triangle.b.z});
-                                geom_verts.push_back({triangle.c.x, triangle.c.y, triangle.c.z});
-                            }
-                        }
-                    }
-                }
-            }
-            // printf("  BLAS[%u] (%lx): %u geoms, %u proc & %u tri nodes, %u uniq tris, %u visited\n",
-            //     i, addr, cnt, cnt1, cnt2, cnt3, num_tris);
-            tot_tri_count += num_tris;
-            vertices.push_back(geom_verts);
-        }
-
-        // Tlas
-        if (tlas_count > 1)
-        {
-            printf("%zu TLAS detected. Will only make use of the first TLAS.\n", tlas_count);
-        }
-
-        for (unsigned i = 0; i < std::min(1, static_cast<int>(tlas_count)); i++)
-        {
-            uint64_t node_count{};
-            uint32_t inst_count{};
-            RraTlasGetBoxNodeCount(i, &node_count);
-
-            uint32_t root_node{};
-            RraBvhGetRootNodePtr(&root_node);
-            std::deque<uint32_t> n2v = {root_node};
-
-            std::vector<InstanceInfo> instance_infos;
-
-            while (!n2v.empty())
-            {
-                uint32_t node = n2v.front();
-                n2v.pop_front();
-
-                uint32_t nc{};
-                RraTlasGetChildNodeCount(i, node, &nc);
-                std::vector<uint32_t> children(nc);
-                RraTlasGetChildNodes(i, node, children.data());
-
-                for (uint32_t j = 0; j < children.size(); j++)
-                {
-                    uint32_t ch = children[j];
-                    if (RraBvhIsBoxNode(ch))
-                    {
-                        n2v.push_back(ch);
-                    }
-                    else if (RraBvhIsInstanceNode(ch))
-                    {
-                        InstanceInfo ii{};
-                        RraTlasGetOriginalInstanceNodeTransform(i, ch, ii.transform);
-                        RraTlasGetBlasIndexFromInstanceNode(i, ch, &(ii.blas_idx));
-                        uint32_t iidx{};
-                        RraTlasGetInstanceIndexFromInstanceNode(i, ch, &iidx);
-                        if (instance_infos.size() < iidx + 1)
-                        {
-                            instance_infos.resize(iidx + 1);
-                        }
-                        instance_infos[iidx] = ii;
-
-                        // Refresh the scene's AABB
-                        std::vector<glm::vec3>& verts = vertices.at(ii.blas_idx);
-                        for (const glm::vec3& v : verts)
-                        {
-                            DirectX::XMFLOAT3 vt{};
-                            DirectX::XMFLOAT3 p  = {v.x, v.y, v.z};
-                            float*             t = ii.transform;
-                            vt.x                 = t[3] + t[0] * p.x + t[1] * p.y + t[2] * p.z;
-                            vt.y                 = t[7] + t[4] * p.x + t[5] * p.y + t[6] * p.z;
-                            vt.z                 = t[11] + t[8] * p.x + t[9] * p.y + t[10] * p.z;
-                            g_scene_aabb_min.x   = std::min(g_scene_aabb_min.x, vt.x);
-                            g_scene_aabb_min.y   = std::min(g_scene_aabb_min.y, vt.y);
-                            g_scene_aabb_min.z   = std::min(g_scene_aabb_min.z, vt.z);
-                            g_scene_aabb_max.x   = std::max(g_scene_aabb_max.x, vt.x);
-                            g_scene_aabb_max.y   = std::max(g_scene_aabb_max.y, vt.y);
-                            g_scene_aabb_max.z   = std::max(g_scene_aabb_max.z, vt.z);
-                        }
-                    }
-                }
-            }
-            inst_count = instance_infos.size();
-
-            printf("TLAS %u: %lu nodes, %zu insts\n", i, node_count, inst_count);
-
-            tlas0_inst_count = inst_count;
-            tlas0_inst_infos = instance_infos;
-        }
+        DecodeDispatchRays(dri);
+        dri->resident = true;
     }
 
-    printf("Scene AABB: (%g,%g,%g)-(%g,%g,%g)\n",
-           g_scene_aabb_min.x,
-           g_scene_aabb_min.y,
-           g_scene_aabb_min.z,
-           g_scene_aabb_max.x,
-           g_scene_aabb_max.y,
-           g_scene_aabb_max.z);
+    std::vector<DispatchRaysInfo*> evictable;
+    for (DispatchRaysInfo& x : g_dispatch_rays_info)
+    {
+        if (x.resident && x.rra_dispatch_idx >= 0)
+            evictable.push_back(&x);
+    }
+    if (evictable.size() <= g_max_resident_dispatches)
+        return;
 
-    ret = std::make_tuple(tlas0_inst_infos, vertices);
-    return ret;
+    std::sort(evictable.begin(), evictable.end(), [](const DispatchRaysInfo* a, const DispatchRaysInfo* b) {
+        return a->last_used < b->last_used;
+    });
+    const size_t num_to_evict = evictable.size() - std::max(1U, g_max_resident_dispatches);
+    for (size_t i = 0; i < num_to_evict; i++)
+    {
+        DispatchRaysInfo* victim = evictable[i];
+        printf("Evicting the rays of %s\n", victim->name.c_str());
+        victim->rays.Clear();
+        std::vector<uint32_t>().swap(victim->ray_idxes);
+        victim->resident = false;
+    }
 }
 
-void LoadDispatchesFromRRAFile()
+// Lists the dispatches of the trace after the PIX dumps; their rays are decoded when they get selected
+void LoadViewerDispatches()
 {
     g_app_state = AppState::APP_READ_DISPATCHES;
-    uint32_t dispatch_count{};
-    RraRayGetDispatchCount(&dispatch_count);
-    printf("dispatch_count=%u\n", dispatch_count);
-    g_app_current_progress = 0;
-
-    for (uint32_t d = 0; d < dispatch_count; d++)
+    for (DispatchRaysInfo& dri : LoadDispatchesFromRRAFile(&g_decode_progress))
     {
-        uint32_t x, y, z;
-        if (RraRayGetDispatchDimensions(d, &x, &y, &z) != kRraOk)
-            continue;
-        uint32_t tot_ray_count = 0;
-        const uint32_t tot_dim       = x * y * z;
-        uint32_t       tot_thd_count = 0;
-        std::vector<Ray> all_rays;
-        DispatchRaysInfo dri{};
-        dri.dispatch_dims.x = x;
-        dri.dispatch_dims.y = y;
-        dri.dispatch_dims.z = z;
-        dri.num_invocations = 0;
-
-        for (uint32_t tz = 0; tz < z; tz++)
-        {
-            for (uint32_t ty = 0; ty < y; ty++)
-            {
-                for (uint32_t tx = 0; tx < x; tx++)
-                {
-                    GlobalInvocationID gid = {tx, ty, tz};
-                    uint32_t           c{0};
-                    if (RraRayGetRayCount(d, gid, &c) != kRraOk)
-                    {
-                        continue;
-                    }
-                    std::vector<Ray> rays(c);
-                    if (RraRayGetRays(d, gid, rays.data()) != kRraOk)
-                    {
-                        continue;
-                    }
-                    tot_ray_count += c;
-                    tot_thd_count++;
-                    g_app_current_progress = tot_thd_count * 1.0f / tot_dim;
-
-                    dri.num_invocations += c;
-                    for (uint32_t i = 0; i < c; i++)
-                    {
-                        const Ray&              r = rays.at(i);
-                        RayInPixDumpFileMinimal rd{};
-                        rd.origin.x = r.origin[0];
-                        rd.origin.y = r.origin[1];
-                        rd.origin.z = r.origin[2];
-                        rd.direction.x = r.direction[0];
-                        rd.direction.y = r.direction[1];
-                        rd.direction.z = r.direction[2];
-                        rd.tmin        = r.t_min;
-                        rd.tcurrent    = r.t_max;
-                        dri.rays.push_back(rd);
-                    }
-                    dri.ray_idxes.push_back(dri.rays.size());
-                }
-            }
-        }
-        printf("  dispatch[%u], dim=(%u,%u,%u), %u rays (%g/thd)\n", d, x, y, z, tot_ray_count, tot_ray_count * 1.0 / x / y / z);
-
-        char buf[100];
-        snprintf(buf, sizeof(buf), "DispatchRays[%u] (%u,%u,%u)", d, x, y, z);
-        g_ray_types.push_back(std::string(buf));
-        dri.name = std::string(buf);
-        g_dispatch_rays_info.push_back(dri);
+        g_ray_types.push_back(dri.name);
+        g_dispatch_rays_info.push_back(std::move(dri));
     }
 }
 
-void CreateASAndSetupCamera(const std::vector<InstanceInfo>& tlas0_inst_infos,    // TLAS
-                            const std::vector<std::vector<glm::vec3>>& vertices)  // BLAS
+// Sets g_inv_view/g_inv_proj to the camera of the capture, see GetCaptureCamera
+void SetupCamera()
 {
-    CreateAS(vertices, tlas0_inst_infos);
-
-    // Set Camera
-    glm::vec3 eye(0, 0, 0);
-    glm::vec3 center(0, 1, 0);
-    glm::vec3 up(0, 1, 0);
-    g_invert_y = false;
-
-    std::string fn(g_rra_file_name);
-    for (const auto& entry : CAM_PARAMS)
+    const CaptureCamera cam = GetCaptureCamera(g_rra_file_name, RT_W, RT_H);
+    if (cam.params_name)
     {
-        printf("Comparing %s vs %s..\n", entry.first.c_str(), fn.c_str());
-        if (fn.find(entry.first) != std::string::npos)
-        {
-            printf("Using camera params for %s\n", entry.first.c_str());
-            eye        = entry.second.eye;
-            center     = entry.second.center;
-            up         = entry.second.up;
-            g_cam_pos  = eye;
-            g_invert_y = entry.second.invert_y;
-        }
+        printf("Using camera params for %s\n", cam.params_name);
+        g_cam_pos = cam.eye;
     }
+    g_invert_y = cam.invert_y;
+    g_inv_view = cam.inverse_view;
+    g_inv_proj = cam.inverse_proj;
+}
 
-    glm::mat4 view = glm::lookAt(eye, center, up);
-    glm::mat4 proj = glm::perspectiveLH_ZO(glm::radians(60.0f), -1.0f * RT_W / RT_H, -0.1f, -499.0f) * (-1.0f);
-
-    g_inv_view = glm::inverse(view);
-    g_inv_proj = glm::inverse(proj);
+void CreateASAndSetupCamera(std::span<const InstanceInfo> inst_infos,    // All TLASes
+                            std::span<const uint64_t>     view_offsets,  // Where each TLAS starts in inst_infos
+                            const BlasGeometrySpans&      geometry)      // BLAS
+{
+    CreateAS(geometry, inst_infos, view_offsets);
+    SetupCamera();
 
     char* mapped{};
     g_raygen_cb->Map(0, nullptr, (void**)(&mapped));
@@ -2989,76 +2791,14 @@ void CreateASAndSetupCamera(const std::vector<InstanceInfo>& tlas0_inst_infos,
     g_raygen_cb->Unmap(0, nullptr);
 }
 
-void ReadPixBufferDump(const char* filename)
+// Reads a PIX buffer dump into a new entry of g_dispatch_rays_info
+void LoadPixBufferDump(const char* filename)
 {
     DispatchRaysInfo dri{};
-
-    printf("Will print a pix buffer dump, named %s\n", filename);
-    std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
-    if (!ifs.good())
-    {
-        printf("Oh! file %s is not good.\n", filename);
-        exit(0);
-    }
-    uint32_t fsize = static_cast<uint32_t>(ifs.tellg());
-    printf("File size: %u\n", fsize);
-    ifs.close();
-
-    FILE* f = nullptr;
-    fopen_s(&f, filename, "rb");
-
-    struct RayInPixBufferDump
-    {
-        uint32_t   type;
-        glm::uvec3 dispatch_rays_idx;
-        glm::vec3 origin;
-        glm::vec3 direction;
-        float     tmin;
-        float     tcurrent;
-        uint32_t   ray_flags;
-    };
-
-    std::vector<RayInPixBufferDump> rays_in_pix;
-    const uint32_t                  num_rays = fsize / sizeof(RayInPixBufferDump);
-
-    for (uint32_t i = 0; i < num_rays; i++)
-    {
-        RayInPixBufferDump r{};
-        fread_s(&r, sizeof(r), sizeof(r), 1, f);
-        rays_in_pix.push_back(r);
-    }
-
-    auto cmp = [&](const RayInPixBufferDump& a, const RayInPixBufferDump& b) {
-        auto key_a = std::tie(a.dispatch_rays_idx.z, a.dispatch_rays_idx.y, a.dispatch_rays_idx.x);
-        auto key_b = std::tie(b.dispatch_rays_idx.z, b.dispatch_rays_idx.y, b.dispatch_rays_idx.x);
-        return key_a < key_b;
-    };
-
-    std::sort(rays_in_pix.begin(), rays_in_pix.end(), cmp);
-
-    for (uint32_t i = 0; i < num_rays; i++)
-    {
-        const auto&             r = rays_in_pix[i];
-        RayInPixDumpFileMinimal r1{};
-        r1.origin                    = r.origin;
-        r1.direction                 = r.direction;
-        r1.tcurrent                  = r.tcurrent;
-        r1.tmin                      = r.tmin;
-        dri.dispatch_dims.x          = std::max(dri.dispatch_dims.x, r.dispatch_rays_idx.x + 1);
-        dri.dispatch_dims.y          = std::max(dri.dispatch_dims.y, r.dispatch_rays_idx.y + 1);
-        dri.dispatch_dims.z          = std::max(dri.dispatch_dims.z, r.dispatch_rays_idx.z + 1);
-        dri.rays.push_back(r1);
-        dri.ray_idxes.push_back(dri.rays.size());
-    }
-    dri.num_invocations = num_rays;
-
-    fclose(f);
-    printf("Read %zu rays\n", dri.rays.size());
-
-    g_dispatch_rays_info.push_back(dri);
-    char buf[100];
-    snprintf(buf, sizeof(buf), "PixDump (%u,%u,%u)", dri.dispatch_dims.x, dri.dispatch_dims.y, dri.dispatch_dims.z);
-    g_ray_types.push_back(std::string(buf));
+    if (!ReadPixBufferDump(filename, GetRayStorageFormat(), &dri))
+        exit(1);
+    g_ray_types.push_back(dri.name);
+    g_dispatch_rays_info.push_back(std::move(dri));
 }
 
 // Stolen from https://github.com/ocornut/imgui/blob/master/examples/example_win32_directx12/main.cpp
@@ -3140,17 +2880,42 @@ void InitImGUI()
     ImGui_ImplGlfw_InitForOther(g_window, true);
 }
 
+// Chrome trace of the profiler scopes (see profiler.h), written by WriteProfile when a mode finishes
+const char* g_profile_output{nullptr};
+
+// Joins the background jobs that record profile events, then writes the trace. Must not run before the loader thread
+// has been joined either. Error exits skip the trace.
+void WriteProfile()
+{
+    g_dispatch_rays_decoder.Wait();
+    g_ray_binner.Wait();
+    if (g_profile_output)
+        WriteChromeTrace(g_profile_output);
+}
+
 int main(int argc, char** argv)
 {
     if (argc == 3 && !strcmp(argv[1], "-pixbufferdump"))
     {
-        ReadPixBufferDump(argv[2]);
+        LoadPixBufferDump(argv[2]);
         exit(0);
     }
 
     g_rra_file_name      = "3DMarkSolarBay-20241020-003039.rra";
     bool rra_file_exists = true;
 
+    // Profiling starts before anything is loaded, so it also covers PIX dumps read while parsing the arguments
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (!strcmp(argv[i], "--profile"))
+            g_profile_output = argv[i + 1];
+    }
+    if (g_profile_output)
+    {
+        SetProfilingEnabled(true);
+        SetProfileThreadName("main");
+    }
+
     for (int i = 0; i < argc; i++)
     {
         if (!strcmp(argv[i], "-w") && i + 1 < argc)
@@ -3168,11 +2933,76 @@ int main(int argc, char** argv)
             g_rra_file_name = argv[i + 1];
             i++;
         }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+        {
+            if (!ParseNumWorkerThreads(argv[i + 1], &g_num_worker_threads))  // -j 1 walks the BLASes serially
+            {
+                printf("-j expects a thread count from 0 to %u, got %s\n", MAX_WORKER_THREADS, argv[i + 1]);
+                return 1;
+            }
+            i++;
+        }
         else if (!strcmp(argv[i], "-pixbufferdump") || !strcmp(argv[i], "-p"))
         {
-            ReadPixBufferDump(argv[i + 1]);
+            LoadPixBufferDump(argv[i + 1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "--tlas") && i + 1 < argc)
+        {
+            if (!ParseSceneViewIndex(argv[i + 1], &g_scene_view))
+            {
+                printf("--tlas expects a TLAS index of 0 or more, got %s\n", argv[i + 1]);
+                return 1;
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "--oct-ray-directions"))
+        {
+            g_oct_ray_directions = true;  // Lossy; affects the dispatches loaded after it, so give it before -p
+        }
+        else if (!strcmp(argv[i], "--quantize-ray-origins"))
+        {
+            g_quantize_ray_origins = true;
+        }
+        else if (!strcmp(argv[i], "--max-resident-dispatches") && i + 1 < argc)
+        {
+            g_max_resident_dispatches = std::max(1, std::atoi(argv[i + 1]));
+            i++;
+        }
+        else if (!strcmp(argv[i], "--ao-samples") && i + 1 < argc)
+        {
+            g_ao_sample_count = std::max(1, std::atoi(argv[i + 1]));
+            i++;
+        }
+        else if (!strcmp(argv[i], "--ao-radius") && i + 1 < argc)
+        {
+            g_ao_radius = float(std::atof(argv[i + 1]));
+            i++;
+        }
+        else if (!strcmp(argv[i], "--cpu-render") || !strcmp(argv[i], "--replay-dispatch") || !strcmp(argv[i], "--batch") ||
+                 !strncmp(argv[i], "--bench-", 8))
+        {
+            printf("%s is a mode of rra_cli now, which runs without a window or GPU.\n", argv[i]);
+            return 1;
+        }
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+        {
+            i++;
+        }
+        else if (!strcmp(argv[i], "--frame-stats-csv") && i + 1 < argc)
+        {
+            g_frame_stats_csv            = argv[i + 1];
+            g_append_frame_stats_on_exit = true;
             i++;
         }
+        else if (!strcmp(argv[i], "--no-geometry-cache"))
+        {
+            g_use_geometry_cache = false;
+        }
+        else if (!strcmp(argv[i], "--no-vertex-weld"))
+        {
+            g_weld_vertices = false;
+        }
         else if (!strcmp(argv[i], "--setsteadypowerstate") ||
                  !strcmp(argv[i], "--setstablepowerstate"))
         {
@@ -3189,10 +3019,14 @@ int main(int argc, char** argv)
         }
         else if (!strcmp(argv[i], "--info"))
         {
-            OpenRRAFile(g_rra_file_name);
-            auto [tlas0_inst_infos, vertices] = LoadGeometryFromRRAFileAndCreateAS();
+            OpenViewerRRAFile(g_rra_file_name);
+            auto [inst_infos, view_offsets, vertices] = LoadGeometryFromRRAFileAndCreateAS();
             printf("Printing RRA file info:\n");
-            printf("%zu instances\n", tlas0_inst_infos.size());
+            for (uint32_t v = 0; v < GetNumSceneViews(view_offsets); v++)
+            {
+                printf("TLAS %u: %zu instances\n", v, GetSceneViewInstances(inst_infos, view_offsets, v).size());
+            }
+            WriteProfile();
             exit(0);
         }
     }
@@ -3214,14 +3048,39 @@ int main(int argc, char** argv)
     CreateShaderBindingTable();
 
     std::thread thd([&]() {
+        SetProfileThreadName("loader");
         if (rra_file_exists)
         {
-            OpenRRAFile(g_rra_file_name);
-            LoadDispatchesFromRRAFile();
-            auto [ tlas0_inst_infos, vertices ] = LoadGeometryFromRRAFileAndCreateAS();
-            CreateASAndSetupCamera(tlas0_inst_infos, vertices);
+            // A valid geometry cache replaces the BLAS/TLAS walk. The trace itself is only opened
+            // if it has ray dispatches, which are not part of the cache.
+            GeometryCache cache;
+            bool          cache_hit = g_use_geometry_cache && MapGeometryCache(g_rra_file_name, g_weld_vertices, &cache);
+            if (cache_hit)
+            {
+                g_scene_aabb_min = cache.aabb_min;
+                g_scene_aabb_max = cache.aabb_max;
+            }
+            if (!cache_hit || cache.header->num_dispatches > 0)
+            {
+                OpenViewerRRAFile(g_rra_file_name);
+                LoadViewerDispatches();
+            }
+
+            if (cache_hit)
+            {
+                CreateASAndSetupCamera(cache.instances, cache.view_offsets, cache.blas_geometry);
+            }
+            else
+            {
+                auto [inst_infos, view_offsets, blases] = LoadGeometryFromRRAFileAndCreateAS();
+                if (g_use_geometry_cache)
+                {
+                    WriteGeometryCache(g_rra_file_name, GetRRADispatchCount(), g_weld_vertices, inst_infos, view_offsets, blases, g_scene_aabb_min, g_scene_aabb_max);
+                }
+                CreateASAndSetupCamera(inst_infos, view_offsets, ToBlasGeometrySpans(blases));
+            }
             g_app_state = AppState::APP_RENDERING;
-            g_frame_time_sliding_window.Reset();
+            ResetFrameStats();
         }
         else
         {
@@ -3235,8 +3094,11 @@ int main(int argc, char** argv)
         Render();
         glfwPollEvents();
     }
+    if (g_append_frame_stats_on_exit && g_as_built)
+        AppendFrameStatsCsv();
 
     thd.join();
+    WriteProfile();
 
     return 0;
 }
\ No newline at end of file
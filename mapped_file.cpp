@@ -0,0 +1,136 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(is_open_, other.is_open_);
+#ifdef _WIN32
+        std::swap(file_handle_, other.file_handle_);
+        std::swap(mapping_handle_, other.mapping_handle_);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* file_name)
+{
+    Close();
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER sz{};
+    if (!GetFileSizeEx(file, &sz))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    file_handle_ = file;
+    size_        = uint64_t(sz.QuadPart);
+    is_open_     = true;
+    if (size_ == 0)
+        return true;
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        Close();
+        return false;
+    }
+    mapping_handle_ = mapping;
+    data_           = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (data_ == nullptr)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mapping_handle_)
+        CloseHandle(mapping_handle_);
+    if (file_handle_)
+        CloseHandle(file_handle_);
+    data_           = nullptr;
+    mapping_handle_ = nullptr;
+    file_handle_    = nullptr;
+    size_           = 0;
+    is_open_        = false;
+}
+
+#else
+
+bool MappedFile::Open(const char* file_name)
+{
+    Close();
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    size_    = uint64_t(st.st_size);
+    is_open_ = true;
+    if (size_ > 0)
+    {
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            Close();
+            return false;
+        }
+        madvise(p, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const uint8_t*>(p);
+    }
+    close(fd);  // The mapping stays valid after the descriptor is closed
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data_)
+        munmap(const_cast<uint8_t*>(data_), size_);
+    data_    = nullptr;
+    size_    = 0;
+    is_open_ = false;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// Read-only memory mapping of a whole file. Files larger than 4 GB are supported.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // Returns false if the file cannot be opened or mapped. Empty files map successfully with Data() == nullptr.
+    bool Open(const char* file_name);
+    void Close();
+
+    const uint8_t* Data() const
+    {
+        return data_;
+    }
+    uint64_t Size() const
+    {
+        return size_;
+    }
+    bool IsOpen() const
+    {
+        return is_open_;
+    }
+
+private:
+    const uint8_t* data_{nullptr};
+    uint64_t       size_{0};
+    bool           is_open_{false};
+#ifdef _WIN32
+    void* file_handle_{nullptr};
+    void* mapping_handle_{nullptr};
+#endif
+};
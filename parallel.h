@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+// Number of worker threads used by the CPU-side loaders and kernels. 0 means "one per hardware thread".
+inline uint32_t g_num_worker_threads{0};
+
+inline uint32_t GetNumWorkerThreads()
+{
+    if (g_num_worker_threads > 0)
+        return g_num_worker_threads;
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+constexpr uint32_t MAX_WORKER_THREADS = 1024;
+
+// Parses the argument of -j: a whole number in [0, MAX_WORKER_THREADS]. Returns false on anything else.
+inline bool ParseNumWorkerThreads(const char* s, uint32_t* num_workers)
+{
+    char* end   = nullptr;
+    long  value = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || value < 0 || value > long(MAX_WORKER_THREADS))
+        return false;
+    *num_workers = uint32_t(value);
+    return true;
+}
+
+// Calls fn(worker_idx) on num_workers threads and waits for all of them.
+// The calling thread acts as worker 0. The first exception thrown by any worker is re-thrown here.
+template<class F>
+void RunWorkers(uint32_t num_workers, F&& fn)
+{
+    num_workers = std::max(1U, num_workers);
+    if (num_workers == 1)
+    {
+        fn(0U);
+        return;
+    }
+
+    std::exception_ptr first_error;
+    std::mutex         error_mutex;
+    auto               run = [&](uint32_t worker_idx) {
+        RRA_PROFILE_SCOPE_ARG("Worker", worker_idx);
+        try
+        {
+            fn(worker_idx);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lk(error_mutex);
+            if (!first_error)
+                first_error = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_workers - 1);
+    for (uint32_t w = 1; w < num_workers; w++)
+    {
+        threads.emplace_back(run, w);
+    }
+    run(0);
+    for (std::thread& t : threads)
+    {
+        t.join();
+    }
+    if (first_error)
+        std::rethrow_exception(first_error);
+}
+
+// Splits [0, n) into one contiguous chunk per worker and calls fn(worker_idx, begin, end).
+// Chunk boundaries only depend on n and the worker count, so results written per chunk are deterministic.
+template<class F>
+void ParallelForChunks(size_t n, F&& fn, uint32_t num_workers = GetNumWorkerThreads())
+{
+    if (n == 0)
+        return;
+    num_workers = uint32_t(std::min<size_t>(std::max(1U, num_workers), n));
+    RunWorkers(num_workers, [&](uint32_t w) {
+        size_t begin = n * w / num_workers;
+        size_t end   = n * (w + 1) / num_workers;
+        fn(w, begin, end);
+    });
+}
+
+// Hands out indices in [0, n) in batches of `grain` through an atomic counter and calls fn(worker_idx, i).
+// Use this when items have very uneven cost (e.g. one BLAS vs another).
+template<class F>
+void ParallelForDynamic(size_t n, size_t grain, F&& fn, uint32_t num_workers = GetNumWorkerThreads())
+{
+    if (n == 0)
+        return;
+    grain       = std::max<size_t>(1, grain);
+    num_workers = uint32_t(std::min<size_t>(std::max(1U, num_workers), (n + grain - 1) / grain));
+    std::atomic<size_t> next{0};
+    RunWorkers(num_workers, [&](uint32_t w) {
+        while (true)
+        {
+            size_t begin = next.fetch_add(grain);
+            if (begin >= n)
+                break;
+            size_t end = std::min(n, begin + grain);
+            for (size_t i = begin; i < end; i++)
+            {
+                fn(w, i);
+            }
+        }
+    });
+}
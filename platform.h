@@ -0,0 +1,17 @@
+#pragma once
+
+#include <time.h>
+
+#include <ctime>
+
+// Thin wrappers over the few calls that differ between the MSVC runtime and POSIX
+
+// Broken-down local time of t
+inline void LocalTime(time_t t, std::tm* out)
+{
+#ifdef _WIN32
+    localtime_s(out, &t);
+#else
+    localtime_r(&t, out);
+#endif
+}
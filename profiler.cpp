@@ -0,0 +1,180 @@
+#include "profiler.h"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "json_writer.h"
+
+struct ProfileEvent
+{
+    const char* name;
+    uint64_t    begin_ns;
+    uint64_t    end_ns;
+    int64_t     arg;
+};
+
+struct ProfileLane
+{
+    std::vector<ProfileEvent> events;  // Ring buffer, event i is at events[i % PROFILE_LANE_CAPACITY]
+    uint64_t                  num_recorded{};
+    std::string               name;  // Named lanes belong to one long-lived thread and are not reused
+};
+
+struct ProfileLanes
+{
+    std::mutex                mutex;
+    std::vector<ProfileLane*> lanes;  // Index = tid in the trace
+    std::vector<ProfileLane*> free_lanes;
+};
+
+// Never destroyed, so threads that exit during shutdown and an atexit WriteChromeTrace still find it
+static ProfileLanes& GetProfileLanes()
+{
+    static ProfileLanes* lanes = new ProfileLanes;
+    return *lanes;
+}
+
+static std::chrono::steady_clock::time_point GetProfileEpoch()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return epoch;
+}
+
+// Hands the lane of a thread back when the thread exits
+struct ProfileLaneHandle
+{
+    ProfileLane* lane{};
+
+    ~ProfileLaneHandle()
+    {
+        if (!lane || !lane->name.empty())
+            return;
+        ProfileLanes&               pl = GetProfileLanes();
+        std::lock_guard<std::mutex> lk(pl.mutex);
+        pl.free_lanes.push_back(lane);
+    }
+};
+static thread_local ProfileLaneHandle t_lane;
+
+static ProfileLane* GetThreadLane()
+{
+    if (t_lane.lane)
+        return t_lane.lane;
+
+    ProfileLanes&               pl = GetProfileLanes();
+    std::lock_guard<std::mutex> lk(pl.mutex);
+    if (!pl.free_lanes.empty())
+    {
+        t_lane.lane = pl.free_lanes.back();
+        pl.free_lanes.pop_back();
+    }
+    else
+    {
+        t_lane.lane = new ProfileLane;
+        t_lane.lane->events.resize(PROFILE_LANE_CAPACITY);
+        pl.lanes.push_back(t_lane.lane);
+    }
+    return t_lane.lane;
+}
+
+void AcquireProfileLane()
+{
+    GetThreadLane();
+}
+
+void SetProfilingEnabled(bool enabled)
+{
+    GetProfileEpoch();
+    g_profiling_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t ProfileNow()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - GetProfileEpoch()).count());
+}
+
+void RecordProfileEvent(const char* name, uint64_t begin_ns, uint64_t end_ns, int64_t arg)
+{
+    static_assert((PROFILE_LANE_CAPACITY & (PROFILE_LANE_CAPACITY - 1)) == 0);
+
+    ProfileLane* lane = GetThreadLane();
+    lane->events[lane->num_recorded & (PROFILE_LANE_CAPACITY - 1)] = {name, begin_ns, end_ns, arg};
+    lane->num_recorded++;
+}
+
+void SetProfileThreadName(const char* name)
+{
+    ProfileLane*                lane = GetThreadLane();
+    std::lock_guard<std::mutex> lk(GetProfileLanes().mutex);
+    lane->name = name;
+}
+
+bool WriteChromeTrace(const char* file_name)
+{
+    FILE* f = fopen(file_name, "w");
+    if (!f)
+    {
+        printf("Could not open %s for writing.\n", file_name);
+        return false;
+    }
+
+    ProfileLanes&               pl = GetProfileLanes();
+    std::lock_guard<std::mutex> lk(pl.mutex);
+
+    JsonWriter json(f);
+    json.BeginObject();
+    json.String("displayTimeUnit", "ms");
+    json.BeginArray("traceEvents");
+    uint64_t num_events = 0;
+    for (size_t tid = 0; tid < pl.lanes.size(); tid++)
+    {
+        const ProfileLane* lane = pl.lanes[tid];
+        json.BeginObject();
+        json.String("name", "thread_name");
+        json.String("ph", "M");
+        json.Integer("pid", 1);
+        json.Integer("tid", int64_t(tid));
+        json.BeginObject("args");
+        json.String("name", lane->name.empty() ? "worker " + std::to_string(tid) : lane->name);
+        json.EndObject();
+        json.EndObject();
+
+        // Oldest first; a full ring has overwritten everything before the last PROFILE_LANE_CAPACITY events
+        const uint64_t first = lane->num_recorded > PROFILE_LANE_CAPACITY ? lane->num_recorded - PROFILE_LANE_CAPACITY : 0;
+        if (first > 0)
+            printf("Profiler lane %zu dropped its %llu oldest events\n", tid, (unsigned long long)first);
+        for (uint64_t i = first; i < lane->num_recorded; i++)
+        {
+            const ProfileEvent& e = lane->events[i & (PROFILE_LANE_CAPACITY - 1)];
+            json.BeginObject();
+            json.String("name", e.name);
+            json.String("ph", "X");
+            json.Number("ts", e.begin_ns / 1000.0);
+            json.Number("dur", (e.end_ns - e.begin_ns) / 1000.0);
+            json.Integer("pid", 1);
+            json.Integer("tid", int64_t(tid));
+            if (e.arg >= 0)
+            {
+                json.BeginObject("args");
+                json.Integer("arg", e.arg);
+                json.EndObject();
+            }
+            json.EndObject();
+        }
+        num_events += lane->num_recorded - first;
+    }
+    json.EndArray();
+    json.EndObject();
+
+    if (fclose(f) != 0)
+    {
+        printf("Could not write %s.\n", file_name);
+        return false;
+    }
+    printf("Wrote %llu profile events of %zu thread lane(s) to %s\n", (unsigned long long)num_events, pl.lanes.size(), file_name);
+    return true;
+}
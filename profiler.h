@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Scoped timers for the loaders and CPU kernels, written as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+//
+// Every thread records into a lane: a ring buffer of PROFILE_LANE_CAPACITY events that keeps the most recent ones.
+// A lane is handed back when its thread exits and reused by the next thread that records, so the short-lived worker
+// threads of parallel.h share a few lanes instead of each getting its own. While profiling is disabled a scope costs
+// one relaxed load; define RRA_DISABLE_PROFILING to compile the scopes out entirely.
+//
+//     RRA_PROFILE_SCOPE("CreateAS");
+//     RRA_PROFILE_SCOPE_ARG("ExtractBlasVertices", blas_idx);
+//
+// Names must outlive the trace, in practice string literals.
+constexpr uint32_t PROFILE_LANE_CAPACITY = 1 << 16;
+
+inline std::atomic<bool> g_profiling_enabled{false};
+
+inline bool IsProfilingEnabled()
+{
+    return g_profiling_enabled.load(std::memory_order_relaxed);
+}
+
+void SetProfilingEnabled(bool enabled);
+
+// Nanoseconds since the profiler's epoch, the first call of any profiler function
+uint64_t ProfileNow();
+
+// Gives the calling thread its lane if it has none yet. Scopes do this before reading their begin time, so a lane is
+// only handed to another thread after every event of its previous thread has ended.
+void AcquireProfileLane();
+
+// Adds one complete event to the lane of the calling thread. arg is shown with the event unless it is negative.
+void RecordProfileEvent(const char* name, uint64_t begin_ns, uint64_t end_ns, int64_t arg = -1);
+
+// Names the lane of the calling thread in the trace, e.g. "main" or "loader"
+void SetProfileThreadName(const char* name);
+
+// Writes the events of all lanes as Chrome trace JSON. Threads must not record while this runs.
+bool WriteChromeTrace(const char* file_name);
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name, int64_t arg = -1)
+    {
+        if (IsProfilingEnabled())
+        {
+            AcquireProfileLane();
+            name_  = name;
+            arg_   = arg;
+            begin_ = ProfileNow();
+        }
+    }
+
+    ~ProfileScope()
+    {
+        if (name_)
+            RecordProfileEvent(name_, begin_, ProfileNow(), arg_);
+    }
+
+    ProfileScope(const ProfileScope&)            = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* name_{nullptr};
+    int64_t     arg_{-1};
+    uint64_t    begin_{};
+};
+
+#define RRA_PROFILE_CONCAT_INNER(a, b) a##b
+#define RRA_PROFILE_CONCAT(a, b)       RRA_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef RRA_DISABLE_PROFILING
+#define RRA_PROFILE_SCOPE(name)
+#define RRA_PROFILE_SCOPE_ARG(name, arg)
+#else
+#define RRA_PROFILE_SCOPE(name)          ProfileScope RRA_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define RRA_PROFILE_SCOPE_ARG(name, arg) ProfileScope RRA_PROFILE_CONCAT(profile_scope_, __LINE__)(name, int64_t(arg))
+#endif
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "parallel.h"
+
+// Stable LSD radix sort of 64-bit keys that only looks at bits [lo_bit, hi_bit).
+// Typical use is a sort key in the upper bits and the element's original index in the lower bits, sorting on the
+// key bits only; the index then comes out in ascending order within every run of equal keys.
+//
+// Each 8-bit pass splits the input into one contiguous chunk per worker. Workers histogram their chunk, a prefix sum
+// over (digit, worker) hands every worker its own output range per digit, and the scatter walks each chunk in order,
+// which keeps the sort stable.
+//
+// tmp is scratch space of the same size as keys; callers that sort repeatedly can pass the same vector every time.
+// values, if not null, holds one payload per key that is moved along with it (values_tmp is its scratch space).
+template<class Value>
+inline void ParallelRadixSortImpl(std::vector<uint64_t>& keys,
+                                  std::vector<uint64_t>& tmp,
+                                  std::vector<Value>*    values,
+                                  std::vector<Value>*    values_tmp,
+                                  uint32_t               lo_bit,
+                                  uint32_t               hi_bit,
+                                  uint32_t               num_workers)
+{
+    constexpr uint32_t DIGIT_BITS       = 8;
+    constexpr uint32_t NUM_BUCKETS      = 1 << DIGIT_BITS;
+    constexpr size_t   MIN_KEYS_PER_JOB = 1 << 16;  // Below this, starting threads costs more than it saves
+
+    const size_t n = keys.size();
+    hi_bit         = std::min(hi_bit, 64U);
+    if (n < 2 || hi_bit <= lo_bit)
+        return;
+
+    num_workers = uint32_t(std::clamp<size_t>(n / MIN_KEYS_PER_JOB, 1, std::max(1U, num_workers)));
+
+    tmp.resize(n);
+    if (values)
+        values_tmp->resize(n);
+    std::vector<size_t> hist(size_t(num_workers) * NUM_BUCKETS);
+    uint64_t*           src     = keys.data();
+    uint64_t*           dst     = tmp.data();
+    Value*              src_val = values ? values->data() : nullptr;
+    Value*              dst_val = values ? values_tmp->data() : nullptr;
+
+    for (uint32_t shift = lo_bit; shift < hi_bit; shift += DIGIT_BITS)
+    {
+        const uint64_t mask = (uint64_t(1) << std::min(DIGIT_BITS, hi_bit - shift)) - 1;
+
+        std::fill(hist.begin(), hist.end(), 0);
+        ParallelForChunks(
+            n,
+            [&](uint32_t w, size_t begin, size_t end) {
+                size_t* h = &hist[size_t(w) * NUM_BUCKETS];
+                for (size_t i = begin; i < end; i++)
+                {
+                    h[(src[i] >> shift) & mask]++;
+                }
+            },
+            num_workers);
+
+        // Exclusive prefix sum in (digit, worker) order. A pass where every key has the same digit is skipped.
+        size_t sum = 0;
+        bool   trivial_pass{false};
+        for (uint32_t d = 0; d < NUM_BUCKETS; d++)
+        {
+            size_t digit_total = 0;
+            for (uint32_t w = 0; w < num_workers; w++)
+            {
+                size_t& h = hist[size_t(w) * NUM_BUCKETS + d];
+                size_t  c = h;
+                h         = sum;
+                sum += c;
+                digit_total += c;
+            }
+            if (digit_total == n)
+                trivial_pass = true;
+        }
+        if (trivial_pass)
+            continue;
+
+        ParallelForChunks(
+            n,
+            [&](uint32_t w, size_t begin, size_t end) {
+                size_t* h = &hist[size_t(w) * NUM_BUCKETS];
+                if (!src_val)
+                {
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        dst[h[(src[i] >> shift) & mask]++] = src[i];
+                    }
+                    return;
+                }
+                for (size_t i = begin; i < end; i++)
+                {
+                    const size_t d = h[(src[i] >> shift) & mask]++;
+                    dst[d]         = src[i];
+                    dst_val[d]     = src_val[i];
+                }
+            },
+            num_workers);
+        std::swap(src, dst);
+        std::swap(src_val, dst_val);
+    }
+
+    if (src != keys.data())
+    {
+        keys.swap(tmp);
+        if (values)
+            values->swap(*values_tmp);
+    }
+}
+
+inline void ParallelRadixSort(std::vector<uint64_t>& keys,
+                              std::vector<uint64_t>& tmp,
+                              uint32_t               lo_bit,
+                              uint32_t               hi_bit,
+                              uint32_t               num_workers = GetNumWorkerThreads())
+{
+    ParallelRadixSortImpl<uint32_t>(keys, tmp, nullptr, nullptr, lo_bit, hi_bit, num_workers);
+}
+
+// Same as above for keys that need all their bits, with a 32-bit payload (e.g. the element's original index)
+// sorted along with every key
+inline void ParallelRadixSort(std::vector<uint64_t>& keys,
+                              std::vector<uint32_t>& values,
+                              std::vector<uint64_t>& tmp,
+                              std::vector<uint32_t>& values_tmp,
+                              uint32_t               lo_bit,
+                              uint32_t               hi_bit,
+                              uint32_t               num_workers = GetNumWorkerThreads())
+{
+    ParallelRadixSortImpl(keys, tmp, &values, &values_tmp, lo_bit, hi_bit, num_workers);
+}
+
+inline void ParallelRadixSort(std::vector<uint64_t>& keys, uint32_t lo_bit, uint32_t hi_bit, uint32_t num_workers = GetNumWorkerThreads())
+{
+    std::vector<uint64_t> tmp;
+    ParallelRadixSort(keys, tmp, lo_bit, hi_bit, num_workers);
+}
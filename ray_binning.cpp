@@ -0,0 +1,115 @@
+#include "ray_binning.h"
+
+#include <chrono>
+
+#include "parallel.h"
+#include "profiler.h"
+#include "rt_common.h"
+
+void ComputeFirstAORays(const RayBinningSettings&  s,
+                        std::span<const glm::vec4> hit_normal_and_t,
+                        std::vector<glm::vec3>*    origins,
+                        std::vector<glm::vec3>*    directions)
+{
+    RRA_PROFILE_SCOPE("ComputeFirstAORays");
+    const size_t n = hit_normal_and_t.size();
+    origins->resize(n);
+    directions->resize(n);
+    ParallelForChunks(n, [&](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            float dx = (float(i % s.width) + 0.5f) / s.width * 2 - 1;
+            float dy = (float(i / s.width) + 0.5f) / s.height * 2 - 1;
+            dy *= -1;
+            if (s.invert_y)
+                dy *= -1;
+            glm::vec3 tgt = TransformPosition(s.inverse_proj, glm::vec3(dx, dy, 1));
+            glm::vec3 dir = TransformDirection(s.inverse_view, glm::normalize(tgt));
+
+            // Same direction as the shader's first AO sample of the pixel
+            int seed         = TEA(uint32_t(i), 0, 16).x;
+            (*origins)[i]    = s.cam_pos + (dir * hit_normal_and_t[i].w);
+            (*directions)[i] = SampleHemisphereCosine(glm::vec3(hit_normal_and_t[i]), seed);
+        }
+    });
+}
+
+RayBinner::~RayBinner()
+{
+    Wait();
+}
+
+void RayBinner::Wait()
+{
+    if (thread_.joinable())
+        thread_.join();
+}
+
+bool RayBinner::Start(const RayBinningSettings& settings, const glm::vec4* hit_normal_and_t)
+{
+    if (busy_)
+        return false;
+    if (thread_.joinable())
+        thread_.join();
+
+    settings_ = settings;
+    hits_.assign(hit_normal_and_t, hit_normal_and_t + size_t(settings.width) * settings.height);
+    done_   = false;
+    busy_   = true;
+    thread_ = std::thread([this]() {
+        Run();
+        done_ = true;
+        busy_ = false;
+    });
+    return true;
+}
+
+bool RayBinner::TakeResult()
+{
+    return done_.exchange(false);
+}
+
+void RayBinner::Run()
+{
+    RRA_PROFILE_SCOPE("RayBinner::Run");
+    using Clock          = std::chrono::steady_clock;
+    Clock::time_point t0 = Clock::now();
+
+    ComputeFirstAORays(settings_, hits_, &origins_, &ao_dirs_);
+
+    const size_t n    = hits_.size();
+    const int    mode = settings_.mode;
+    if (mode >= RAY_REORDER_MODE_BEGIN && mode < RAY_REORDER_MODE_END)
+    {
+        if (!strategies_[mode])
+            strategies_[mode] = CreateRayReorderStrategy(mode);
+
+        RayReorderInput in;
+        in.width      = settings_.width;
+        in.height     = settings_.height;
+        in.origins    = origins_;
+        in.directions = ao_dirs_;
+        in.scene_min  = settings_.scene_min;
+        in.scene_max  = settings_.scene_max;
+        strategies_[mode]->Reorder(in, &order_);
+    }
+    else
+    {
+        order_.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            order_[i] = uint32_t(i);
+        }
+    }
+
+    dirs_.resize(n);
+    mapping_.resize(n);
+    ParallelForChunks(n, [&](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            dirs_[i]    = ao_dirs_[order_[i]];
+            mapping_[i] = int(order_[i]);
+        }
+    });
+    last_millis_ = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_reorder.h"
+
+// Reorders the AO rays of a frame for the use_ray_binning modes of shaders/aoray.hlsl. Every pixel gets the
+// first cosine-weighted AO direction the shader would have traced, then the rays are permuted by the
+// RayReorderStrategy of the mode (see RayReorderMode).
+// The result is RayDirs (direction of the i-th traced ray) and RayMapping (the pixel it belongs to).
+struct RayBinningSettings
+{
+    int       mode{};
+    uint32_t  width{};
+    uint32_t  height{};
+    glm::mat4 inverse_view{1.0f};
+    glm::mat4 inverse_proj{1.0f};
+    bool      invert_y{false};
+    glm::vec3 cam_pos{};
+    glm::vec3 scene_min{};
+    glm::vec3 scene_max{};
+};
+
+// Origin (primary hit point) and first AO direction of every pixel, from the float4(normal, t) of the primary pass
+void ComputeFirstAORays(const RayBinningSettings&  settings,
+                        std::span<const glm::vec4> hit_normal_and_t,
+                        std::vector<glm::vec3>*    origins,
+                        std::vector<glm::vec3>*    directions);
+
+// Runs the binning on a background thread, which spreads each stage over the worker threads. All buffers are kept
+// between runs and only grow when the resolution does, so rebinning the same target does not allocate.
+class RayBinner
+{
+public:
+    ~RayBinner();
+
+    // Copies the width * height float4(normal, t) of the primary pass and starts binning them.
+    // Returns false, without doing anything, while the previous run is still going.
+    bool Start(const RayBinningSettings& settings, const glm::vec4* hit_normal_and_t);
+
+    bool Busy() const
+    {
+        return busy_;
+    }
+
+    // Blocks until the current run, if any, has finished. Its result is still taken with TakeResult().
+    void Wait();
+
+    // Returns true once per finished run. Directions() and Mapping() then hold its result until the next Start().
+    bool TakeResult();
+
+    std::span<const glm::vec3> Directions() const
+    {
+        return dirs_;
+    }
+    std::span<const int> Mapping() const
+    {
+        return mapping_;
+    }
+    const RayBinningSettings& Settings() const
+    {
+        return settings_;
+    }
+    double LastMillis() const
+    {
+        return last_millis_;
+    }
+
+private:
+    void Run();
+
+    RayBinningSettings                  settings_;
+    std::vector<glm::vec4>              hits_;
+    std::vector<glm::vec3>              origins_, ao_dirs_;
+    std::vector<uint32_t>               order_;
+    std::unique_ptr<RayReorderStrategy> strategies_[RAY_REORDER_MODE_END];  // Created on first use of a mode
+    std::vector<glm::vec3>              dirs_;
+    std::vector<int>                    mapping_;
+    double                              last_millis_{};
+
+    std::thread       thread_;
+    std::atomic<bool> busy_{false};
+    std::atomic<bool> done_{false};
+};
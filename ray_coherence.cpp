@@ -0,0 +1,177 @@
+#include "ray_coherence.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "parallel.h"
+#include "profiler.h"
+
+constexpr uint32_t NUM_OCT_BINS = RAY_COHERENCE_OCT_BINS * RAY_COHERENCE_OCT_BINS;
+
+static bool HasDirection(const glm::vec3& dir)
+{
+    const float len2 = glm::dot(dir, dir);
+    return len2 > 0 && std::isfinite(len2);
+}
+
+static uint32_t GetOctBin(const glm::vec3& dir)
+{
+    const glm::vec2 uv = OctEncode(dir);
+    const uint32_t  u  = std::min(uint32_t(std::max(uv.x, 0.0f) * RAY_COHERENCE_OCT_BINS), RAY_COHERENCE_OCT_BINS - 1);
+    const uint32_t  v  = std::min(uint32_t(std::max(uv.y, 0.0f) * RAY_COHERENCE_OCT_BINS), RAY_COHERENCE_OCT_BINS - 1);
+    return v * RAY_COHERENCE_OCT_BINS + u;
+}
+
+// Mean angular deviation (degrees) and origin spread over tiles of tile_size x tile_size threads, one tile at a time
+// on the worker threads. The rays of a row of threads within a tile are contiguous in the ray array.
+static void MeasureTiles(const glm::uvec3&         dims,
+                         std::span<const uint32_t> ray_idxes,
+                         const RayStorage&         rays,
+                         uint32_t                  tile_size,
+                         float*                    angular_deviation,
+                         float*                    origin_spread)
+{
+    const uint32_t tiles_x     = (dims.x + tile_size - 1) / tile_size;
+    const uint32_t tiles_y     = (dims.y + tile_size - 1) / tile_size;
+    const size_t   num_tiles   = size_t(tiles_x) * tiles_y * dims.z;
+    const uint32_t num_workers = GetNumWorkerThreads();
+
+    std::vector<double>   worker_angle(num_workers, 0), worker_spread(num_workers, 0);
+    std::vector<uint64_t> worker_count(num_workers, 0);
+    ParallelForDynamic(num_tiles, 1, [&](uint32_t w, size_t tile) {
+        const uint32_t x0 = uint32_t(tile % tiles_x) * tile_size;
+        const uint32_t y0 = uint32_t(tile / tiles_x % tiles_y) * tile_size;
+        const uint32_t z  = uint32_t(tile / (size_t(tiles_x) * tiles_y));
+        const uint32_t x1 = std::min(x0 + tile_size, dims.x);
+        const uint32_t y1 = std::min(y0 + tile_size, dims.y);
+        auto for_each_ray = [&](auto&& fn) {
+            for (uint32_t y = y0; y < y1; y++)
+            {
+                const size_t   row = (size_t(z) * dims.y + y) * dims.x;
+                const uint32_t lb  = (row + x0 == 0) ? 0 : ray_idxes[row + x0 - 1];
+                const uint32_t ub  = uint32_t(std::min<size_t>(ray_idxes[row + x1 - 1], rays.Size()));
+                for (uint32_t i = lb; i < ub; i++)
+                {
+                    const glm::vec3 dir = rays.Direction(i);
+                    if (HasDirection(dir))
+                        fn(rays.Origin(i), glm::normalize(dir));
+                }
+            }
+        };
+
+        glm::vec3 dir_sum(0), org_sum(0);
+        uint32_t  count = 0;
+        for_each_ray([&](const glm::vec3& org, const glm::vec3& dir) {
+            dir_sum += dir;
+            org_sum += org;
+            count++;
+        });
+        if (count == 0)
+            return;
+
+        const float     dir_len  = glm::length(dir_sum);
+        const glm::vec3 mean_dir = dir_len > 0 ? dir_sum / dir_len : glm::vec3(0, 0, 1);
+        const glm::vec3 mean_org = org_sum / float(count);
+
+        double angle = 0, spread = 0;
+        for_each_ray([&](const glm::vec3& org, const glm::vec3& dir) {
+            angle += std::acos(std::clamp(glm::dot(dir, mean_dir), -1.0f, 1.0f));
+            spread += glm::length(org - mean_org);
+        });
+        worker_angle[w] += angle;
+        worker_spread[w] += spread;
+        worker_count[w] += count;
+    });
+
+    double   angle = 0, spread = 0;
+    uint64_t count = 0;
+    for (uint32_t w = 0; w < num_workers; w++)
+    {
+        angle += worker_angle[w];
+        spread += worker_spread[w];
+        count += worker_count[w];
+    }
+    *angular_deviation = count ? float(angle / count * 180.0 / 3.14159265358979) : 0;
+    *origin_spread     = count ? float(spread / count) : 0;
+}
+
+RayCoherence ComputeRayCoherence(const glm::uvec3& dispatch_dims, std::span<const uint32_t> ray_idxes, const RayStorage& rays)
+{
+    RRA_PROFILE_SCOPE("ComputeRayCoherence");
+    RayCoherence ret;
+    if (rays.Size() == 0)
+        return ret;
+
+    if (uint64_t(dispatch_dims.x) * dispatch_dims.y * dispatch_dims.z == ray_idxes.size())
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            MeasureTiles(dispatch_dims, ray_idxes, rays, RAY_COHERENCE_TILE_SIZES[i], &ret.tile_angular_deviation[i], &ret.tile_origin_spread[i]);
+        }
+    }
+
+    // Direction bins of all rays, and the most common bin of every warp-sized group
+    const uint32_t        num_workers = GetNumWorkerThreads();
+    const size_t          num_groups  = (rays.Size() + RAY_COHERENCE_WARP_SIZE - 1) / RAY_COHERENCE_WARP_SIZE;
+    std::vector<uint64_t> worker_bins(size_t(num_workers) * NUM_OCT_BINS, 0);
+    std::vector<uint64_t> worker_shared(num_workers, 0);
+    ParallelForChunks(
+        num_groups,
+        [&](uint32_t w, size_t begin, size_t end) {
+            uint64_t* bins   = &worker_bins[size_t(w) * NUM_OCT_BINS];
+            uint64_t  shared = 0;
+            for (size_t g = begin; g < end; g++)
+            {
+                uint32_t       group[RAY_COHERENCE_WARP_SIZE];
+                uint32_t       n     = 0;
+                const size_t   first = g * RAY_COHERENCE_WARP_SIZE;
+                const size_t   last  = std::min(first + RAY_COHERENCE_WARP_SIZE, rays.Size());
+                for (size_t i = first; i < last; i++)
+                {
+                    const glm::vec3 dir = rays.Direction(i);
+                    if (!HasDirection(dir))
+                        continue;
+                    group[n] = GetOctBin(dir);
+                    bins[group[n]]++;
+                    n++;
+                }
+
+                std::sort(group, group + n);
+                uint32_t longest = 0;
+                for (uint32_t i = 0, run = 0; i < n; i++)
+                {
+                    run     = (i > 0 && group[i] == group[i - 1]) ? run + 1 : 1;
+                    longest = std::max(longest, run);
+                }
+                shared += longest;
+            }
+            worker_shared[w] = shared;
+        },
+        num_workers);
+
+    uint64_t bins[NUM_OCT_BINS]{};
+    uint64_t num_rays = 0, shared = 0;
+    for (size_t i = 0; i < worker_bins.size(); i++)
+    {
+        bins[i % NUM_OCT_BINS] += worker_bins[i];
+        num_rays += worker_bins[i];
+    }
+    for (uint64_t s : worker_shared)
+    {
+        shared += s;
+    }
+    if (num_rays == 0)
+        return ret;
+
+    double entropy = 0;
+    for (uint64_t b : bins)
+    {
+        if (b > 0)
+            entropy -= double(b) / num_rays * std::log2(double(b) / num_rays);
+    }
+    ret.direction_entropy        = float(entropy);
+    ret.warp_shared_bin_fraction = float(double(shared) / num_rays);
+    ret.valid                    = true;
+    return ret;
+}
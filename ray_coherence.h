@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+
+#include <glm/glm.hpp>
+
+#include "ray_storage.h"
+
+// How coherent the rays of a dispatch are, i.e. whether reordering them before tracing is likely to pay off.
+// Rays without a direction (threads whose rays could not be decoded) are left out.
+constexpr uint32_t RAY_COHERENCE_TILE_SIZES[2] = {8, 32};  // Dispatch threads per side of a tile
+constexpr uint32_t RAY_COHERENCE_OCT_BINS      = 16;       // Octahedral direction bins per side
+constexpr uint32_t RAY_COHERENCE_WARP_SIZE     = 32;
+
+struct RayCoherence
+{
+    // Per tile size: mean angle in degrees between a ray and the mean direction of its tile,
+    // and mean distance between a ray's origin and the mean origin of its tile
+    float tile_angular_deviation[2]{};
+    float tile_origin_spread[2]{};
+
+    float direction_entropy{};         // Bits over the OctEncode bins, from 0 (one direction) to 8 (uniform)
+    float warp_shared_bin_fraction{};  // Rays that fall into the most common bin of their group of 32, in [1/32, 1]
+    bool  valid{false};
+};
+
+// The rays of thread t are [ray_idxes[t - 1], ray_idxes[t]) with threads in z, y, x order, as in DispatchRaysInfo.
+// Groups of RAY_COHERENCE_WARP_SIZE consecutive rays stand in for warps.
+RayCoherence ComputeRayCoherence(const glm::uvec3& dispatch_dims, std::span<const uint32_t> ray_idxes, const RayStorage& rays);
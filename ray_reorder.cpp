@@ -0,0 +1,359 @@
+#include "ray_reorder.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+#include "profiler.h"
+#include "radix_sort.h"
+#include "rt_common.h"
+#include "sort_keys.h"
+
+constexpr uint32_t BLOCK_SIZE = 32;  // Pixels per side of a tile of RayReorderStrategy::BinTiles
+constexpr uint32_t NUM_BINS_W = 4, NUM_BINS_H = 4;
+
+static glm::vec3 Constrain(glm::vec3 x)
+{
+    x.x = std::max(0.0f, std::min(1.0f, x.x));
+    x.y = std::max(0.0f, std::min(1.0f, x.y));
+    x.z = std::max(0.0f, std::min(1.0f, x.z));
+    return x;
+}
+
+// Integer grid coordinates of p with 2^bits cells per side of the scene bounds; NaNs land in cell 0
+static glm::uvec3 GetGridCell(const RayReorderInput& in, const glm::vec3& p, uint32_t bits)
+{
+    const glm::vec3 p01 = Constrain((p - in.scene_min) / (in.scene_max - in.scene_min));
+    const float     max = float((1U << bits) - 1);
+    auto            q   = [&](float x) { return std::isnan(x) ? 0U : uint32_t(std::min(x * (max + 1), max)); };
+    return {q(p01.x), q(p01.y), q(p01.z)};
+}
+
+// Inserts a zero bit above each of the low 16 bits of x
+static uint32_t SpreadBits2(uint32_t x)
+{
+    x &= 0xffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+// 2D Morton code of the octahedral encoding of dir at 2^bits cells per side; directions that do not encode go last
+static uint32_t GetOctMorton(const glm::vec3& dir, uint32_t bits)
+{
+    const glm::vec2 enc = OctEncode(dir);
+    const int       max = (1 << bits) - 1;
+    if (std::isnan(enc.x) || std::isnan(enc.y))
+        return (1U << (2 * bits)) - 1;
+    const uint32_t u = uint32_t(std::clamp(int(enc.x * (max + 1)), 0, max));
+    const uint32_t v = uint32_t(std::clamp(int(enc.y * (max + 1)), 0, max));
+    return SpreadBits2(u) | (SpreadBits2(v) << 1);
+}
+
+// Bin of a direction for BinTiles; directions that do not encode (zero-length) go to the last bin
+static uint8_t GetOctBin(const glm::vec3& dir)
+{
+    glm::vec2 enc = OctEncode(dir);
+    if (std::isnan(enc.x) || std::isnan(enc.y))
+        return NUM_BINS_W * NUM_BINS_H - 1;
+    int gridx = std::clamp(int(enc.x * NUM_BINS_W), 0, int(NUM_BINS_W) - 1);
+    int gridy = std::clamp(int(enc.y * NUM_BINS_H), 0, int(NUM_BINS_H) - 1);
+    return uint8_t(gridy * NUM_BINS_W + gridx);
+}
+
+template<class KeyFn>
+static void FillKeys(std::vector<uint64_t>* keys, size_t n, KeyFn&& key)
+{
+    keys->resize(n);
+    ParallelForChunks(n, [&](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            (*keys)[i] = key(uint32_t(i));
+        }
+    });
+}
+
+// The radix sort is stable, so starting from the pixels in order breaks ties by pixel index
+void RayReorderStrategy::SortByKeys(uint32_t key_bits, std::vector<uint32_t>* order)
+{
+    RRA_PROFILE_SCOPE("SortByKeys");
+    const size_t n = keys_.size();
+    order->resize(n);
+    ParallelForChunks(n, [&](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            (*order)[i] = uint32_t(i);
+        }
+    });
+    ParallelRadixSort(keys_, *order, keys_tmp_, order_tmp_, 0, key_bits);
+}
+
+void RayReorderStrategy::BinTiles(const RayReorderInput& in, std::vector<uint32_t>* order)
+{
+    RRA_PROFILE_SCOPE("BinTiles");
+    const uint32_t w           = in.width;
+    const uint32_t h           = in.height;
+    const uint32_t tiles_x     = (w + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const uint32_t tiles_y     = (h + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const uint32_t num_workers = GetNumWorkerThreads();
+    tile_pixels_.resize(size_t(num_workers) * BLOCK_SIZE * BLOCK_SIZE);
+    tile_bins_.resize(tile_pixels_.size());
+
+    ParallelForDynamic(
+        size_t(tiles_x) * tiles_y,
+        1,
+        [&](uint32_t worker, size_t tile) {
+            uint32_t*      block = &tile_pixels_[size_t(worker) * BLOCK_SIZE * BLOCK_SIZE];
+            uint8_t*       bins  = &tile_bins_[size_t(worker) * BLOCK_SIZE * BLOCK_SIZE];
+            const uint32_t x0    = uint32_t(tile % tiles_x) * BLOCK_SIZE;
+            const uint32_t y0    = uint32_t(tile / tiles_x) * BLOCK_SIZE;
+            const uint32_t bw    = std::min(BLOCK_SIZE, w - x0);
+            const uint32_t bh    = std::min(BLOCK_SIZE, h - y0);
+
+            uint32_t occs[NUM_BINS_W * NUM_BINS_H]{};
+            for (uint32_t i = 0; i < bw * bh; i++)
+            {
+                block[i] = (*order)[(x0 + i % bw) + size_t(y0 + i / bw) * w];
+                bins[i]  = GetOctBin(in.directions[block[i]]);
+                occs[bins[i]]++;
+            }
+
+            uint32_t offsets[NUM_BINS_W * NUM_BINS_H];
+            uint32_t s = 0;
+            for (uint32_t b = 0; b < NUM_BINS_W * NUM_BINS_H; b++)
+            {
+                offsets[b] = s;
+                s += occs[b];
+            }
+            for (uint32_t i = 0; i < bw * bh; i++)
+            {
+                const uint32_t d                                 = offsets[bins[i]]++;
+                (*order)[(x0 + d % bw) + size_t(y0 + d / bw) * w] = block[i];
+            }
+        },
+        num_workers);
+}
+
+// Mode 2: rays close on the 6D curve start close together and point the same way
+class OriginDirectionStrategy : public RayReorderStrategy
+{
+public:
+    const char* Name() const override
+    {
+        return "origin-direction";
+    }
+
+    void Reorder(const RayReorderInput& in, std::vector<uint32_t>* order) override
+    {
+        RRA_PROFILE_SCOPE(Name());
+        keys_.resize(in.origins.size());
+        encoder_.EncodeRays(in.origins, in.directions, in.scene_min, in.scene_max, keys_.data());
+        SortByKeys(encoder_.KeyBits(), order);
+    }
+
+private:
+    SortKeyEncoder encoder_{SORT_KEY_HILBERT, {6, {10, 10, 10, 10, 10, 10}}};
+};
+
+// Mode 3: the tile pass on its own, over the rays in pixel order
+class TileOctBinsStrategy : public RayReorderStrategy
+{
+public:
+    const char* Name() const override
+    {
+        return "tile-oct-bins";
+    }
+
+    void Reorder(const RayReorderInput& in, std::vector<uint32_t>* order) override
+    {
+        RRA_PROFILE_SCOPE(Name());
+        order->resize(in.origins.size());
+        ParallelForChunks(order->size(), [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                (*order)[i] = uint32_t(i);
+            }
+        });
+        BinTiles(in, order);
+    }
+};
+
+// 16 bits per axis of the origin above 8 bits per side of the octahedral direction. The Hilbert curve has no jumps
+// between neighbouring cells, so consecutive rays stay closer together where the Morton order skips across the scene.
+class OriginCurveStrategy : public RayReorderStrategy
+{
+public:
+    explicit OriginCurveStrategy(SortKeyCurve curve)
+        : encoder_(curve, {3, {16, 16, 16}})
+        , curve_(curve)
+    {
+    }
+
+    const char* Name() const override
+    {
+        return curve_ == SORT_KEY_HILBERT ? "hilbert" : "morton";
+    }
+
+    void Reorder(const RayReorderInput& in, std::vector<uint32_t>* order) override
+    {
+        RRA_PROFILE_SCOPE(Name());
+        const size_t n = in.origins.size();
+        keys_.resize(n);
+        encoder_.EncodeRays(in.origins, {}, in.scene_min, in.scene_max, keys_.data());
+        ParallelForChunks(n, [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                keys_[i] = (keys_[i] << 16) | GetOctMorton(in.directions[i], 8);
+            }
+        });
+        SortByKeys(encoder_.KeyBits() + 16, order);
+    }
+
+private:
+    SortKeyEncoder encoder_;
+    SortKeyCurve   curve_;
+};
+
+// Groups rays first by the octant they point into, then by the origin cell. Unlike the space-filling curves, cells
+// are only gathered, not walked in a spatially coherent order.
+class TwoLevelHashStrategy : public RayReorderStrategy
+{
+public:
+    const char* Name() const override
+    {
+        return "two-level-hash";
+    }
+
+    void Reorder(const RayReorderInput& in, std::vector<uint32_t>* order) override
+    {
+        RRA_PROFILE_SCOPE(Name());
+        FillKeys(&keys_, in.origins.size(), [&](uint32_t i) {
+            const glm::vec3& d      = in.directions[i];
+            const uint32_t   octant = (d.x < 0 ? 1 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 4 : 0);
+            const glm::uvec3 c      = GetGridCell(in, in.origins[i], 5);
+            return uint64_t((octant << 15) | (c.z << 10) | (c.y << 5) | c.x);
+        });
+        SortByKeys(18, order);
+    }
+};
+
+// Spherical k-means over the directions: a few Lloyd iterations on a strided sample find NUM_CLUSTERS mean
+// directions, every ray joins the nearest one, and rays of a cluster are ordered by origin.
+class KMeansStrategy : public RayReorderStrategy
+{
+public:
+    const char* Name() const override
+    {
+        return "kmeans";
+    }
+
+    void Reorder(const RayReorderInput& in, std::vector<uint32_t>* order) override
+    {
+        RRA_PROFILE_SCOPE(Name());
+        const size_t   n           = in.directions.size();
+        const size_t   stride      = std::max<size_t>(1, n / MAX_SAMPLES);
+        const size_t   num_samples = n / stride;
+        const uint32_t num_workers = GetNumWorkerThreads();
+        if (num_samples == 0)
+        {
+            order->clear();
+            return;
+        }
+
+        // Seeded with evenly spaced samples, so the result only depends on the input
+        for (uint32_t k = 0; k < NUM_CLUSTERS; k++)
+        {
+            centroids_[k] = in.directions[(k * num_samples / NUM_CLUSTERS) * stride];
+        }
+
+        sums_.resize(size_t(num_workers) * NUM_CLUSTERS);
+        for (int iter = 0; iter < NUM_ITERATIONS; iter++)
+        {
+            std::fill(sums_.begin(), sums_.end(), glm::vec3(0));
+            ParallelForChunks(
+                num_samples,
+                [&](uint32_t w, size_t begin, size_t end) {
+                    glm::vec3* sums = &sums_[size_t(w) * NUM_CLUSTERS];
+                    for (size_t s = begin; s < end; s++)
+                    {
+                        const glm::vec3& d = in.directions[s * stride];
+                        if (glm::dot(d, d) > 0 && std::isfinite(d.x + d.y + d.z))
+                            sums[GetCluster(d)] += d;
+                    }
+                },
+                num_workers);
+
+            for (uint32_t k = 0; k < NUM_CLUSTERS; k++)
+            {
+                glm::vec3 sum(0);
+                for (uint32_t w = 0; w < num_workers; w++)
+                {
+                    sum += sums_[size_t(w) * NUM_CLUSTERS + k];
+                }
+                const float len = glm::length(sum);
+                if (len > 0 && std::isfinite(len))
+                    centroids_[k] = sum / len;  // Empty clusters keep their centroid
+            }
+        }
+
+        keys_.resize(n);
+        encoder_.EncodeRays(in.origins, {}, in.scene_min, in.scene_max, keys_.data());
+        ParallelForChunks(n, [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                keys_[i] |= uint64_t(GetCluster(in.directions[i])) << encoder_.KeyBits();
+            }
+        });
+        SortByKeys(encoder_.KeyBits() + CLUSTER_BITS, order);
+    }
+
+private:
+    static constexpr uint32_t CLUSTER_BITS   = 5;
+    static constexpr uint32_t NUM_CLUSTERS   = 1 << CLUSTER_BITS;
+    static constexpr int      NUM_ITERATIONS = 8;
+    static constexpr size_t   MAX_SAMPLES    = 65536;
+
+    // Largest cosine; directions that compare with nothing (zero or NaN) join cluster 0
+    uint32_t GetCluster(const glm::vec3& d) const
+    {
+        uint32_t best     = 0;
+        float    best_dot = -2;
+        for (uint32_t k = 0; k < NUM_CLUSTERS; k++)
+        {
+            const float dot = glm::dot(d, centroids_[k]);
+            if (dot > best_dot)
+            {
+                best     = k;
+                best_dot = dot;
+            }
+        }
+        return best;
+    }
+
+    SortKeyEncoder         encoder_{SORT_KEY_MORTON, {3, {19, 19, 19}}};
+    glm::vec3              centroids_[NUM_CLUSTERS];
+    std::vector<glm::vec3> sums_;  // NUM_CLUSTERS per worker
+};
+
+std::unique_ptr<RayReorderStrategy> CreateRayReorderStrategy(int mode)
+{
+    switch (mode)
+    {
+    case RAY_REORDER_ORIGIN_DIRECTION:
+        return std::make_unique<OriginDirectionStrategy>();
+    case RAY_REORDER_TILE_OCT_BINS:
+        return std::make_unique<TileOctBinsStrategy>();
+    case RAY_REORDER_MORTON:
+        return std::make_unique<OriginCurveStrategy>(SORT_KEY_MORTON);
+    case RAY_REORDER_HILBERT:
+        return std::make_unique<OriginCurveStrategy>(SORT_KEY_HILBERT);
+    case RAY_REORDER_TWO_LEVEL_HASH:
+        return std::make_unique<TwoLevelHashStrategy>();
+    case RAY_REORDER_KMEANS:
+        return std::make_unique<KMeansStrategy>();
+    default:
+        return nullptr;
+    }
+}
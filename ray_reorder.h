@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Ways of permuting the AO rays of a frame before they are traced. The values double as the use_ray_binning modes of
+// the viewer and shaders/aoray.hlsl; 0 and 1 trace the rays in pixel order.
+enum RayReorderMode
+{
+    RAY_REORDER_ORIGIN_DIRECTION = 2,  // 6D Hilbert index of the origin and the direction, 10 bits per axis
+    RAY_REORDER_TILE_OCT_BINS,         // 4x4 octahedral direction bins within every 32x32 pixel tile
+    RAY_REORDER_MORTON,                // 3D Morton code of the origin, then 2D Morton code of the octahedral direction
+    RAY_REORDER_HILBERT,               // 3D Hilbert index of the origin, then 2D Morton code of the octahedral direction
+    RAY_REORDER_TWO_LEVEL_HASH,        // Direction octant, then a 32^3 grid cell of the origin
+    RAY_REORDER_KMEANS,                // K-means cluster of the direction, then 3D Morton code of the origin
+    RAY_REORDER_MODE_END,
+};
+constexpr int RAY_REORDER_MODE_BEGIN = RAY_REORDER_ORIGIN_DIRECTION;
+
+// One ray per pixel of a width x height frame, in pixel order. Zero directions are rays that are not traced.
+struct RayReorderInput
+{
+    uint32_t                   width{};
+    uint32_t                   height{};
+    std::span<const glm::vec3> origins;
+    std::span<const glm::vec3> directions;
+    glm::vec3                  scene_min{};
+    glm::vec3                  scene_max{};
+};
+
+// A strategy keeps its scratch buffers between calls, so reordering frames of the same size does not allocate.
+// One instance must not be used by two threads at once.
+class RayReorderStrategy
+{
+public:
+    virtual ~RayReorderStrategy() = default;
+
+    virtual const char* Name() const = 0;
+
+    // Fills order with the width * height pixels, order[i] being the pixel whose ray is traced i-th
+    virtual void Reorder(const RayReorderInput& in, std::vector<uint32_t>* order) = 0;
+
+protected:
+    // Sorts the pixels by the low key_bits bits of keys_[pixel] and breaks ties by pixel index, on all worker threads
+    void SortByKeys(uint32_t key_bits, std::vector<uint32_t>* order);
+
+    // Counting sort of the rays within every 32x32 tile of the frame into 4x4 octahedral direction bins. Each tile
+    // is rewritten in raster order, so the pass keeps the rays of a tile in its own slots of the dispatch.
+    void BinTiles(const RayReorderInput& in, std::vector<uint32_t>* order);
+
+    std::vector<uint64_t> keys_, keys_tmp_;
+    std::vector<uint32_t> order_tmp_;
+    std::vector<uint32_t> tile_pixels_;  // One tile per worker
+    std::vector<uint8_t>  tile_bins_;
+};
+
+// Returns null for modes outside [RAY_REORDER_MODE_BEGIN, RAY_REORDER_MODE_END)
+std::unique_ptr<RayReorderStrategy> CreateRayReorderStrategy(int mode);
@@ -0,0 +1,178 @@
+#include "ray_storage.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+
+constexpr uint32_t NO_DIRECTION    = 0xffffffff;  // Also the encoding of (0, 0, -1), which is stored as 0x0000ffff instead
+constexpr float    QUANTIZED_SCALE = 65535.0f;
+
+static uint32_t EncodeDirection(const glm::vec3& unit_dir)
+{
+    const glm::vec2 enc = OctEncode(unit_dir);
+    const uint32_t  u   = uint32_t(std::clamp(enc.x, 0.0f, 1.0f) * QUANTIZED_SCALE + 0.5f);
+    const uint32_t  v   = uint32_t(std::clamp(enc.y, 0.0f, 1.0f) * QUANTIZED_SCALE + 0.5f);
+    const uint32_t  ret = (v << 16) | u;
+    return ret == NO_DIRECTION ? 0x0000ffff : ret;
+}
+
+static glm::vec3 DecodeDirection(uint32_t enc)
+{
+    if (enc == NO_DIRECTION)
+        return glm::vec3(0);
+    return OctDecode(glm::vec2(float(enc & 0xffff), float(enc >> 16)) / QUANTIZED_SCALE);
+}
+
+void RayStorageError::Add(const RayStorageError& other)
+{
+    num_rays += other.num_rays;
+    num_rescaled += other.num_rescaled;
+    num_clamped += other.num_clamped;
+    sum_angle += other.sum_angle;
+    max_angle = std::max(max_angle, other.max_angle);
+    sum_origin += other.sum_origin;
+    max_origin = std::max(max_origin, other.max_origin);
+}
+
+void RayStorage::Reset(size_t n, const RayStorageFormat& format)
+{
+    Clear();
+    format_ = format;
+    size_   = n;
+    for (int c = 0; c < 3; c++)
+    {
+        if (format_.quantize_origins)
+            quantized_origins_[c].resize(n);
+        else
+            origins_[c].resize(n);
+        if (!format_.oct_directions)
+            directions_[c].resize(n);
+    }
+    if (format_.oct_directions)
+        oct_directions_.assign(n, NO_DIRECTION);
+    tmin_.resize(n);
+    tcurrent_.resize(n);
+}
+
+void RayStorage::Clear()
+{
+    for (int c = 0; c < 3; c++)
+    {
+        std::vector<float>().swap(origins_[c]);
+        std::vector<float>().swap(directions_[c]);
+        std::vector<uint16_t>().swap(quantized_origins_[c]);
+    }
+    std::vector<uint32_t>().swap(oct_directions_);
+    std::vector<float>().swap(tmin_);
+    std::vector<float>().swap(tcurrent_);
+    size_ = 0;
+}
+
+size_t RayStorage::MemoryBytes() const
+{
+    size_t bytes = oct_directions_.size() * sizeof(uint32_t) + (tmin_.size() + tcurrent_.size()) * sizeof(float);
+    for (int c = 0; c < 3; c++)
+    {
+        bytes += (origins_[c].size() + directions_[c].size()) * sizeof(float) + quantized_origins_[c].size() * sizeof(uint16_t);
+    }
+    return bytes;
+}
+
+void RayStorage::Set(size_t i, const RayInPixDumpFileMinimal& ray, RayStorageError* err)
+{
+    float tmin = ray.tmin, tcurrent = ray.tcurrent;
+    if (format_.oct_directions)
+    {
+        const float len = glm::length(ray.direction);
+        if (len > 0 && std::isfinite(len))
+        {
+            oct_directions_[i] = EncodeDirection(ray.direction / len);
+            tmin *= len;
+            tcurrent *= len;
+            if (err && len != 1.0f)
+                err->num_rescaled++;
+        }
+        else
+        {
+            oct_directions_[i] = NO_DIRECTION;
+        }
+    }
+    else
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            directions_[c][i] = ray.direction[c];
+        }
+    }
+
+    bool clamped = false;
+    for (int c = 0; c < 3; c++)
+    {
+        if (!format_.quantize_origins)
+        {
+            origins_[c][i] = ray.origin[c];
+            continue;
+        }
+        const float extent = format_.origin_max[c] - format_.origin_min[c];
+        const float x      = extent > 0 ? (ray.origin[c] - format_.origin_min[c]) / extent : 0.0f;
+        clamped |= !(x >= 0 && x <= 1);
+        quantized_origins_[c][i] = uint16_t(std::clamp(x, 0.0f, 1.0f) * QUANTIZED_SCALE + 0.5f);
+    }
+    tmin_[i]     = tmin;
+    tcurrent_[i] = tcurrent;
+
+    if (!err)
+        return;
+    err->num_rays++;
+    err->num_clamped += clamped;
+    const glm::dvec3 d0(ray.direction), d1(Direction(i));
+    if (glm::dot(d0, d0) > 0 && glm::dot(d1, d1) > 0)
+    {
+        // atan2 stays exact for tiny angles, where acos of the dot product rounds to hundredths of a degree
+        const double angle = std::atan2(glm::length(glm::cross(d0, d1)), glm::dot(d0, d1)) * 180.0 / 3.14159265358979;
+        err->sum_angle += angle;
+        err->max_angle = std::max(err->max_angle, angle);
+    }
+    const double dist = glm::length(ray.origin - Origin(i));
+    if (std::isfinite(dist))
+    {
+        err->sum_origin += dist;
+        err->max_origin = std::max(err->max_origin, dist);
+    }
+}
+
+glm::vec3 RayStorage::Origin(size_t i) const
+{
+    if (!format_.quantize_origins)
+        return glm::vec3(origins_[0][i], origins_[1][i], origins_[2][i]);
+    const glm::vec3 q(quantized_origins_[0][i], quantized_origins_[1][i], quantized_origins_[2][i]);
+    return format_.origin_min + q / QUANTIZED_SCALE * (format_.origin_max - format_.origin_min);
+}
+
+glm::vec3 RayStorage::Direction(size_t i) const
+{
+    if (format_.oct_directions)
+        return DecodeDirection(oct_directions_[i]);
+    return glm::vec3(directions_[0][i], directions_[1][i], directions_[2][i]);
+}
+
+RayInPixDumpFileMinimal RayStorage::Get(size_t i) const
+{
+    RayInPixDumpFileMinimal r;
+    r.origin    = Origin(i);
+    r.tmin      = tmin_[i];
+    r.direction = Direction(i);
+    r.tcurrent  = tcurrent_[i];
+    return r;
+}
+
+void RayStorage::Decode(size_t begin, size_t end, RayInPixDumpFileMinimal* out) const
+{
+    ParallelForChunks(end - begin, [&](uint32_t, size_t b, size_t e) {
+        for (size_t i = b; i < e; i++)
+        {
+            out[i] = Get(begin + i);
+        }
+    });
+}
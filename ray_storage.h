@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "rt_common.h"
+
+// How RayStorage keeps the rays of a dispatch. The default stores every component as a float and is lossless.
+//   oct_directions:   32 bits per direction (OctEncode, 16 bits per side). Directions are stored normalized, with tmin
+//                     and tcurrent multiplied by the original length, so every ray still covers the same segment.
+//   quantize_origins: 16 bits per axis within [origin_min, origin_max]; origins outside are clamped to it.
+struct RayStorageFormat
+{
+    bool      oct_directions{false};
+    bool      quantize_origins{false};
+    glm::vec3 origin_min{};
+    glm::vec3 origin_max{};
+};
+
+// What the stored rays lose against the rays given to RayStorage::Set
+struct RayStorageError
+{
+    uint64_t num_rays{};
+    uint64_t num_rescaled{};  // Rays whose direction was not unit length, so their t range was rescaled
+    uint64_t num_clamped{};   // Rays whose origin was outside the quantization bounds
+    double   sum_angle{}, max_angle{};    // Degrees between the original and the stored direction
+    double   sum_origin{}, max_origin{};  // Distance between the original and the stored origin
+
+    void Add(const RayStorageError& other);
+};
+
+// Structure-of-arrays storage of the rays of a dispatch, so kernels can stream over one component at a time and the
+// compressed formats save memory. 32 bytes per ray as floats, 18 with both compressions.
+class RayStorage
+{
+public:
+    // Drops all rays, then holds n zero rays in the given format
+    void Reset(size_t n, const RayStorageFormat& format);
+    void Clear();
+
+    size_t Size() const
+    {
+        return size_;
+    }
+    size_t MemoryBytes() const;
+    const RayStorageFormat& Format() const
+    {
+        return format_;
+    }
+
+    // Safe to call from several threads for different i. err, if given, accumulates the error of this ray.
+    void Set(size_t i, const RayInPixDumpFileMinimal& ray, RayStorageError* err = nullptr);
+
+    glm::vec3 Origin(size_t i) const;
+    glm::vec3 Direction(size_t i) const;  // Zero for rays stored without a direction
+    float     TMin(size_t i) const
+    {
+        return tmin_[i];
+    }
+    float TCurrent(size_t i) const
+    {
+        return tcurrent_[i];
+    }
+    RayInPixDumpFileMinimal Get(size_t i) const;
+
+    // Decodes [begin, end) into out, e.g. straight into the upload buffer of the GPU ray buffer, on the worker threads
+    void Decode(size_t begin, size_t end, RayInPixDumpFileMinimal* out) const;
+
+    // The float streams of one axis, empty when that part of the rays is compressed
+    std::span<const float> Origins(int axis) const
+    {
+        return origins_[axis];
+    }
+    std::span<const float> Directions(int axis) const
+    {
+        return directions_[axis];
+    }
+
+private:
+    RayStorageFormat      format_;
+    size_t                size_{};
+    std::vector<float>    origins_[3], directions_[3];
+    std::vector<uint16_t> quantized_origins_[3];
+    std::vector<uint32_t> oct_directions_;
+    std::vector<float>    tmin_, tcurrent_;
+};
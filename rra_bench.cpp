@@ -0,0 +1,436 @@
+// Benchmark suite of the CPU paths over a set of captures, for tracking regressions across commits.
+// Every scenario is run for a number of warmup iterations, then timed for a number of repeats, and reported with the
+// min, median, mean and standard deviation of the repeats, on stdout and optionally as JSON and CSV.
+// The geometry comes from the .rrageo cache the viewer writes next to each capture, so this runs without a GPU or the
+// RRA backend.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "capture_camera.h"
+#include "cpu_replay.h"
+#include "cpu_tracer.h"
+#include "dispatch_rays.h"
+#include "geometry_cache.h"
+#include "json_writer.h"
+#include "parallel.h"
+#include "platform.h"
+#include "profiler.h"
+#include "ray_binning.h"
+#include "ray_reorder.h"
+#include "vertex_weld.h"
+
+struct BenchSettings
+{
+    int                      warmup{1};
+    int                      repeats{5};
+    uint32_t                 width{1280};
+    uint32_t                 height{720};
+    uint32_t                 scene_view{0};  // TLAS whose instances are traced
+    int                      ao_samples{1};
+    float                    ao_radius{10000};
+    std::vector<std::string> filters;  // Substrings of the scenarios to run; all of them if empty
+};
+
+struct BenchResult
+{
+    std::string scenario;
+    std::string capture;
+    int         warmup{};
+    int         repeats{};
+    double      min_ms{};
+    double      median_ms{};
+    double      mean_ms{};
+    double      stddev_ms{};
+    uint64_t    items{};      // Work done by one iteration, 0 if the scenario has no natural unit
+    const char* item_name{};  // "rays", "tris", ...
+};
+
+BenchSettings            g_settings;
+std::vector<BenchResult> g_results;
+
+static bool ScenarioSelected(const std::string& scenario)
+{
+    if (g_settings.filters.empty())
+        return true;
+    for (const std::string& f : g_settings.filters)
+    {
+        if (scenario.find(f) != std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+// Runs fn() g_settings.warmup times, then times g_settings.repeats calls of it and records the result.
+// Scenarios filtered out are skipped without calling fn.
+template<class F>
+void RunScenario(const std::string& scenario, const std::string& capture, uint64_t items, const char* item_name, F&& fn)
+{
+    using Clock = std::chrono::steady_clock;
+
+    if (!ScenarioSelected(scenario))
+        return;
+
+    for (int i = 0; i < g_settings.warmup; i++)
+    {
+        fn();
+    }
+    std::vector<double> millis;
+    for (int i = 0; i < std::max(1, g_settings.repeats); i++)
+    {
+        Clock::time_point t0 = Clock::now();
+        fn();
+        millis.push_back(std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+    }
+    std::sort(millis.begin(), millis.end());
+
+    BenchResult r;
+    r.scenario  = scenario;
+    r.capture   = capture;
+    r.warmup    = g_settings.warmup;
+    r.repeats   = int(millis.size());
+    r.min_ms    = millis.front();
+    r.median_ms = millis.size() % 2 ? millis[millis.size() / 2] : (millis[millis.size() / 2 - 1] + millis[millis.size() / 2]) / 2;
+    for (double m : millis)
+    {
+        r.mean_ms += m / millis.size();
+    }
+    for (double m : millis)
+    {
+        r.stddev_ms += (m - r.mean_ms) * (m - r.mean_ms);
+    }
+    r.stddev_ms = millis.size() > 1 ? sqrt(r.stddev_ms / (millis.size() - 1)) : 0;
+    r.items     = items;
+    r.item_name = item_name;
+
+    printf("%-32s %-40s %10.2f %10.2f %10.2f %9.1f%%", scenario.c_str(), capture.c_str(), r.min_ms, r.median_ms, r.mean_ms, 100 * r.stddev_ms / r.mean_ms);
+    if (items > 0)
+        printf(" %10.2f M%s/s", items / (r.median_ms * 1000.0), item_name);
+    printf("\n");
+    g_results.push_back(r);
+}
+
+// All scenarios of one capture. pix_dumps are replayed against the capture's BVH.
+static bool BenchCapture(const std::string& rra_file, const std::vector<DispatchRaysInfo>& pix_dumps)
+{
+    const std::string capture = std::filesystem::path(rra_file).filename().string();
+
+    GeometryCache cache;
+    if (!MapGeometryCache(rra_file.c_str(), true, &cache))
+    {
+        printf("%s has no usable geometry cache; open it once in MyRRALoader to write %s\n", rra_file.c_str(), GetGeometryCachePath(rra_file.c_str()).c_str());
+        return false;
+    }
+    // A capture without TLASes is benchmarked with an empty scene view
+    const uint32_t                      num_views  = GetNumSceneViews(cache.view_offsets);
+    const uint32_t                      scene_view = num_views > 0 ? std::min(g_settings.scene_view, num_views - 1) : 0;
+    const std::span<const InstanceInfo> instances  = GetSceneViewInstances(cache.instances, cache.view_offsets, scene_view);
+
+    uint64_t num_tris = 0, num_soup_verts = 0;
+    for (const BlasGeometry& blas : cache.blas_geometry)
+    {
+        num_tris += blas.NumTriangles();
+        num_soup_verts += blas.indices.size();
+    }
+
+    // Load phases that do not need the trace: mapping and validating the cache, and welding the decoded triangles
+    RunScenario("load.map_cache", capture, 0, "", [&]() {
+        GeometryCache c;
+        MapGeometryCache(rra_file.c_str(), true, &c);
+    });
+    if (ScenarioSelected("load.weld"))
+    {
+        std::vector<std::vector<glm::vec3>> soups(cache.blas_geometry.size());
+        for (size_t b = 0; b < soups.size(); b++)
+        {
+            const BlasGeometry& blas = cache.blas_geometry[b];
+            for (uint32_t idx : blas.indices)
+            {
+                soups[b].push_back(blas.vertices[idx]);
+            }
+        }
+        std::vector<IndexedBlas> welded(soups.size());
+        RunScenario("load.weld", capture, num_soup_verts, "verts", [&]() {
+            for (size_t b = 0; b < soups.size(); b++)
+            {
+                WeldVertices(soups[b], &welded[b]);
+            }
+        });
+    }
+
+    RunScenario("bvh.build", capture, num_tris, "tris", [&]() {
+        CpuTlas tlas;
+        tlas.Build(cache.blas_geometry, instances);
+    });
+
+    CpuScene scene;
+    scene.Build(cache.blas_geometry, instances);
+
+    const CaptureCamera cam = GetCaptureCamera(rra_file.c_str(), g_settings.width, g_settings.height);
+    CpuRenderSettings   settings;
+    settings.width        = g_settings.width;
+    settings.height       = g_settings.height;
+    settings.inverse_view = cam.inverse_view;
+    settings.inverse_proj = cam.inverse_proj;
+    settings.invert_y     = cam.invert_y;
+    settings.ao_samples   = g_settings.ao_samples;
+    settings.ao_radius    = g_settings.ao_radius;
+
+    const uint64_t         num_pixels = uint64_t(settings.width) * settings.height;
+    std::vector<glm::vec4> hit_normal_and_t, colors;
+    for (CpuTraceMode mode : {CPU_TRACE_SINGLE, CPU_TRACE_PACKET8, CPU_TRACE_PACKET16, CPU_TRACE_STREAM})
+    {
+        settings.trace_mode = mode;
+        RunScenario(std::string("trace.primary.") + GetCpuTraceModeName(mode), capture, num_pixels, "rays", [&]() {
+            CpuTracePrimary(scene, settings, &hit_normal_and_t);
+        });
+    }
+    settings.trace_mode = CPU_TRACE_SINGLE;
+    CpuTracePrimary(scene, settings, &hit_normal_and_t);
+    RunScenario("trace.ao", capture, num_pixels * settings.ao_samples, "rays", [&]() {
+        CpuTraceAO(scene, settings, hit_normal_and_t, &colors);
+    });
+
+    // The first AO ray of every pixel, as the viewer reorders them in the ray binning modes
+    RayBinningSettings binning;
+    binning.width        = settings.width;
+    binning.height       = settings.height;
+    binning.inverse_view = cam.inverse_view;
+    binning.inverse_proj = cam.inverse_proj;
+    binning.invert_y     = cam.invert_y;
+    binning.cam_pos      = cam.eye;
+    binning.scene_min    = cache.aabb_min;
+    binning.scene_max    = cache.aabb_max;
+    std::vector<glm::vec3> origins, directions;
+    ComputeFirstAORays(binning, hit_normal_and_t, &origins, &directions);
+
+    RayReorderInput in;
+    in.width      = settings.width;
+    in.height     = settings.height;
+    in.origins    = origins;
+    in.directions = directions;
+    in.scene_min  = cache.aabb_min;
+    in.scene_max  = cache.aabb_max;
+    std::vector<uint32_t> order;
+    for (int mode = RAY_REORDER_MODE_BEGIN; mode < RAY_REORDER_MODE_END; mode++)
+    {
+        std::unique_ptr<RayReorderStrategy> strategy = CreateRayReorderStrategy(mode);
+        RunScenario(std::string("reorder.") + strategy->Name(), capture, num_pixels, "rays", [&]() { strategy->Reorder(in, &order); });
+    }
+
+    std::vector<CpuReplayRecord> records;
+    for (const DispatchRaysInfo& dri : pix_dumps)
+    {
+        records.resize(dri.rays.Size());
+        RunScenario("replay." + dri.name, capture, dri.rays.Size(), "rays", [&]() {
+            CpuReplayRays(scene.tlas, records, [&](size_t i) {
+                const RayInPixDumpFileMinimal r = dri.rays.Get(i);
+                return CpuRay{r.origin, r.tmin, r.direction, r.tcurrent};
+            });
+        });
+    }
+    return true;
+}
+
+static bool WriteResultsJson(const char* file_name)
+{
+    FILE* f = fopen(file_name, "w");
+    if (!f)
+    {
+        printf("Could not open %s for writing.\n", file_name);
+        return false;
+    }
+
+    std::tm tm;
+    LocalTime(time(nullptr), &tm);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    JsonWriter json(f);
+    json.BeginObject();
+    json.Integer("version", 1);
+    json.String("date", date);
+    json.Integer("threads", GetNumWorkerThreads());
+    json.String("simd", GetCpuSimdLevelName(GetCpuSimdLevel()));
+    json.Integer("width", g_settings.width);
+    json.Integer("height", g_settings.height);
+    json.Integer("ao_samples", g_settings.ao_samples);
+    json.BeginArray("results");
+    for (const BenchResult& r : g_results)
+    {
+        json.BeginObject();
+        json.String("scenario", r.scenario);
+        json.String("capture", r.capture);
+        json.Integer("warmup", r.warmup);
+        json.Integer("repeats", r.repeats);
+        json.Number("min_ms", r.min_ms);
+        json.Number("median_ms", r.median_ms);
+        json.Number("mean_ms", r.mean_ms);
+        json.Number("stddev_ms", r.stddev_ms);
+        if (r.items > 0)
+        {
+            json.Integer("items", int64_t(r.items));
+            json.String("item", r.item_name);
+            json.Number("mitems_per_second", r.items / (r.median_ms * 1000.0));
+        }
+        json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+
+    if (fclose(f) != 0)
+    {
+        printf("Could not write %s.\n", file_name);
+        return false;
+    }
+    printf("Wrote %s\n", file_name);
+    return true;
+}
+
+static bool WriteResultsCsv(const char* file_name)
+{
+    FILE* f = fopen(file_name, "w");
+    if (!f)
+    {
+        printf("Could not open %s for writing.\n", file_name);
+        return false;
+    }
+    fprintf(f, "scenario,capture,warmup,repeats,min_ms,median_ms,mean_ms,stddev_ms,items,item,mitems_per_second\n");
+    for (const BenchResult& r : g_results)
+    {
+        fprintf(f, "%s,%s,%d,%d,%.4f,%.4f,%.4f,%.4f,", r.scenario.c_str(), r.capture.c_str(), r.warmup, r.repeats, r.min_ms, r.median_ms, r.mean_ms, r.stddev_ms);
+        if (r.items > 0)
+            fprintf(f, "%llu,%s,%.4f\n", (unsigned long long)r.items, r.item_name, r.items / (r.median_ms * 1000.0));
+        else
+            fprintf(f, ",,\n");
+    }
+    if (fclose(f) != 0)
+    {
+        printf("Could not write %s.\n", file_name);
+        return false;
+    }
+    printf("Wrote %s\n", file_name);
+    return true;
+}
+
+static void PrintUsage()
+{
+    printf("Usage: rra_bench [-i RRA_FILE]... [-p PIX_DUMP]... [--scenario SUBSTRING]... [--warmup N] [--repeats N]\n"
+           "                 [-j NUM_THREADS] [-w W] [-h H] [--tlas N] [--ao-samples N] [--json FILE] [--csv FILE]\n"
+           "                 [--profile TRACE_JSON]\n"
+           "Scenarios: load.map_cache load.weld bvh.build trace.primary.<mode> trace.ao reorder.<strategy> replay.<pix dump>\n");
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> rra_files, pix_files;
+    const char*              json_file{nullptr};
+    const char*              csv_file{nullptr};
+    const char*              profile_file{nullptr};
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            rra_files.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            pix_files.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "--scenario") && i + 1 < argc)
+            g_settings.filters.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "--warmup") && i + 1 < argc)
+            g_settings.warmup = std::max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--repeats") && i + 1 < argc)
+            g_settings.repeats = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+        {
+            if (!ParseNumWorkerThreads(argv[++i], &g_num_worker_threads))
+            {
+                printf("-j expects a thread count from 0 to %u, got %s\n", MAX_WORKER_THREADS, argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            g_settings.width = uint32_t(std::max(1, atoi(argv[++i])));
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+            g_settings.height = uint32_t(std::max(1, atoi(argv[++i])));
+        else if (!strcmp(argv[i], "--tlas") && i + 1 < argc)
+        {
+            if (!ParseSceneViewIndex(argv[++i], &g_settings.scene_view))
+            {
+                printf("--tlas expects a TLAS index of 0 or more, got %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--ao-samples") && i + 1 < argc)
+            g_settings.ao_samples = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--json") && i + 1 < argc)
+            json_file = argv[++i];
+        else if (!strcmp(argv[i], "--csv") && i + 1 < argc)
+            csv_file = argv[++i];
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+            profile_file = argv[++i];
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if (profile_file)
+    {
+        SetProfilingEnabled(true);
+        SetProfileThreadName("main");
+    }
+
+    if (rra_files.empty())
+    {
+        for (const auto& entry : std::filesystem::directory_iterator("."))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".rra")
+                rra_files.push_back(entry.path().string());
+        }
+        std::sort(rra_files.begin(), rra_files.end());
+    }
+
+    std::vector<DispatchRaysInfo> pix_dumps(pix_files.size());
+    for (size_t i = 0; i < pix_files.size(); i++)
+    {
+        if (!ReadPixBufferDump(pix_files[i].c_str(), RayStorageFormat{}, &pix_dumps[i]))
+            return 1;
+        pix_dumps[i].name = std::filesystem::path(pix_files[i]).stem().string();
+    }
+
+    printf("%zu capture(s), %u thread(s), %s, %dx%d, %d warmup, %d repeat(s)\n",
+           rra_files.size(),
+           GetNumWorkerThreads(),
+           GetCpuSimdLevelName(GetCpuSimdLevel()),
+           g_settings.width,
+           g_settings.height,
+           g_settings.warmup,
+           g_settings.repeats);
+    printf("%-32s %-40s %10s %10s %10s %10s %12s\n", "Scenario", "Capture", "Min ms", "Median ms", "Mean ms", "Stddev", "Throughput");
+
+    int ret = 0;
+    for (const std::string& rra_file : rra_files)
+    {
+        if (!BenchCapture(rra_file, pix_dumps))
+            ret = 1;
+    }
+
+    if (json_file && !WriteResultsJson(json_file))
+        ret = 1;
+    if (csv_file && !WriteResultsCsv(csv_file))
+        ret = 1;
+    if (profile_file && !WriteChromeTrace(profile_file))
+        ret = 1;
+    return ret;
+}
@@ -0,0 +1,1000 @@
+// Headless frontends of the CPU paths: rendering a capture on the CPU tracer, replaying dispatch rays, the CPU
+// benchmarks and the batch analysis. Nothing here needs a window or a GPU.
+// The geometry comes from the .rrageo cache the viewer writes next to each capture and the rays from PIX dumps. Where
+// the RRA backend is available (Windows), captures without a cache and the ray dispatches of the traces are decoded
+// as well.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "capture_camera.h"
+#include "cpu_replay.h"
+#include "cpu_tracer.h"
+#include "dispatch_rays.h"
+#include "geometry_cache.h"
+#include "json_writer.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "ray_binning.h"
+#include "ray_reorder.h"
+#include "ray_storage.h"
+#include "rt_common.h"
+#ifdef RRA_HAS_TRACE_DECODER
+#include "rra_trace.h"
+#endif
+
+struct CliSettings
+{
+    uint32_t         width{1280};
+    uint32_t         height{720};
+    uint32_t         scene_view{0};  // TLAS whose instances are traced; captures with fewer use TLAS 0
+    int              ao_samples{1};
+    float            ao_radius{10000};
+    int              bench_repeats{5};
+    bool             use_geometry_cache{true};
+    bool             weld_vertices{true};
+    bool             oct_ray_directions{false};  // RayStorageFormat of the dispatches loaded from then on
+    bool             quantize_ray_origins{false};
+    bool             cpu_normals{false};  // Render the normal visualization of primaryray.hlsl instead of AO
+    CpuTraceMode     trace_mode{CPU_TRACE_SINGLE};
+    CpuReplayCounter replay_counter{CPU_REPLAY_NODE_VISITS};  // Shown as a histogram and in the heatmap
+    const char*      replay_heatmap{nullptr};                 // BMP of replay_counter per dispatch thread
+};
+
+CliSettings                   g_settings;
+std::vector<DispatchRaysInfo> g_pix_dumps;  // Read while parsing the command line, replayed against every capture
+
+using Clock = std::chrono::steady_clock;
+
+static double Millis(Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+static bool CanDecodeTraces()
+{
+#ifdef RRA_HAS_TRACE_DECODER
+    return true;
+#else
+    return false;
+#endif
+}
+
+// The format dispatches are loaded in. Origins are quantized within the scene bounds, so they stay floats when the
+// scene is not known, as for PIX dumps, which are read while parsing the command line.
+static RayStorageFormat GetRayStorageFormat(const glm::vec3& scene_min, const glm::vec3& scene_max)
+{
+    RayStorageFormat format;
+    format.oct_directions   = g_settings.oct_ray_directions;
+    format.quantize_origins = g_settings.quantize_ray_origins;
+    const bool has_bounds   = scene_min.x <= scene_max.x && scene_min.y <= scene_max.y && scene_min.z <= scene_max.z;
+    if (format.quantize_origins && !has_bounds)
+    {
+        printf("  No scene bounds yet, keeping the ray origins as floats\n");
+        format.quantize_origins = false;
+    }
+    format.origin_min = scene_min;
+    format.origin_max = scene_max;
+    return format;
+}
+
+// Geometry of one capture, mapped from the .rrageo cache or decoded from the trace
+struct CaptureGeometry
+{
+    GeometryCache                 cache;
+    std::vector<InstanceInfo>     inst_infos;
+    std::vector<uint64_t>         view_offsets;
+    std::vector<IndexedBlas>      blases;
+    BlasGeometrySpans             blas_geometry;
+    std::span<const uint64_t>     all_view_offsets;
+    std::span<const InstanceInfo> instances;  // Of the scene view that is traced
+    uint32_t                      scene_view{0};
+    uint32_t                      num_dispatches{0};            // RRA dispatches of the trace
+    uint32_t                      num_undecoded_dispatches{0};  // Of those, the ones that could not be decoded here
+    glm::vec3                     aabb_min{1e20f}, aabb_max{-1e20f};
+    bool                          decoded{false};       // The trace was loaded and is still open
+    const char*                   load_error{nullptr};  // Why LoadCaptureGeometry failed, as --batch reports it
+};
+
+// Points geom->instances at g_settings.scene_view, or at the first TLAS if the capture has fewer
+static void SelectSceneView(CaptureGeometry* geom, std::span<const InstanceInfo> inst_infos, std::span<const uint64_t> view_offsets)
+{
+    const uint32_t num_views = GetNumSceneViews(view_offsets);
+    geom->scene_view         = g_settings.scene_view;
+    if (num_views == 0)
+    {
+        printf("The capture has no TLAS, tracing an empty scene\n");
+        geom->scene_view = 0;
+    }
+    else if (geom->scene_view >= num_views)
+    {
+        printf("The capture has %u TLAS(es), using TLAS 0 instead of %u\n", num_views, g_settings.scene_view);
+        geom->scene_view = 0;
+    }
+    geom->all_view_offsets = view_offsets;
+    geom->instances        = GetSceneViewInstances(inst_infos, view_offsets, geom->scene_view);
+}
+
+static bool LoadCaptureGeometry(const char* rra_file_name, CaptureGeometry* geom)
+{
+    if (!std::filesystem::exists(rra_file_name))
+    {
+        printf("%s does not exist.\n", rra_file_name);
+        geom->load_error = "missing";
+        return false;
+    }
+
+    if (g_settings.use_geometry_cache && MapGeometryCache(rra_file_name, g_settings.weld_vertices, &geom->cache))
+    {
+        geom->aabb_min       = geom->cache.aabb_min;
+        geom->aabb_max       = geom->cache.aabb_max;
+        geom->blas_geometry  = geom->cache.blas_geometry;
+        geom->num_dispatches = geom->cache.header->num_dispatches;
+        SelectSceneView(geom, geom->cache.instances, geom->cache.view_offsets);
+        return true;
+    }
+
+#ifdef RRA_HAS_TRACE_DECODER
+    if (!OpenRRAFile(rra_file_name))
+    {
+        geom->load_error = "decode_failed";
+        return false;
+    }
+    RraGeometry decoded  = LoadGeometryFromRRAFile(g_settings.weld_vertices);
+    geom->inst_infos     = std::move(decoded.inst_infos);
+    geom->view_offsets   = std::move(decoded.view_offsets);
+    geom->blases         = std::move(decoded.blases);
+    geom->aabb_min       = decoded.aabb_min;
+    geom->aabb_max       = decoded.aabb_max;
+    geom->num_dispatches = GetRRADispatchCount();
+    geom->decoded        = true;
+    if (g_settings.use_geometry_cache)
+        WriteGeometryCache(rra_file_name, geom->num_dispatches, g_settings.weld_vertices, geom->inst_infos, geom->view_offsets, geom->blases, geom->aabb_min, geom->aabb_max);
+    geom->blas_geometry = ToBlasGeometrySpans(geom->blases);
+    SelectSceneView(geom, geom->inst_infos, geom->view_offsets);
+    return true;
+#else
+    printf("%s has no usable geometry cache, and RRA traces can only be decoded on Windows. Open it once in MyRRALoader to write %s\n",
+           rra_file_name,
+           GetGeometryCachePath(rra_file_name).c_str());
+    geom->load_error = "no_geometry_cache";
+    return false;
+#endif
+}
+
+static void CloseCapture([[maybe_unused]] CaptureGeometry* geom)
+{
+#ifdef RRA_HAS_TRACE_DECODER
+    if (geom->decoded)
+        CloseRRAFile();
+    geom->decoded = false;
+#endif
+}
+
+// The ray dispatches of the capture's trace, without their rays. Empty where traces cannot be decoded.
+static std::vector<DispatchRaysInfo> LoadCaptureDispatches(const char* rra_file_name, CaptureGeometry* geom)
+{
+    if (geom->num_dispatches == 0)
+        return {};
+#ifdef RRA_HAS_TRACE_DECODER
+    // The trace only has to be opened for its dispatches when the geometry came from the cache
+    if (!geom->decoded)
+    {
+        if (!OpenRRAFile(rra_file_name))
+        {
+            geom->num_undecoded_dispatches = geom->num_dispatches;
+            return {};
+        }
+        geom->decoded = true;
+    }
+    return LoadDispatchesFromRRAFile();
+#else
+    printf("Skipping the %u ray dispatch(es) of %s; RRA traces can only be decoded on Windows\n", geom->num_dispatches, rra_file_name);
+    geom->num_undecoded_dispatches = geom->num_dispatches;
+    return {};
+#endif
+}
+
+// Decodes the rays of an RRA dispatch and measures their coherence; PIX dumps are resident already
+static void EnsureDispatchRaysResident([[maybe_unused]] const CaptureGeometry& geom, DispatchRaysInfo* dri)
+{
+    if (dri->resident)
+        return;
+#ifdef RRA_HAS_TRACE_DECODER
+    printf("Decoding the rays of %s\n", dri->name.c_str());
+    ExtractDispatchRays(dri, GetRayStorageFormat(geom.aabb_min, geom.aabb_max));
+    ComputeDispatchRaysCoherence(dri);
+    dri->resident = true;
+#endif
+}
+
+static void DropDispatchRays(DispatchRaysInfo* dri)
+{
+    if (dri->rra_dispatch_idx < 0)
+        return;
+    dri->rays.Clear();
+    std::vector<uint32_t>().swap(dri->ray_idxes);
+    dri->resident = false;
+}
+
+static CpuRenderSettings GetRenderSettings(const CaptureCamera& cam)
+{
+    CpuRenderSettings settings;
+    settings.width        = g_settings.width;
+    settings.height       = g_settings.height;
+    settings.inverse_view = cam.inverse_view;
+    settings.inverse_proj = cam.inverse_proj;
+    settings.invert_y     = cam.invert_y;
+    settings.ao_samples   = g_settings.ao_samples;
+    settings.ao_radius    = g_settings.ao_radius;
+    settings.trace_mode   = g_settings.trace_mode;
+    return settings;
+}
+
+// Replays the AO passes of aoray.hlsl, or the normals of primaryray.hlsl, on the CPU tracer and writes a BMP
+static int RunCpuRender(const char* rra_file_name, const char* output_file_name)
+{
+    CaptureGeometry geom;
+    if (!LoadCaptureGeometry(rra_file_name, &geom))
+        return 1;
+    const CaptureCamera cam = GetCaptureCamera(rra_file_name, g_settings.width, g_settings.height);
+    if (cam.params_name)
+        printf("Using camera params for %s\n", cam.params_name);
+
+    Clock::time_point t0 = Clock::now();
+    CpuScene          scene;
+    scene.Build(geom.blas_geometry, geom.instances);
+    Clock::time_point t1 = Clock::now();
+    printf("CPU BVH: %zu instances over %zu unique triangles, %zu nodes, %.1f MB, built in %.1f ms\n",
+           scene.tlas.NumInstances(),
+           scene.tlas.NumBlasTriangles(),
+           scene.tlas.NumNodes(),
+           scene.tlas.MemoryBytes() / 1048576.0,
+           Millis(t0, t1));
+
+    const CpuRenderSettings settings = GetRenderSettings(cam);
+    std::vector<glm::vec4>  hit_normal_and_t, colors;
+    CpuTracePrimary(scene, settings, &hit_normal_and_t, g_settings.cpu_normals ? &colors : nullptr);
+    Clock::time_point t2 = Clock::now();
+    printf("Primary pass: %ux%u in %.1f ms on %u thread(s), %s %s traversal\n",
+           settings.width,
+           settings.height,
+           Millis(t1, t2),
+           GetNumWorkerThreads(),
+           GetCpuSimdLevelName(GetCpuSimdLevel()),
+           GetCpuTraceModeName(settings.trace_mode));
+    if (!g_settings.cpu_normals)
+    {
+        CpuTraceAO(scene, settings, hit_normal_and_t, &colors);
+        printf("AO pass: %d sample(s), radius %g in %.1f ms\n", settings.ao_samples, settings.ao_radius, Millis(t2, Clock::now()));
+    }
+    CloseCapture(&geom);
+
+    if (!WriteBMP(output_file_name, settings.width, settings.height, colors))
+        return 1;
+    printf("Wrote %s\n", output_file_name);
+    return 0;
+}
+
+// Times the CPU BVH build (all BLASes plus the instance TLAS) on each capture and reports unique triangles per second
+static int RunBvhBuildBenchmark(const std::vector<std::string>& rra_files)
+{
+    printf("BVH build benchmark, %u thread(s), median of %d build(s)\n", GetNumWorkerThreads(), g_settings.bench_repeats);
+    printf("%-48s %12s %10s %12s %10s %10s %10s\n", "Capture", "Triangles", "Instances", "Nodes", "Min ms", "Median ms", "Mtris/s");
+    for (const std::string& rra_file : rra_files)
+    {
+        CaptureGeometry geom;
+        if (!LoadCaptureGeometry(rra_file.c_str(), &geom))
+            continue;
+
+        size_t num_tris = 0;
+        for (const BlasGeometry& blas : geom.blas_geometry)
+        {
+            num_tris += blas.NumTriangles();
+        }
+
+        std::vector<double> millis;
+        size_t              num_nodes = 0;
+        for (int r = 0; r < std::max(1, g_settings.bench_repeats); r++)
+        {
+            CpuTlas           tlas;
+            Clock::time_point t0 = Clock::now();
+            tlas.Build(geom.blas_geometry, geom.instances);
+            millis.push_back(Millis(t0, Clock::now()));
+            num_nodes = tlas.NumNodes();
+        }
+        std::sort(millis.begin(), millis.end());
+        const double median = millis[millis.size() / 2];
+
+        printf("%-48s %12zu %10zu %12zu %10.1f %10.1f %10.2f\n",
+               std::filesystem::path(rra_file).filename().string().c_str(),
+               num_tris,
+               geom.instances.size(),
+               num_nodes,
+               millis.front(),
+               median,
+               num_tris / (median * 1000.0));
+        CloseCapture(&geom);
+    }
+    return 0;
+}
+
+// Traces the primary pass of each capture with every CpuTraceMode and reports camera rays per second.
+// The camera is the one the viewer uses for the capture, so the numbers follow what RayGen_primary traces.
+static int RunPrimaryRayBenchmark(const std::vector<std::string>& rra_files)
+{
+    const CpuTraceMode modes[] = {CPU_TRACE_SINGLE, CPU_TRACE_PACKET8, CPU_TRACE_PACKET16, CPU_TRACE_STREAM};
+    printf("Primary ray benchmark, %ux%u, %u thread(s), %s, median of %d pass(es), Mrays/s\n",
+           g_settings.width,
+           g_settings.height,
+           GetNumWorkerThreads(),
+           GetCpuSimdLevelName(GetCpuSimdLevel()),
+           g_settings.bench_repeats);
+    printf("%-48s", "Capture");
+    for (CpuTraceMode mode : modes)
+    {
+        printf(" %10s", GetCpuTraceModeName(mode));
+    }
+    printf("\n");
+
+    for (const std::string& rra_file : rra_files)
+    {
+        CaptureGeometry geom;
+        if (!LoadCaptureGeometry(rra_file.c_str(), &geom))
+            continue;
+
+        CpuScene scene;
+        scene.Build(geom.blas_geometry, geom.instances);
+
+        CpuRenderSettings settings = GetRenderSettings(GetCaptureCamera(rra_file.c_str(), g_settings.width, g_settings.height));
+
+        std::vector<glm::vec4> reference, hit_normal_and_t;
+        double                 mrays[std::size(modes)];
+        size_t                 mismatches = 0;
+        for (size_t m = 0; m < std::size(modes); m++)
+        {
+            settings.trace_mode = modes[m];
+            std::vector<double> millis;
+            for (int r = 0; r < std::max(1, g_settings.bench_repeats); r++)
+            {
+                Clock::time_point t0 = Clock::now();
+                CpuTracePrimary(scene, settings, &hit_normal_and_t);
+                millis.push_back(Millis(t0, Clock::now()));
+            }
+            std::sort(millis.begin(), millis.end());
+            mrays[m] = double(settings.width) * settings.height / (millis[millis.size() / 2] * 1000.0);
+
+            // Every mode has to find the same hit distances as single-ray traversal
+            if (m == 0)
+                reference = hit_normal_and_t;
+            for (size_t i = 0; i < reference.size(); i++)
+            {
+                mismatches += reference[i].w != hit_normal_and_t[i].w;
+            }
+        }
+
+        printf("%-48s", std::filesystem::path(rra_file).filename().string().c_str());
+        for (double v : mrays)
+        {
+            printf(" %10.2f", v);
+        }
+        printf("\n");
+        if (mismatches > 0)
+            printf("  %zu pixel(s) differ from single-ray traversal\n", mismatches);
+        CloseCapture(&geom);
+    }
+    return 0;
+}
+
+// How the first AO ray of every pixel traces in the order of one RayReorderStrategy
+struct RayReorderEvaluation
+{
+    const char*         name;
+    double              median_ms{};  // Of bench_repeats reorders; 0 for the pixel order
+    CpuReplayOrderScore score;
+};
+
+// Builds the first AO ray of every pixel from the capture's camera, the rays the viewer bins in modes 2 and up, and
+// evaluates the pixel order the AO pass uses without binning followed by every strategy of strategies[mode].
+static std::vector<RayReorderEvaluation> EvaluateRayReorderStrategies(const CpuScene&                                     scene,
+                                                                      const CaptureGeometry&                              geom,
+                                                                      const CaptureCamera&                                cam,
+                                                                      std::span<const std::unique_ptr<RayReorderStrategy>> strategies)
+{
+    CpuRenderSettings settings = GetRenderSettings(cam);
+    settings.trace_mode        = CPU_TRACE_SINGLE;
+    std::vector<glm::vec4> hit_normal_and_t;
+    CpuTracePrimary(scene, settings, &hit_normal_and_t);
+
+    RayBinningSettings binning;
+    binning.width        = settings.width;
+    binning.height       = settings.height;
+    binning.inverse_view = cam.inverse_view;
+    binning.inverse_proj = cam.inverse_proj;
+    binning.invert_y     = cam.invert_y;
+    binning.cam_pos      = TransformPosition(cam.inverse_view, glm::vec3(0, 0, 0));
+    binning.scene_min    = geom.aabb_min;
+    binning.scene_max    = geom.aabb_max;
+    std::vector<glm::vec3> origins, directions;
+    ComputeFirstAORays(binning, hit_normal_and_t, &origins, &directions);
+
+    // Pixels whose primary ray missed trace no AO ray
+    std::vector<CpuRay> rays(origins.size());
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        const bool hit = hit_normal_and_t[i].w >= 0;
+        rays[i]        = {origins[i], 0.001f, hit ? directions[i] : glm::vec3(0), g_settings.ao_radius};
+    }
+
+    RayReorderInput in;
+    in.width      = settings.width;
+    in.height     = settings.height;
+    in.origins    = origins;
+    in.directions = directions;
+    in.scene_min  = geom.aabb_min;
+    in.scene_max  = geom.aabb_max;
+
+    std::vector<RayReorderEvaluation> ret;
+    std::vector<uint32_t>             order(rays.size());
+    for (int mode = 0; mode < int(strategies.size()); mode++)
+    {
+        RayReorderStrategy* strategy = strategies[mode].get();
+        if (mode > 0 && !strategy)
+            continue;
+
+        // Mode 0 is the pixel order
+        RayReorderEvaluation e;
+        e.name = strategy ? strategy->Name() : "pixel-order";
+        if (strategy)
+        {
+            std::vector<double> millis;
+            for (int r = 0; r < std::max(1, g_settings.bench_repeats); r++)
+            {
+                Clock::time_point t0 = Clock::now();
+                strategy->Reorder(in, &order);
+                millis.push_back(Millis(t0, Clock::now()));
+            }
+            std::sort(millis.begin(), millis.end());
+            e.median_ms = millis[millis.size() / 2];
+        }
+        else
+        {
+            for (size_t i = 0; i < order.size(); i++)
+            {
+                order[i] = uint32_t(i);
+            }
+        }
+        e.score = ScoreCpuReplayOrder(scene.tlas, rays, order);
+        ret.push_back(e);
+    }
+    return ret;
+}
+
+static void CreateRayReorderStrategies(std::unique_ptr<RayReorderStrategy> (&strategies)[RAY_REORDER_MODE_END])
+{
+    for (int mode = RAY_REORDER_MODE_BEGIN; mode < RAY_REORDER_MODE_END; mode++)
+    {
+        strategies[mode] = CreateRayReorderStrategy(mode);
+    }
+}
+
+// Compares the RayReorderStrategies on the first AO rays of each capture: how long reordering takes, and how the
+// rays trace in the resulting order.
+static int RunReorderBenchmark(const std::vector<std::string>& rra_files)
+{
+    printf("Ray reordering benchmark, %ux%u AO rays, %u thread(s), %s, median of %d reorder(s)\n",
+           g_settings.width,
+           g_settings.height,
+           GetNumWorkerThreads(),
+           GetCpuSimdLevelName(GetCpuSimdLevel()),
+           g_settings.bench_repeats);
+
+    std::unique_ptr<RayReorderStrategy> strategies[RAY_REORDER_MODE_END];
+    CreateRayReorderStrategies(strategies);
+
+    for (const std::string& rra_file : rra_files)
+    {
+        CaptureGeometry geom;
+        if (!LoadCaptureGeometry(rra_file.c_str(), &geom))
+            continue;
+
+        CpuScene scene;
+        scene.Build(geom.blas_geometry, geom.instances);
+
+        printf("%s\n", std::filesystem::path(rra_file).filename().string().c_str());
+        printf("  %-16s %10s %10s %10s %10s %10s\n", "Strategy", "Sort ms", "Mrays/s", "Cost/ray", "SIMD eff", "Line reuse");
+        const CaptureCamera cam = GetCaptureCamera(rra_file.c_str(), g_settings.width, g_settings.height);
+        for (const RayReorderEvaluation& e : EvaluateRayReorderStrategies(scene, geom, cam, strategies))
+        {
+            printf("  %-16s %10.2f %10.2f %10.1f %10.3f %10.3f\n",
+                   e.name,
+                   e.median_ms,
+                   e.score.mrays_per_second,
+                   e.score.mean_cost,
+                   e.score.simd_efficiency,
+                   e.score.cache_line_reuse);
+        }
+        CloseCapture(&geom);
+    }
+    return 0;
+}
+
+// Traces every resident ray of dri into records on the worker threads and returns the milliseconds it took
+static double ReplayDispatchRays(const CpuTlas& tlas, const DispatchRaysInfo& dri, std::vector<CpuReplayRecord>* records)
+{
+    records->resize(dri.rays.Size());
+    Clock::time_point t0 = Clock::now();
+    CpuReplayRays(tlas, *records, [&](size_t i) {
+        const RayInPixDumpFileMinimal r = dri.rays.Get(i);
+        return CpuRay{r.origin, r.tmin, r.direction, r.tcurrent};
+    });
+    return Millis(t0, Clock::now());
+}
+
+// Replays one dispatch against the CPU BVH of the capture. PIX dumps given with -p come first, then the dispatches of
+// the RRA trace, in the same order as the list box of the viewer. Every ray is traced for its closest hit in
+// (tmin, tcurrent) and written to a replay file, along with its traversal counters, which are summarized.
+static int RunDispatchReplay(const char* rra_file_name, uint32_t dispatch_idx, const char* output_file_name)
+{
+    CaptureGeometry geom;
+    if (!LoadCaptureGeometry(rra_file_name, &geom))
+        return 1;
+
+    std::vector<DispatchRaysInfo> dispatches = std::move(g_pix_dumps);
+    for (DispatchRaysInfo& dri : LoadCaptureDispatches(rra_file_name, &geom))
+    {
+        dispatches.push_back(std::move(dri));
+    }
+    if (dispatch_idx >= dispatches.size())
+    {
+        printf("Dispatch %u does not exist, there are %zu.\n", dispatch_idx, dispatches.size());
+        return 1;
+    }
+    DispatchRaysInfo* dri = &dispatches[dispatch_idx];
+    EnsureDispatchRaysResident(geom, dri);
+
+    Clock::time_point t0 = Clock::now();
+    CpuTlas           tlas;
+    tlas.Build(geom.blas_geometry, geom.instances);
+    Clock::time_point t1 = Clock::now();
+    printf("CPU BVH: %zu instances, %zu nodes, built in %.1f ms\n", tlas.NumInstances(), tlas.NumNodes(), Millis(t0, t1));
+
+    std::vector<CpuReplayRecord> records;
+    const double                 replay_ms = ReplayDispatchRays(tlas, *dri, &records);
+
+    uint64_t num_hits = 0;
+    for (const CpuReplayRecord& rec : records)
+    {
+        num_hits += rec.t >= 0;
+    }
+    printf("%s: %zu rays in %.1f ms on %u thread(s), %s, %.2f Mrays/s, %.1f%% hit\n",
+           dri->name.c_str(),
+           records.size(),
+           replay_ms,
+           GetNumWorkerThreads(),
+           GetCpuSimdLevelName(GetCpuSimdLevel()),
+           records.size() / (replay_ms * 1000.0),
+           100.0 * num_hits / std::max<size_t>(1, records.size()));
+
+    // Per-ray traversal cost of the dispatch
+    printf("%-10s %10s %8s %8s %8s %8s\n", "Counter", "mean", "p50", "p95", "p99", "max");
+    for (int c = 0; c < CPU_REPLAY_NUM_COUNTERS; c++)
+    {
+        const CpuReplayHistogram h = ComputeCpuReplayHistogram(records, CpuReplayCounter(c));
+        printf("%-10s %10.2f %8u %8u %8u %8u\n", GetCpuReplayCounterName(CpuReplayCounter(c)), h.mean, h.p50, h.p95, h.p99, h.max);
+    }
+
+    const CpuReplayCounter   counter   = g_settings.replay_counter;
+    const CpuReplayHistogram hist      = ComputeCpuReplayHistogram(records, counter);
+    const uint64_t           max_bin   = std::max<uint64_t>(1, *std::max_element(hist.bins.begin(), hist.bins.end()));
+    const int                BAR_CHARS = 50;
+    printf("Histogram of %s per ray:\n", GetCpuReplayCounterName(counter));
+    for (size_t b = 0; b < hist.bins.size(); b++)
+    {
+        if (b * hist.bin_width > hist.max)
+            break;
+        printf("  [%6zu, %6zu) %10llu %s\n",
+               b * hist.bin_width,
+               (b + 1) * hist.bin_width,
+               (unsigned long long)hist.bins[b],
+               std::string(size_t(hist.bins[b] * BAR_CHARS / max_bin), '#').c_str());
+    }
+    CloseCapture(&geom);
+
+    if (!WriteCpuReplayFile(output_file_name, dri->dispatch_dims, dri->ray_idxes, records))
+        return 1;
+    printf("Wrote %s\n", output_file_name);
+
+    if (g_settings.replay_heatmap)
+    {
+        if (!WriteCpuReplayHeatmap(g_settings.replay_heatmap, dri->dispatch_dims, dri->ray_idxes, records, counter))
+            return 1;
+        printf("Wrote the %s heatmap to %s\n", GetCpuReplayCounterName(counter), g_settings.replay_heatmap);
+    }
+    return 0;
+}
+
+static void WriteBatchDispatch(JsonWriter* json, const DispatchRaysInfo& dri)
+{
+    json->String("name", dri.name);
+    json->String("source", dri.rra_dispatch_idx >= 0 ? "rra" : "pix");
+    json->BeginArray("dims");
+    for (int c = 0; c < 3; c++)
+    {
+        json->Integer(nullptr, dri.dispatch_dims[c]);
+    }
+    json->EndArray();
+    json->Integer("rays", dri.rays.Size());
+    json->Integer("memory_bytes", dri.rays.MemoryBytes());
+
+    const RayCoherence& c = dri.coherence;
+    if (!c.valid)
+        return;
+    json->BeginObject("coherence");
+    for (int t = 0; t < 2; t++)
+    {
+        const std::string tile = std::to_string(RAY_COHERENCE_TILE_SIZES[t]);
+        json->Number(("tile" + tile + "_angular_deviation").c_str(), c.tile_angular_deviation[t]);
+        json->Number(("tile" + tile + "_origin_spread").c_str(), c.tile_origin_spread[t]);
+    }
+    json->Number("direction_entropy", c.direction_entropy);
+    json->Number("warp_shared_bin_fraction", c.warp_shared_bin_fraction);
+    json->EndObject();
+}
+
+static void WriteBatchReplay(JsonWriter* json, std::span<const CpuReplayRecord> records, double replay_ms)
+{
+    uint64_t num_hits = 0;
+    for (const CpuReplayRecord& rec : records)
+    {
+        num_hits += rec.t >= 0;
+    }
+    json->BeginObject("replay");
+    json->Number("ms", replay_ms);
+    json->Number("mrays_per_second", records.size() / (replay_ms * 1000.0));
+    json->Number("hit_fraction", double(num_hits) / std::max<size_t>(1, records.size()));
+    for (int c = 0; c < CPU_REPLAY_NUM_COUNTERS; c++)
+    {
+        const CpuReplayHistogram h = ComputeCpuReplayHistogram(records, CpuReplayCounter(c));
+        json->BeginObject(GetCpuReplayCounterName(CpuReplayCounter(c)));
+        json->Number("mean", h.mean);
+        json->Integer("p50", h.p50);
+        json->Integer("p95", h.p95);
+        json->Integer("p99", h.p99);
+        json->Integer("max", h.max);
+        json->EndObject();
+    }
+    json->EndObject();
+}
+
+// For each capture: loads the geometry, builds the CPU BVH, replays every PIX dump and every RRA dispatch against it
+// and evaluates the ray reordering strategies, then writes everything to one JSON file
+static int RunBatch(const std::vector<std::string>& rra_files, const char* output_file_name)
+{
+    FILE* f = fopen(output_file_name, "wb");
+    if (!f)
+    {
+        printf("Could not open %s for writing.\n", output_file_name);
+        return 1;
+    }
+    JsonWriter json(f);
+    json.BeginObject();
+    json.Integer("version", 1);
+    json.Integer("width", g_settings.width);
+    json.Integer("height", g_settings.height);
+    json.Integer("threads", GetNumWorkerThreads());
+    json.String("simd", GetCpuSimdLevelName(GetCpuSimdLevel()));
+    json.Bool("oct_ray_directions", g_settings.oct_ray_directions);
+    json.Bool("quantize_ray_origins", g_settings.quantize_ray_origins);
+    json.Bool("trace_decoder", CanDecodeTraces());
+
+    json.BeginArray("pix_dumps");
+    for (const DispatchRaysInfo& dri : g_pix_dumps)
+    {
+        json.BeginObject();
+        WriteBatchDispatch(&json, dri);
+        json.EndObject();
+    }
+    json.EndArray();
+
+    std::unique_ptr<RayReorderStrategy> strategies[RAY_REORDER_MODE_END];
+    CreateRayReorderStrategies(strategies);
+
+    int                          ret = 0;
+    std::vector<CpuReplayRecord> records;
+    json.BeginArray("captures");
+    for (const std::string& rra_file : rra_files)
+    {
+        printf("Batch: %s\n", rra_file.c_str());
+        json.BeginObject();
+        json.String("file", std::filesystem::path(rra_file).filename().string());
+
+        Clock::time_point t0 = Clock::now();
+        CaptureGeometry   geom;
+        if (!LoadCaptureGeometry(rra_file.c_str(), &geom))
+        {
+            json.Bool("loaded", false);
+            json.String("error", geom.load_error);
+            json.EndObject();
+            ret = 1;
+            continue;
+        }
+        Clock::time_point   t1  = Clock::now();
+        const CaptureCamera cam = GetCaptureCamera(rra_file.c_str(), g_settings.width, g_settings.height);
+
+        size_t num_verts = 0, num_tris = 0;
+        for (const BlasGeometry& blas : geom.blas_geometry)
+        {
+            num_verts += blas.vertices.size();
+            num_tris += blas.NumTriangles();
+        }
+        json.Bool("loaded", true);
+        json.String("geometry_source", geom.decoded ? "trace" : "cache");
+        json.Number("load_ms", Millis(t0, t1));
+        json.Integer("tlas_count", GetNumSceneViews(geom.all_view_offsets));
+        json.Integer("scene_view", geom.scene_view);
+        json.Integer("blas_count", geom.blas_geometry.size());
+        json.Integer("instances", geom.instances.size());
+        json.Integer("vertices", num_verts);
+        json.Integer("triangles", num_tris);
+        json.BeginArray("scene_aabb");
+        for (int c = 0; c < 3; c++)
+        {
+            json.Number(nullptr, geom.aabb_min[c]);
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            json.Number(nullptr, geom.aabb_max[c]);
+        }
+        json.EndArray();
+
+        Clock::time_point t2 = Clock::now();
+        CpuScene          scene;
+        scene.Build(geom.blas_geometry, geom.instances);
+        json.BeginObject("bvh");
+        json.Number("build_ms", Millis(t2, Clock::now()));
+        json.Integer("nodes", scene.tlas.NumNodes());
+        json.Integer("memory_bytes", scene.tlas.MemoryBytes());
+        json.EndObject();
+
+        // One RRA dispatch is decoded at a time and dropped after its replay
+        std::vector<DispatchRaysInfo> rra_dispatches = LoadCaptureDispatches(rra_file.c_str(), &geom);
+        json.BeginArray("dispatches");
+        for (std::vector<DispatchRaysInfo>* list : {&g_pix_dumps, &rra_dispatches})
+        {
+            for (DispatchRaysInfo& dri : *list)
+            {
+                EnsureDispatchRaysResident(geom, &dri);
+                json.BeginObject();
+                WriteBatchDispatch(&json, dri);
+                const double replay_ms = ReplayDispatchRays(scene.tlas, dri, &records);
+                WriteBatchReplay(&json, records, replay_ms);
+                json.EndObject();
+                DropDispatchRays(&dri);
+            }
+        }
+        json.EndArray();
+        json.Integer("undecoded_dispatches", geom.num_undecoded_dispatches);
+
+        json.BeginArray("reorder");
+        for (const RayReorderEvaluation& e : EvaluateRayReorderStrategies(scene, geom, cam, strategies))
+        {
+            json.BeginObject();
+            json.String("strategy", e.name);
+            json.Number("sort_ms", e.median_ms);
+            json.Number("mrays_per_second", e.score.mrays_per_second);
+            json.Number("cost_per_ray", e.score.mean_cost);
+            json.Number("simd_efficiency", e.score.simd_efficiency);
+            json.Number("cache_line_reuse", e.score.cache_line_reuse);
+            json.EndObject();
+        }
+        json.EndArray();
+        json.EndObject();
+        CloseCapture(&geom);
+    }
+    json.EndArray();
+    json.EndObject();
+
+    if (fclose(f) != 0)
+    {
+        printf("Could not write %s.\n", output_file_name);
+        return 1;
+    }
+    printf("Wrote %s\n", output_file_name);
+    return ret;
+}
+
+static void PrintUsage()
+{
+    printf("Usage: rra_cli MODE [-i RRA_FILE]... [-p PIX_DUMP]... [-w W] [-h H] [-j NUM_THREADS] [--tlas N] [--profile TRACE_JSON]\n"
+           "                    [--no-geometry-cache] [--no-vertex-weld] [--oct-ray-directions] [--quantize-ray-origins]\n"
+           "Modes:\n"
+           "  --cpu-render OUT.bmp       [--ao-samples N] [--ao-radius R] [--cpu-normals] [--cpu-simd scalar|sse|avx2]\n"
+           "                             [--cpu-trace single|packet8|packet16|stream]\n"
+           "  --replay-dispatch N        [--replay-output replay.bin] [--replay-heatmap heat.bmp]\n"
+           "                             [--replay-counter steps|nodes|triangles|instances|depth] [--cpu-simd ...]\n"
+           "  --bench-bvh-build          [--bench-repeats N]\n"
+           "  --bench-primary-rays       [--bench-repeats N] [--cpu-simd ...]\n"
+           "  --bench-reorder            [--bench-repeats N] [--ao-radius R] [--cpu-simd ...]\n"
+           "  --batch RESULTS.json       [--bench-repeats N]\n"
+           "RRA traces without a geometry cache and the ray dispatches of traces are %s.\n",
+           CanDecodeTraces() ? "decoded with the RRA backend" : "only decoded on Windows, with the RRA backend");
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> rra_files_given;
+    const char*              cpu_render_output{nullptr};
+    int32_t                  replay_dispatch{-1};
+    const char*              replay_output{"replay.bin"};
+    bool                     bench_bvh_build{false};
+    bool                     bench_primary_rays{false};
+    bool                     bench_reorder{false};
+    const char*              batch_output{nullptr};
+    const char*              profile_file{nullptr};
+
+    // Profiling starts before anything is loaded, so it also covers PIX dumps read while parsing the arguments
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (!strcmp(argv[i], "--profile"))
+            profile_file = argv[i + 1];
+    }
+    if (profile_file)
+    {
+        SetProfilingEnabled(true);
+        SetProfileThreadName("main");
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            rra_files_given.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+        {
+            DispatchRaysInfo dri{};
+            if (!ReadPixBufferDump(argv[++i], GetRayStorageFormat(glm::vec3(1e20f), glm::vec3(-1e20f)), &dri))
+                return 1;
+            g_pix_dumps.push_back(std::move(dri));
+        }
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            g_settings.width = uint32_t(std::max(1, atoi(argv[++i])));
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+            g_settings.height = uint32_t(std::max(1, atoi(argv[++i])));
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+        {
+            if (!ParseNumWorkerThreads(argv[++i], &g_num_worker_threads))
+            {
+                printf("-j expects a thread count from 0 to %u, got %s\n", MAX_WORKER_THREADS, argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--tlas") && i + 1 < argc)
+        {
+            if (!ParseSceneViewIndex(argv[++i], &g_settings.scene_view))
+            {
+                printf("--tlas expects a TLAS index of 0 or more, got %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+            i++;
+        else if (!strcmp(argv[i], "--no-geometry-cache"))
+            g_settings.use_geometry_cache = false;
+        else if (!strcmp(argv[i], "--no-vertex-weld"))
+            g_settings.weld_vertices = false;
+        else if (!strcmp(argv[i], "--oct-ray-directions"))
+            g_settings.oct_ray_directions = true;  // Lossy; affects the dispatches loaded after it, so give it before -p
+        else if (!strcmp(argv[i], "--quantize-ray-origins"))
+            g_settings.quantize_ray_origins = true;
+        else if (!strcmp(argv[i], "--cpu-render") && i + 1 < argc)
+            cpu_render_output = argv[++i];
+        else if (!strcmp(argv[i], "--cpu-normals"))
+            g_settings.cpu_normals = true;
+        else if (!strcmp(argv[i], "--ao-samples") && i + 1 < argc)
+            g_settings.ao_samples = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--ao-radius") && i + 1 < argc)
+            g_settings.ao_radius = float(atof(argv[++i]));
+        else if (!strcmp(argv[i], "--cpu-simd") && i + 1 < argc)
+        {
+            // Caps the traversal kernels, e.g. to compare them; the best supported one is used by default
+            i++;
+            if (!strcmp(argv[i], "scalar"))
+                g_cpu_simd_limit = CPU_SIMD_SCALAR;
+            else if (!strcmp(argv[i], "sse"))
+                g_cpu_simd_limit = CPU_SIMD_SSE;
+            else
+                g_cpu_simd_limit = CPU_SIMD_AVX2;
+        }
+        else if (!strcmp(argv[i], "--cpu-trace") && i + 1 < argc)
+        {
+            i++;
+            if (!strcmp(argv[i], "packet8"))
+                g_settings.trace_mode = CPU_TRACE_PACKET8;
+            else if (!strcmp(argv[i], "packet16"))
+                g_settings.trace_mode = CPU_TRACE_PACKET16;
+            else if (!strcmp(argv[i], "stream"))
+                g_settings.trace_mode = CPU_TRACE_STREAM;
+            else
+                g_settings.trace_mode = CPU_TRACE_SINGLE;
+        }
+        else if (!strcmp(argv[i], "--replay-dispatch") && i + 1 < argc)
+            replay_dispatch = std::max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--replay-output") && i + 1 < argc)
+            replay_output = argv[++i];
+        else if (!strcmp(argv[i], "--replay-heatmap") && i + 1 < argc)
+            g_settings.replay_heatmap = argv[++i];
+        else if (!strcmp(argv[i], "--replay-counter") && i + 1 < argc)
+        {
+            i++;
+            for (int c = 0; c < CPU_REPLAY_NUM_COUNTERS; c++)
+            {
+                if (!strcmp(argv[i], GetCpuReplayCounterName(CpuReplayCounter(c))))
+                    g_settings.replay_counter = CpuReplayCounter(c);
+            }
+        }
+        else if (!strcmp(argv[i], "--bench-bvh-build"))
+            bench_bvh_build = true;
+        else if (!strcmp(argv[i], "--bench-primary-rays"))
+            bench_primary_rays = true;
+        else if (!strcmp(argv[i], "--bench-reorder"))
+            bench_reorder = true;
+        else if (!strcmp(argv[i], "--bench-repeats") && i + 1 < argc)
+            g_settings.bench_repeats = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_output = argv[++i];
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+    // The multi-capture modes work on the captures given with -i, or on every .rra file in the working directory. A
+    // batch over PIX dumps alone does not pick up captures.
+    std::vector<std::string> rra_files      = rra_files_given;
+    const bool               find_rra_files = bench_bvh_build || bench_primary_rays || bench_reorder || (batch_output && g_pix_dumps.empty());
+    if (find_rra_files && rra_files.empty())
+    {
+        for (const auto& entry : std::filesystem::directory_iterator("."))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".rra")
+                rra_files.push_back(entry.path().string());
+        }
+        std::sort(rra_files.begin(), rra_files.end());
+    }
+    // The single-capture modes default to the capture the viewer opens
+    const char* rra_file_name = rra_files_given.empty() ? "3DMarkSolarBay-20241020-003039.rra" : rra_files_given.back().c_str();
+
+    int ret = 0;
+    if (batch_output)
+        ret = RunBatch(rra_files, batch_output);
+    else if (bench_primary_rays)
+        ret = RunPrimaryRayBenchmark(rra_files);
+    else if (bench_reorder)
+        ret = RunReorderBenchmark(rra_files);
+    else if (bench_bvh_build)
+        ret = RunBvhBuildBenchmark(rra_files);
+    else if (cpu_render_output)
+        ret = RunCpuRender(rra_file_name, cpu_render_output);
+    else if (replay_dispatch >= 0)
+        ret = RunDispatchReplay(rra_file_name, uint32_t(replay_dispatch), replay_output);
+    else
+    {
+        PrintUsage();
+        ret = 1;
+    }
+
+    if (profile_file && !WriteChromeTrace(profile_file))
+        ret = 1;
+    return ret;
+}
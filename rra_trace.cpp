@@ -0,0 +1,447 @@
+#include "rra_trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <string>
+
+#include "public/rra_bvh.h"
+#include "public/rra_blas.h"
+#include "public/rra_tlas.h"
+#include "public/rra_trace_loader.h"
+#include "public/rra_ray_history.h"
+
+#include "blas_pool.h"
+#include "cpu_bvh.h"
+#include "parallel.h"
+#include "platform.h"
+#include "profiler.h"
+
+const uint32_t DISPATCH_ROW_GRAIN = 4;  // Rows of a dispatch handed to a worker at a time
+
+static void SetProgress(RraDecodeProgress* progress, float fraction)
+{
+    if (progress)
+        progress->fraction = fraction;
+}
+
+bool OpenRRAFile(const char* rra_file_name)
+{
+    RRA_PROFILE_SCOPE("OpenRRAFile");
+    if (!std::filesystem::exists(rra_file_name))
+    {
+        printf("%s does not exist.\n", rra_file_name);
+        return false;
+    }
+
+    RraErrorCode ec = RraTraceLoaderLoad(rra_file_name);
+    printf("Error: %d\n", static_cast<int>(ec));
+    if (ec)
+    {
+        printf("Could not load %s.\n", rra_file_name);
+        return false;
+    }
+    return true;
+}
+
+void CloseRRAFile()
+{
+    RraTraceLoaderUnload();
+}
+
+uint32_t ExtractBlasVertices(uint32_t blas_idx, std::vector<glm::vec3>* geom_verts)
+{
+    RRA_PROFILE_SCOPE_ARG("ExtractBlasVertices", blas_idx);
+    const uint32_t i = blas_idx;
+
+    uint32_t root_node{};
+    RraBvhGetRootNodePtr(&root_node);
+    std::deque<uint32_t> n2v = {root_node};
+
+    if (i > 0)
+    {
+        float sa{};
+        RraBlasGetSurfaceArea(i, root_node, &sa);
+        if (sa <= 0)
+        {
+            throw std::exception();
+        }
+    }
+
+    uint32_t                      num_tris{0};
+    std::vector<uint32_t>         children;
+    std::vector<TriangleVertices> triangles(8);
+    while (!n2v.empty())
+    {
+        uint32_t node = n2v.front();
+        n2v.pop_front();
+
+        uint32_t nc{};
+        RraBlasGetChildNodeCount(i, node, &nc);
+        children.resize(nc);
+        RraBlasGetChildNodes(i, node, children.data());
+
+        for (uint32_t j = 0; j < children.size(); j++)
+        {
+            uint32_t ch = children[j];
+            if (RraBvhIsBoxNode(ch))
+            {
+                n2v.push_back(ch);
+            }
+            else if (RraBlasIsTriangleNode(i, ch))
+            {
+                float sa{};
+                RraBlasGetSurfaceArea(i, ch, &sa);
+                if (sa <= 0)
+                {
+                    printf("BLAS[%u]'s node %08X's surface area is zero\n", i, ch);
+                }
+
+                uint32_t tc{};
+                if (RraBlasGetNodeTriangleCount(i, ch, &tc) != kRraOk)
+                {
+                    continue;
+                }
+                assert(tc < 3);
+
+                if (RraBlasGetNodeTriangles(i, ch, triangles.data()) != kRraOk)
+                {
+                    continue;
+                }
+
+                if (sa > 0)
+                {
+                    num_tris += tc;
+                    for (uint32_t tri_idx = 0; tri_idx < tc; tri_idx++)
+                    {
+                        const TriangleVertices& triangle = triangles.at(tri_idx);
+                        geom_verts->push_back({triangle.a.x, triangle.a.y, triangle.a.z});
+                        geom_verts->push_back({triangle.b.x, triangle.b.y, triangle.b.z});
+                        geom_verts->push_back({triangle.c.x, triangle.c.y, triangle.c.z});
+                    }
+                }
+            }
+        }
+    }
+    return num_tris;
+}
+
+RraGeometry LoadGeometryFromRRAFile(bool weld_vertices, RraDecodeProgress* progress)
+{
+    RRA_PROFILE_SCOPE("LoadGeometryFromRRAFile");
+    SetProgress(progress, 0);
+    RraGeometry ret;
+
+    {
+        time_t  ct = RraTraceLoaderGetCreateTime();
+        std::tm tm;
+        LocalTime(ct, &tm);
+        char buffer[100];
+        std::strftime(buffer, 32, "%a, %Y-%m-%d %H:%M:%S", &tm);
+        printf("Trace create time: %s\n", buffer);
+
+        uint64_t tlas_count{}, blas_count{};
+        RraBvhGetTlasCount(&tlas_count);
+        RraBvhGetBlasCount(&blas_count);
+        printf("Trace has %llu TLASs and %llu BLASs\n", tlas_count, blas_count);
+
+        for (unsigned i = 1; i <= blas_count; i++)
+        {
+            uint32_t cnt{}, cnt1{}, cnt2{}, cnt3{};
+            uint64_t addr{};
+            RraBlasGetGeometryCount(i, &cnt);
+            RraBlasGetProceduralNodeCount(i, &cnt1);
+            RraBlasGetTriangleNodeCount(i, &cnt2);
+            RraBlasGetUniqueTriangleCount(i, &cnt3);
+            RraBlasGetBaseAddress(i, &addr);
+            printf("  BLAS[%u] (%llx) has %u geometries, %u proc nodes, %u tri nodes, %u uniq tris\n", i, addr, cnt, cnt1, cnt2, cnt3);
+        }
+    }
+
+    // The instances of every TLAS
+    uint64_t tlas_count{0}, blas_count{0};
+
+    std::vector<InstanceInfo>& inst_infos   = ret.inst_infos;
+    std::vector<uint64_t>&     view_offsets = ret.view_offsets;
+    view_offsets                            = {0};
+
+    // BLAS's vertices, as extracted and then indexed
+    std::vector<std::vector<glm::vec3>> vertices;
+    uint32_t                            tot_tri_count{0};
+
+    // Triangles
+    {
+        RraBvhGetTlasCount(&tlas_count);
+        RraBvhGetBlasCount(&blas_count);
+
+        // BLAS walks are independent of each other, so they are spread over the worker threads.
+        // Every BLAS is written to its own slot, so the result is identical to walking them one by one.
+        const uint32_t num_blas_slots = uint32_t(blas_count) + 1;
+        vertices.resize(num_blas_slots);
+
+        const uint32_t        num_workers = std::min(GetNumWorkerThreads(), num_blas_slots);
+        std::atomic<uint32_t> num_blas_done{0};
+        std::atomic<uint32_t> num_tris_total{0};
+        if (progress)
+        {
+            progress->num_workers = std::min(num_workers, MAX_PROGRESS_WORKERS);
+            for (uint32_t w = 0; w < MAX_PROGRESS_WORKERS; w++)
+            {
+                progress->worker_current_blas[w] = 0;
+                progress->worker_num_done[w]     = 0;
+            }
+        }
+        printf("Extracting %u BLASes on %u thread(s)\n", num_blas_slots, num_workers);
+
+        ParallelForDynamic(
+            num_blas_slots,
+            1,
+            [&](uint32_t worker_idx, size_t i) {
+                const uint32_t slot = worker_idx % MAX_PROGRESS_WORKERS;
+                if (progress)
+                    progress->worker_current_blas[slot] = uint32_t(i);
+
+                uint32_t num_tris = ExtractBlasVertices(uint32_t(i), &vertices[i]);
+
+                num_tris_total += num_tris;
+                if (progress)
+                    progress->worker_num_done[slot]++;
+                SetProgress(progress, 1.0f * (++num_blas_done) / num_blas_slots);
+            },
+            num_workers);
+        tot_tri_count = num_tris_total;
+        printf("Extracted %u triangles\n", tot_tri_count);
+
+        // Object-space bounds of every BLAS, so instances only need their box transformed
+        std::vector<CpuAabb> blas_aabbs(num_blas_slots);
+        ParallelForDynamic(num_blas_slots, 1, [&](uint32_t, size_t i) {
+            for (const glm::vec3& v : vertices[i])
+            {
+                blas_aabbs[i].Grow(v);
+            }
+        });
+
+        // Tlas. Every TLAS is a scene view over the BLASes extracted above, so nothing is decoded twice.
+        for (unsigned i = 0; i < tlas_count; i++)
+        {
+            RRA_PROFILE_SCOPE_ARG("WalkTlas", i);
+            uint64_t node_count{};
+            uint32_t inst_count{};
+            RraTlasGetBoxNodeCount(i, &node_count);
+
+            uint32_t root_node{};
+            RraBvhGetRootNodePtr(&root_node);
+            std::deque<uint32_t> n2v = {root_node};
+
+            std::vector<InstanceInfo> instance_infos;
+
+            while (!n2v.empty())
+            {
+                uint32_t node = n2v.front();
+                n2v.pop_front();
+
+                uint32_t nc{};
+                RraTlasGetChildNodeCount(i, node, &nc);
+                std::vector<uint32_t> children(nc);
+                RraTlasGetChildNodes(i, node, children.data());
+
+                for (uint32_t j = 0; j < children.size(); j++)
+                {
+                    uint32_t ch = children[j];
+                    if (RraBvhIsBoxNode(ch))
+                    {
+                        n2v.push_back(ch);
+                    }
+                    else if (RraBvhIsInstanceNode(ch))
+                    {
+                        InstanceInfo ii{};
+                        RraTlasGetOriginalInstanceNodeTransform(i, ch, ii.transform);
+                        RraTlasGetBlasIndexFromInstanceNode(i, ch, &(ii.blas_idx));
+                        uint32_t iidx{};
+                        RraTlasGetInstanceIndexFromInstanceNode(i, ch, &iidx);
+                        if (instance_infos.size() < iidx + 1)
+                        {
+                            instance_infos.resize(iidx + 1);
+                        }
+                        instance_infos[iidx] = ii;
+
+                        // Grow the scene's AABB by the instance's transformed BLAS bounds
+                        CpuAabb inst_aabb = TransformAabb(ii.transform, blas_aabbs.at(ii.blas_idx));
+                        if (!inst_aabb.Empty())
+                        {
+                            ret.aabb_min = glm::min(ret.aabb_min, inst_aabb.min);
+                            ret.aabb_max = glm::max(ret.aabb_max, inst_aabb.max);
+                        }
+                    }
+                }
+            }
+            inst_count = instance_infos.size();
+
+            printf("TLAS %u: %llu nodes, %u insts\n", i, (unsigned long long)node_count, inst_count);
+
+            inst_infos.insert(inst_infos.end(), instance_infos.begin(), instance_infos.end());
+            view_offsets.push_back(inst_infos.size());
+        }
+
+        DeduplicateBlasPool(&vertices, inst_infos);
+        ret.blases = IndexBlasSoups(&vertices, weld_vertices);
+    }
+
+    printf("Scene AABB: (%g,%g,%g)-(%g,%g,%g)\n", ret.aabb_min.x, ret.aabb_min.y, ret.aabb_min.z, ret.aabb_max.x, ret.aabb_max.y, ret.aabb_max.z);
+    return ret;
+}
+
+uint32_t GetRRADispatchCount()
+{
+    uint32_t dispatch_count{};
+    RraRayGetDispatchCount(&dispatch_count);
+    return dispatch_count;
+}
+
+// Count pass over RRA dispatch `d`: fills dri->ray_idxes with the end offset of every thread's rays and returns the
+// total ray count. The (z, y) rows are split over the worker threads.
+static uint64_t CountDispatchRays(uint32_t d, DispatchRaysInfo* dri, RraDecodeProgress* progress, float progress_lo, float progress_hi)
+{
+    RRA_PROFILE_SCOPE_ARG("CountDispatchRays", d);
+    const glm::uvec3 dims     = dri->dispatch_dims;
+    const uint64_t   num_thds = uint64_t(dims.x) * dims.y * dims.z;
+    const uint32_t   num_rows = dims.y * dims.z;
+
+    std::atomic<uint32_t> rows_done{0};
+
+    // ray_idxes holds the per-thread counts first and is turned into end offsets below
+    dri->ray_idxes.assign(num_thds, 0);
+    ParallelForDynamic(num_rows, DISPATCH_ROW_GRAIN, [&](uint32_t, size_t row) {
+        const uint32_t ty = uint32_t(row % dims.y), tz = uint32_t(row / dims.y);
+        uint32_t*      counts = &dri->ray_idxes[uint64_t(row) * dims.x];
+        for (uint32_t tx = 0; tx < dims.x; tx++)
+        {
+            GlobalInvocationID gid = {tx, ty, tz};
+            uint32_t           c{0};
+            if (RraRayGetRayCount(d, gid, &c) == kRraOk)
+            {
+                counts[tx] = c;
+            }
+        }
+        SetProgress(progress, progress_lo + (progress_hi - progress_lo) * (++rows_done) / num_rows);
+    });
+
+    uint64_t tot_ray_count = 0;
+    for (uint32_t& x : dri->ray_idxes)
+    {
+        tot_ray_count += x;
+        x = uint32_t(std::min<uint64_t>(tot_ray_count, UINT32_MAX));
+    }
+    return tot_ray_count;
+}
+
+std::vector<DispatchRaysInfo> LoadDispatchesFromRRAFile(RraDecodeProgress* progress)
+{
+    RRA_PROFILE_SCOPE("LoadDispatchesFromRRAFile");
+    const uint32_t dispatch_count = GetRRADispatchCount();
+    printf("dispatch_count=%u\n", dispatch_count);
+    SetProgress(progress, 0);
+
+    std::vector<DispatchRaysInfo> ret;
+    for (uint32_t d = 0; d < dispatch_count; d++)
+    {
+        uint32_t x, y, z;
+        if (RraRayGetDispatchDimensions(d, &x, &y, &z) != kRraOk)
+            continue;
+        DispatchRaysInfo dri{};
+        dri.dispatch_dims.x  = x;
+        dri.dispatch_dims.y  = y;
+        dri.dispatch_dims.z  = z;
+        dri.rra_dispatch_idx = int32_t(d);
+        dri.resident         = false;
+
+        // Only the ray count is needed up front; the rays are decoded when the dispatch is used
+        const uint64_t tot_ray_count = CountDispatchRays(d, &dri, progress, 1.0f * d / dispatch_count, 1.0f * (d + 1) / dispatch_count);
+        std::vector<uint32_t>().swap(dri.ray_idxes);
+        dri.num_invocations = uint32_t(std::min<uint64_t>(tot_ray_count, UINT32_MAX));
+        printf("  dispatch[%u], dim=(%u,%u,%u), %llu rays (%g/thd)\n", d, x, y, z, (unsigned long long)tot_ray_count, tot_ray_count * 1.0 / x / y / z);
+
+        char buf[100];
+        snprintf(buf, sizeof(buf), "DispatchRays[%u] (%u,%u,%u), %llu rays", d, x, y, z, (unsigned long long)tot_ray_count);
+        dri.name = std::string(buf);
+        ret.push_back(std::move(dri));
+    }
+    return ret;
+}
+
+// The count pass sizes both arrays exactly, then the fill pass splits the (z, y) rows of the dispatch over the worker
+// threads, each of which reuses a single scratch buffer for RraRayGetRays.
+void ExtractDispatchRays(DispatchRaysInfo* dri, const RayStorageFormat& format, RraDecodeProgress* progress, float progress_lo, float progress_hi)
+{
+    const uint32_t d = uint32_t(dri->rra_dispatch_idx);
+    RRA_PROFILE_SCOPE_ARG("ExtractDispatchRays", d);
+    const glm::uvec3 dims         = dri->dispatch_dims;
+    const uint32_t   num_rows     = dims.y * dims.z;
+    const float      progress_mid = progress_lo + (progress_hi - progress_lo) * 0.2f;
+
+    dri->rays.Clear();
+    const uint64_t tot_ray_count = CountDispatchRays(d, dri, progress, progress_lo, progress_mid);
+    if (tot_ray_count > UINT32_MAX)
+    {
+        printf("  dispatch[%u] has %llu rays, which does not fit the 32-bit ray offsets. Skipping its rays.\n", d, (unsigned long long)tot_ray_count);
+        dri->ray_idxes.clear();
+        dri->num_invocations = 0;
+        return;
+    }
+    dri->rays.Reset(tot_ray_count, format);
+    dri->num_invocations = uint32_t(tot_ray_count);
+
+    // Fill pass
+    std::vector<std::vector<Ray>> scratch(GetNumWorkerThreads());
+    std::vector<RayStorageError>  errors(GetNumWorkerThreads());
+    std::atomic<uint32_t>         num_failed_thds{0};
+    std::atomic<uint32_t>         rows_done{0};
+    ParallelForDynamic(num_rows, DISPATCH_ROW_GRAIN, [&](uint32_t w, size_t row) {
+        const uint32_t    ty = uint32_t(row % dims.y), tz = uint32_t(row / dims.y);
+        std::vector<Ray>& rays = scratch[w];
+        for (uint32_t tx = 0; tx < dims.x; tx++)
+        {
+            const uint64_t thd_idx = uint64_t(row) * dims.x + tx;
+            const uint32_t lb      = (thd_idx == 0) ? 0 : dri->ray_idxes[thd_idx - 1];
+            const uint32_t c       = dri->ray_idxes[thd_idx] - lb;
+            if (c == 0)
+                continue;
+
+            rays.resize(std::max<size_t>(rays.size(), c));
+            GlobalInvocationID gid = {tx, ty, tz};
+            if (RraRayGetRays(d, gid, rays.data()) != kRraOk)
+            {
+                // The slots are already reserved; leave them as zero-length rays
+                num_failed_thds++;
+                continue;
+            }
+
+            for (uint32_t i = 0; i < c; i++)
+            {
+                const Ray&              r = rays[i];
+                RayInPixDumpFileMinimal rd;
+                rd.origin.x    = r.origin[0];
+                rd.origin.y    = r.origin[1];
+                rd.origin.z    = r.origin[2];
+                rd.direction.x = r.direction[0];
+                rd.direction.y = r.direction[1];
+                rd.direction.z = r.direction[2];
+                rd.tmin        = r.t_min;
+                rd.tcurrent    = r.t_max;
+                dri->rays.Set(lb + i, rd, &errors[w]);
+            }
+        }
+        SetProgress(progress, progress_mid + (progress_hi - progress_mid) * (++rows_done) / num_rows);
+    });
+    if (num_failed_thds > 0)
+    {
+        printf("  dispatch[%u]: could not read the rays of %u threads\n", d, uint32_t(num_failed_thds));
+    }
+    PrintRayStorageReport(dri, errors);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "dispatch_rays.h"
+#include "ray_storage.h"
+#include "rt_common.h"
+
+// Decoding of RRA traces through the RRA backend, which is only built on Windows. The backend holds one trace at a
+// time; everything below reads the trace loaded by OpenRRAFile.
+
+constexpr uint32_t MAX_PROGRESS_WORKERS = 64;
+
+// How far a decode is, for the viewer's loading screen. Written from the worker threads.
+struct RraDecodeProgress
+{
+    std::atomic<float>    fraction{0};
+    std::atomic<uint32_t> num_workers{0};  // Of the BLAS walk
+    std::atomic<uint32_t> worker_current_blas[MAX_PROGRESS_WORKERS]{};
+    std::atomic<uint32_t> worker_num_done[MAX_PROGRESS_WORKERS]{};
+};
+
+// The geometry of a trace: the instances of all TLASes back to back, where each TLAS starts among them, the indexed
+// BLASes and the bounds of all instances
+struct RraGeometry
+{
+    std::vector<InstanceInfo> inst_infos;
+    std::vector<uint64_t>     view_offsets;
+    std::vector<IndexedBlas>  blases;
+    glm::vec3                 aabb_min{1e20f}, aabb_max{-1e20f};
+};
+
+// Loads the trace into the backend. Returns false, after printing why, if the file is missing or cannot be loaded.
+bool OpenRRAFile(const char* rra_file_name);
+void CloseRRAFile();
+
+// Walks BLAS[blas_idx] breadth-first and appends its triangles to *geom_verts as a triangle soup.
+// Only reads from the loaded trace, so different BLASes may be walked on different threads.
+uint32_t ExtractBlasVertices(uint32_t blas_idx, std::vector<glm::vec3>* geom_verts);
+
+// Decodes the triangles of every BLAS once, then the instances of every TLAS, which become the scene views
+RraGeometry LoadGeometryFromRRAFile(bool weld_vertices, RraDecodeProgress* progress = nullptr);
+
+uint32_t GetRRADispatchCount();
+
+// The dispatches of the trace with their dimensions and ray counts only; their rays are decoded by ExtractDispatchRays
+std::vector<DispatchRaysInfo> LoadDispatchesFromRRAFile(RraDecodeProgress* progress = nullptr);
+
+// Decodes the rays of dri, one of the dispatches of LoadDispatchesFromRRAFile, into dri->rays and dri->ray_idxes.
+// Progress is scaled into [progress_lo, progress_hi].
+void ExtractDispatchRays(DispatchRaysInfo*       dri,
+                         const RayStorageFormat& format,
+                         RraDecodeProgress*      progress    = nullptr,
+                         float                   progress_lo = 0,
+                         float                   progress_hi = 1);
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <cmath>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Scene description and shader helpers shared by the DXR frontend and the CPU tracer.
+// The sampling functions are line-by-line ports of shaders/includes.hlsli so both backends produce the same rays.
+
+struct InstanceInfo
+{
+    uint64_t blas_idx{};
+    float    transform[12]{};  // Row Major
+};
+
+// One BLAS as an indexed triangle list: triangle t is vertices[indices[3 * t + 0..2]]
+struct IndexedBlas
+{
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t>  indices;
+};
+
+// View of one BLAS, either into an IndexedBlas or into a mapped geometry cache
+struct BlasGeometry
+{
+    std::span<const glm::vec3> vertices;
+    std::span<const uint32_t>  indices;
+
+    size_t NumTriangles() const
+    {
+        return indices.size() / 3;
+    }
+    const glm::vec3& Vertex(size_t tri, uint32_t k) const
+    {
+        return vertices[indices[tri * 3 + k]];
+    }
+};
+using BlasGeometrySpans = std::vector<BlasGeometry>;
+
+inline BlasGeometrySpans ToBlasGeometrySpans(const std::vector<IndexedBlas>& blases)
+{
+    BlasGeometrySpans ret;
+    ret.reserve(blases.size());
+    for (const IndexedBlas& b : blases)
+    {
+        ret.push_back({b.vertices, b.indices});
+    }
+    return ret;
+}
+
+// The instances of all TLASes of a capture are kept back to back. Scene view v, the instances of TLAS v, is
+// [view_offsets[v], view_offsets[v + 1]); every view indexes the same pool of BLASes.
+inline uint32_t GetNumSceneViews(std::span<const uint64_t> view_offsets)
+{
+    return view_offsets.empty() ? 0 : uint32_t(view_offsets.size() - 1);
+}
+
+inline std::span<const InstanceInfo> GetSceneViewInstances(std::span<const InstanceInfo> instances, std::span<const uint64_t> view_offsets, uint32_t v)
+{
+    if (v >= GetNumSceneViews(view_offsets))
+        return {};
+    return instances.subspan(view_offsets[v], view_offsets[v + 1] - view_offsets[v]);
+}
+
+// Parses the argument of --tlas: a whole, non-negative scene view index. Returns false on anything else.
+inline bool ParseSceneViewIndex(const char* s, uint32_t* v)
+{
+    char* end   = nullptr;
+    long  value = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || value < 0 || value > long(INT32_MAX))
+        return false;
+    *v = uint32_t(value);
+    return true;
+}
+
+// 64-bit FNV-1a over n bytes, continuing from h; start from 0xcbf29ce484222325
+inline uint64_t HashBytesFNV1a(uint64_t h, const uint8_t* data, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// One captured ray, as uploaded for load_ray_from_buffer
+struct RayInPixDumpFileMinimal
+{
+    //uint32_t   type;
+    //glm::uvec3 dispatch_rays_idx;
+    glm::vec3  origin;
+    float      tmin;
+    glm::vec3  direction;
+    float      tcurrent;
+    //uint32_t   ray_flags;
+};
+
+// InstanceInfo::transform applied to a point / a direction
+inline glm::vec3 TransformInstancePosition(const float* t, const glm::vec3& p)
+{
+    return glm::vec3(t[3] + t[0] * p.x + t[1] * p.y + t[2] * p.z,
+                     t[7] + t[4] * p.x + t[5] * p.y + t[6] * p.z,
+                     t[11] + t[8] * p.x + t[9] * p.y + t[10] * p.z);
+}
+
+inline glm::vec3 TransformInstanceDirection(const float* t, const glm::vec3& d)
+{
+    return glm::vec3(t[0] * d.x + t[1] * d.y + t[2] * d.z, t[4] * d.x + t[5] * d.y + t[6] * d.z, t[8] * d.x + t[9] * d.y + t[10] * d.z);
+}
+
+inline glm::vec3 TransformPosition(const glm::mat4& m, const glm::vec3& x)
+{
+    glm::vec4 x4(x, 0.0f);
+    x4 = m * x4;
+    x4.x += m[3][0];
+    x4.y += m[3][1];
+    x4.z += m[3][2];
+    return glm::vec3(x4);
+}
+
+inline glm::vec3 TransformDirection(const glm::mat4& m, const glm::vec3& x)
+{
+    glm::vec4 x4(x, 0.0f);
+    x4 = m * x4;
+    return glm::vec3(x4);
+}
+
+inline glm::vec2 OctWrap(const glm::vec2& v)
+{
+    glm::vec2 ret(1.0f, 1.0f);
+    ret -= glm::vec2(std::abs(v.y), std::abs(v.x));
+    ret.x *= (v.x >= 0 ? 1 : -1);
+    ret.y *= (v.y >= 0 ? 1 : -1);
+    return ret;
+}
+
+inline glm::vec2 OctEncode(glm::vec3 n)
+{
+    n = glm::normalize(n);
+    n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+    if (n.z < 0)
+    {
+        glm::vec2 xy = OctWrap(glm::vec2(n.x, n.y));
+        n.x          = xy.x;
+        n.y          = xy.y;
+    }
+    n.x = n.x * 0.5 + 0.5;
+    n.y = n.y * 0.5 + 0.5;
+    return glm::vec2(n.x, n.y);
+}
+
+// Inverse of OctEncode, up to the precision the encoding was stored at
+inline glm::vec3 OctDecode(glm::vec2 f)
+{
+    f = f * 2.0f - 1.0f;
+    glm::vec3 n(f.x, f.y, 1.0f - std::abs(f.x) - std::abs(f.y));
+    if (n.z < 0)
+    {
+        glm::vec2 xy = OctWrap(glm::vec2(n.x, n.y));
+        n.x          = xy.x;
+        n.y          = xy.y;
+    }
+    return glm::normalize(n);
+}
+
+inline glm::uvec2 TEA(unsigned int val0, unsigned int val1, unsigned int N)
+{
+    unsigned int v0 = val0;
+    unsigned int v1 = val1;
+    unsigned int s0 = 0;
+
+    for (unsigned int n = 0; n < N; n++)
+    {
+        s0 += 0x9e3779b9;
+        v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+        v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+    }
+
+    return glm::uvec2(v0, v1);
+}
+
+inline unsigned LCG(int& seed)
+{
+    const unsigned int LCG_A = 1103515245u;
+    const unsigned int LCG_C = 12345u;
+    const unsigned int LCG_M = 0x00FFFFFFu;
+    seed                     = (LCG_A * seed + LCG_C);
+    return seed & LCG_M;
+}
+
+inline float RandF(int& seed)
+{
+    return float(LCG(seed)) / float(0x01000000);
+}
+
+inline glm::vec3 SampleHemisphereCosine(glm::vec3 n, int& seed)
+{
+    float phi         = 2.0f * 3.14159 * RandF(seed);
+    float sinThetaSqr = RandF(seed);
+    float sinTheta    = std::sqrt(sinThetaSqr);
+
+    glm::vec3 axis = std::abs(n.x) > 0.001f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 t    = glm::cross(axis, n);
+    t              = glm::normalize(t);
+    glm::vec3 s    = glm::cross(n, t);
+
+    return glm::normalize(s * std::cos(phi) * sinTheta + t * std::sin(phi) * sinTheta + n * std::sqrt(1.0f - sinThetaSqr));
+}
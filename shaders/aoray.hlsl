@@ -53,11 +53,11 @@ void Miss_primary(inout HitInfo_primary payload : SV_RayPayload)
 [shader("closesthit")]
 void ClosestHit_primary(inout HitInfo_primary payload, Attributes attrib)
 {
-    uint vert_ofst = InstanceVertOffsets[InstanceIndex()];
-    uint vert_idx = PrimitiveIndex() * 3 + vert_ofst;
-    float3 v0 = Vertices[vert_idx + 0];
-    float3 v1 = Vertices[vert_idx + 1];
-    float3 v2 = Vertices[vert_idx + 2];
+    uint2 ofst = InstanceGeometryOffsets[InstanceIndex()];
+    uint idx = PrimitiveIndex() * 3 + ofst.x;
+    float3 v0 = Vertices[ofst.y + Indices[idx + 0]];
+    float3 v1 = Vertices[ofst.y + Indices[idx + 1]];
+    float3 v2 = Vertices[ofst.y + Indices[idx + 2]];
     float3 v0v1 = v1 - v0, v0v2 = v2 - v0;
     float3 n = normalize(cross(v0v1, v0v2));
 
@@ -8,9 +8,10 @@ struct RayInPixBufferMinimal
 
 RaytracingAccelerationStructure Scene : register(t0, space0);
 StructuredBuffer<float3> Vertices : register(t1);
-StructuredBuffer<int> InstanceVertOffsets : register(t2);
+StructuredBuffer<uint2> InstanceGeometryOffsets : register(t2);  // x: first index, y: first vertex of the instance's BLAS
 StructuredBuffer<RayInPixBufferMinimal> RaysInPixBufferMinimal : register(t3);
 StructuredBuffer<uint> RayEntryOffsets : register(t4);
+StructuredBuffer<uint> Indices : register(t5);
 
 RWTexture2D<float4> RenderTarget : register(u0);
 
@@ -0,0 +1,288 @@
+#include "sort_keys.h"
+
+#include <algorithm>
+
+#include "cpu_bvh.h"
+#include "parallel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)
+#include <immintrin.h>
+#define SORT_KEYS_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SORT_KEYS_BMI2_HELPER static __forceinline
+#define SORT_KEYS_BMI2_ENTRY
+#else
+#include <cpuid.h>
+#define SORT_KEYS_BMI2_HELPER static inline __attribute__((target("bmi2")))
+#define SORT_KEYS_BMI2_ENTRY  __attribute__((target("bmi2"), flatten))
+#endif
+#endif
+
+#if SORT_KEYS_X86
+static void CpuId(int leaf, int info[4])
+{
+#if defined(_MSC_VER)
+    __cpuidex(info, leaf, 0);
+#else
+    __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+// BMI2 is there and pdep is not microcoded, which it is on AMD family 17h (Zen 1 and 2) at hundreds of cycles
+static bool DetectFastPdep()
+{
+    int info[4];
+    CpuId(0, info);
+    if (info[0] < 7)
+        return false;
+    const bool amd = info[1] == 0x68747541 && info[3] == 0x69746e65 && info[2] == 0x444d4163;  // "AuthenticAMD"
+
+    CpuId(7, info);
+    if (!(info[1] & (1 << 8)))
+        return false;
+
+    CpuId(1, info);
+    uint32_t family = (info[0] >> 8) & 0xf;
+    if (family == 0xf)
+        family += (info[0] >> 20) & 0xff;
+    return !(amd && family == 0x17);
+}
+
+SORT_KEYS_BMI2_HELPER uint64_t Deposit(uint64_t bits, uint64_t mask)
+{
+    return _pdep_u64(bits, mask);
+}
+#endif
+
+// Fills mask from its lowest set bit upwards with the bits of x, lowest first, like pdep
+static uint64_t SoftDeposit(uint64_t x, uint64_t mask)
+{
+    uint64_t ret = 0;
+    for (; mask; mask &= mask - 1, x >>= 1)
+    {
+        if (x & 1)
+            ret |= mask & (~mask + 1);
+    }
+    return ret;
+}
+
+// Skilling's transpose form of the Hilbert index ("Programming the Hilbert curve", 2004), in place.
+// Interleaving the result with x[0] as the most significant axis gives the index.
+static void HilbertTranspose(uint32_t* x, uint32_t n, uint32_t bits)
+{
+    for (uint32_t q = 1U << (bits - 1); q > 1; q >>= 1)
+    {
+        const uint32_t p = q - 1;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (x[i] & q)
+            {
+                x[0] ^= p;
+            }
+            else
+            {
+                const uint32_t t = (x[0] ^ x[i]) & p;
+                x[0] ^= t;
+                x[i] ^= t;
+            }
+        }
+    }
+    for (uint32_t i = 1; i < n; i++)
+    {
+        x[i] ^= x[i - 1];
+    }
+    uint32_t t = 0;
+    for (uint32_t q = 1U << (bits - 1); q > 1; q >>= 1)
+    {
+        if (x[n - 1] & q)
+            t ^= q - 1;
+    }
+    for (uint32_t i = 0; i < n; i++)
+    {
+        x[i] ^= t;
+    }
+}
+
+SortKeyEncoder::SortKeyEncoder(SortKeyCurve curve, const SortKeyLayout& layout)
+    : curve_(curve)
+    , layout_(layout)
+{
+    const uint32_t n = layout_.num_axes = std::clamp(layout_.num_axes, 1U, SORT_KEY_MAX_AXES);
+    for (uint32_t a = 0; a < n; a++)
+    {
+        layout_.bits[a] = std::clamp(layout_.bits[a], 1U, SORT_KEY_MAX_BITS);
+    }
+
+    // Hilbert keys run every axis at the largest precision; Morton keys give up bits of the most precise axes first
+    uint32_t bits[SORT_KEY_MAX_AXES];
+    if (curve_ == SORT_KEY_HILBERT)
+    {
+        curve_bits_ = std::min(*std::max_element(layout_.bits, layout_.bits + n), 64 / n);
+        for (uint32_t a = 0; a < n; a++)
+        {
+            layout_.bits[a] = std::min(layout_.bits[a], curve_bits_);
+            bits[a]         = curve_bits_;
+        }
+    }
+    else
+    {
+        for (;;)
+        {
+            uint32_t* most  = std::max_element(layout_.bits, layout_.bits + n);
+            uint32_t  total = 0;
+            for (uint32_t a = 0; a < n; a++)
+            {
+                total += layout_.bits[a];
+            }
+            if (total <= 64)
+                break;
+            (*most)--;
+        }
+        curve_bits_ = *std::max_element(layout_.bits, layout_.bits + n);
+        std::copy(layout_.bits, layout_.bits + n, bits);
+    }
+
+    // Level l of the curve holds bit (l - (curve_bits_ - bits[a])) of every axis that reaches down to it, axis 0 first
+    key_bits_ = 0;
+    for (uint32_t a = 0; a < n; a++)
+    {
+        key_bits_ += bits[a];
+        masks_[a] = 0;
+    }
+    uint32_t pos = key_bits_;
+    for (uint32_t l = curve_bits_; l-- > 0;)
+    {
+        for (uint32_t a = 0; a < n; a++)
+        {
+            if (l >= curve_bits_ - bits[a])
+                masks_[a] |= uint64_t(1) << --pos;
+        }
+    }
+
+    for (uint32_t a = 0; a < n; a++)
+    {
+        for (uint32_t b = 0; b < 3; b++)
+        {
+            for (uint32_t v = 0; v < 256; v++)
+            {
+                deposit_[a][b][v] = SoftDeposit(uint64_t(v) << (8 * b), masks_[a]);
+            }
+        }
+    }
+}
+
+template<bool BMI2>
+void SortKeyEncoder::EncodeBlock(const CoordBlock& coords, size_t n, uint64_t* keys) const
+{
+    const uint32_t num_axes = layout_.num_axes;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t x[SORT_KEY_MAX_AXES];
+        for (uint32_t a = 0; a < num_axes; a++)
+        {
+            x[a] = coords[a][i];
+        }
+        if (curve_ == SORT_KEY_HILBERT)
+        {
+            for (uint32_t a = 0; a < num_axes; a++)
+            {
+                x[a] <<= curve_bits_ - layout_.bits[a];
+            }
+            HilbertTranspose(x, num_axes, curve_bits_);
+        }
+
+        uint64_t key = 0;
+        for (uint32_t a = 0; a < num_axes; a++)
+        {
+#if SORT_KEYS_X86
+            if constexpr (BMI2)
+            {
+                key |= Deposit(x[a], masks_[a]);
+                continue;
+            }
+#endif
+            key |= deposit_[a][0][x[a] & 0xff] | deposit_[a][1][(x[a] >> 8) & 0xff] | deposit_[a][2][(x[a] >> 16) & 0xff];
+        }
+        keys[i] = key;
+    }
+}
+
+#if SORT_KEYS_X86
+SORT_KEYS_BMI2_ENTRY void SortKeyEncoder::EncodeBlockBmi2(const CoordBlock& coords, size_t n, uint64_t* keys) const
+{
+    EncodeBlock<true>(coords, n, keys);
+}
+#endif
+
+uint64_t SortKeyEncoder::Encode(const uint32_t* coords) const
+{
+    CoordBlock c;
+    for (uint32_t a = 0; a < layout_.num_axes; a++)
+    {
+        c[a][0] = coords[a];
+    }
+    uint64_t key;
+    EncodeBlock<false>(c, 1, &key);
+    return key;
+}
+
+void SortKeyEncoder::EncodeRays(std::span<const glm::vec3> positions,
+                                std::span<const glm::vec3> directions,
+                                const glm::vec3&           bounds_min,
+                                const glm::vec3&           bounds_max,
+                                uint64_t*                  keys) const
+{
+#if SORT_KEYS_X86
+    static const bool fast_pdep = DetectFastPdep();
+    const bool        bmi2      = fast_pdep && GetCpuSimdLevel() == CPU_SIMD_AVX2;
+#endif
+
+    // Per axis: coordinate = clamp((v - offset) * scale, 0, cells - 1)
+    float          offset[SORT_KEY_MAX_AXES], scale[SORT_KEY_MAX_AXES], max_cell[SORT_KEY_MAX_AXES];
+    const uint32_t num_axes = layout_.num_axes;
+    for (uint32_t a = 0; a < num_axes; a++)
+    {
+        const float cells = float(1U << layout_.bits[a]);
+        if (a < 3)
+        {
+            offset[a] = bounds_min[a];
+            scale[a]  = cells / (bounds_max[a] - bounds_min[a]);
+        }
+        else
+        {
+            offset[a] = -1;
+            scale[a]  = cells / 2;
+        }
+        max_cell[a] = cells - 1;
+    }
+
+    const size_t n = positions.size();
+    ParallelForChunks(n, [&](uint32_t, size_t begin, size_t end) {
+        CoordBlock coords;
+        for (size_t first = begin; first < end; first += BLOCK_SIZE)
+        {
+            const size_t count = std::min(BLOCK_SIZE, end - first);
+            for (uint32_t a = 0; a < num_axes; a++)
+            {
+                const glm::vec3* src = a < 3 ? &positions[first] : &directions[first];
+                const uint32_t   c   = a % 3;
+                for (size_t i = 0; i < count; i++)
+                {
+                    float v      = (src[i][c] - offset[a]) * scale[a];
+                    v            = v > 0 ? v : 0;  // Also NaN
+                    v            = v < max_cell[a] ? v : max_cell[a];
+                    coords[a][i] = uint32_t(v);
+                }
+            }
+#if SORT_KEYS_X86
+            if (bmi2)
+            {
+                EncodeBlockBmi2(coords, count, keys + first);
+                continue;
+            }
+#endif
+            EncodeBlock<false>(coords, count, keys + first);
+        }
+    });
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+
+#include <glm/glm.hpp>
+
+// 64-bit space-filling curve keys over up to six axes, e.g. a ray origin (3D) or origin and direction (6D).
+// Every axis is quantized to its own number of bits. The first bits of a key hold the most significant bit of every
+// axis, so two keys that share a prefix lie in the same cell of a coarser grid whatever the per-axis precision.
+constexpr uint32_t SORT_KEY_MAX_AXES = 6;
+constexpr uint32_t SORT_KEY_MAX_BITS = 21;  // Per axis
+
+enum SortKeyCurve
+{
+    SORT_KEY_MORTON,
+    SORT_KEY_HILBERT,  // Uses the largest precision on every axis; keys of lower-precision axes are padded with zeros
+};
+
+struct SortKeyLayout
+{
+    uint32_t num_axes{3};
+    uint32_t bits[SORT_KEY_MAX_AXES]{21, 21, 21};  // Clamped so the key fits 64 bits
+};
+
+// Precomputes the bit placement of a layout. Encoding is a BMI2 pdep per axis where the CPU has a fast one, and
+// otherwise three 256-entry table lookups per axis.
+class SortKeyEncoder
+{
+public:
+    SortKeyEncoder(SortKeyCurve curve, const SortKeyLayout& layout);
+
+    // coords[a] < 2^bits[a]
+    uint64_t Encode(const uint32_t* coords) const;
+
+    // Keys of points whose first three axes are positions within [bounds_min, bounds_max] and, for 6D layouts, the
+    // other three are a direction in [-1, 1]. Out-of-range and NaN coordinates land in the first or last cell.
+    void EncodeRays(std::span<const glm::vec3> positions,
+                    std::span<const glm::vec3> directions,
+                    const glm::vec3&           bounds_min,
+                    const glm::vec3&           bounds_max,
+                    uint64_t*                  keys) const;
+
+    // Number of key bits in use, counted from bit 0
+    uint32_t KeyBits() const
+    {
+        return key_bits_;
+    }
+
+private:
+    static constexpr size_t BLOCK_SIZE = 256;  // Points quantized at once, one axis after the other
+    using CoordBlock                   = uint32_t[SORT_KEY_MAX_AXES][BLOCK_SIZE];
+
+    template<bool BMI2>
+    void EncodeBlock(const CoordBlock& coords, size_t n, uint64_t* keys) const;
+    void EncodeBlockBmi2(const CoordBlock& coords, size_t n, uint64_t* keys) const;
+
+    SortKeyCurve  curve_;
+    SortKeyLayout layout_;
+    uint32_t      curve_bits_;  // Bits per axis the curve runs at: the layout's for Morton, the largest for Hilbert
+    uint32_t      key_bits_;
+    uint64_t      masks_[SORT_KEY_MAX_AXES];         // Key bits of every axis
+    uint64_t      deposit_[SORT_KEY_MAX_AXES][3][256];  // masks_ spread of every byte of a coordinate
+};
@@ -0,0 +1,131 @@
+#include "vertex_weld.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <bit>
+
+#include "profiler.h"
+
+constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+static bool SameVertex(const glm::vec3& a, const glm::vec3& b)
+{
+    return memcmp(&a, &b, sizeof(glm::vec3)) == 0;
+}
+
+static uint64_t HashVertex(const glm::vec3& v)
+{
+    uint32_t bits[3];
+    memcpy(bits, &v, sizeof(bits));
+    uint64_t h = (uint64_t(bits[0]) << 32 | bits[1]) * 0x9e3779b97f4a7c15ULL;
+    h ^= (h >> 29) ^ bits[2];
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 32);
+}
+
+void WeldVertices(std::span<const glm::vec3> soup, IndexedBlas* out, uint32_t num_workers)
+{
+    RRA_PROFILE_SCOPE_ARG("WeldVertices", soup.size());
+    const size_t n = soup.size();
+    num_workers    = std::max(1U, num_workers);
+    out->vertices.clear();
+    out->indices.resize(n);
+    if (n == 0)
+        return;
+
+    // Open addressing at a load factor of at most 1/2. A slot holds the lowest index of its vertex seen so far; once
+    // a slot is taken it only ever holds indices of that one vertex, so lowering it with compare-exchange is safe.
+    const size_t                       capacity = std::bit_ceil(std::max<size_t>(n * 2, 16));
+    const size_t                       mask     = capacity - 1;
+    std::vector<std::atomic<uint32_t>> table(capacity);
+    ParallelForChunks(
+        capacity,
+        [&](uint32_t, size_t begin, size_t end) {
+            for (size_t s = begin; s < end; s++)
+            {
+                table[s].store(EMPTY_SLOT, std::memory_order_relaxed);
+            }
+        },
+        num_workers);
+
+    auto find_slot = [&](size_t i) -> std::atomic<uint32_t>& {
+        for (size_t s = HashVertex(soup[i]) & mask;; s = (s + 1) & mask)
+        {
+            uint32_t cur = table[s].load(std::memory_order_acquire);
+            if (cur == EMPTY_SLOT && table[s].compare_exchange_strong(cur, uint32_t(i), std::memory_order_acq_rel))
+                return table[s];
+            if (SameVertex(soup[cur], soup[i]))
+                return table[s];
+        }
+    };
+    ParallelForChunks(
+        n,
+        [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                std::atomic<uint32_t>& slot = find_slot(i);
+                uint32_t               cur  = slot.load(std::memory_order_relaxed);
+                while (i < cur && !slot.compare_exchange_weak(cur, uint32_t(i), std::memory_order_relaxed))
+                {
+                }
+            }
+        },
+        num_workers);
+
+    // Every vertex now finds the first index of its value. Those first uses are numbered in order with a prefix sum
+    // over the same chunks, then every index is resolved through them.
+    std::vector<uint32_t>& first = out->indices;  // Reused: first use of vertex i, then its final index
+    std::vector<uint32_t>  chunk_counts(num_workers + 1, 0);
+    ParallelForChunks(
+        n,
+        [&](uint32_t w, size_t begin, size_t end) {
+            uint32_t count = 0;
+            for (size_t i = begin; i < end; i++)
+            {
+                first[i] = find_slot(i).load(std::memory_order_relaxed);
+                count += first[i] == i;
+            }
+            chunk_counts[w + 1] = count;
+        },
+        num_workers);
+    for (uint32_t w = 0; w < num_workers; w++)
+    {
+        chunk_counts[w + 1] += chunk_counts[w];
+    }
+
+    std::vector<uint32_t> new_idx(n);
+    out->vertices.resize(chunk_counts[num_workers]);
+    ParallelForChunks(
+        n,
+        [&](uint32_t w, size_t begin, size_t end) {
+            uint32_t next = chunk_counts[w];
+            for (size_t i = begin; i < end; i++)
+            {
+                if (first[i] != i)
+                    continue;
+                new_idx[i]            = next;
+                out->vertices[next++] = soup[i];
+            }
+        },
+        num_workers);
+    ParallelForChunks(
+        n,
+        [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                first[i] = new_idx[first[i]];
+            }
+        },
+        num_workers);
+}
+
+void IndexTriangleSoup(std::span<const glm::vec3> soup, IndexedBlas* out)
+{
+    out->vertices.assign(soup.begin(), soup.end());
+    out->indices.resize(soup.size());
+    for (size_t i = 0; i < soup.size(); i++)
+    {
+        out->indices[i] = uint32_t(i);
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+
+#include <glm/glm.hpp>
+
+#include "parallel.h"
+#include "rt_common.h"
+
+// Turns a triangle soup (three vertices per triangle) into an indexed BLAS whose vertices are the bitwise distinct
+// vertices of the soup, in order of first use. Equal vertices are found through one lock-free hash table shared by
+// all workers, and the result does not depend on the number of workers.
+void WeldVertices(std::span<const glm::vec3> soup, IndexedBlas* out, uint32_t num_workers = GetNumWorkerThreads());
+
+// The soup as is, with indices 0, 1, 2, ...
+void IndexTriangleSoup(std::span<const glm::vec3> soup, IndexedBlas* out);